@@ -5,6 +5,11 @@
 
 #include "matrix.h"
 
+#include <algorithm>
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
 // print vector - int
 void print_vector(const char *label, int *value, int size) {
     printf("%s [", label);
@@ -714,6 +719,8 @@ CSCMatrix::CSCMatrix(Matrix *m) : Matrix()
         this->add_from_dense((DenseMatrix *) m);
     else if (dynamic_cast<CSRMatrix *>(m))
         this->add_from_csr((CSRMatrix *) m);
+    else if (dynamic_cast<CSCMatrix *>(m))
+        this->add_from_csc((CSCMatrix *) m);
     else
         _error("Matrix type not supported.");
 }
@@ -876,6 +883,31 @@ void CSCMatrix::add_from_csr(CSRMatrix *m)
     }
 }
 
+void CSCMatrix::add_from_csc(CSCMatrix *m)
+{
+    free_data();
+
+    this->size = m->get_size();
+    this->nnz = m->get_nnz();
+    this->complex = m->is_complex();
+
+    // allocate and copy data
+    this->Ap = new int[this->size + 1];
+    this->Ai = new int[this->nnz];
+    memcpy(this->Ap, m->get_Ap(), (this->size + 1) * sizeof(int));
+    memcpy(this->Ai, m->get_Ai(), this->nnz * sizeof(int));
+    if (is_complex())
+    {
+        this->Ax_cplx = new cplx[this->nnz];
+        memcpy(this->Ax_cplx, m->get_Ax_cplx(), this->nnz * sizeof(cplx));
+    }
+    else
+    {
+        this->Ax = new double[this->nnz];
+        memcpy(this->Ax, m->get_Ax(), this->nnz * sizeof(double));
+    }
+}
+
 void CSCMatrix::print()
 {
     printf("\nCSC Matrix:\n");
@@ -890,6 +922,208 @@ void CSCMatrix::print()
         print_vector("data", this->Ax, this->nnz);
 }
 
+// *********************************************************************************************************************
+
+// Returns a new pattern seq. The patterns may be finished in several threads.
+static int next_pattern_seq()
+{
+    static volatile long seq = 0;
+#if defined(_MSC_VER)
+    return (int) _InterlockedIncrement(&seq);
+#else
+    return (int) __sync_add_and_fetch(&seq, 1);
+#endif
+}
+
+PatternMatrix::PatternMatrix(int size, bool is_complex) : CSCMatrix(size)
+{
+    this->complex = is_complex;
+    this->pattern_seq = -1;
+}
+
+PatternMatrix::~PatternMatrix()
+{
+    free_data();
+}
+
+void PatternMatrix::free_data()
+{
+    CSCMatrix::free_data();
+    this->pre_cols.clear();
+    this->pre_sorted.clear();
+    this->pattern_seq = -1;
+}
+
+void PatternMatrix::set_zero()
+{
+    if (!has_pattern())
+        _error("PatternMatrix::set_zero() called before finish_pattern().");
+
+    if (is_complex())
+        std::fill(this->Ax_cplx, this->Ax_cplx + this->nnz, cplx(0.0));
+    else
+        std::fill(this->Ax, this->Ax + this->nnz, 0.0);
+}
+
+void PatternMatrix::prealloc(int size)
+{
+    free_data();
+    this->size = size;
+    this->pre_cols.resize(size);
+    this->pre_sorted.assign(size, 0);
+}
+
+void PatternMatrix::compress_column(int n)
+{
+    std::vector<int> &col = this->pre_cols[n];
+    std::sort(col.begin(), col.end());
+    col.erase(std::unique(col.begin(), col.end()), col.end());
+    this->pre_sorted[n] = col.size();
+}
+
+void PatternMatrix::pre_add_ij(int m, int n)
+{
+    if (m < 0 || n < 0) return;
+    if (n >= this->size || m >= this->size)
+        _error("PatternMatrix::pre_add_ij(): index out of range.");
+
+    std::vector<int> &col = this->pre_cols[n];
+    col.push_back(m);
+    // neighboring elements register the same entries over and over, so the list
+    // is compressed whenever it has doubled since the last compression
+    if ((int) col.size() >= 2 * this->pre_sorted[n] + 16)
+        compress_column(n);
+}
+
+void PatternMatrix::pre_add_block(int *iidx, int ilen, int *jidx, int jlen)
+{
+    for (int j = 0; j < jlen; j++)
+        if (jidx[j] >= 0)
+            for (int i = 0; i < ilen; i++)
+                pre_add_ij(iidx[i], jidx[j]);
+}
+
+void PatternMatrix::finish_pattern()
+{
+    int n = this->size;
+    if ((int) this->pre_cols.size() != n)
+        _error("PatternMatrix::finish_pattern() called without prealloc().");
+
+    this->nnz = 0;
+    for (int j = 0; j < n; j++)
+    {
+        compress_column(j);
+        this->nnz += this->pre_cols[j].size();
+    }
+
+    this->Ap = new int[n + 1];
+    this->Ai = new int[this->nnz];
+    int count = 0;
+    for (int j = 0; j < n; j++)
+    {
+        this->Ap[j] = count;
+        if (!this->pre_cols[j].empty())
+            memcpy(this->Ai + count, &this->pre_cols[j][0], sizeof(int) * this->pre_cols[j].size());
+        count += this->pre_cols[j].size();
+    }
+    this->Ap[n] = count;
+
+    // the lists are no longer needed
+    std::vector<std::vector<int> >().swap(this->pre_cols);
+    std::vector<int>().swap(this->pre_sorted);
+
+    if (is_complex())
+        this->Ax_cplx = new cplx[this->nnz];
+    else
+        this->Ax = new double[this->nnz];
+    set_zero();
+    this->pattern_seq = next_pattern_seq();
+}
+
+void PatternMatrix::add(int m, int n, double v)
+{
+    if (m < 0 || n < 0) return;
+    // a real value added to a complex matrix goes to its real part
+    if (is_complex())
+        this->Ax_cplx[find_or_fail(m, n)] += v;
+    else
+        this->Ax[find_or_fail(m, n)] += v;
+}
+
+void PatternMatrix::add(int m, int n, cplx v)
+{
+    if (m < 0 || n < 0) return;
+    this->Ax_cplx[find_or_fail(m, n)] += v;
+}
+
+void PatternMatrix::add_block(int *iidx, int ilen, int *jidx, int jlen, double** mat)
+{
+    for (int j = 0; j < jlen; j++)
+        if (jidx[j] >= 0)
+            for (int i = 0; i < ilen; i++)
+                if (iidx[i] >= 0)
+                {
+                    int k = find_or_fail(iidx[i], jidx[j]);
+                    if (is_complex())
+                        this->Ax_cplx[k] += mat[i][j];
+                    else
+                        this->Ax[k] += mat[i][j];
+                }
+}
+
+void PatternMatrix::add_block(int *iidx, int ilen, int *jidx, int jlen, cplx** mat)
+{
+    for (int j = 0; j < jlen; j++)
+        if (jidx[j] >= 0)
+            for (int i = 0; i < ilen; i++)
+                if (iidx[i] >= 0)
+                    this->Ax_cplx[find_or_fail(iidx[i], jidx[j])] += mat[i][j];
+}
+
+double PatternMatrix::get(int m, int n)
+{
+    if (!has_pattern()) return 0.0;
+    int k = find(m, n);
+    if (k < 0) return 0.0;
+    return is_complex() ? this->Ax_cplx[k].real() : this->Ax[k];
+}
+
+cplx PatternMatrix::get_cplx(int m, int n)
+{
+    if (!has_pattern()) return cplx(0.0);
+    int k = find(m, n);
+    return (k < 0) ? cplx(0.0) : this->Ax_cplx[k];
+}
+
+void PatternMatrix::copy_into(Matrix *m)
+{
+    m->free_data();
+    if (!has_pattern()) return;
+    for (int j = 0; j < this->size; j++)
+        for (int k = this->Ap[j]; k < this->Ap[j+1]; k++)
+        {
+            if (is_complex())
+                m->add(this->Ai[k], j, this->Ax_cplx[k]);
+            else
+                m->add(this->Ai[k], j, this->Ax[k]);
+        }
+}
+
+void PatternMatrix::times_vector(double* vec, double* result, int rank)
+{
+    // the result of a complex matrix does not fit into a real vector
+    if (is_complex())
+        _error("PatternMatrix::times_vector() called for a complex matrix.");
+    if (!has_pattern())
+        _error("PatternMatrix::times_vector() called before finish_pattern().");
+
+    for (int i = 0; i < rank; i++) result[i] = 0;
+
+    for (int j = 0; j < this->size; j++)
+        for (int k = this->Ap[j]; k < this->Ap[j+1]; k++)
+            result[this->Ai[k]] += this->Ax[k] * vec[j];
+}
+
 // ******************************************************************************************************************************
 
 template<typename T>
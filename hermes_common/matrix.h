@@ -16,6 +16,7 @@
 #include <string.h>
 #include <complex>
 #include <map>
+#include <vector>
 
 typedef std::complex<double> cplx;
 class Matrix;
@@ -468,6 +469,7 @@ public:
     void add_from_dense(DenseMatrix *m);
     void add_from_coo(CooMatrix *m);
     void add_from_csr(CSRMatrix *m);
+    void add_from_csc(CSCMatrix *m);
 
     virtual void add(int m, int n, double v)
     {
@@ -484,6 +486,12 @@ public:
     }
     inline int get_nnz() { return this->nnz;
     }
+    // memory taken by the index arrays and the values, in bytes
+    inline size_t get_memory_size()
+    {
+        return (this->size + 1) * sizeof(int) +
+               this->nnz * (sizeof(int) + (this->complex ? sizeof(cplx) : sizeof(double)));
+    }
     virtual void copy_into(Matrix *m)
     {
         _error("CSC matrix copy_into() not implemented.");
@@ -496,7 +504,7 @@ public:
     inline double *get_Ax() { return this->Ax; }
     inline cplx *get_Ax_cplx() { return this->Ax_cplx; }
 
-private:
+protected:
     // number of non-zeros
     int nnz;
 
@@ -507,6 +515,76 @@ private:
     int *Ai;
 };
 
+// **********************************************************************************************************
+
+/// Sparse matrix assembled in two phases. In the symbolic phase, the positions of all
+/// nonzero entries are registered with pre_add_ij() or pre_add_block() and the compressed
+/// structure is built once by finish_pattern(). In the numeric phase, add() and add_block()
+/// accumulate the values in place, looking the row up in the sorted column by bisection.
+/// set_zero() only zeroes the values, so the same pattern can be reused in every Newton
+/// iteration or time step. The entries are stored column-wise, so the matrix is a CSCMatrix
+/// and the direct solvers (UMFPACK, SuperLU) work on its arrays without any conversion.
+class PatternMatrix : public CSCMatrix
+{
+public:
+    PatternMatrix(int size = 0, bool is_complex = false);
+    ~PatternMatrix();
+
+    inline virtual void init(bool is_complex = false) { this->complex = is_complex; free_data(); }
+    virtual void free_data();
+    virtual void set_zero();
+
+    // symbolic phase
+    void prealloc(int size);
+    void pre_add_ij(int m, int n);
+    void pre_add_block(int *iidx, int ilen, int *jidx, int jlen);
+    void finish_pattern();
+    inline bool has_pattern() { return this->Ap != NULL; }
+    // number of the current pattern, -1 without one; every finish_pattern() of any
+    // matrix takes a new number, so equal numbers mean the same pattern
+    inline int get_pattern_seq() { return this->pattern_seq; }
+
+    // numeric phase
+    virtual void add(int m, int n, double v);
+    virtual void add(int m, int n, cplx v);
+    virtual void add_block(int *iidx, int ilen, int *jidx, int jlen, double** mat);
+    virtual void add_block(int *iidx, int ilen, int *jidx, int jlen, cplx** mat);
+
+    virtual double get(int m, int n);
+    virtual cplx get_cplx(int m, int n);
+    virtual void copy_into(Matrix *m);
+    virtual void times_vector(double* vec, double* result, int rank);
+
+protected:
+    // returns the index of the entry (m, n) in Ai/Ax, or -1 if it is not in the pattern
+    inline int find(int m, int n)
+    {
+        if (!has_pattern()) _error("PatternMatrix: finish_pattern() has not been called.");
+        int lo = this->Ap[n], hi = this->Ap[n+1];
+        while (lo < hi)
+        {
+            int mid = (lo + hi) >> 1;
+            if (this->Ai[mid] < m) lo = mid + 1;
+            else hi = mid;
+        }
+        return (lo < this->Ap[n+1] && this->Ai[lo] == m) ? lo : -1;
+    }
+    inline int find_or_fail(int m, int n)
+    {
+        int k = find(m, n);
+        if (k < 0) _error("PatternMatrix: entry is not in the sparsity pattern.");
+        return k;
+    }
+
+    void compress_column(int n);
+
+    // row indices registered in the symbolic phase, one list per column
+    std::vector<std::vector<int> > pre_cols;
+    // length of each column list after its last compression
+    std::vector<int> pre_sorted;
+    int pattern_seq;
+};
+
 template<typename T>
 void dense_to_coo(int size, int nnz, T **Ad, int *row, int *col, T *A);
 template<typename T>
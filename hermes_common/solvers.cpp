@@ -14,6 +14,141 @@ bool CommonSolver::solve(Matrix *mat, Vector *res)
         return this->_solve(mat, res->get_c_array());
 }
 
+bool CommonSolver::solve_many(Matrix *mat, double *res, int nrhs)
+{
+    // the matrix does not change between the right-hand sides
+    int size = mat->get_size();
+    bool changed = matrix_changed;
+    bool flag = true;
+    for (int i = 0; i < nrhs && flag; i++)
+    {
+        flag = this->_solve(mat, res + i*size);
+        matrix_changed = false;
+    }
+    matrix_changed = changed;
+    return flag;
+}
+
+bool CommonSolver::solve_many(Matrix *mat, cplx *res, int nrhs)
+{
+    int size = mat->get_size();
+    bool changed = matrix_changed;
+    bool flag = true;
+    for (int i = 0; i < nrhs && flag; i++)
+    {
+        flag = this->_solve(mat, res + i*size);
+        matrix_changed = false;
+    }
+    matrix_changed = changed;
+    return flag;
+}
+
+CommonSolverFactorized::CommonSolverFactorized()
+{
+    size = nnz = 0;
+    Ap = Ai = NULL;
+    Ax = Az = NULL;
+    complex = has_symbolic = has_numeric = false;
+    pattern_seq = -1;
+    pattern_Ap = pattern_Ai = NULL;
+    converted = NULL;
+}
+
+CommonSolverFactorized::~CommonSolverFactorized()
+{
+    // the factorization itself has been freed by the derived class
+    delete [] pattern_Ap;
+    delete [] pattern_Ai;
+    delete converted;
+}
+
+void CommonSolverFactorized::free_factorization()
+{
+    if (has_numeric) free_numeric();
+    if (has_symbolic) free_symbolic();
+    has_numeric = has_symbolic = false;
+
+    pattern_seq = -1;
+    delete [] pattern_Ap; pattern_Ap = NULL;
+    delete [] pattern_Ai; pattern_Ai = NULL;
+    delete converted; converted = NULL;
+    Ap = Ai = NULL;
+    Ax = Az = NULL;
+    size = nnz = 0;
+}
+
+bool CommonSolverFactorized::factorize(Matrix *mat, bool is_complex)
+{
+    // the arrays of a CSC matrix are factorized in place, other formats are converted
+    CSCMatrix *Acsc = dynamic_cast<CSCMatrix*>(mat);
+    CSCMatrix *conv = NULL;
+    if (Acsc == NULL)
+    {
+        if (CooMatrix *mcoo = dynamic_cast<CooMatrix*>(mat))
+            conv = new CSCMatrix(mcoo);
+        else if (CSRMatrix *mcsr = dynamic_cast<CSRMatrix*>(mat))
+            conv = new CSCMatrix(mcsr);
+        else
+            _error("Matrix type not supported.");
+        Acsc = conv;
+    }
+
+    // the symbolic factorization depends on the sparsity pattern only, which is
+    // checked also when the values are known to be the same: by the seq of a
+    // PatternMatrix, the arrays of other matrices are compared
+    int n = Acsc->get_size();
+    int nz = Acsc->get_nnz();
+    PatternMatrix *pat = dynamic_cast<PatternMatrix*>(Acsc);
+    int seq = (pat != NULL) ? pat->get_pattern_seq() : -1;
+    bool same_pattern = has_symbolic && complex == is_complex && n == size && nz == nnz;
+    if (same_pattern && seq >= 0)
+        same_pattern = (seq == pattern_seq);
+    else if (same_pattern)
+        same_pattern = pattern_Ap != NULL &&
+                       !memcmp(pattern_Ap, Acsc->get_Ap(), (n + 1) * sizeof(int)) &&
+                       !memcmp(pattern_Ai, Acsc->get_Ai(), nz * sizeof(int));
+    if (!same_pattern)
+    {
+        free_factorization();
+        size = n;
+        nnz = nz;
+        complex = is_complex;
+        pattern_seq = seq;
+        if (seq < 0)
+        {
+            pattern_Ap = new int[n + 1];
+            pattern_Ai = new int[nz];
+            memcpy(pattern_Ap, Acsc->get_Ap(), (n + 1) * sizeof(int));
+            memcpy(pattern_Ai, Acsc->get_Ai(), nz * sizeof(int));
+        }
+    }
+    else
+        delete converted;
+    converted = conv;
+
+    Ap = Acsc->get_Ap();
+    Ai = Acsc->get_Ai();
+    Ax = is_complex ? (double*) Acsc->get_Ax_cplx() : Acsc->get_Ax();
+
+    // the values are the same as in the last factorization
+    if (has_numeric && !matrix_changed)
+        return true;
+
+    if (has_numeric)
+    {
+        free_numeric();
+        has_numeric = false;
+    }
+    if (!has_symbolic)
+    {
+        if (!factorize_symbolic()) return false;
+        has_symbolic = true;
+    }
+    if (!factorize_numeric()) return false;
+    has_numeric = true;
+    return true;
+}
+
 // Standard CG method starting from zero vector
 // (because we solve for the increment)
 // x... comes as right-hand side, leaves as solution
@@ -90,6 +225,11 @@ bool CommonSolverDenseLU::_solve(Matrix* A, double *x)
         Aden = mden;
     else if (CooMatrix *mcoo = dynamic_cast<CooMatrix*>(A))
         Aden = new DenseMatrix(mcoo);
+    else if (CSCMatrix *mcsc = dynamic_cast<CSCMatrix*>(A))
+    {
+        CooMatrix coo(mcsc);
+        Aden = new DenseMatrix(&coo);
+    }
     else
         _error("Matrix type not supported.");
 
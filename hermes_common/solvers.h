@@ -8,16 +8,38 @@
 
 class Matrix;
 class Vector;
+class CSCMatrix;
 
 // abstract class
 class CommonSolver
 {
 public:
+    CommonSolver() : matrix_changed(true), log(NULL) {}
+    virtual ~CommonSolver() {}
+
     virtual bool _solve(Matrix *mat, double *res) = 0;
     virtual bool _solve(Matrix *mat, cplx *res) = 0;
     virtual bool solve(Matrix *mat, Vector *res);
     inline char *get_log() { return log; }
 
+    // Tells the solver whether the values of the matrix passed to the next
+    // solve() differ from the previous call. Solvers that keep the
+    // factorization of the matrix need not refactorize it if they do not,
+    // the others ignore this.
+    inline void set_matrix_changed(bool changed) { matrix_changed = changed; }
+
+    // Solves the system with the matrix for 'nrhs' right-hand sides stored
+    // one after another in 'res', the solutions overwrite them. Solvers that
+    // keep the factorization factorize the matrix only once.
+    virtual bool solve_many(Matrix *mat, double *res, int nrhs);
+    virtual bool solve_many(Matrix *mat, cplx *res, int nrhs);
+
+    // Releases the factorization kept by the solver, if any.
+    virtual void free_factorization() {}
+
+protected:
+    bool matrix_changed;
+
 private:
     char *log;
 };
@@ -66,12 +88,60 @@ inline void solve_linear_system_dense_lu(Matrix *mat, cplx *res)
     solver._solve(mat, res);
 }
 
+// Base of the direct solvers that keep the factorization of the matrix
+// between solves. The solver works on the arrays of a CSC matrix (other
+// formats are converted), which therefore must stay valid until the next
+// solve. The symbolic factorization is reused while the sparsity pattern of
+// the matrix does not change, the numeric one while set_matrix_changed(false)
+// is in effect and the pattern is the same. The pattern of a PatternMatrix is
+// recognized by its pattern seq, other matrices keep a copy of the pattern.
+class CommonSolverFactorized : public CommonSolver
+{
+public:
+    CommonSolverFactorized();
+    // Derived classes have to call free_factorization() in their destructors.
+    virtual ~CommonSolverFactorized();
+    virtual void free_factorization();
+
+protected:
+    // Makes the numeric factorization of 'mat' available, computing only
+    // what cannot be reused. Returns false if the factorization failed.
+    bool factorize(Matrix *mat, bool is_complex);
+
+    virtual bool factorize_symbolic() = 0;
+    virtual bool factorize_numeric() = 0;
+    virtual void free_symbolic() = 0;
+    virtual void free_numeric() = 0;
+
+    int size, nnz;
+    int *Ap, *Ai;      // the pattern of the last factorized matrix
+    double *Ax;        // its values, interleaved real and imaginary parts in the complex case
+    double *Az;        // always NULL: UMFPACK reads the complex values packed in Ax
+    bool complex, has_symbolic, has_numeric;
+
+private:
+    int pattern_seq;               // seq of the pattern of the factorization, or -1
+    int *pattern_Ap, *pattern_Ai;  // copy of the pattern if it has no seq
+    CSCMatrix *converted;          // the last matrix if it was not a CSC one
+};
+
 // c++ umfpack - optional
-class CommonSolverUmfpack : public CommonSolver
+class CommonSolverUmfpack : public CommonSolverFactorized
 {
 public:
+    CommonSolverUmfpack() : symbolic(NULL), numeric(NULL) {}
+    ~CommonSolverUmfpack() { free_factorization(); }
+
     bool _solve(Matrix *mat, double *res);
     bool _solve(Matrix *mat, cplx *res);
+
+protected:
+    virtual bool factorize_symbolic();
+    virtual bool factorize_numeric();
+    virtual void free_symbolic();
+    virtual void free_numeric();
+
+    void *symbolic, *numeric;
 };
 inline void solve_linear_system_umfpack(Matrix *mat, double *res)
 {
@@ -130,12 +200,26 @@ inline void solve_linear_system_sparselib_ir(Matrix *mat, double *res, double to
 }
 
 // c++ superlu - optional
-class CommonSolverSuperLU : public CommonSolver
+struct CommonSolverSuperLUData;
+class CommonSolverSuperLU : public CommonSolverFactorized
 {
 public:
+    CommonSolverSuperLU() : data(NULL) {}
+    ~CommonSolverSuperLU() { free_factorization(); }
+
     bool _solve(Matrix *mat, double *res);
     bool _solve2(Matrix *mat, double *res);
     bool _solve(Matrix *mat, cplx *res);
+    using CommonSolver::solve_many;
+    bool solve_many(Matrix *mat, double *res, int nrhs);
+
+protected:
+    virtual bool factorize_symbolic();
+    virtual bool factorize_numeric();
+    virtual void free_symbolic();
+    virtual void free_numeric();
+
+    CommonSolverSuperLUData *data;  // SuperLU structures, see superlu_solver.cpp
 };
 inline void solve_linear_system_superlu(Matrix *mat, double *res)
 {
@@ -9,42 +9,25 @@
 #ifdef COMMON_WITH_SUPERLU
 #include <superlu/slu_ddefs.h>
 
-bool CommonSolverSuperLU::_solve(Matrix *mat, double *res)
+// SuperLU structures kept between solves.
+struct CommonSolverSuperLUData
 {
-    printf("SuperLU solver\n");
-
-    int size = mat->get_size();
-    int nnz = 0;
-
-    int *Ap = NULL;
-    int *Ai = NULL;
-    double *Ax = NULL;
-
-    CSCMatrix *Acsc = NULL;
-
-    if (CooMatrix *mcoo = dynamic_cast<CooMatrix*>(mat))
-        Acsc = new CSCMatrix(mcoo);
-    else if (CSCMatrix *mcsc = dynamic_cast<CSCMatrix*>(mat))
-        Acsc = mcsc;
-    else if (CSRMatrix *mcsr = dynamic_cast<CSRMatrix*>(mat))
-        Acsc = new CSCMatrix(mcsr);
-    else
-        _error("Matrix type not supported.");
-
-    nnz = Acsc->get_nnz();
-    Ap = Acsc->get_Ap();
-    Ai = Acsc->get_Ai();
-    Ax = Acsc->get_Ax();
-
-    SuperMatrix A;
-    SuperMatrix B;
+    superlu_options_t options;
+    SuperMatrix A;      // the matrix, refers to Ap, Ai, Ax of the solver
+    SuperMatrix AC;     // A with permuted columns
     SuperMatrix L;      // factor L
     SuperMatrix U;      // factor U
+    int *perm_c;        // column permutation vector
+    int *perm_r;        // row permutations from partial pivoting
+    int *etree;         // column elimination tree
+#if defined(SUPERLU_MAJOR_VERSION) && SUPERLU_MAJOR_VERSION >= 5
+    GlobalLU_t Glu;
+#endif
+};
 
-    int nrhs, info;
-
-    superlu_options_t options;
-    SuperLUStat_t stat;
+bool CommonSolverSuperLU::factorize_symbolic()
+{
+    data = new CommonSolverSuperLUData;
 
     // Set the default input options:
     /*
@@ -59,73 +42,113 @@ bool CommonSolverSuperLU::_solve(Matrix *mat, double *res)
     options.ConditionNumber = NO;
     options.PrintStat = YES;
     */
-    set_default_options(&options);
+    set_default_options(&data->options);
 
-    // create csc matrix
-    dCreate_CompCol_Matrix(&A, size, size, nnz, Ax, Ai, Ap,
+    // create csc matrix, the arrays are those of the factorized matrix
+    dCreate_CompCol_Matrix(&data->A, size, size, nnz, Ax, Ai, Ap,
                            SLU_NC, SLU_D, SLU_GE);
     // dPrint_CompCol_Matrix("A", &A);
 
-    nrhs = 1;
-    // create rhs matrix
-    dCreate_Dense_Matrix(&B, size, nrhs, res, size,
-                         SLU_DN, SLU_D, SLU_GE);
-    // dPrint_Dense_Matrix("B", &B);
+    data->perm_c = intMalloc(size);
+    data->perm_r = intMalloc(size);
+    data->etree = intMalloc(size);
+    if (!data->perm_c) ABORT("Malloc fails for perm_c[].");
+    if (!data->perm_r) ABORT("Malloc fails for perm_r[].");
+    if (!data->etree) ABORT("Malloc fails for etree[].");
+
+    // column ordering and elimination tree, these depend on the pattern only
+    get_perm_c(data->options.ColPerm, &data->A, data->perm_c);
+    sp_preorder(&data->options, &data->A, data->perm_c, data->etree, &data->AC);
+    return true;
+}
+
+bool CommonSolverSuperLU::factorize_numeric()
+{
+    SuperLUStat_t stat;
+    int info;
+    int panel_size = sp_ienv(1);
+    int relax = sp_ienv(2);
 
-    // column permutation vector
-    int *perm_c = intMalloc(size);
-    // row permutations from partial pivoting
-    int *perm_r = intMalloc(size);
-    if (!perm_c) ABORT("Malloc fails for perm_c[].");
-    if (!perm_r) ABORT("Malloc fails for perm_r[].");
+    // the matrix may have moved since the symbolic factorization, its pattern has not
+    NCformat *store = (NCformat*) data->A.Store;
+    NCPformat *pstore = (NCPformat*) data->AC.Store;
+    store->nzval = pstore->nzval = Ax;
+    store->rowind = pstore->rowind = Ai;
+    store->colptr = Ap;
 
     // initialize the statistics variables
     StatInit(&stat);
-    dgssv(&options, &A, perm_c, perm_r, &L, &U, &B, &stat, &info);
+    dgstrf(&data->options, &data->AC, relax, panel_size, data->etree, NULL, 0,
+           data->perm_c, data->perm_r, &data->L, &data->U,
+#if defined(SUPERLU_MAJOR_VERSION) && SUPERLU_MAJOR_VERSION >= 5
+           &data->Glu,
+#endif
+           &stat, &info);
+    StatFree(&stat);
 
-    mem_usage_t mem_usage;
-    if ( info == 0 )
-    {
-        // solution
-        double *x = (double*) ((DNformat*) B.Store)->nzval;
-
-        // copy result
-        memcpy(res, x, size*sizeof(double));
-
-        /*
-        SCformat *Lstore = (SCformat *) L.Store;
-        NCformat *Ustore = (NCformat *) U.Store;
-        printf("No of nonzeros in factor L = %d\n", Lstore->nnz);
-        printf("No of nonzeros in factor U = %d\n", Ustore->nnz);
-        printf("No of nonzeros in L+U = %d\n", Lstore->nnz + Ustore->nnz - mcsc.get_size());
-        printf("FILL ratio = %.1f\n", (float)(Lstore->nnz + Ustore->nnz - mcsc.get_size())/nnz);
-
-        mem_usage_t mem_usage;
-        dQuerySpace(&L, &U, &mem_usage);
-        printf("L\\U MB %.3f\ttotal MB needed %.3f\n", mem_usage.for_lu/1e6, mem_usage.total_needed/1e6);
-        */
-    }
-    else
+    if (info != 0)
     {
-        printf("dgssv() error returns INFO = %d\n", info);
+        printf("dgstrf() error returns INFO = %d\n", info);
         if (info <= size)
         {
             // factorization completes
-            dQuerySpace(&L, &U, &mem_usage);
+            mem_usage_t mem_usage;
+            dQuerySpace(&data->L, &data->U, &mem_usage);
             printf("L\\U MB %.3f\ttotal MB needed %.3f\n", mem_usage.for_lu/1e6, mem_usage.total_needed/1e6);
+            free_numeric();
         }
+        return false;
     }
+    return true;
+}
+
+void CommonSolverSuperLU::free_symbolic()
+{
+    if (data == NULL) return;
+    Destroy_CompCol_Permuted(&data->AC);
+    // the arrays of A belong to the matrix
+    Destroy_SuperMatrix_Store(&data->A);
+    SUPERLU_FREE (data->perm_r);
+    SUPERLU_FREE (data->perm_c);
+    SUPERLU_FREE (data->etree);
+    delete data;
+    data = NULL;
+}
+
+void CommonSolverSuperLU::free_numeric()
+{
+    Destroy_SuperNode_Matrix(&data->L);
+    Destroy_CompCol_Matrix(&data->U);
+}
+
+bool CommonSolverSuperLU::solve_many(Matrix *mat, double *res, int nrhs)
+{
+    printf("SuperLU solver\n");
+
+    // symbolic analysis and LU factorization, if they cannot be reused
+    if (!factorize(mat, false)) return false;
+
+    // create rhs matrix, the solution overwrites it
+    SuperMatrix B;
+    dCreate_Dense_Matrix(&B, size, nrhs, res, size,
+                         SLU_DN, SLU_D, SLU_GE);
+    // dPrint_Dense_Matrix("B", &B);
+
+    SuperLUStat_t stat;
+    int info;
+    StatInit(&stat);
+    dgstrs(NOTRANS, &data->L, &data->U, data->perm_c, data->perm_r, &B, &stat, &info);
+    StatFree(&stat);
 
-    SUPERLU_FREE (perm_r);
-    SUPERLU_FREE (perm_c);
-    // FIXME
-    // Destroy_CompCol_Matrix(&A);
     Destroy_SuperMatrix_Store(&B);
-    Destroy_SuperNode_Matrix(&L);
-    Destroy_CompCol_Matrix(&U);
 
-    if (!dynamic_cast<CSCMatrix*>(mat))
-        delete Acsc;
+    if (info != 0) printf("dgstrs() error returns INFO = %d\n", info);
+    return info == 0;
+}
+
+bool CommonSolverSuperLU::_solve(Matrix *mat, double *res)
+{
+    return solve_many(mat, res, 1);
 }
 
 bool CommonSolverSuperLU::_solve(Matrix *mat, cplx *res)
@@ -135,6 +158,16 @@ bool CommonSolverSuperLU::_solve(Matrix *mat, cplx *res)
 
 #else
 
+bool CommonSolverSuperLU::factorize_symbolic() { return false; }
+bool CommonSolverSuperLU::factorize_numeric() { return false; }
+void CommonSolverSuperLU::free_symbolic() {}
+void CommonSolverSuperLU::free_numeric() {}
+
+bool CommonSolverSuperLU::solve_many(Matrix *mat, double *res, int nrhs)
+{
+    _error("CommonSolverSuperLU::solve_many(Matrix *mat, double *res, int nrhs) not implemented.");
+}
+
 bool CommonSolverSuperLU::_solve(Matrix *mat, double *res)
 {
     _error("CommonSolverSuperLU::solve(Matrix *mat, double *res) not implemented.");
@@ -146,3 +179,9 @@ bool CommonSolverSuperLU::_solve(Matrix *mat, cplx *res)
 }
 
 #endif
+
+// kept for compatibility, the same as _solve()
+bool CommonSolverSuperLU::_solve2(Matrix *mat, double *res)
+{
+    return _solve(mat, res);
+}
@@ -110,6 +110,71 @@ void test_matrix4()
     */
 }
 
+void test_matrix6()
+{
+    // symbolic phase
+    PatternMatrix m;
+    _assert(!m.has_pattern());
+    _assert(m.get_pattern_seq() == -1);
+    _assert(m.get(0, 0) == 0.0);
+    bool failed = false;
+    try { m.add(0, 0, 1.0); }
+    catch (std::runtime_error &e) { failed = true; }
+    _assert(failed);
+    m.prealloc(4);
+    int idx1[] = {0, 1, 2};
+    int idx2[] = {2, -1, 3};
+    m.pre_add_block(idx1, 3, idx1, 3);
+    m.pre_add_block(idx2, 3, idx2, 3);
+    m.finish_pattern();
+    _assert(m.get_nnz() == 12);
+    int seq = m.get_pattern_seq();
+    _assert(seq >= 0);
+
+    // numeric phase, twice with the same pattern
+    for (int k = 0; k < 2; k++)
+    {
+        m.set_zero();
+        m.add(0, 2, 3.5);
+        m.add(1, 2, 4.5);
+        m.add(3, 2, 1.5);
+        m.add(1, 2, 1);
+        m.add(-1, 2, 7);
+        m.add(0, 0, 2.5);
+        m.print();
+    }
+    _assert(m.get_pattern_seq() == seq);
+    _assert(m.get(1, 2) == 5.5);
+    _assert(m.get(3, 2) == 1.5);
+    _assert(m.get(3, 0) == 0.0);
+
+    failed = false;
+    try { m.add(3, 0, 1.0); }
+    catch (std::runtime_error &e) { failed = true; }
+    _assert(failed);
+
+    double x[4] = {1, 1, 1, 1}, y[4];
+    m.times_vector(x, y, 4);
+    _assert(y[0] == 6.0 && y[1] == 5.5 && y[2] == 0.0 && y[3] == 1.5);
+
+    // a complex matrix is not multiplied with real vectors
+    PatternMatrix mc(0, true);
+    mc.prealloc(4);
+    mc.pre_add_block(idx1, 3, idx1, 3);
+    mc.finish_pattern();
+    _assert(mc.get_pattern_seq() >= 0 && mc.get_pattern_seq() != seq);
+    failed = false;
+    try { mc.times_vector(x, y, 4); }
+    catch (std::runtime_error &e) { failed = true; }
+    _assert(failed);
+
+    // the solvers take it as a CSC matrix
+    Matrix *_m = &m;
+    _assert(dynamic_cast<CSCMatrix *>(_m) != NULL);
+    CSRMatrix n1(_m);
+    n1.print();
+}
+
 #include "python_api.h"
 
 void test_matrix5()
@@ -143,6 +208,7 @@ int main(int argc, char* argv[])
         test_matrix3();
         test_matrix4();
         test_matrix5();
+        test_matrix6();
 
         return ERROR_SUCCESS;
     } catch(std::exception const &ex) {
@@ -417,6 +417,85 @@ void test_solver_superlu()
     _assert(fabs(res[4] - 5.) < EPS);
 }
 
+// The 5x5 matrix of the tests above multiplied by 'scale'.
+void fill_matrix_5(Matrix &A, double scale)
+{
+    A.add(0, 0, 2 * scale);
+    A.add(0, 1, 3 * scale);
+    A.add(1, 0, 3 * scale);
+    A.add(1, 2, 4 * scale);
+    A.add(1, 4, 6 * scale);
+    A.add(2, 1, -1 * scale);
+    A.add(2, 2, -3 * scale);
+    A.add(2, 3, 2 * scale);
+    A.add(3, 2, 1 * scale);
+    A.add(4, 1, 4 * scale);
+    A.add(4, 2, 2 * scale);
+    A.add(4, 4, 1 * scale);
+}
+
+// Solves repeatedly with a solver that keeps its factorization.
+void test_solver_factorized(CommonSolver &solver)
+{
+    CooMatrix A(5);
+    fill_matrix_5(A, 1.);
+
+    double res[5] = {8., 45., -3., 3., 19.};
+    _assert(solver._solve(&A, res));
+    for (int i=0; i < 5; i++) _assert(fabs(res[i] - (i+1)) < EPS);
+
+    // the factorization of A is reused for both right-hand sides
+    solver.set_matrix_changed(false);
+    double res2[10] = {8., 45., -3., 3., 19., 16., 90., -6., 6., 38.};
+    _assert(solver.solve_many(&A, res2, 2));
+    for (int i=0; i < 5; i++) _assert(fabs(res2[i] - (i+1)) < EPS);
+    for (int i=0; i < 5; i++) _assert(fabs(res2[5+i] - 2*(i+1)) < EPS);
+
+    // same pattern, different values
+    solver.set_matrix_changed(true);
+    CooMatrix B(5);
+    fill_matrix_5(B, 2.);
+    double res3[5] = {8., 45., -3., 3., 19.};
+    _assert(solver._solve(&B, res3));
+    for (int i=0; i < 5; i++) _assert(fabs(res3[i] - 0.5*(i+1)) < EPS);
+
+    // the arrays of a CSC matrix are factorized in place
+    CSCMatrix C(&B);
+    double res4[5] = {8., 45., -3., 3., 19.};
+    _assert(solver._solve(&C, res4));
+    for (int i=0; i < 5; i++) _assert(fabs(res4[i] - 0.5*(i+1)) < EPS);
+
+    // a different pattern is refactorized even if the values are declared unchanged
+    solver.set_matrix_changed(false);
+    CooMatrix D(5);
+    fill_matrix_5(D, 1.);
+    D.add(3, 3, 1.);
+    double res5[5] = {8., 45., -3., 7., 19.};
+    _assert(solver._solve(&D, res5));
+    for (int i=0; i < 5; i++) _assert(fabs(res5[i] - (i+1)) < EPS);
+    solver.set_matrix_changed(true);
+
+    // the pattern of a PatternMatrix is recognized by its seq: a new pattern is
+    // factorized again even if it has the same entries and the values are declared unchanged
+    PatternMatrix P(5);
+    for (int k = 0; k < 2; k++)
+    {
+        P.prealloc(5);
+        for (int i=0; i < 5; i++)
+            for (int j=0; j < 5; j++)
+                P.pre_add_ij(i, j);
+        P.finish_pattern();
+        fill_matrix_5(P, k ? 1. : 2.);
+        double res6[5] = {8., 45., -3., 3., 19.};
+        _assert(solver._solve(&P, res6));
+        for (int i=0; i < 5; i++) _assert(fabs(res6[i] - (k ? 1. : 0.5)*(i+1)) < EPS);
+        solver.set_matrix_changed(false);
+    }
+    solver.set_matrix_changed(true);
+
+    solver.free_factorization();
+}
+
 int main(int argc, char* argv[])
 {
     try {
@@ -440,11 +519,19 @@ int main(int argc, char* argv[])
 #ifdef COMMON_WITH_UMFPACK
         test_solver_umfpack_real();
         test_solver_umfpack_imag();
+        {
+            CommonSolverUmfpack solver;
+            test_solver_factorized(solver);
+        }
 #endif
 
         // SuperLU
 #ifdef COMMON_WITH_SUPERLU
         test_solver_superlu();
+        {
+            CommonSolverSuperLU solver;
+            test_solver_factorized(solver);
+        }
 #endif
 
         return ERROR_SUCCESS;
@@ -35,110 +35,84 @@ void print_status(int status)
     }
 }
 
-bool CommonSolverUmfpack::_solve(Matrix *mat, double *res)
+bool CommonSolverUmfpack::factorize_symbolic()
 {
-    printf("UMFPACK solver\n");
-
-    CSCMatrix *Acsc = NULL;
-
-    if (CooMatrix *mcoo = dynamic_cast<CooMatrix*>(mat))
-        Acsc = new CSCMatrix(mcoo);
-    else if (CSCMatrix *mcsc = dynamic_cast<CSCMatrix*>(mat))
-        Acsc = mcsc;
-    else if (CSRMatrix *mcsr = dynamic_cast<CSRMatrix*>(mat))
-        Acsc = new CSCMatrix(mcsr);
+    int status;
+    if (complex)
+    {
+        umfpack_zi_defaults(control_array);
+        status = umfpack_zi_symbolic(size, size, Ap, Ai, Ax, Az, &symbolic,
+                                     control_array, info_array);
+    }
     else
-        _error("Matrix type not supported.");
+    {
+        umfpack_di_defaults(control_array);
+        status = umfpack_di_symbolic(size, size, Ap, Ai, Ax, &symbolic,
+                                     control_array, info_array);
+    }
+    print_status(status);
+    return status == UMFPACK_OK;
+}
 
-    int nnz = Acsc->get_nnz();
-    int size = Acsc->get_size();
+bool CommonSolverUmfpack::factorize_numeric()
+{
+    int status;
+    if (complex)
+        status = umfpack_zi_numeric(Ap, Ai, Ax, Az, symbolic, &numeric,
+                                    control_array, info_array);
+    else
+        status = umfpack_di_numeric(Ap, Ai, Ax, symbolic, &numeric,
+                                    control_array, info_array);
+    print_status(status);
+    return status == UMFPACK_OK;
+}
 
-    // solve
-    umfpack_di_defaults(control_array);
+void CommonSolverUmfpack::free_symbolic()
+{
+    if (symbolic == NULL) return;
+    if (complex) umfpack_zi_free_symbolic(&symbolic);
+    else umfpack_di_free_symbolic(&symbolic);
+    symbolic = NULL;
+}
 
-    /* symbolic analysis */
-    void *symbolic, *numeric;
-    int status_symbolic = umfpack_di_symbolic(size, size,
-                                              Acsc->get_Ap(), Acsc->get_Ai(), NULL, &symbolic,
-                                              control_array, info_array);
-    print_status(status_symbolic);
+void CommonSolverUmfpack::free_numeric()
+{
+    if (numeric == NULL) return;
+    if (complex) umfpack_zi_free_numeric(&numeric);
+    else umfpack_di_free_numeric(&numeric);
+    numeric = NULL;
+}
 
-    /* LU factorization */
-    int status_numeric = umfpack_di_numeric(Acsc->get_Ap(), Acsc->get_Ai(), Acsc->get_Ax(), symbolic, &numeric,
-                                            control_array, info_array);
-    print_status(status_numeric);
+bool CommonSolverUmfpack::_solve(Matrix *mat, double *res)
+{
+    printf("UMFPACK solver\n");
 
-    umfpack_di_free_symbolic(&symbolic);
+    // symbolic analysis and LU factorization, if they cannot be reused
+    if (!factorize(mat, false)) return false;
 
-    double *x;
-    x = (double*) malloc(size * sizeof(double));
+    double *x = new double[size];
 
     /* solve system */
-    int status_solve = umfpack_di_solve(UMFPACK_A,
-                                        Acsc->get_Ap(), Acsc->get_Ai(), Acsc->get_Ax(), x, res, numeric,
+    int status_solve = umfpack_di_solve(UMFPACK_A, Ap, Ai, Ax, x, res, numeric,
                                         control_array, info_array);
 
     print_status(status_solve);
 
-    umfpack_di_free_numeric(&numeric);
-
-    if (symbolic) umfpack_di_free_symbolic(&symbolic);
-    if (numeric) umfpack_di_free_numeric(&numeric);
-
     memcpy(res, x, size*sizeof(double));
     delete[] x;
 
-    if (!dynamic_cast<CSCMatrix*>(mat))
-        delete Acsc;
+    return status_solve == UMFPACK_OK;
 }
 
 bool CommonSolverUmfpack::_solve(Matrix *mat, cplx *res)
 {
     printf("UMFPACK solver - cplx\n");
 
-    CSCMatrix *Acsc = NULL;
-
-    if (CooMatrix *mcoo = dynamic_cast<CooMatrix*>(mat))
-        Acsc = new CSCMatrix(mcoo);
-    else if (CSCMatrix *mcsc = dynamic_cast<CSCMatrix*>(mat))
-        Acsc = mcsc;
-    else if (CSRMatrix *mcsr = dynamic_cast<CSRMatrix*>(mat))
-        Acsc = new CSCMatrix(mcsr);
-    else
-        _error("Matrix type not supported.");
-
-    int nnz = Acsc->get_nnz();
-    int size = Acsc->get_size();
-
-    // complex components
-    double *Axr = new double[nnz];
-    double *Axi = new double[nnz];
-    cplx *Ax = Acsc->get_Ax_cplx();
-    for (int i = 0; i < nnz; i++)
-    {
-        Axr[i] = Ax[i].real();
-        Axi[i] = Ax[i].imag();
-    }
-
-    umfpack_zi_defaults(control_array);
-
-    /* symbolic analysis */
-    void *symbolic, *numeric;
-    int status_symbolic = umfpack_zi_symbolic(size, size,
-                                              Acsc->get_Ap(), Acsc->get_Ai(), NULL, NULL, &symbolic,
-                                              control_array, info_array);
-    print_status(status_symbolic);
+    // symbolic analysis and LU factorization, if they cannot be reused
+    if (!factorize(mat, true)) return false;
 
-    /* LU factorization */
-    int status_numeric = umfpack_zi_numeric(Acsc->get_Ap(), Acsc->get_Ai(), Axr, Axi, symbolic, &numeric,
-                                            control_array, info_array);
-    print_status(status_numeric);
-
-    umfpack_zi_free_symbolic(&symbolic);
-
-    double *xr, *xi;
-    xr = (double*) malloc(size * sizeof(double));
-    xi = (double*) malloc(size * sizeof(double));
+    double *xr = new double[size];
+    double *xi = new double[size];
 
     double *resr = new double[size];
     double *resi = new double[size];
@@ -150,34 +124,29 @@ bool CommonSolverUmfpack::_solve(Matrix *mat, cplx *res)
     }
 
     /* solve system */
-    int status_solve = umfpack_zi_solve(UMFPACK_A,
-                                        Acsc->get_Ap(), Acsc->get_Ai(), Axr, Axi, xr, xi, resr, resi, numeric,
+    int status_solve = umfpack_zi_solve(UMFPACK_A, Ap, Ai, Ax, Az, xr, xi, resr, resi, numeric,
                                         control_array, info_array);
 
     print_status(status_solve);
 
-    umfpack_zi_free_numeric(&numeric);
+    for (int i = 0; i < size; i++)
+        res[i] = cplx(xr[i], xi[i]);
 
     delete[] resr;
     delete[] resi;
-    delete[] Axr;
-    delete[] Axi;
-
-    if (symbolic) umfpack_di_free_symbolic(&symbolic);
-    if (numeric) umfpack_di_free_numeric(&numeric);
+    delete[] xr;
+    delete[] xi;
 
-    for (int i = 0; i < Acsc->get_size(); i++)
-        res[i] = cplx(xr[i], xi[i]);
-
-    delete xr;
-    delete xi;
-
-    if (!dynamic_cast<CSCMatrix*>(mat))
-        delete Acsc;
+    return status_solve == UMFPACK_OK;
 }
 
 #else
 
+bool CommonSolverUmfpack::factorize_symbolic() { return false; }
+bool CommonSolverUmfpack::factorize_numeric() { return false; }
+void CommonSolverUmfpack::free_symbolic() {}
+void CommonSolverUmfpack::free_numeric() {}
+
 bool CommonSolverUmfpack::_solve(Matrix *mat, double *res)
 {
     _error("CommonSolverUmfpack::solve(Matrix *mat, double *res) not implemented.");
@@ -32,7 +32,7 @@ using namespace std;
 #define H2D_TOTAL_ERROR_MASK 0x0F ///< A mask which mask-out total error type. Used by Adapt::calc_elem_errors() internally. \internal
 #define H2D_ELEMENT_ERROR_MASK 0xF0 ///< A mask which mask-out element error type. Used by Adapt::calc_elem_errors() internally. \internal
 
-Adapt::Adapt(Tuple<Space *> spaces_, Tuple<int> proj_norms) : num_act_elems(-1), have_solutions(false), have_errors(false) 
+Adapt::Adapt(Tuple<Space *> spaces_, Tuple<int> proj_norms) : num_act_elems(-1), have_solutions(false), have_errors(false), num_threads(1)
 {
   // sanity check
   if (proj_norms.size() > 0 && spaces_.size() != proj_norms.size()) 
@@ -76,6 +76,77 @@ Adapt::~Adapt()
 
 //// adapt /////////////////////////////////////////////////////////////////////////////////////////
 
+/// Refinements of the elements of the regular queue selected by the threads.
+struct Adapt::SelectionList
+{
+  Mesh** meshes;                        ///< meshes of the (coarse) solutions
+  std::vector<ElementToRefine> refs;    ///< selected refinements, indexed like the regular queue
+  std::vector<char> refined;            ///< results of Selector::select_refinement(), indexed like the regular queue
+  int end;                              ///< index of the regular queue behind the last selected element
+
+  int next;                             ///< first element not taken by a thread yet
+  pthread_mutex_t lock;
+};
+
+struct Adapt::SelectionThread
+{
+  Adapt* adapt;
+  SelectionList* list;
+  int end;
+  RefinementSelectors::Selector* selectors[H2D_MAX_COMPONENTS]; ///< workers of the selectors
+  Solution* rsln[H2D_MAX_COMPONENTS];   ///< copies of the reference solutions
+};
+
+void* Adapt::select_thread(void* data)
+{
+  SelectionThread* t = (SelectionThread*) data;
+  SelectionList* list = t->list;
+  Adapt* adapt = t->adapt;
+  const int chunk = 4;
+
+  while (1)
+  {
+    pthread_mutex_lock(&list->lock);
+    int first = list->next;
+    list->next += chunk;
+    pthread_mutex_unlock(&list->lock);
+    if (first >= t->end) break;
+
+    for (int inx = first; inx < std::min(first + chunk, t->end); inx++)
+    {
+      int id = adapt->regular_queue[inx].id;
+      int comp = adapt->regular_queue[inx].comp;
+      Element* e = list->meshes[comp]->get_element(id);
+
+      ElementToRefine elem_ref(id, comp);
+      int current = adapt->spaces[comp]->get_element_order(id);
+      list->refined[inx] = t->selectors[comp]->select_refinement(e, current, t->rsln[comp], elem_ref);
+      list->refs[inx] = elem_ref;
+    }
+  }
+  return NULL;
+}
+
+void Adapt::select_parallel(SelectionList& list, std::vector<SelectionThread>& threads, int end)
+{
+  list.next = list.end;
+  pthread_mutex_init(&list.lock, NULL);
+
+  std::vector<pthread_t> tid(num_threads);
+  for (int k = 0; k < num_threads; k++)
+  {
+    threads[k].end = end;
+    if (pthread_create(&tid[k], NULL, select_thread, &threads[k]) != 0)
+      error("Could not create selection thread %d.", k);
+  }
+  for (int k = 0; k < num_threads; k++)
+    pthread_join(tid[k], NULL);
+  pthread_mutex_destroy(&list.lock);
+  debug_log("Selected refinements of elements %d-%d by %d threads.", list.end, end - 1, num_threads);
+
+  list.end = end;
+}
+
 bool Adapt::adapt(Tuple<RefinementSelectors::Selector *> refinement_selectors, double thr, int strat, 
             int regularize, double to_be_processed)
 {
@@ -114,6 +185,57 @@ bool Adapt::adapt(Tuple<RefinementSelectors::Selector *> refinement_selectors, d
   int num_not_changed = 0; //a number of element that were not changed
   int num_priority_elem = 0; //a number of elements that were processed using priority queue
 
+  //prepare threads which select refinements of regular elements ahead
+  std::vector<SelectionThread> sel_threads;
+  SelectionList sel_list;
+  int sel_batch = 4 * num_threads;
+  if (num_threads > 1)
+  {
+    sel_threads.resize(num_threads);
+    for (int k = 0; k < num_threads && !sel_threads.empty(); k++)
+    {
+      for (int j = 0; j < this->neq; j++)
+      {
+        sel_threads[k].selectors[j] = refinement_selectors[j]->get_worker(k);
+        if (sel_threads[k].selectors[j] == NULL)
+        {
+          warn("Selector of component %d does not support threads, refinements are selected serially.", j);
+          sel_threads.clear();
+          break;
+        }
+      }
+    }
+  }
+  if (!sel_threads.empty())
+  {
+    sel_list.meshes = meshes;
+    sel_list.refs.resize(num_act_elems);
+    sel_list.refined.resize(num_act_elems);
+    sel_list.end = 0;
+    for (int k = 0; k < num_threads; k++)
+    {
+      SelectionThread* t = &sel_threads[k];
+      t->adapt = this;
+      t->list = &sel_list;
+      for (int j = 0; j < this->neq; j++)
+      {
+        t->rsln[j] = new Solution;
+        t->rsln[j]->copy(rsln[j]);
+        t->rsln[j]->set_quad_2d(&g_quad_2d_std);
+        t->rsln[j]->enable_transform(false);
+      }
+    }
+
+    // The copies share one copy of each reference mesh. Let the reference maps cache
+    // the inverse reference map orders in its elements now, so that the threads only read them.
+    for (int j = 0; j < this->neq; j++)
+    {
+      Element* e;
+      for_all_active_elements(e, sel_threads[0].rsln[j]->get_mesh())
+        sel_threads[0].rsln[j]->set_active_element(e);
+    }
+  }
+
   bool first_regular_element = true; //true if first regular element was not processed yet
   int inx_regular_element = 0;
   while (inx_regular_element < num_act_elems || !priority_queue.empty())
@@ -169,8 +291,19 @@ bool Adapt::adapt(Tuple<RefinementSelectors::Selector *> refinement_selectors, d
 
       // get refinement suggestion
       ElementToRefine elem_ref(id, comp);
-      int current = this->spaces[comp]->get_element_order(id);
-      bool refined = refinement_selectors[comp]->select_refinement(e, current, rsln[comp], elem_ref);
+      bool refined;
+      if (inx_element >= 0 && !sel_threads.empty()) {
+        if (inx_element >= sel_list.end) {
+          select_parallel(sel_list, sel_threads, std::min(num_act_elems, sel_list.end + sel_batch));
+          sel_batch = std::min(2 * sel_batch, 64 * num_threads);
+        }
+        elem_ref = sel_list.refs[inx_element];
+        refined = sel_list.refined[inx_element] != 0;
+      }
+      else {
+        int current = this->spaces[comp]->get_element_order(id);
+        refined = refinement_selectors[comp]->select_refinement(e, current, rsln[comp], elem_ref);
+      }
 
       //add to a list of elements that are going to be refined
       if (can_refine_element(mesh, e, refined, elem_ref) ) {
@@ -189,6 +322,10 @@ bool Adapt::adapt(Tuple<RefinementSelectors::Selector *> refinement_selectors, d
     }
   }
 
+  for (unsigned k = 0; k < sel_threads.size(); k++)
+    for (int j = 0; j < this->neq; j++)
+      delete sel_threads[k].rsln[j];
+
   verbose("Examined elements: %d", num_exam_elem);
   verbose(" Elements taken from priority queue: %d", num_priority_elem);
   verbose(" Ignored elements: %d", num_ignored_elem);
@@ -648,34 +785,49 @@ double Adapt::calc_elem_errors(unsigned int error_flags) {
   std::vector<double> norms_squared(this->neq, 0.0);
   double errors_squared_abs_sum = 0.0;
 
-  //calculate error
-  Element** ee;
+  //calculate errors and norms of all traversal states
+  int nf = this->neq * this->neq;
+  std::vector<int> ids;
+  std::vector<double> state_errors, state_norms;
   trav.begin(2*this->neq, meshes, tr);
-  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+  if (num_threads > 1)
+    calc_errors_parallel(trav, ids, state_errors, state_norms);
+  else
+  {
+    Element** ee;
+    while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+    {
+      for (int i = 0; i < this->neq; i++)
+        ids.push_back(ee[i]->id);
+      state_errors.resize(state_errors.size() + nf);
+      state_norms.resize(state_norms.size() + nf);
+      update_limit_table(ee[0]->get_mode());
+      eval_state_errors(sln, rsln, &state_errors[state_errors.size() - nf], &state_norms[state_norms.size() - nf]);
+    }
+  }
+  trav.finish();
+
+  //sum up the states in the order of the traversal
+  int nstates = ids.size() / this->neq;
+  for (int st = 0; st < nstates; st++)
   {
     for (int i = 0; i < this->neq; i++)
     {
-      RefMap* rmi = sln[i]->get_refmap();
-      RefMap* rrmi = rsln[i]->get_refmap();
       for (int j = 0; j < this->neq; j++)
       {
-        RefMap* rmj = sln[j]->get_refmap();
-        RefMap* rrmj = rsln[j]->get_refmap();
-        double error_squared, norm_squared;
         if (form[i][j] != NULL)
         {
-          error_squared = eval_elem_error_squared(form[i][j], ord[i][j], sln[i], sln[j], rsln[i], rsln[j], rmi, rmj, rrmi, rrmj);
-          norm_squared = eval_elem_norm_squared(form[i][j], ord[i][j], rsln[i], rsln[j], rrmi, rrmj);
+          double error_squared = state_errors[st*nf + i*this->neq + j];
+          double norm_squared = state_norms[st*nf + i*this->neq + j];
 
           norms_squared[i] += norm_squared;
           norms_squared_sum += norm_squared;
           errors_squared_abs_sum += error_squared;
-          errors_squared[i][ee[i]->id] += error_squared;
+          errors_squared[i][ids[st*this->neq + i]] += error_squared;
         }
       }
     }
   }
-  trav.finish();
 
   //make the error relative
   if ((error_flags & H2D_ELEMENT_ERROR_MASK) == H2D_ELEMENT_ERROR_REL) {
@@ -711,6 +863,158 @@ double Adapt::calc_elem_errors(unsigned int error_flags) {
   }
 }
 
+void Adapt::eval_state_errors(Solution** slns, Solution** rslns, double* errors, double* norms)
+{
+  for (int i = 0; i < this->neq; i++)
+  {
+    RefMap* rmi = slns[i]->get_refmap();
+    RefMap* rrmi = rslns[i]->get_refmap();
+    for (int j = 0; j < this->neq; j++)
+    {
+      RefMap* rmj = slns[j]->get_refmap();
+      RefMap* rrmj = rslns[j]->get_refmap();
+      int k = i * this->neq + j;
+      errors[k] = norms[k] = 0.0;
+      if (form[i][j] != NULL)
+      {
+        errors[k] = eval_elem_error_squared(form[i][j], ord[i][j], slns[i], slns[j], rslns[i], rslns[j], rmi, rmj, rrmi, rrmj);
+        norms[k] = eval_elem_norm_squared(form[i][j], ord[i][j], rslns[i], rslns[j], rrmi, rrmj);
+      }
+    }
+  }
+}
+
+void Adapt::set_num_threads(int num_threads)
+{
+  error_if(num_threads < 1, "Invalid number of threads (%d).", num_threads);
+  this->num_threads = num_threads;
+}
+
+/// Traversal states recorded by the main thread, to be evaluated by any of the threads.
+struct Adapt::ErrorStateList
+{
+  int nfns;                       ///< number of functions: (coarse) and reference solutions
+  std::vector<Element*> elems;    ///< elements of the functions, nfns per state
+  std::vector<uint64_t> subs;     ///< sub-element transforms of the functions, nfns per state
+  std::vector<double>* errors;    ///< squared errors, neq * neq per state
+  std::vector<double>* norms;     ///< squared norms, neq * neq per state
+
+  int next;                       ///< first state not taken by a thread yet
+  pthread_mutex_t lock;
+};
+
+struct Adapt::ErrorThread
+{
+  Adapt* adapt;
+  ErrorStateList* list;
+  Solution* sln[H2D_MAX_COMPONENTS];  ///< copies of the (coarse) solutions
+  Solution* rsln[H2D_MAX_COMPONENTS]; ///< copies of the reference solutions
+};
+
+void* Adapt::calc_errors_thread(void* data)
+{
+  ErrorThread* t = (ErrorThread*) data;
+  ErrorStateList* list = t->list;
+  Adapt* adapt = t->adapt;
+  const int chunk = 16;
+  int neq = adapt->neq;
+  int nf = neq * neq;
+  int nstates = list->elems.size() / list->nfns;
+
+  while (1)
+  {
+    pthread_mutex_lock(&list->lock);
+    int first = list->next;
+    list->next += chunk;
+    pthread_mutex_unlock(&list->lock);
+    if (first >= nstates) break;
+
+    for (int st = first; st < std::min(first + chunk, nstates); st++)
+    {
+      // restore the state as Traverse::get_next_state() left it in the main thread
+      Element** ee = &list->elems[st * list->nfns];
+      uint64_t* sub = &list->subs[st * list->nfns];
+      for (int i = 0; i < neq; i++)
+      {
+        t->sln[i]->set_active_element(ee[i]);
+        t->sln[i]->set_transform(sub[i]);
+        t->rsln[i]->set_active_element(ee[neq + i]);
+        t->rsln[i]->set_transform(sub[neq + i]);
+      }
+
+      // the order limiting tables are kept for every thread
+      update_limit_table(ee[0]->get_mode());
+      adapt->eval_state_errors(t->sln, t->rsln, &(*list->errors)[st * nf], &(*list->norms)[st * nf]);
+    }
+  }
+  return NULL;
+}
+
+void Adapt::calc_errors_parallel(Traverse& trav, std::vector<int>& ids, std::vector<double>& errors, std::vector<double>& norms)
+{
+  // Traverse the meshes in the main thread and record all states. This also makes
+  // the reference maps cache the inverse reference map orders in the elements, so
+  // that the threads only read them.
+  ErrorStateList list;
+  list.nfns = 2 * this->neq;
+  Element** ee;
+  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+  {
+    for (int i = 0; i < this->neq; i++)
+      ids.push_back(ee[i]->id);
+    for (int k = 0; k < list.nfns; k++)
+    {
+      list.elems.push_back(ee[k]);
+      list.subs.push_back(k < this->neq ? sln[k]->get_transform() : rsln[k - this->neq]->get_transform());
+    }
+  }
+
+  int nstates = ids.size() / this->neq;
+  errors.resize(nstates * this->neq * this->neq);
+  norms.resize(nstates * this->neq * this->neq);
+  list.errors = &errors;
+  list.norms = &norms;
+  list.next = 0;
+  pthread_mutex_init(&list.lock, NULL);
+
+  // Every thread evaluates its own copies of the solutions, since the solutions keep
+  // the active element and the precalculated values.
+  std::vector<ErrorThread> threads(num_threads);
+  for (int k = 0; k < num_threads; k++)
+  {
+    ErrorThread* t = &threads[k];
+    t->adapt = this;
+    t->list = &list;
+    for (int i = 0; i < this->neq; i++)
+    {
+      t->sln[i] = new Solution;
+      t->sln[i]->copy(sln[i]);
+      t->sln[i]->set_quad_2d(sln[i]->get_quad_2d());
+      t->sln[i]->enable_transform(sln[i]->is_transform_enabled());
+      t->rsln[i] = new Solution;
+      t->rsln[i]->copy(rsln[i]);
+      t->rsln[i]->set_quad_2d(rsln[i]->get_quad_2d());
+      t->rsln[i]->enable_transform(rsln[i]->is_transform_enabled());
+    }
+  }
+
+  std::vector<pthread_t> tid(num_threads);
+  for (int k = 0; k < num_threads; k++)
+    if (pthread_create(&tid[k], NULL, calc_errors_thread, &threads[k]) != 0)
+      error("Could not create error evaluation thread %d.", k);
+  for (int k = 0; k < num_threads; k++)
+    pthread_join(tid[k], NULL);
+  pthread_mutex_destroy(&list.lock);
+  verbose("Evaluated errors of %d states by %d threads.", nstates, num_threads);
+
+  for (int k = 0; k < num_threads; k++)
+    for (int i = 0; i < this->neq; i++)
+    {
+      delete threads[k].sln[i];
+      delete threads[k].rsln[i];
+    }
+}
+
 void Adapt::fill_regular_queue(Mesh** meshes, Mesh** ref_meshes) {
   assert_msg(num_act_elems > 0, "Number of active elements (%d) is invalid.", num_act_elems);
 
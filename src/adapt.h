@@ -119,6 +119,8 @@ struct AdaptivityParamType {
   }
 };
 
+class Traverse;
+
 /// Evaluation of an error between a (coarse) solution and a refernece solution and adaptivity. \ingroup g_adapt
 /** The class provides basic functionality necessary to adaptively refine elements.
  *  Given a reference solution and a coarse solution, it calculates error estimates
@@ -209,6 +211,23 @@ public:
   /** \return A vector of refinements generated during the last execution of the method adapt(). The returned vector might change or become invalid after the next execution of the method adadpt(). */
   const std::vector<ElementToRefine>& get_last_refinements() const; ///< Returns last refinements.
 
+  /// Sets the number of threads used by calc_elem_errors() and adapt().
+  /** The default is one, i.e., the serial evaluation. With more threads, the traversal states
+   *  are recorded first and distributed among the threads, each of them having its own copies
+   *  of the solutions. The errors and norms of the states are summed in the serial order
+   *  afterwards, so the result does not depend on the number of threads. Note that
+   *  eval_elem_error_squared() and eval_elem_norm_squared() are then called from several
+   *  threads at once.
+   *
+   *  The method adapt() selects refinements of the elements of the regular queue by the threads
+   *  in batches ahead of the loop which decides about them. Each thread uses its own worker
+   *  of a selector (see Selector::get_worker()) and its own copies of the reference solutions.
+   *  The refinements are the same as in the serial case. If a selector does not provide workers,
+   *  the selection is serial.
+   *  \param[in] num_threads A number of threads. */
+  void set_num_threads(int num_threads);
+  int get_num_threads() const { return num_threads; } ///< Returns the number of threads used by calc_elem_errors() and adapt().
+
 protected: //adaptivity
   int num_act_elems; ///< A total number of active elements across all provided meshes.
   std::queue<ElementReference> priority_queue; ///< A queue of priority elements. Elements in this queue are processed before the elements in the Adapt::regular_queue.
@@ -250,6 +269,7 @@ protected: //adaptivity
 protected: //object state
   bool have_errors; ///< True if errors of elements were calculated.
   bool have_solutions; ///< True if solutions were set.
+  int num_threads; ///< A number of threads used by calc_elem_errors() and adapt().
 
 protected: // spaces & solutions
   int neq;                              ///< Number of solution components (as in wf->neq).
@@ -297,6 +317,13 @@ protected: //forms and error evaluation
   virtual double eval_elem_norm_squared(matrix_form_val_t bi_fn, matrix_form_ord_t bi_ord,
                    MeshFunction *rsln1, MeshFunction *rsln2, RefMap *rrv1, RefMap *rrv2);
 
+  /// Evaluates squared errors and squared norms of all pairs of components on the current traversal state.
+  /** \param[in] slns (Coarse) solutions, set to the elements of the state.
+   *  \param[in] rslns Reference solutions, set to the elements of the state.
+   *  \param[out] errors Squared errors, indexed by i * neq + j. Zero if there is no form for the pair (i, j).
+   *  \param[out] norms Squared norms, indexed by i * neq + j. Zero if there is no form for the pair (i, j). */
+  void eval_state_errors(Solution** slns, Solution** rslns, double* errors, double* norms);
+
   /// Builds an ordered queue of elements that are be examined.
   /** The method fills Adapt::standard_queue by elements sorted accordin to their error descending.
    *  The method assumes that Adapt::errors_squared contains valid values.
@@ -305,7 +332,29 @@ protected: //forms and error evaluation
    *  /param[in] meshes An array of pointers to meshes of a reference solution. An index into the array is an index of a component. */
   virtual void fill_regular_queue(Mesh** meshes, Mesh** ref_meshes);
 
-private: 
+private:
+  struct ErrorStateList;
+  struct ErrorThread;
+  static void* calc_errors_thread(void* data);
+
+  /// Multithreaded counterpart of the traversal loop in calc_elem_errors().
+  /** Records the traversal states and evaluates them by threads.
+   *  \param[in] trav A traversal which was started on all (coarse) and reference meshes.
+   *  \param[out] ids IDs of the elements of the (coarse) solutions, neq per state.
+   *  \param[out] errors Squared errors, neq * neq per state, see eval_state_errors().
+   *  \param[out] norms Squared norms, neq * neq per state, see eval_state_errors(). */
+  void calc_errors_parallel(Traverse& trav, std::vector<int>& ids, std::vector<double>& errors, std::vector<double>& norms);
+
+  struct SelectionList;
+  struct SelectionThread;
+  static void* select_thread(void* data);
+
+  /// Selects refinements of elements of the regular queue by threads.
+  /** \param[in,out] list Selections made so far. Selections of elements up to the index \a end of the regular queue are added.
+   *  \param[in] threads Threads with workers of selectors and copies of the reference solutions.
+   *  \param[in] end An index of the regular queue behind the last element to select. */
+  void select_parallel(SelectionList& list, std::vector<SelectionThread>& threads, int end);
+
   /// A functor that compares elements accoring to their error. Used by std::sort().
   class CompareElements {
   private:
@@ -0,0 +1,100 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __H2D_ARENA_H
+#define __H2D_ARENA_H
+
+#include "common.h"
+#include <vector>
+
+/// \brief A chunked bump allocator.
+///
+/// Memory is handed out from large contiguous chunks. Single blocks cannot be
+/// released, everything is freed at once by free(). This suits tables which
+/// live as long as their owner, such as the flat storage of precalculated
+/// shape function values (see PrecalcShapeset), and keeps them close together
+/// in memory without the per-block overhead of malloc().
+///
+class Arena
+{
+public:
+
+  Arena(size_t chunk_size = 256*1024) : chunk_size(chunk_size)
+  {
+    ptr = NULL;
+    left = size = used = 0;
+  }
+
+  ~Arena() { free(); }
+
+  /// Returns a block of 'bytes' bytes, aligned to 16 bytes.
+  void* alloc(size_t bytes)
+  {
+    bytes = (bytes + 15) & ~(size_t) 15;
+    if (bytes > left) new_chunk(bytes);
+    void* p = ptr;
+    ptr += bytes;
+    left -= bytes;
+    used += bytes;
+    return p;
+  }
+
+  /// Returns a zeroed block of 'bytes' bytes.
+  void* calloc(size_t bytes)
+  {
+    void* p = alloc(bytes);
+    memset(p, 0, bytes);
+    return p;
+  }
+
+  /// Releases all blocks.
+  void free()
+  {
+    for (unsigned i = 0; i < chunks.size(); i++)
+      ::free(chunks[i]);
+    chunks.clear();
+    ptr = NULL;
+    left = size = used = 0;
+  }
+
+  /// Returns the number of bytes allocated from the system.
+  size_t get_size() const { return size; }
+
+  /// Returns the number of bytes handed out by alloc().
+  size_t get_used() const { return used; }
+
+protected:
+
+  H2D_API_USED_STL_VECTOR(char*);
+  std::vector<char*> chunks;
+  size_t chunk_size;
+  char*  ptr;   ///< start of the free part of the current chunk
+  size_t left;  ///< free bytes in the current chunk
+  size_t size, used;
+
+  void new_chunk(size_t bytes)
+  {
+    size_t n = std::max(bytes, chunk_size);
+    char* chunk = (char*) malloc(n);
+    if (chunk == NULL) error("Out of memory allocating %lu bytes.", (unsigned long) n);
+    chunks.push_back(chunk);
+    ptr = chunk;
+    left = n;
+    size += n;
+  }
+
+};
+
+#endif
@@ -73,6 +73,16 @@ public:
     }
   }
 
+  /// Exchanges the contents with another array, without copying the items.
+  void swap(Array& array)
+  {
+    pages.swap(array.pages);
+    unused.swap(array.unused);
+    std::swap(size, array.size);
+    std::swap(nitems, array.nitems);
+    std::swap(append_only, array.append_only);
+  }
+
   /// Removes all elements from the array.
   void free()
   {
@@ -154,14 +164,14 @@ public:
 
   /// Counts the items in the array and registers unused items.
   /// This is a special-purpose function, used after loading the array
-  /// from file.
+  /// from file. Unused items below 'start' are not registered, their ids are never reused.
   void post_load_scan(int start = 0)
   {
     nitems = 0;
-    for (int i = start; i < size; i++)
+    for (int i = 0; i < size; i++)
       if (get_item(i).used)
         nitems++;
-      else
+      else if (i >= start)
         unused.push_back(i);
   }
 
@@ -0,0 +1,425 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "checkpoint.h"
+
+#ifdef WITH_ZLIB
+  #include <zlib.h>
+#endif
+
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+
+// Size of the chunks passed to zlib and to fwrite(). zlib counts bytes in unsigned ints,
+// so larger buffers have to be processed in chunks anyway.
+static const size_t H2D_CHUNK_SIZE = 1 << 20;
+
+
+//// SaveBuffer ////////////////////////////////////////////////////////////////////////////////////
+
+void SaveBuffer::save(const char* filename, bool compress) const
+{
+#ifndef WITH_ZLIB
+  if (compress)
+    warn("Hermes2D was built without zlib, %s is not compressed.", filename);
+#endif
+  if (!try_save(filename, compress)) error("Error writing to file %s.", filename);
+}
+
+
+bool SaveBuffer::try_save(const char* filename, bool compress) const
+{
+  FILE* f = fopen(filename, "wb");
+  if (f == NULL) return false;
+  const char* ptr = data.empty() ? NULL : &data[0];
+  bool ok = true;
+
+#ifndef WITH_ZLIB
+  compress = false;
+#else
+  if (compress)
+  {
+    // the fastest compression level: checkpoints are written much more often than read,
+    // and the floating point data does not compress well anyway
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      fclose(f);
+      return false;
+    }
+
+    std::vector<unsigned char> out(H2D_CHUNK_SIZE);
+    size_t left = data.size();
+    int flush;
+    do
+    {
+      size_t n = std::min(left, H2D_CHUNK_SIZE);
+      zs.next_in = (Bytef*) ptr;
+      zs.avail_in = (uInt) n;
+      ptr += n;
+      left -= n;
+      flush = (left == 0) ? Z_FINISH : Z_NO_FLUSH;
+      do
+      {
+        zs.next_out = &out[0];
+        zs.avail_out = (uInt) out.size();
+        deflate(&zs, flush);
+        size_t n_out = out.size() - zs.avail_out;
+        if (ok && fwrite(&out[0], 1, n_out, f) != n_out) ok = false;
+      }
+      while (zs.avail_out == 0);
+    }
+    while (flush != Z_FINISH);
+    deflateEnd(&zs);
+  }
+#endif
+
+  if (!compress && fwrite(ptr, 1, data.size(), f) != data.size()) ok = false;
+
+  if (fclose(f) != 0) ok = false;
+  return ok;
+}
+
+
+//// LoadBuffer ////////////////////////////////////////////////////////////////////////////////////
+
+void LoadBuffer::load(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) error("Could not open %s", filename);
+
+  // read the whole file
+  std::vector<char> raw;
+  size_t n;
+  do
+  {
+    size_t pos = raw.size();
+    raw.resize(pos + H2D_CHUNK_SIZE);
+    n = fread(&raw[pos], 1, H2D_CHUNK_SIZE, f);
+    raw.resize(pos + n);
+  }
+  while (n == H2D_CHUNK_SIZE);
+  if (ferror(f)) error("Error reading file %s.", filename);
+  fclose(f);
+
+  pos = 0;
+  bool compressed = (raw.size() >= 2 && (unsigned char) raw[0] == 0x1f && (unsigned char) raw[1] == 0x8b);
+  if (!compressed)
+  {
+    data.swap(raw);
+    return;
+  }
+
+#ifndef WITH_ZLIB
+  error("Hermes2D was built without zlib, the compressed file %s cannot be read.", filename);
+#else
+  // the gzip trailer contains the size of the data modulo 2^32
+  size_t size = 0;
+  if (raw.size() >= 4)
+    for (int i = 1; i <= 4; i++)
+      size = (size << 8) | (unsigned char) raw[raw.size() - i];
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 32) != Z_OK)
+    error("Could not initialize zlib.");
+
+  data.resize(std::max(size, H2D_CHUNK_SIZE));
+  const char* in = &raw[0];
+  size_t in_left = raw.size(), out_pos = 0;
+  int ret = Z_OK;
+  while (ret != Z_STREAM_END)
+  {
+    if (out_pos == data.size()) data.resize(2 * data.size());
+    size_t in_n = std::min(in_left, H2D_CHUNK_SIZE);
+    size_t out_n = std::min(data.size() - out_pos, H2D_CHUNK_SIZE);
+    zs.next_in = (Bytef*) in;
+    zs.avail_in = (uInt) in_n;
+    zs.next_out = (Bytef*) &data[out_pos];
+    zs.avail_out = (uInt) out_n;
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && !(ret == Z_BUF_ERROR && in_n > 0))
+      error("Corrupt compressed file %s.", filename);
+    in += in_n - zs.avail_in;
+    in_left -= in_n - zs.avail_in;
+    out_pos += out_n - zs.avail_out;
+    if (ret != Z_STREAM_END && in_left == 0 && zs.avail_out != 0)
+      error("Premature end of compressed file %s.", filename);
+  }
+  inflateEnd(&zs);
+  data.resize(out_pos);
+#endif
+}
+
+
+//// CheckpointWriter //////////////////////////////////////////////////////////////////////////////
+
+CheckpointWriter::CheckpointWriter() : compress(false), write_time(0.0), running(false), failed(false)
+{
+}
+
+
+CheckpointWriter::~CheckpointWriter()
+{
+  wait();
+}
+
+
+void* CheckpointWriter::write_thread(void* data)
+{
+  CheckpointWriter* w = (CheckpointWriter*) data;
+  TimePeriod cpu_time;
+  // errors are only recorded here, wait() reports them in the thread of the caller
+  if (!w->buffer.try_save(w->filename.c_str(), w->compress))
+    w->failed = true;
+  w->write_time += cpu_time.tick().last();
+  w->buffer.clear();
+  return NULL;
+}
+
+
+void CheckpointWriter::save(SaveBuffer& buffer, const char* filename, bool compress)
+{
+  wait();
+
+#ifndef WITH_ZLIB
+  if (compress)
+    warn("Hermes2D was built without zlib, %s is not compressed.", filename);
+#endif
+  this->buffer.clear();
+  this->buffer.swap(buffer);
+  this->filename = filename;
+  this->compress = compress;
+
+  if (pthread_create(&thread, NULL, write_thread, this) == 0)
+    running = true;
+  else
+  {
+    warn("Could not create a thread, writing %s in the foreground.", filename);
+    write_thread(this);
+    wait();
+  }
+}
+
+
+void CheckpointWriter::wait()
+{
+  if (running)
+  {
+    pthread_join(thread, NULL);
+    running = false;
+  }
+  if (failed)
+  {
+    failed = false;
+    error("Error writing to file %s.", filename.c_str());
+  }
+}
+
+
+//// BinaryWriter, BinaryFile //////////////////////////////////////////////////////////////////////
+
+// Header and section table entry of the H2DB format. The section offsets are counted
+// from the beginning of the file and are multiples of 8.
+struct BinaryHeader
+{
+  char magic[4];         // "H2DB"
+  unsigned version;
+  unsigned byte_order;   // H2D_BYTE_ORDER as written by the saving machine
+  unsigned nsections;
+  uint64_t size;         // file size, to detect truncated files
+};
+
+struct BinarySection
+{
+  char name[8];
+  uint64_t offset, size;
+  unsigned item_size, reserved;
+};
+
+static const unsigned H2D_BINARY_VERSION = 1;
+static const unsigned H2D_BYTE_ORDER = 0x01020304;
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t) 7; }
+
+
+void BinaryWriter::add_section(const char* name, const void* ptr, size_t item_size, size_t count)
+{
+  if (strlen(name) > 8) error("Section name %s is too long.", name);
+  for (unsigned i = 0; i < sections.size(); i++)
+    if (!strncmp(sections[i].name, name, 8))
+      error("Duplicate section %s.", name);
+
+  Section sec;
+  memset(sec.name, 0, sizeof(sec.name));
+  memcpy(sec.name, name, strlen(name));
+  sec.offset = data.size();
+  sec.item_size = item_size;
+  sec.count = count;
+  sections.push_back(sec);
+
+  size_t n = item_size * count;
+  data.resize(align8(sec.offset + n), 0);
+  if (n) memcpy(&data[sec.offset], ptr, n);
+}
+
+
+void BinaryWriter::save(const char* filename) const
+{
+  size_t start = align8(sizeof(BinaryHeader) + sections.size() * sizeof(BinarySection));
+
+  BinaryHeader hdr;
+  memcpy(hdr.magic, "H2DB", 4);
+  hdr.version = H2D_BINARY_VERSION;
+  hdr.byte_order = H2D_BYTE_ORDER;
+  hdr.nsections = sections.size();
+  hdr.size = start + data.size();
+
+  std::vector<BinarySection> table(sections.size());
+  for (unsigned i = 0; i < sections.size(); i++)
+  {
+    memcpy(table[i].name, sections[i].name, 8);
+    table[i].offset = start + sections[i].offset;
+    table[i].size = sections[i].item_size * sections[i].count;
+    table[i].item_size = sections[i].item_size;
+    table[i].reserved = 0;
+  }
+
+  FILE* f = fopen(filename, "wb");
+  if (f == NULL) error("Could not open %s for writing.", filename);
+  hermes2d_fwrite(&hdr, sizeof(hdr), 1, f);
+  if (!table.empty())
+    hermes2d_fwrite(&table[0], sizeof(BinarySection), table.size(), f);
+  static const char zeros[8] = { 0 };
+  size_t pad = start - sizeof(hdr) - table.size() * sizeof(BinarySection);
+  if (pad) hermes2d_fwrite(zeros, 1, pad, f);
+  if (!data.empty())
+    hermes2d_fwrite(&data[0], 1, data.size(), f);
+  if (fclose(f) != 0) error("Error writing to file %s.", filename);
+}
+
+
+BinaryFile::BinaryFile() : base(NULL), size(0), mapped(false)
+{
+}
+
+
+BinaryFile::~BinaryFile()
+{
+  close();
+}
+
+
+void BinaryFile::open(const char* filename)
+{
+  close();
+  this->filename = filename;
+
+#ifndef _WIN32
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) error("Could not open %s", filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) error("Could not get the size of %s.", filename);
+  size = st.st_size;
+  if (size > 0)
+  {
+    void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED)
+    {
+      base = (const char*) ptr;
+      mapped = true;
+    }
+  }
+  ::close(fd);
+#endif
+
+  // no mmap(): read the whole file (malloc() returns memory suitably aligned for the records)
+  if (!mapped)
+  {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) error("Could not open %s", filename);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* buf = (char*) malloc(std::max(size, (size_t) 1));
+    if (buf == NULL) error("Out of memory.");
+    if (fread(buf, 1, size, f) != size) error("Error reading file %s.", filename);
+    fclose(f);
+    base = buf;
+  }
+
+  // check the header and the section table
+  const BinaryHeader* hdr = (const BinaryHeader*) base;
+  if (size < sizeof(BinaryHeader) || memcmp(hdr->magic, "H2DB", 4))
+    error("%s is not a Hermes2D binary file.", filename);
+  if (hdr->byte_order != H2D_BYTE_ORDER)
+    error("%s was saved on a machine with a different byte order.", filename);
+  if (hdr->version > H2D_BINARY_VERSION)
+    error("Unsupported version of the binary file %s.", filename);
+  if (hdr->size != size)
+    error("The binary file %s is truncated.", filename);
+
+  const BinarySection* table = (const BinarySection*) (hdr + 1);
+  if (sizeof(BinaryHeader) + hdr->nsections * sizeof(BinarySection) > size)
+    error("Corrupt binary file %s.", filename);
+  for (unsigned i = 0; i < hdr->nsections; i++)
+    if (table[i].offset % 8 || table[i].offset > size || table[i].size > size - table[i].offset ||
+        (table[i].item_size && table[i].size % table[i].item_size))
+      error("Corrupt binary file %s.", filename);
+}
+
+
+void BinaryFile::close()
+{
+  if (base == NULL) return;
+#ifndef _WIN32
+  if (mapped) munmap((void*) base, size);
+#endif
+  if (!mapped) ::free((void*) base);
+  base = NULL;
+  size = 0;
+  mapped = false;
+}
+
+
+const void* BinaryFile::find_section(const char* name) const
+{
+  if (base == NULL) return NULL;
+  const BinaryHeader* hdr = (const BinaryHeader*) base;
+  const BinarySection* table = (const BinarySection*) (hdr + 1);
+  for (unsigned i = 0; i < hdr->nsections; i++)
+    if (!strncmp(table[i].name, name, 8))
+      return table + i;
+  return NULL;
+}
+
+
+const void* BinaryFile::get_section(const char* name, size_t item_size, size_t& count) const
+{
+  const BinarySection* sec = (const BinarySection*) find_section(name);
+  if (sec == NULL)
+    error("Section %s not found in %s.", name, filename.c_str());
+  if (sec->item_size != item_size)
+    error("Section %s in %s has an incompatible record size.", name, filename.c_str());
+  count = item_size ? sec->size / item_size : 0;
+  return base + sec->offset;
+}
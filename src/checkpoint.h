@@ -0,0 +1,238 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __H2D_CHECKPOINT_H
+#define __H2D_CHECKPOINT_H
+
+#include "common.h"
+
+/// SaveBuffer collects binary data in one contiguous block of memory, which is then
+/// written to a file at once. If 'compress' is true, the data is compressed by zlib in
+/// the calling process. The compressed file has the gzip format, so it can be examined
+/// by the usual tools. Without zlib (WITH_ZLIB not defined), the data is stored uncompressed.
+///
+/// Solution::save() and Mesh::save_raw() serialize into a SaveBuffer, CheckpointWriter
+/// writes the buffers in a background thread.
+///
+class H2D_API SaveBuffer
+{
+public:
+
+  /// Appends 'nitems' items of 'size' bytes.
+  void write(const void* ptr, size_t size, size_t nitems)
+  {
+    size_t n = size * nitems;
+    if (n == 0) return;
+    size_t pos = data.size();
+    data.resize(pos + n);
+    memcpy(&data[pos], ptr, n);
+  }
+
+  /// Returns the number of bytes in the buffer.
+  size_t get_size() const { return data.size(); }
+
+  /// Removes all data from the buffer.
+  void clear() { data.clear(); }
+
+  /// Exchanges the contents with another buffer, without copying the data.
+  void swap(SaveBuffer& other) { data.swap(other.data); }
+
+  /// Writes the buffer to a file.
+  /// \param filename Name of the file.
+  /// \param compress If true, the data is compressed in the gzip format.
+  void save(const char* filename, bool compress) const;
+
+  /// Writes the buffer to a file. Returns false instead of reporting an error if the file
+  /// cannot be written; does not log anything, so it can be called from any thread.
+  bool try_save(const char* filename, bool compress) const;
+
+protected:
+
+  std::vector<char> data;
+
+};
+
+
+/// LoadBuffer reads a whole file created by SaveBuffer::save() into the memory, the file
+/// is decompressed if it is in the gzip format. The data is then read item by item.
+///
+class H2D_API LoadBuffer
+{
+public:
+
+  LoadBuffer() : pos(0) {}
+
+  /// Reads a file into the buffer.
+  void load(const char* filename);
+
+  /// Reads 'nitems' items of 'size' bytes, reports an error at the end of the data.
+  void read(void* ptr, size_t size, size_t nitems)
+  {
+    if (!try_read(ptr, size, nitems)) error("Premature end of file.");
+  }
+
+  /// Reads 'nitems' items of 'size' bytes. Returns false and reads nothing if there
+  /// is not enough data left.
+  bool try_read(void* ptr, size_t size, size_t nitems)
+  {
+    size_t n = size * nitems;
+    if (n > data.size() - pos) return false;
+    if (n == 0) return true;
+    memcpy(ptr, &data[pos], n);
+    pos += n;
+    return true;
+  }
+
+protected:
+
+  std::vector<char> data;
+  size_t pos;
+
+};
+
+
+/// CheckpointWriter compresses and writes saved data in a background thread, so that
+/// the computation does not wait for the I/O. Only one file is written at a time: a new
+/// save waits until the previous one is finished. The destructor waits for the last one.
+/// A failure of the background writing is reported by the next save() or wait().
+///
+/// Usage:
+///
+///   CheckpointWriter writer;
+///   for (int ts = 0; ...)
+///   {
+///     ...
+///     sln.save(filename, true, &writer); // returns as soon as the data is copied
+///   }
+///
+class H2D_API CheckpointWriter
+{
+public:
+
+  CheckpointWriter();
+  ~CheckpointWriter();
+
+  /// Starts writing the buffer to a file. The contents of the buffer is taken over,
+  /// i.e., the buffer is empty on return.
+  void save(SaveBuffer& buffer, const char* filename, bool compress);
+
+  /// Waits until the last file is written. Reports an error if it could not be written.
+  void wait();
+
+  /// Returns the total time spent by writing in the background (in seconds).
+  double get_write_time() const { return write_time; }
+
+protected:
+
+  SaveBuffer buffer;
+  std::string filename;
+  bool compress;
+  double write_time;
+
+  bool running;
+  bool failed; ///< set by the writing thread, checked by wait()
+  pthread_t thread;
+
+  static void* write_thread(void* data);
+
+};
+
+
+/// BinaryWriter assembles a file in the H2DB binary format, which is meant to be mapped
+/// into the memory and used without parsing (see BinaryFile). The file consists of a header,
+/// a table of named sections and the section data. Each section is an array of fixed-size
+/// records, aligned to 8 bytes. All references are stored as id numbers or file offsets,
+/// the layout does not depend on the address the file is mapped at.
+///
+/// Mesh::save_binary() and Solution::save_binary() add their sections to a BinaryWriter.
+///
+class H2D_API BinaryWriter
+{
+public:
+
+  /// Appends a section of 'count' records of 'item_size' bytes. The name has at most
+  /// 8 characters and must be unique in the file.
+  void add_section(const char* name, const void* data, size_t item_size, size_t count);
+
+  /// Writes the file (uncompressed, so that it can be mapped).
+  void save(const char* filename) const;
+
+protected:
+
+  struct Section
+  {
+    char name[8];
+    size_t offset;  ///< offset in 'data'
+    size_t item_size, count;
+  };
+
+  std::vector<Section> sections;
+  std::vector<char> data;
+
+};
+
+
+/// BinaryFile maps a file created by BinaryWriter into the memory (read-only, using mmap()
+/// where available, otherwise the file is read at once) and gives direct access to its
+/// sections. Only the header and the section table are checked when the file is opened,
+/// the pages of the sections are read by the operating system when they are first accessed.
+///
+/// Usage:
+///
+///   BinaryFile file;
+///   file.open("mesh.h2db");
+///   size_t n;
+///   const RawNode* rn = (const RawNode*) file.get_section("NODES", sizeof(RawNode), n);
+///
+class H2D_API BinaryFile
+{
+public:
+
+  BinaryFile();
+  ~BinaryFile();
+
+  /// Maps the file and checks its header. Reports an error if the file is not in the
+  /// H2DB format, has an unsupported version or a different byte order.
+  void open(const char* filename);
+
+  /// Unmaps the file. The pointers returned by get_section() become invalid.
+  void close();
+
+  /// Returns true if the file contains the section.
+  bool has_section(const char* name) const { return find_section(name) != NULL; }
+
+  /// Returns a pointer to the data of a section and the number of its records in 'count'.
+  /// Reports an error if the section is missing or its record size is not 'item_size'.
+  const void* get_section(const char* name, size_t item_size, size_t& count) const;
+
+  /// Returns true if the file is mapped, false if it was read into the memory.
+  bool is_mapped() const { return mapped; }
+
+  /// Returns the size of the file in bytes.
+  size_t get_size() const { return size; }
+
+protected:
+
+  const char* base;
+  size_t size;
+  bool mapped;
+  std::string filename;
+
+  const void* find_section(const char* name) const;
+
+};
+
+
+#endif
@@ -328,3 +328,72 @@ H2D_API void throw_exception(char *text)
   throw std::runtime_error(text);
 }
 
+
+H2D_THREAD_LOCAL ThreadMode::Entry* ThreadMode::entries = NULL;
+H2D_THREAD_LOCAL int ThreadMode::num_entries = 0;
+
+/// Guards the allocation of the slots of ThreadMode. The free slots are never deleted,
+/// since static instances release their slots during the destruction of the statics.
+static pthread_mutex_t thread_mode_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int>* thread_mode_free_slots = NULL;
+static int thread_mode_num_slots = 0;
+static unsigned thread_mode_serial = 0;
+
+/// Frees the entries of a thread when it exits; the key is only used for the cleanup.
+static pthread_key_t thread_mode_key;
+static pthread_once_t thread_mode_once = PTHREAD_ONCE_INIT;
+
+void ThreadMode::free_entries(void* e)
+{
+  // called in the exiting thread, which may still read modes in later destructors
+  free(e);
+  entries = NULL;
+  num_entries = 0;
+}
+
+void ThreadMode::create_key()
+{
+  if (pthread_key_create(&thread_mode_key, free_entries) != 0)
+    error("Could not create the key of the thread modes.");
+}
+
+void ThreadMode::acquire_slot()
+{
+  pthread_mutex_lock(&thread_mode_mutex);
+  if (thread_mode_free_slots != NULL && !thread_mode_free_slots->empty())
+  {
+    slot = thread_mode_free_slots->back();
+    thread_mode_free_slots->pop_back();
+  }
+  else
+    slot = thread_mode_num_slots++;
+  // serial 0 marks the unused entries
+  if (++thread_mode_serial == 0) ++thread_mode_serial;
+  serial = thread_mode_serial;
+  pthread_mutex_unlock(&thread_mode_mutex);
+}
+
+void ThreadMode::release_slot()
+{
+  pthread_mutex_lock(&thread_mode_mutex);
+  if (thread_mode_free_slots == NULL) thread_mode_free_slots = new std::vector<int>;
+  thread_mode_free_slots->push_back(slot);
+  pthread_mutex_unlock(&thread_mode_mutex);
+}
+
+void ThreadMode::set(int mode)
+{
+  if (slot >= num_entries)
+  {
+    pthread_once(&thread_mode_once, create_key);
+    int num = std::max(std::max(2 * num_entries, slot + 1), 16);
+    Entry* e = (Entry*) realloc(entries, num * sizeof(Entry));
+    if (e == NULL) error("Out of memory.");
+    memset(e + num_entries, 0, (num - num_entries) * sizeof(Entry));
+    pthread_setspecific(thread_mode_key, e);
+    entries = e;
+    num_entries = num;
+  }
+  entries[slot].serial = serial;
+  entries[slot].mode = mode;
+}
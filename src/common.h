@@ -79,6 +79,67 @@ enum ElementMode { // element modes
   H2D_MODE_QUAD = 1
 };
 
+/// \brief Mode of an object shared by several threads.
+///
+/// Concurrency contract: independent problems (meshes, spaces, weak forms,
+/// DiscreteProblems, Solutions) may be set up, assembled and solved in separate
+/// threads of one process, as long as each object is used by one thread at a time.
+/// The state shared by the library, i.e., the standard quadrature, the shapesets
+/// of the reference maps, the order limiting tables, the projection matrices of
+/// the spaces and the mesh parser, is either guarded by a mutex or kept for every
+/// thread separately. A shapeset may be shared by problems in several threads.
+///
+/// ThreadMode keeps H2D_MODE_TRIANGLE or H2D_MODE_QUAD separately for every thread,
+/// which is how shapesets and quadratures switch between triangles and quads: each
+/// thread sets the mode of the element it works on without affecting the others.
+/// A thread that has not set the mode yet sees the initial one. The modes are kept in
+/// a thread-local array indexed by a slot of the instance, so reading the mode costs
+/// a thread-local load and a comparison, and the number of instances is not limited.
+class H2D_API ThreadMode
+{
+public:
+  ThreadMode(int init = H2D_MODE_TRIANGLE) : init(init) { acquire_slot(); }
+  ThreadMode(const ThreadMode& other) : init(other) { acquire_slot(); }
+  ~ThreadMode() { release_slot(); }
+
+  operator int() const
+  {
+    const Entry* e = entries;
+    return (slot < num_entries && e[slot].serial == serial) ? e[slot].mode : init;
+  }
+
+  ThreadMode& operator=(int mode)
+  {
+    assert(mode >= 0);
+    if (*this != mode) set(mode);
+    return *this;
+  }
+
+  ThreadMode& operator=(const ThreadMode& other) { return *this = (int) other; }
+
+private:
+  /// Mode of one instance in one thread, valid if the serial number is that of the instance.
+  struct Entry
+  {
+    unsigned serial;
+    int mode;
+  };
+
+  static H2D_THREAD_LOCAL Entry* entries;   ///< entries of the calling thread, indexed by slot
+  static H2D_THREAD_LOCAL int num_entries;
+
+  int slot;          ///< reused by later instances once this one is destroyed
+  unsigned serial;   ///< unique for every instance, the stale entries of a slot do not match
+  int init;
+
+  void acquire_slot();
+  void release_slot();
+  void set(int mode);
+
+  static void create_key();
+  static void free_entries(void* entries);
+};
+
 // default projection norm is H1 norm
 // FIXME: this global variable should be declared here but 
 // doing so leads to compilation problems. That's why it 
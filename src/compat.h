@@ -33,6 +33,22 @@ FILE *fmemopen (void *buf, size_t size, const char *opentype);
 # define H2D_API_USED_STL_VECTOR(__type)
 #endif
 
+//Memory barrier: tables that are filled lazily and then read without locking are
+//published only after their contents are written
+#if defined(_MSC_VER)
+# include <intrin.h>
+# define H2D_MEMORY_BARRIER() _mm_mfence()
+#else
+# define H2D_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+//Thread-local storage of plain data
+#if defined(_MSC_VER)
+# define H2D_THREAD_LOCAL __declspec(thread)
+#else
+# define H2D_THREAD_LOCAL __thread
+#endif
+
 //C99 functions
 #include "compat/c99_functions.h"
 
@@ -38,6 +38,10 @@ static double* bubble_quad_p = NULL; // diagonal vector in cholesky factorizatio
 static Quad1DStd quad1d;
 static Quad2DStd quad2d; // fixme: g_quad_2d_std
 
+/// Guards the projection matrices and ref_map_pss, which are shared by all curved
+/// elements, also of meshes in different threads.
+static pthread_mutex_t curved_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static Trf ctm;
 
 
@@ -523,6 +527,7 @@ static void ref_map_projection(Element* e, Nurbs** nurbs, int order, double2* pr
 
 void CurvMap::update_refmap_coefs(Element* e)
 {
+  pthread_mutex_lock(&curved_mutex);
   ref_map_pss.set_quad_2d(&quad2d);
   //ref_map_pss.set_active_element(e);
 
@@ -562,6 +567,7 @@ void CurvMap::update_refmap_coefs(Element* e)
 
   // calculation of new projection coefficients
   ref_map_projection(e, nurbs, order, coefs);
+  pthread_mutex_unlock(&curved_mutex);
 }
 
 
@@ -578,12 +584,12 @@ void CurvMap::get_mid_edge_points(Element* e, double2* pt, int n)
     nurbs = e->cm->nurbs;
   }
 
-  ctm = *(tran.get_ctm());
+  Trf* tr = tran.get_ctm();
   double xi_1, xi_2;
   for (int i = 0; i < n; i++)
   {
-    xi_1 = ctm.m[0] * pt[i][0] + ctm.t[0];
-    xi_2 = ctm.m[1] * pt[i][1] + ctm.t[1];
+    xi_1 = tr->m[0] * pt[i][0] + tr->t[0];
+    xi_2 = tr->m[1] * pt[i][1] + tr->t[1];
     calc_ref_map(e, nurbs, xi_1, xi_2, pt[i]);
   }
 }
@@ -47,6 +47,21 @@ void DiscreteProblem::init(WeakForm* wf_, CommonSolver* solver_)
   this->solver_default = new CommonSolverSciPyUmfpack();
   this->solver = (solver_) ? solver_ : solver_default;
   this->wf_seq = -1;
+  this->sp_seq = NULL;
+  this->struct_mat = NULL;
+  this->num_struct_created = this->num_struct_reused = 0;
+  this->struct_nnz = 0;
+  this->struct_memory = 0;
+  this->struct_time = 0.0;
+  memset(&this->newton_stats, 0, sizeof(NewtonStats));
+  this->num_threads = 1;
+  this->geom_cache_memory = 0;
+  this->cache_order_seq = -1;
+  this->static_condensation = false;
+  this->base_order_traversal = false;
+  this->cond_ndof = this->cond_ndof_full = 0;
+  this->buffer = NULL;
+  this->mat_size = 0;
 
   this->mat_sym = false;
 
@@ -92,6 +107,8 @@ DiscreteProblem::~DiscreteProblem()
     delete [] this->pss;
   }
   if (this->solver_default != NULL) delete this->solver_default;
+  for (unsigned int i = 0; i < this->geom_caches.size(); i++)
+    delete this->geom_caches[i];
 }
 
 // NOTE: This should not be called in the destructor to DiscreteProblem
@@ -186,8 +203,27 @@ void DiscreteProblem::copy(DiscreteProblem* sys)
 void DiscreteProblem::free()
 {
   this->struct_changed = this->values_changed = true;
-  memset(this->sp_seq, -1, sizeof(int) * this->wf->neq);
+  if (this->sp_seq != NULL) memset(this->sp_seq, -1, sizeof(int) * this->wf->neq);
+  this->mesh_seq.clear();
   this->wf_seq = -1;
+  this->struct_mat = NULL;
+}
+
+bool DiscreteProblem::is_up_to_date(Matrix* mat_ext)
+{
+  // check if we can reuse the matrix structure, see FeProblem::is_up_to_date()
+  if (mat_ext != struct_mat || (int) mesh_seq.size() != wf->neq) return false;
+  for (int i = 0; i < wf->neq; i++)
+    if (spaces[i]->get_seq() != sp_seq[i] || spaces[i]->get_mesh()->get_seq() != mesh_seq[i])
+      return false;
+  return wf->get_seq() == wf_seq;
+}
+
+void DiscreteProblem::set_static_condensation(bool enable)
+{
+  if (enable == static_condensation) return;
+  static_condensation = enable;
+  struct_mat = NULL; // the matrix has a different size and structure now
 }
 
 //// assembly //////////////////////////////////////////////////////////////////////////////////////
@@ -197,6 +233,250 @@ void DiscreteProblem::insert_block(Matrix *mat_ext, scalar** mat, int* iidx, int
     mat_ext->add_block(iidx, ilen, jidx, jlen, mat);
 }
 
+/// Matrix which only records the blocks added to it. Each assembling thread has one,
+/// the blocks are added to the global matrix after all threads have finished. The static
+/// condensation records the local system of a traversal state in it.
+class AsmRecMatrix : public Matrix
+{
+public:
+  AsmRecMatrix() { this->size = 0; this->complex = false; }
+
+  virtual void free_data() { blocks.clear(); idx.clear(); val.clear(); }
+  virtual void set_zero() { }
+  virtual void print() { }
+  virtual double get(int m, int n) { return 0.0; }
+  virtual void copy_into(Matrix* m) { error("AsmRecMatrix cannot be copied."); }
+
+  virtual void add(int m, int n, double v)
+  {
+    scalar sv = v, *row = &sv;
+    record(&m, 1, &n, 1, &row);
+  }
+#ifdef H2D_COMPLEX
+  virtual void add(int m, int n, cplx v)
+  {
+    scalar* row = &v;
+    record(&m, 1, &n, 1, &row);
+  }
+  virtual void add_block(int *iidx, int ilen, int *jidx, int jlen, cplx** mat)
+    { record(iidx, ilen, jidx, jlen, mat); }
+#else
+  virtual void add_block(int *iidx, int ilen, int *jidx, int jlen, double** mat)
+    { record(iidx, ilen, jidx, jlen, mat); }
+#endif
+
+  int get_num_blocks() const { return blocks.size(); }
+
+  /// Adds the recorded blocks [first, last) to the matrix 'mat'.
+  void replay(Matrix* mat, int first, int last)
+  {
+    std::vector<scalar*> rows;
+    for (int b = first; b < last; b++)
+    {
+      Block* bl = &blocks[b];
+      rows.resize(bl->ilen);
+      for (int i = 0; i < bl->ilen; i++)
+        rows[i] = &val[bl->val + i * bl->jlen];
+      mat->add_block(&idx[bl->idx], bl->ilen, &idx[bl->idx + bl->ilen], bl->jlen, &rows.front());
+    }
+  }
+
+  /// Appends the DOF numbers (rows and columns, without the Dirichlet ones) of the blocks
+  /// [first, last) to 'dofs'.
+  void get_dofs(int first, int last, std::vector<int>& dofs) const
+  {
+    for (int b = first; b < last; b++)
+    {
+      const Block* bl = &blocks[b];
+      for (int i = 0; i < bl->ilen + bl->jlen; i++)
+        if (idx[bl->idx + i] >= 0) dofs.push_back(idx[bl->idx + i]);
+    }
+  }
+
+  /// Adds the blocks [first, last) to the dense matrix 'a' stored by rows with the row
+  /// length 'lda'. The entry (m, n) goes to the row local[m] and the column local[n].
+  void add_to_dense(int first, int last, const int* local, scalar* a, int lda) const
+  {
+    for (int b = first; b < last; b++)
+    {
+      const Block* bl = &blocks[b];
+      const int* jidx = &idx[bl->idx + bl->ilen];
+      for (int i = 0; i < bl->ilen; i++)
+      {
+        int m = idx[bl->idx + i];
+        if (m < 0) continue;
+        scalar* row = a + local[m] * lda;
+        const scalar* v = &val[bl->val + i * bl->jlen];
+        for (int j = 0; j < bl->jlen; j++)
+          if (jidx[j] >= 0) row[local[jidx[j]]] += v[j];
+      }
+    }
+  }
+
+protected:
+  struct Block { int ilen, jlen, idx, val; };
+  std::vector<Block> blocks;
+  std::vector<int> idx;
+  std::vector<scalar> val;
+
+  void record(int* iidx, int ilen, int* jidx, int jlen, scalar** mat)
+  {
+    if (ilen <= 0 || jlen <= 0) return;
+    Block bl = { ilen, jlen, (int) idx.size(), (int) val.size() };
+    blocks.push_back(bl);
+    idx.insert(idx.end(), iidx, iidx + ilen);
+    idx.insert(idx.end(), jidx, jidx + jlen);
+    for (int i = 0; i < ilen; i++)
+      val.insert(val.end(), mat[i], mat[i] + jlen);
+  }
+};
+
+/// Vector which only records the values added to it, see AsmRecMatrix.
+class AsmRecVector : public Vector
+{
+public:
+  virtual void init(int n, bool is_complex = false) { this->size = n; this->complex = is_complex; }
+  virtual void set_zero() { }
+  virtual void free_data() { idx.clear(); val.clear(); }
+  virtual void print() { }
+  virtual void set(int m, double v) { error("AsmRecVector::set() is not supported."); }
+  virtual double get(int m) { return 0.0; }
+
+  virtual void add(int m, double v) { idx.push_back(m); val.push_back(v); }
+#ifdef H2D_COMPLEX
+  virtual void add(int m, cplx v) { idx.push_back(m); val.push_back(v); }
+#endif
+
+  int get_num_values() const { return idx.size(); }
+
+  /// Adds the recorded values [first, last) to the vector 'vec'.
+  void replay(Vector* vec, int first, int last)
+  {
+    for (int i = first; i < last; i++)
+      vec->add(idx[i], val[i]);
+  }
+
+  /// Appends the DOF numbers of the values [first, last) to 'dofs', see AsmRecMatrix.
+  void get_dofs(int first, int last, std::vector<int>& dofs) const
+  {
+    for (int i = first; i < last; i++)
+      if (idx[i] >= 0) dofs.push_back(idx[i]);
+  }
+
+  /// Adds the values [first, last) to the column 'col' of the dense matrix 'a', see
+  /// AsmRecMatrix::add_to_dense().
+  void add_to_dense(int first, int last, const int* local, scalar* a, int lda, int col) const
+  {
+    for (int i = first; i < last; i++)
+      if (idx[i] >= 0) a[local[idx[i]] * lda + col] += val[i];
+  }
+
+protected:
+  std::vector<int> idx;
+  std::vector<scalar> val;
+};
+
+void DiscreteProblem::create_pattern(PatternMatrix* mat, int ndof)
+{
+  TimePeriod cpu_time;
+  int neq = wf->neq;
+  mat->prealloc(ndof);
+
+  AUTOLA_CL(AsmList, al, neq);
+  AUTOLA_OR(Mesh*, meshes, neq);
+  AUTOLA_OR(bool, nat, neq);
+  AUTOLA_OR(bool, added, neq * neq);
+  std::vector<int> clique;
+  bool bnd[4];
+  EdgePos ep[4];
+
+  // init multi-mesh traversal
+  for (int i = 0; i < neq; i++)
+    meshes[i] = spaces[i]->get_mesh();
+
+  Traverse trav;
+  trav.begin(neq, meshes);
+
+  // loop through all elements
+  Element **e;
+  while ((e = trav.get_next_state(bnd, ep)) != NULL)
+  {
+    // obtain assembly lists for the element at all spaces
+    Element* e0 = NULL;
+    for (int i = 0; i < neq; i++)
+      if (e[i] != NULL)
+      {
+        if (e0 == NULL) e0 = e[i];
+        spaces[i]->get_element_assembly_list(e[i], al + i);
+      }
+    if (e0 == NULL) continue;
+
+    // the Schur complement couples all DOFs of the element which are not eliminated
+    if (static_condensation)
+    {
+      clique.clear();
+      for (int i = 0; i < neq; i++)
+        if (e[i] != NULL)
+          for (int k = 0; k < al[i].cnt; k++)
+            if (al[i].dof[k] >= 0 && cond_dof[al[i].dof[k]] >= 0)
+              clique.push_back(cond_dof[al[i].dof[k]]);
+      if (!clique.empty())
+        mat->pre_add_block(&clique[0], clique.size(), &clique[0], clique.size());
+      continue;
+    }
+
+    // register the nonzero entries of the blocks which have a volume form on the element,
+    // the same way as the forms are skipped in assemble_state()
+    memset(added, 0, sizeof(bool) * neq * neq);
+    for (unsigned int ww = 0; ww < wf->mfvol.size(); ww++)
+    {
+      WeakForm::MatrixFormVol* mfv = &wf->mfvol[ww];
+      int m = mfv->i, n = mfv->j;
+      if (e[m] == NULL || e[n] == NULL) continue;
+      if (mfv->area != H2D_ANY && !wf->is_in_area(e0->marker, mfv->area)) continue;
+      if (!added[m*neq + n])
+        mat->pre_add_block(al[m].dof, al[m].cnt, al[n].dof, al[n].cnt);
+      added[m*neq + n] = true;
+      if (mfv->sym && !added[n*neq + m])
+        mat->pre_add_block(al[n].dof, al[n].cnt, al[m].dof, al[m].cnt);
+      if (mfv->sym) added[n*neq + m] = true;
+    }
+
+    // surface forms on the boundary edges of the element
+    if (wf->mfsurf.size() == 0) continue;
+    for (unsigned int edge = 0; edge < e0->nvert; edge++)
+    {
+      if (!bnd[edge]) continue;
+      int marker = ep[edge].marker;
+      for (int i = 0; i < neq; i++)
+        if (e[i] != NULL && (nat[i] = (spaces[i]->bc_type_callback(marker) == BC_NATURAL)))
+          spaces[i]->get_edge_assembly_list(e[i], edge, al + i);
+
+      memset(added, 0, sizeof(bool) * neq * neq);
+      for (unsigned int ww = 0; ww < wf->mfsurf.size(); ww++)
+      {
+        WeakForm::MatrixFormSurf* mfs = &wf->mfsurf[ww];
+        int m = mfs->i, n = mfs->j;
+        if (e[m] == NULL || e[n] == NULL || !nat[m] || !nat[n]) continue;
+        if (mfs->area != H2D_ANY && !wf->is_in_area(marker, mfs->area)) continue;
+        if (!added[m*neq + n])
+          mat->pre_add_block(al[m].dof, al[m].cnt, al[n].dof, al[n].cnt);
+        added[m*neq + n] = true;
+      }
+    }
+  }
+
+  trav.finish();
+
+  mat->finish_pattern();
+
+  struct_nnz = mat->get_nnz();
+  struct_memory = mat->get_memory_size();
+  struct_time = cpu_time.tick().last();
+  verbose("Sparse structure: %d nonzeros, %g MB, created in %g s.", struct_nnz,
+          struct_memory / 1048576.0, struct_time);
+}
+
 void DiscreteProblem::assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ext, 
                                Vector* rhs_ext, bool rhsonly, bool is_complex)
 {
@@ -226,28 +506,34 @@ void DiscreteProblem::assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ex
       error("Mismatched mat_ext and rhs_ext vector sizes in DiscreteProblem::assemble().");
     }
   }
+  if (rhsonly && static_condensation)
+    error("The right-hand side cannot be assembled alone with the static condensation.");
 
   // Assign dof in all spaces. 
   int ndof = this->assign_dofs();
   if (ndof == 0) error("ndof = 0 in DiscreteProblem::assemble().");
   //printf("ndof = %d\n", ndof);
+
+  // With the static condensation, the global system only has the DOFs which are not
+  // eliminated.
+  int size = static_condensation ? init_condensation(ndof) : ndof;
   
   // Realloc mat_ext, dir_ext and rhs_ext if ndof changed, 
   // and clear dir_ext and rhs_ext. 
   // Do not touch the matrix if rhsonly == true. 
   if (rhsonly == false) {
-    if (mat_ext->get_size() != ndof) mat_ext->init(is_complex);
+    if (mat_ext->get_size() != size) mat_ext->init(is_complex);
   }
   if (dir_ext != NULL) {
-    if (dir_ext->get_size() != ndof) {
+    if (dir_ext->get_size() != size) {
       dir_ext->free_data();
-      dir_ext->init(ndof, is_complex);
+      dir_ext->init(size, is_complex);
     }
     else dir_ext->set_zero();
   }
-  if (rhs_ext->get_size() != ndof) {
+  if (rhs_ext->get_size() != size) {
     rhs_ext->free_data();
-    rhs_ext->init(ndof, is_complex);
+    rhs_ext->init(size, is_complex);
   }
   else rhs_ext->set_zero();
 
@@ -261,17 +547,45 @@ void DiscreteProblem::assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ex
     else u_ext.push_back(NULL);
   }
 
-  int k, m, marker;
-  std::vector<AsmList> al(wf->neq);
-  AsmList* am, * an;
   bool bnd[4];
-  std::vector<bool> nat(wf->neq), isempty(wf->neq);
   EdgePos ep[4];
   reset_warn_order();
 
+  // The cached integration orders are keyed by form pointers, which
+  // are not valid anymore if forms were added to the weak form.
+  if (cache_order_seq != wf->get_seq())
+  {
+    cache_order.clear();
+    cache_order_seq = wf->get_seq();
+  }
+
+  // A PatternMatrix keeps its structure in set_zero(), so the structure is created
+  // only if the spaces or the weak form have changed since the last assembling.
+  // Other matrices are always assembled from scratch.
   if (rhsonly == false) {
-    trace("Creating matrix sparse structure...");
-    mat_ext->free_data();
+    PatternMatrix* pat = dynamic_cast<PatternMatrix*>(mat_ext);
+    if (pat != NULL && pat->has_pattern() && is_up_to_date(mat_ext))
+    {
+      verbose("Reusing matrix sparse structure.");
+      pat->set_zero();
+      num_struct_reused++;
+    }
+    else
+    {
+      trace("Creating matrix sparse structure...");
+      mat_ext->free_data();
+      if (pat != NULL) create_pattern(pat, size);
+      num_struct_created++;
+
+      struct_mat = mat_ext;
+      mesh_seq.resize(wf->neq);
+      for (int i = 0; i < wf->neq; i++)
+      {
+        sp_seq[i] = spaces[i]->get_seq();
+        mesh_seq[i] = spaces[i]->get_mesh()->get_seq();
+      }
+      wf_seq = wf->get_seq();
+    }
   }
   else trace("Reusing matrix sparse structure...");
 
@@ -280,16 +594,8 @@ void DiscreteProblem::assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ex
   TimePeriod cpu_time;
 
   // create slave pss's for test functions, init quadrature points
-  std::vector<PrecalcShapeset*> spss(wf->neq, static_cast<PrecalcShapeset*>(NULL));
-  PrecalcShapeset *fu, *fv;
-  std::vector<RefMap> refmap(wf->neq);
-  for (int i = 0; i < wf->neq; i++)
-  {
-    spss[i] = new PrecalcShapeset(pss[i]);
-    pss [i]->set_quad_2d(&g_quad_2d_std);
-    spss[i]->set_quad_2d(&g_quad_2d_std);
-    refmap[i].set_quad_2d(&g_quad_2d_std);
-  }
+  AsmContext ctx;
+  init_context(ctx, u_ext);
 
   // initialize buffer
   buffer = NULL;
@@ -301,320 +607,910 @@ void DiscreteProblem::assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ex
   // Returns assembling stages with correct meshes, ext_functions that are needed in a particular stage.
   wf->get_stages(spaces, u_ext, stages, rhsonly);
 
-  // Loop through all assembling stages -- the purpose of this is increased performance
-  // in multi-mesh calculations, where, e.g., only the right hand side uses two meshes.
-  // In such a case, the matrix forms are assembled over one mesh, and only the rhs
-  // traverses through the union mesh. On the other hand, if you don't use multi-mesh
-  // at all, there will always be only one stage in which all forms are assembled as usual.
-  Traverse trav;
-  for (unsigned int ss = 0; ss < stages.size(); ss++)
+  // Forms with external functions cannot be assembled in parallel, since we have
+  // no way of duplicating the external functions for each thread.
+  bool parallel = (num_threads > 1);
+  for (unsigned int ss = 0; parallel && ss < stages.size(); ss++)
   {
     WeakForm::Stage* s = &stages[ss];
-    // Fills the solution and test functions into the stage s.
-    for (unsigned int i = 0; i < s->idx.size(); i++)
-			s->fns[i] = pss[s->idx[i]];
-    for (unsigned int i = 0; i < s->ext.size(); i++)
-			s->ext[i]->set_quad_2d(&g_quad_2d_std);
-    // Tests whether the meshes in this stage are compatible and initializes the traverse process.
-    trav.begin(s->meshes.size(), &(s->meshes.front()), &(s->fns.front()));
+    for (unsigned int i = 0; i < s->mfvol.size(); i++)  if (s->mfvol[i]->ext.size())  parallel = false;
+    for (unsigned int i = 0; i < s->mfsurf.size(); i++) if (s->mfsurf[i]->ext.size()) parallel = false;
+    for (unsigned int i = 0; i < s->vfvol.size(); i++)  if (s->vfvol[i]->ext.size())  parallel = false;
+    for (unsigned int i = 0; i < s->vfsurf.size(); i++) if (s->vfsurf[i]->ext.size()) parallel = false;
+    if (!parallel) warn("Weak forms with external functions are assembled by one thread only.");
+  }
 
-    // Assemble one stage.
-    Element** e;
-    // See Traverse::get_next_state for explanation.
-    while ((e = trav.get_next_state(bnd, ep)) != NULL)
+  if (parallel)
+    assemble_parallel(init_vec, stages, ctx, mat_ext, dir_ext, rhs_ext, rhsonly);
+  else
+  {
+    // Loop through all assembling stages -- the purpose of this is increased performance
+    // in multi-mesh calculations, where, e.g., only the right hand side uses two meshes.
+    // In such a case, the matrix forms are assembled over one mesh, and only the rhs
+    // traverses through the union mesh. On the other hand, if you don't use multi-mesh
+    // at all, there will always be only one stage in which all forms are assembled as usual.
+    // Reuse the element geometry of the previous assemblings if enabled.
+    for (int i = 0; i < wf->neq; i++)
+      ctx.refmap[i].set_geom_cache(acquire_geom_cache(i));
+
+    // The static condensation records the local system of each state first.
+    AsmRecMatrix rec_mat;
+    AsmRecVector rec_dir, rec_rhs;
+
+    Traverse trav;
+    trav.set_base_order(base_order_traversal);
+    for (unsigned int ss = 0; ss < stages.size(); ss++)
     {
-      // Checking if at least on one mesh in this stage the element over which we are assembling is used.
-      // If not, we continue with another state.
-      Element* e0 = NULL;
+      WeakForm::Stage* s = &stages[ss];
+      // Fills the solution and test functions into the stage s.
       for (unsigned int i = 0; i < s->idx.size(); i++)
-      if ((e0 = e[i]) != NULL) break;
-      if (e0 == NULL) continue;
+        s->fns[i] = pss[s->idx[i]];
+      for (unsigned int i = 0; i < s->ext.size(); i++)
+        s->ext[i]->set_quad_2d(&g_quad_2d_std);
+      // Tests whether the meshes in this stage are compatible and initializes the traverse process.
+      trav.begin(s->meshes.size(), &(s->meshes.front()), &(s->fns.front()));
+
+      // Assemble one stage.
+      Element** e;
+      // See Traverse::get_next_state for explanation.
+      while ((e = trav.get_next_state(bnd, ep)) != NULL)
+      {
+        // Checking if at least on one mesh in this stage the element over which we are assembling is used.
+        // If not, we continue with another state.
+        Element* e0 = NULL;
+        for (unsigned int i = 0; i < s->idx.size(); i++)
+          if ((e0 = e[i]) != NULL) break;
+        if (e0 == NULL) continue;
 
-      // Set maximum integration order for use in integrals, see limit_order().
-      update_limit_table(e0->get_mode());
+        // Set maximum integration order for use in integrals, see limit_order().
+        update_limit_table(e0->get_mode());
 
-      // Obtain assembly lists for the element at all spaces of the stage, set appropriate mode for each pss.
-      // NOTE: Active elements and transformations for external functions (including the solutions from previous
-      // Newton's iteration) as well as basis functions (master PrecalcShapesets) have already been set in 
-      // trav.get_next_state(...).
-      std::fill(isempty.begin(), isempty.end(), false);
-      for (unsigned int i = 0; i < s->idx.size(); i++)
-      {
-        int j = s->idx[i];
-        if (e[i] == NULL) { isempty[j] = true; continue; }
-        // FIXME: Do not retrieve assembly list again if the element has not changed.
-        spaces[j]->get_element_assembly_list(e[i], &al[j]);
-
-	// Set active element to all test function PrecalcShapesets.
-        spss[j]->set_active_element(e[i]);
-	// Set the subelement transformation as it is set on all the appropriate solution function PrecalcShapeset.
-        spss[j]->set_master_transform();
-	// Set the active element to the reference mapping.
-        refmap[j].set_active_element(e[i]);
-	// Important : the reference mapping gets the same subelement transformation as the
-	// appropriate PrecalcShapeset (~test function). This is used in eval_form functions.
-        refmap[j].force_transform(pss[j]->get_transform(), pss[j]->get_ctm());
+        if (static_condensation)
+        {
+          assemble_state(s, e, bnd, ep, trav.get_base(), ctx, &rec_mat,
+                         dir_ext != NULL ? &rec_dir : NULL, &rec_rhs, rhsonly);
+          condense_state(&rec_mat, 0, rec_mat.get_num_blocks(), &rec_dir, 0, rec_dir.get_num_values(),
+                         &rec_rhs, 0, rec_rhs.get_num_values(), mat_ext, dir_ext, rhs_ext);
+          rec_mat.free_data();
+          rec_dir.free_data();
+          rec_rhs.free_data();
+        }
+        else
+          assemble_state(s, e, bnd, ep, trav.get_base(), ctx, mat_ext, dir_ext, rhs_ext, rhsonly);
       }
-      // Boundary marker.
-      marker = e0->marker;
+      trav.finish();
+    }
+  }
+
+  verbose("Stiffness matrix assembled (stages: %d)", stages.size());
+  if (static_condensation)
+    verbose("Static condensation: %d of %d DOFs eliminated in %d states.", ndof - size, ndof,
+            (int) cond_states.size());
+  report_time("Stiffness matrix assembled in %g s", cpu_time.tick().last());
+  free_context(ctx);
+  for (int i = 0; i < wf->neq; i++) { 
+    if (u_ext[i] != NULL) delete u_ext[i];
+  }
+  delete [] buffer;
+
+  if (rhsonly == false) values_changed = true;
+}
+
+void DiscreteProblem::init_context(AsmContext& ctx, Tuple<Solution*> u_ext)
+{
+  ctx.u_ext = u_ext;
+  ctx.spss.resize(wf->neq);
+  ctx.refmap = new RefMap[wf->neq];
+  ctx.al.resize(wf->neq);
+  ctx.nat.resize(wf->neq);
+  ctx.isempty.resize(wf->neq);
+  for (int i = 0; i < wf->neq; i++)
+  {
+    ctx.spss[i] = new PrecalcShapeset(pss[i]);
+    pss [i]->set_quad_2d(&g_quad_2d_std);
+    ctx.spss[i]->set_quad_2d(&g_quad_2d_std);
+    ctx.refmap[i].set_quad_2d(&g_quad_2d_std);
+  }
+}
+
+void DiscreteProblem::free_context(AsmContext& ctx)
+{
+  for (int i = 0; i < wf->neq; i++)
+    delete ctx.spss[i];
+  delete [] ctx.refmap;
+}
 
-      init_cache();
-      //// assemble volume matrix forms //////////////////////////////////////
-      for (unsigned int ww = 0; ww < s->mfvol.size(); ww++)
+void DiscreteProblem::assemble_state(WeakForm::Stage* s, Element** e, bool* bnd, EdgePos* ep,
+                                     Element* base, AsmContext& ctx, Matrix* mat_ext,
+                                     Vector* dir_ext, Vector* rhs_ext, bool rhsonly)
+{
+  int m, n, marker;
+  AsmList* am, * an;
+  PrecalcShapeset *fu, *fv;
+  std::vector<AsmList>& al = ctx.al;
+  std::vector<PrecalcShapeset*>& spss = ctx.spss;
+  RefMap* refmap = ctx.refmap;
+  Tuple<Solution*>& u_ext = ctx.u_ext;
+
+  Element* e0 = NULL;
+  for (unsigned int i = 0; i < s->idx.size(); i++)
+    if ((e0 = e[i]) != NULL) break;
+
+  // Obtain assembly lists for the element at all spaces of the stage, set appropriate mode for each pss.
+  // NOTE: Active elements and transformations for external functions (including the solutions from previous
+  // Newton's iteration) as well as basis functions (master PrecalcShapesets) have already been set in 
+  // trav.get_next_state(...).
+  std::fill(ctx.isempty.begin(), ctx.isempty.end(), false);
+  for (unsigned int i = 0; i < s->idx.size(); i++)
+  {
+    int j = s->idx[i];
+    if (e[i] == NULL) { ctx.isempty[j] = true; continue; }
+    // FIXME: Do not retrieve assembly list again if the element has not changed.
+    spaces[j]->get_element_assembly_list(e[i], &al[j]);
+
+    // Set active element to all test function PrecalcShapesets.
+    spss[j]->set_active_element(e[i]);
+    // Set the subelement transformation as it is set on all the appropriate solution function PrecalcShapeset.
+    spss[j]->set_master_transform();
+    // Set the active element to the reference mapping.
+    refmap[j].set_active_element(e[i]);
+    // Important : the reference mapping gets the same subelement transformation as the
+    // appropriate PrecalcShapeset (~test function). This is used in eval_form functions.
+    refmap[j].force_transform(pss[j]->get_transform(), pss[j]->get_ctm());
+  }
+  // Boundary marker.
+  marker = e0->marker;
+
+  init_cache();
+  //// assemble volume matrix forms //////////////////////////////////////
+  for (unsigned int ww = 0; ww < s->mfvol.size(); ww++)
+  {
+    WeakForm::MatrixFormVol* mfv = s->mfvol[ww];
+    if (ctx.isempty[mfv->i] || ctx.isempty[mfv->j]) continue;
+    if (mfv->area != H2D_ANY && !wf->is_in_area(marker, mfv->area)) continue;
+    m = mfv->i;  fv = spss[m];  am = &al[m];
+    n = mfv->j;  fu = pss[n];   an = &al[n];
+    bool tra = (m != n) && (mfv->sym != 0);
+    bool sym = (m == n) && (mfv->sym == 1);
+
+    // assemble the local stiffness matrix for the form mfv
+    scalar **local_stiffness_matrix = get_matrix_buffer(std::max(am->cnt, an->cnt));
+    if (mfv->fn_block != NULL || mfv->std_type != H2D_STD_NONE) // batched or standard form: the whole block at once
+    {
+      if (rhsonly == false || dir_ext != NULL)
       {
-        WeakForm::MatrixFormVol* mfv = s->mfvol[ww];
-        if (isempty[mfv->i] || isempty[mfv->j]) continue;
-        if (mfv->area != H2D_ANY && !wf->is_in_area(marker, mfv->area)) continue;
-        m = mfv->i;  fv = spss[m];  am = &al[m];
-        n = mfv->j;  fu = pss[n];   an = &al[n];
-        bool tra = (m != n) && (mfv->sym != 0);
-        bool sym = (m == n) && (mfv->sym == 1);
-
-        // assemble the local stiffness matrix for the form mfv
-        scalar **local_stiffness_matrix = get_matrix_buffer(std::max(am->cnt, an->cnt));
+        eval_form_block(mfv, u_ext, fu, fv, &refmap[n], &refmap[m], an, am, local_stiffness_matrix);
         for (int i = 0; i < am->cnt; i++)
         {
           if (!tra && am->dof[i] < 0) continue;
-          fv->set_active_shape(am->idx[i]);
-
-          if (!sym) // unsymmetric block
-          {
-            for (int j = 0; j < an->cnt; j++) {
-              fu->set_active_shape(an->idx[j]);
-              if (an->dof[j] < 0) {
-                if (dir_ext != NULL) {
-                  scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
-                  dir_ext->add(am->dof[i], val);
-                } 
-              }
-              else if (rhsonly == false) {
+          for (int j = 0; j < an->cnt; j++) {
+            local_stiffness_matrix[i][j] *= an->coef[j] * am->coef[i];
+            if (an->dof[j] < 0 && dir_ext != NULL)
+              dir_ext->add(am->dof[i], local_stiffness_matrix[i][j]);
+          }
+        }
+      }
+    }
+    else
+    {
+      for (int i = 0; i < am->cnt; i++)
+      {
+        if (!tra && am->dof[i] < 0) continue;
+        fv->set_active_shape(am->idx[i]);
+
+        if (!sym) // unsymmetric block
+        {
+          for (int j = 0; j < an->cnt; j++) {
+            fu->set_active_shape(an->idx[j]);
+            if (an->dof[j] < 0) {
+              if (dir_ext != NULL) {
                 scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
-                local_stiffness_matrix[i][j] = val;
-              }
+                dir_ext->add(am->dof[i], val);
+              } 
+            }
+            else if (rhsonly == false) {
+              scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
+              local_stiffness_matrix[i][j] = val;
             }
           }
-          else // symmetric block
-          {
-            for (int j = 0; j < an->cnt; j++) {
-              if (j < i && an->dof[j] >= 0) continue;
-              fu->set_active_shape(an->idx[j]);
-              if (an->dof[j] < 0) {
-                if (dir_ext != NULL) {
-                  scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
-                  dir_ext->add(am->dof[i], val);
-                }
-              } 
-              else if (rhsonly == false) {
+        }
+        else // symmetric block
+        {
+          for (int j = 0; j < an->cnt; j++) {
+            if (j < i && an->dof[j] >= 0) continue;
+            fu->set_active_shape(an->idx[j]);
+            if (an->dof[j] < 0) {
+              if (dir_ext != NULL) {
                 scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
-                local_stiffness_matrix[i][j] = local_stiffness_matrix[j][i] = val;
+                dir_ext->add(am->dof[i], val);
               }
+            } 
+            else if (rhsonly == false) {
+              scalar val = eval_form(mfv, u_ext, fu, fv, &refmap[n], &refmap[m]) * an->coef[j] * am->coef[i];
+              local_stiffness_matrix[i][j] = local_stiffness_matrix[j][i] = val;
             }
           }
         }
+      }
+    }
 
-        // insert the local stiffness matrix into the global one
-        if (rhsonly == false) {
-          insert_block(mat_ext, local_stiffness_matrix, am->dof, an->dof, am->cnt, an->cnt);
-        }
+    // insert the local stiffness matrix into the global one
+    if (rhsonly == false) {
+      insert_block(mat_ext, local_stiffness_matrix, am->dof, an->dof, am->cnt, an->cnt);
+    }
 
-        // insert also the off-diagonal (anti-)symmetric block, if required
-        if (tra)
-        {
-          if (mfv->sym < 0) chsgn(local_stiffness_matrix, am->cnt, an->cnt);
-          transpose(local_stiffness_matrix, am->cnt, an->cnt);
-          if (rhsonly == false) {
-            insert_block(mat_ext, local_stiffness_matrix, an->dof, am->dof, an->cnt, am->cnt);
-          }
+    // insert also the off-diagonal (anti-)symmetric block, if required
+    if (tra)
+    {
+      if (mfv->sym < 0) chsgn(local_stiffness_matrix, am->cnt, an->cnt);
+      transpose(local_stiffness_matrix, am->cnt, an->cnt);
+      if (rhsonly == false) {
+        insert_block(mat_ext, local_stiffness_matrix, an->dof, am->dof, an->cnt, am->cnt);
+      }
 
-          // we also need to take care of the RHS...
-          for (int j = 0; j < am->cnt; j++) {
-            if (am->dof[j] < 0) {
-              for (int i = 0; i < an->cnt; i++) {
-                if (an->dof[i] >= 0) {
-                  if (dir_ext != NULL) dir_ext->add(an->dof[i], local_stiffness_matrix[i][j]);
-                }
-              }
+      // we also need to take care of the RHS...
+      for (int j = 0; j < am->cnt; j++) {
+        if (am->dof[j] < 0) {
+          for (int i = 0; i < an->cnt; i++) {
+            if (an->dof[i] >= 0) {
+              if (dir_ext != NULL) dir_ext->add(an->dof[i], local_stiffness_matrix[i][j]);
             }
           }
         }
       }
+    }
+  }
 
-      //// assemble volume linear forms ////////////////////////////////////////
-      for (unsigned int ww = 0; ww < s->vfvol.size(); ww++)
-      {
-        WeakForm::VectorFormVol* vfv = s->vfvol[ww];
-        if (isempty[vfv->i]) continue;
-        if (vfv->area != H2D_ANY && !wf->is_in_area(marker, vfv->area)) continue;
-        m = vfv->i;  fv = spss[m];  am = &al[m];
+  //// assemble volume linear forms ////////////////////////////////////////
+  for (unsigned int ww = 0; ww < s->vfvol.size(); ww++)
+  {
+    WeakForm::VectorFormVol* vfv = s->vfvol[ww];
+    if (ctx.isempty[vfv->i]) continue;
+    if (vfv->area != H2D_ANY && !wf->is_in_area(marker, vfv->area)) continue;
+    m = vfv->i;  fv = spss[m];  am = &al[m];
 
-        for (int i = 0; i < am->cnt; i++)
-        {
-          if (am->dof[i] < 0) continue;
-          fv->set_active_shape(am->idx[i]);
-          scalar val = eval_form(vfv, u_ext, fv, &refmap[m]) * am->coef[i];
-          rhs_ext->add(am->dof[i], val);
-        }
-      }
+    for (int i = 0; i < am->cnt; i++)
+    {
+      if (am->dof[i] < 0) continue;
+      fv->set_active_shape(am->idx[i]);
+      scalar val = eval_form(vfv, u_ext, fv, &refmap[m]) * am->coef[i];
+      rhs_ext->add(am->dof[i], val);
+    }
+  }
 
 
-      // assemble surface integrals now: loop through boundary edges of the element
-      for (unsigned int edge = 0; edge < e0->nvert; edge++)
-      {
-        if (!bnd[edge]) continue;
-        marker = ep[edge].marker;
-
-        // obtain the list of shape functions which are nonzero on this edge
-        for (unsigned int i = 0; i < s->idx.size(); i++) {
-          if (e[i] == NULL) continue;
-          int j = s->idx[i];
-          if ((nat[j] = (spaces[j]->bc_type_callback(marker) == BC_NATURAL)))
-            spaces[j]->get_edge_assembly_list(e[i], edge, &al[j]);
-        }
+  // assemble surface integrals now: loop through boundary edges of the element
+  for (unsigned int edge = 0; edge < e0->nvert; edge++)
+  {
+    if (!bnd[edge]) continue;
+    marker = ep[edge].marker;
+
+    // obtain the list of shape functions which are nonzero on this edge
+    for (unsigned int i = 0; i < s->idx.size(); i++) {
+      if (e[i] == NULL) continue;
+      int j = s->idx[i];
+      if ((ctx.nat[j] = (spaces[j]->bc_type_callback(marker) == BC_NATURAL)))
+        spaces[j]->get_edge_assembly_list(e[i], edge, &al[j]);
+    }
 
-        // assemble surface matrix forms ///////////////////////////////////
-        for (unsigned int ww = 0; ww < s->mfsurf.size(); ww++)
+    // assemble surface matrix forms ///////////////////////////////////
+    for (unsigned int ww = 0; ww < s->mfsurf.size(); ww++)
+    {
+      WeakForm::MatrixFormSurf* mfs = s->mfsurf[ww];
+      if (ctx.isempty[mfs->i] || ctx.isempty[mfs->j]) continue;
+      if (mfs->area != H2D_ANY && !wf->is_in_area(marker, mfs->area)) continue;
+      m = mfs->i;  fv = spss[m];  am = &al[m];
+      n = mfs->j;  fu = pss[n];   an = &al[n];
+
+      if (!ctx.nat[m] || !ctx.nat[n]) continue;
+      ep[edge].base = base;
+      ep[edge].space_v = spaces[m];
+      ep[edge].space_u = spaces[n];
+
+      scalar **local_stiffness_matrix = get_matrix_buffer(std::max(am->cnt, an->cnt));
+      for (int i = 0; i < am->cnt; i++)
+      {
+        if (am->dof[i] < 0) continue;
+        fv->set_active_shape(am->idx[i]);
+        for (int j = 0; j < an->cnt; j++)
         {
-          WeakForm::MatrixFormSurf* mfs = s->mfsurf[ww];
-          if (isempty[mfs->i] || isempty[mfs->j]) continue;
-          if (mfs->area != H2D_ANY && !wf->is_in_area(marker, mfs->area)) continue;
-          m = mfs->i;  fv = spss[m];  am = &al[m];
-          n = mfs->j;  fu = pss[n];   an = &al[n];
-
-          if (!nat[m] || !nat[n]) continue;
-          ep[edge].base = trav.get_base();
-          ep[edge].space_v = spaces[m];
-          ep[edge].space_u = spaces[n];
-
-          scalar **local_stiffness_matrix = get_matrix_buffer(std::max(am->cnt, an->cnt));
-          for (int i = 0; i < am->cnt; i++)
-          {
-            if (am->dof[i] < 0) continue;
-            fv->set_active_shape(am->idx[i]);
-            for (int j = 0; j < an->cnt; j++)
-            {
-              fu->set_active_shape(an->idx[j]);
-              if (an->dof[j] < 0) {
-                if (dir_ext != NULL) {
-                  scalar val = eval_form(mfs, u_ext, fu, fv, &refmap[n], &refmap[m], &(ep[edge])) 
-                               * an->coef[j] * am->coef[i];
-                  dir_ext->add(am->dof[i], val);
-                }
-              }
-              else if (rhsonly == false) {
-                scalar val = eval_form(mfs, u_ext, fu, fv, &refmap[n], &refmap[m], &(ep[edge])) 
-                             * an->coef[j] * am->coef[i];
-                local_stiffness_matrix[i][j] = val;
-              } 
+          fu->set_active_shape(an->idx[j]);
+          if (an->dof[j] < 0) {
+            if (dir_ext != NULL) {
+              scalar val = eval_form(mfs, u_ext, fu, fv, &refmap[n], &refmap[m], &(ep[edge])) 
+                           * an->coef[j] * am->coef[i];
+              dir_ext->add(am->dof[i], val);
             }
           }
-          if (rhsonly == false) {
-            insert_block(mat_ext, local_stiffness_matrix, am->dof, an->dof, am->cnt, an->cnt);
-          }
-        }
-
-        // assemble surface linear forms /////////////////////////////////////
-        for (unsigned int ww = 0; ww < s->vfsurf.size(); ww++)
-        {
-          WeakForm::VectorFormSurf* vfs = s->vfsurf[ww];
-          if (isempty[vfs->i]) continue;
-          if (vfs->area != H2D_ANY && !wf->is_in_area(marker, vfs->area)) continue;
-          m = vfs->i;  fv = spss[m];  am = &al[m];
-
-          if (!nat[m]) continue;
-          ep[edge].base = trav.get_base();
-          ep[edge].space_v = spaces[m];
-
-          for (int i = 0; i < am->cnt; i++)
-          {
-            if (am->dof[i] < 0) continue;
-            fv->set_active_shape(am->idx[i]);
-            scalar val = eval_form(vfs, u_ext, fv, &refmap[m], &(ep[edge])) * am->coef[i];
-            rhs_ext->add(am->dof[i], val);
-          }
+          else if (rhsonly == false) {
+            scalar val = eval_form(mfs, u_ext, fu, fv, &refmap[n], &refmap[m], &(ep[edge])) 
+                         * an->coef[j] * am->coef[i];
+            local_stiffness_matrix[i][j] = val;
+          } 
         }
       }
-      delete_cache();
+      if (rhsonly == false) {
+        insert_block(mat_ext, local_stiffness_matrix, am->dof, an->dof, am->cnt, an->cnt);
+      }
     }
-    trav.finish();
-  }
 
-  verbose("Stiffness matrix assembled (stages: %d)", stages.size());
-  report_time("Stiffness matrix assembled in %g s", cpu_time.tick().last());
-  for (int i = 0; i < wf->neq; i++) { 
-    delete spss[i];
-    if (u_ext[i] != NULL) delete u_ext[i];
-  }
-  delete [] buffer;
+    // assemble surface linear forms /////////////////////////////////////
+    for (unsigned int ww = 0; ww < s->vfsurf.size(); ww++)
+    {
+      WeakForm::VectorFormSurf* vfs = s->vfsurf[ww];
+      if (ctx.isempty[vfs->i]) continue;
+      if (vfs->area != H2D_ANY && !wf->is_in_area(marker, vfs->area)) continue;
+      m = vfs->i;  fv = spss[m];  am = &al[m];
 
-  if (rhsonly == false) values_changed = true;
+      if (!ctx.nat[m]) continue;
+      ep[edge].base = base;
+      ep[edge].space_v = spaces[m];
+
+      for (int i = 0; i < am->cnt; i++)
+      {
+        if (am->dof[i] < 0) continue;
+        fv->set_active_shape(am->idx[i]);
+        scalar val = eval_form(vfs, u_ext, fv, &refmap[m], &(ep[edge])) * am->coef[i];
+        rhs_ext->add(am->dof[i], val);
+      }
+    }
+  }
+  delete_cache();
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//// geometry cache ////////////////////////////////////////////////////////////////////////////////
 
-// Initialize integration order for external functions
-ExtData<Ord>* DiscreteProblem::init_ext_fns_ord(std::vector<MeshFunction *> &ext)
+void DiscreteProblem::set_geom_cache(size_t max_memory)
 {
-  ExtData<Ord>* fake_ext = new ExtData<Ord>;
-  fake_ext->nf = ext.size();
-  Func<Ord>** fake_ext_fn = new Func<Ord>*[fake_ext->nf];
-  for (int i = 0; i < fake_ext->nf; i++)
-    fake_ext_fn[i] = init_fn_ord(ext[i]->get_fn_order());
-  fake_ext->fn = fake_ext_fn;
-
-  return fake_ext;
+  geom_cache_memory = max_memory;
+  for (unsigned int i = 0; i < geom_caches.size(); i++)
+    delete geom_caches[i];
+  geom_caches.clear();
 }
 
-// Initialize integration order on a given edge for external functions
-ExtData<Ord>* DiscreteProblem::init_ext_fns_ord(std::vector<MeshFunction *> &ext, int edge)
+GeomCache* DiscreteProblem::get_geom_cache(int i) const
 {
-  ExtData<Ord>* fake_ext = new ExtData<Ord>;
-  fake_ext->nf = ext.size();
-  Func<Ord>** fake_ext_fn = new Func<Ord>*[fake_ext->nf];
-  for (int i = 0; i < fake_ext->nf; i++)
-    fake_ext_fn[i] = init_fn_ord(ext[i]->get_edge_fn_order(edge));
-  fake_ext->fn = fake_ext_fn;
-  
-  return fake_ext;
+  Mesh* mesh = spaces[i]->get_mesh();
+  for (unsigned int k = 0; k < geom_caches.size(); k++)
+    if (geom_caches[k]->get_mesh() == mesh) return geom_caches[k];
+  return NULL;
 }
 
-// Initialize external functions (obtain values, derivatives,...)
-ExtData<scalar>* DiscreteProblem::init_ext_fns(std::vector<MeshFunction *> &ext, RefMap *rm, const int order)
+GeomCache* DiscreteProblem::acquire_geom_cache(int i)
 {
-  ExtData<scalar>* ext_data = new ExtData<scalar>;
-  Func<scalar>** ext_fn = new Func<scalar>*[ext.size()];
-  for (unsigned int i = 0; i < ext.size(); i++) {
-    ext_fn[i] = init_fn(ext[i], rm, order);
+  if (geom_cache_memory == 0) return NULL;
+  GeomCache* cache = get_geom_cache(i);
+  if (cache == NULL)
+  {
+    cache = new GeomCache(spaces[i]->get_mesh(), geom_cache_memory, &g_quad_2d_std);
+    geom_caches.push_back(cache);
   }
-  ext_data->nf = ext.size();
-  ext_data->fn = ext_fn;
-
-  return ext_data;
+  cache->validate();
+  return cache;
 }
 
-// Initialize shape function values and derivatives (fill in the cache)
-Func<double>* DiscreteProblem::get_fn(PrecalcShapeset *fu, RefMap *rm, const int order)
-{
-  Key key(256 - fu->get_active_shape(), order, fu->get_transform(), fu->get_shapeset()->get_id());
-  if (cache_fn[key] == NULL)
-    cache_fn[key] = init_fn(fu, rm, order);
-
-  return cache_fn[key];
-}
+//// multithreaded assembling //////////////////////////////////////////////////////////////////////
 
-// Caching transformed values
-void DiscreteProblem::init_cache()
+void DiscreteProblem::set_num_threads(int num_threads)
 {
-  for (int i = 0; i < g_max_quad + 1 + 4 * g_max_quad + 4; i++)
-  {
-    cache_e[i] = NULL;
-    cache_jwt[i] = NULL;
-  }
+  if (num_threads < 1) error("The number of assembling threads must be at least one.");
+  this->num_threads = num_threads;
 }
 
-void DiscreteProblem::delete_cache()
+/// Traversal state recorded by the main thread, to be assembled by any of the threads.
+struct DiscreteProblem::AsmState
 {
-  for (int i = 0; i < g_max_quad + 1 + 4 * g_max_quad + 4; i++)
-  {
+  int stage, mode;
+  int fn;          ///< offset of the elements and sub-element transforms in AsmStateList
+  Element* base;
+  bool bnd[4];
+  EdgePos ep[4];
+};
+
+struct DiscreteProblem::AsmStateList
+{
+  std::vector<AsmState> states;
+  std::vector<Element*> elems;
+  std::vector<uint64_t> subs;
+
+  std::vector<int> todo;          ///< states of the mode being assembled
+  int mode;                       ///< the mode of the states in 'todo'
+  int next;                       ///< first state of 'todo' not taken by a thread yet
+  pthread_mutex_t lock;
+
+  std::vector<int> owner;         ///< the thread which assembled the state
+  std::vector<int> segment;       ///< index of the state in the records of the owner
+};
+
+struct DiscreteProblem::AsmThread
+{
+  int id;
+  DiscreteProblem* dp;            ///< worker copy of the problem, has its own pss and caches
+  AsmContext ctx;
+  std::vector<WeakForm::Stage> stages;
+  AsmStateList* list;
+  bool rhsonly, has_dir;
+
+  AsmRecMatrix mat;
+  AsmRecVector dir, rhs;
+  std::vector<int> seg_mat, seg_dir, seg_rhs;
+};
+
+DiscreteProblem* DiscreteProblem::create_worker()
+{
+  // A worker is set up by init() like any other problem with the same weak form. It shares
+  // the spaces, whose DOFs are already assigned, and only owns its precalculated shapesets,
+  // buffers and caches.
+  DiscreteProblem* dp = new DiscreteProblem(wf);
+  dp->spaces = spaces;
+  dp->have_spaces = true;
+  dp->mat_sym = mat_sym;
+  dp->cache_order = cache_order;
+  dp->cache_order_seq = cache_order_seq;
+  dp->pss = new PrecalcShapeset*[wf->neq];
+  for (int i = 0; i < wf->neq; i++)
+    dp->pss[i] = new PrecalcShapeset(spaces[i]->get_shapeset());
+  dp->num_user_pss = wf->neq;
+  return dp;
+}
+
+void* DiscreteProblem::assemble_thread(void* data)
+{
+  AsmThread* t = (AsmThread*) data;
+  AsmStateList* list = t->list;
+  const int chunk = 16;
+  int ntodo = list->todo.size();
+
+  // the modes of the shapesets and the order limiting tables are kept for every thread
+  update_limit_table(list->mode);
+  for (int i = 0; i < t->dp->wf->neq; i++)
+    t->dp->spaces[i]->get_shapeset()->set_mode(list->mode);
+
+  while (1)
+  {
+    pthread_mutex_lock(&list->lock);
+    int first = list->next;
+    list->next += chunk;
+    pthread_mutex_unlock(&list->lock);
+    if (first >= ntodo) break;
+
+    for (int k = first; k < std::min(first + chunk, ntodo); k++)
+    {
+      int st = list->todo[k];
+      AsmState* as = &list->states[st];
+      WeakForm::Stage* s = &t->stages[as->stage];
+      Element** e = &list->elems[as->fn];
+      uint64_t* sub = &list->subs[as->fn];
+
+      // restore the state as Traverse::get_next_state() left it in the main thread
+      for (unsigned int i = 0; i < s->fns.size(); i++)
+      {
+        if (e[i] == NULL) continue;
+        s->fns[i]->set_active_element(e[i]);
+        s->fns[i]->set_transform(sub[i]);
+      }
+      bool bnd[4];
+      EdgePos ep[4];
+      memcpy(bnd, as->bnd, sizeof(bnd));
+      memcpy(ep, as->ep, sizeof(ep));
+
+      list->owner[st] = t->id;
+      list->segment[st] = t->seg_mat.size();
+      t->seg_mat.push_back(t->mat.get_num_blocks());
+      t->seg_dir.push_back(t->dir.get_num_values());
+      t->seg_rhs.push_back(t->rhs.get_num_values());
+
+      t->dp->assemble_state(s, e, bnd, ep, as->base, t->ctx, &t->mat, t->has_dir ? &t->dir : NULL,
+                            &t->rhs, t->rhsonly);
+    }
+  }
+  return NULL;
+}
+
+void DiscreteProblem::assemble_parallel(Vector* init_vec, std::vector<WeakForm::Stage>& stages,
+                                        AsmContext& ctx, Matrix* mat_ext, Vector* dir_ext,
+                                        Vector* rhs_ext, bool rhsonly)
+{
+  // Traverse the meshes in the main thread and record all states. The threads then
+  // only restore the active elements and sub-element transforms of the state.
+  AsmStateList list;
+  bool bnd[4];
+  EdgePos ep[4];
+  Traverse trav;
+  trav.set_base_order(base_order_traversal);
+  for (unsigned int ss = 0; ss < stages.size(); ss++)
+  {
+    WeakForm::Stage* s = &stages[ss];
+    for (unsigned int i = 0; i < s->idx.size(); i++)
+      s->fns[i] = pss[s->idx[i]];
+    for (unsigned int i = 0; i < s->ext.size(); i++)
+      s->ext[i]->set_quad_2d(&g_quad_2d_std);
+    trav.begin(s->meshes.size(), &(s->meshes.front()), &(s->fns.front()));
+
+    Element** e;
+    while ((e = trav.get_next_state(bnd, ep)) != NULL)
+    {
+      Element* e0 = NULL;
+      for (unsigned int i = 0; i < s->idx.size(); i++)
+        if ((e0 = e[i]) != NULL) break;
+      if (e0 == NULL) continue;
+
+      AsmState as;
+      as.stage = ss;
+      as.mode = e0->get_mode();
+      as.fn = list.elems.size();
+      as.base = trav.get_base();
+      memcpy(as.bnd, bnd, sizeof(bnd));
+      memcpy(as.ep, ep, sizeof(ep));
+      list.states.push_back(as);
+      for (unsigned int i = 0; i < s->fns.size(); i++)
+      {
+        list.elems.push_back(e[i]);
+        list.subs.push_back(e[i] != NULL ? s->fns[i]->get_transform() : 0);
+      }
+
+      // RefMap::set_active_element() caches the inverse reference map order in the
+      // element, do it here so that the threads only read it
+      for (unsigned int i = 0; i < s->idx.size(); i++)
+        if (e[i] != NULL) ctx.refmap[s->idx[i]].set_active_element(e[i]);
+    }
+    trav.finish();
+  }
+
+  int nstates = list.states.size();
+  list.owner.resize(nstates);
+  list.segment.resize(nstates);
+  pthread_mutex_init(&list.lock, NULL);
+
+  // Set up the threads. Everything is allocated here in the main thread, since the
+  // constructors of PrecalcShapeset switch the mode of the shared shapesets.
+  std::vector<AsmThread*> threads(num_threads);
+  for (int k = 0; k < num_threads; k++)
+  {
+    AsmThread* t = threads[k] = new AsmThread;
+    t->id = k;
+    t->list = &list;
+    t->rhsonly = rhsonly;
+    t->has_dir = (dir_ext != NULL);
+    t->dp = create_worker();
+    t->dp->get_matrix_buffer(9);
+
+    Tuple<Solution*> u_ext;
+    for (int i = 0; i < wf->neq; i++)
+    {
+      Solution* sln = NULL;
+      if (init_vec != NULL)
+      {
+        sln = new Solution(spaces[i]->get_mesh());
+        sln->set_fe_solution(spaces[i], t->dp->pss[i], init_vec);
+        sln->set_private_refmap_pss(true);
+        sln->set_quad_2d(&g_quad_2d_std);
+      }
+      u_ext.push_back(sln);
+    }
+    t->dp->init_context(t->ctx, u_ext);
+    for (int i = 0; i < wf->neq; i++)
+      t->ctx.refmap[i].set_private_pss(true);
+
+    // the stages of the thread are the same, only with its own functions
+    t->stages = stages;
+    for (unsigned int ss = 0; ss < t->stages.size(); ss++)
+    {
+      WeakForm::Stage* s = &t->stages[ss];
+      for (unsigned int i = 0; i < s->idx.size(); i++)
+        s->fns[i] = t->dp->pss[s->idx[i]];
+      for (unsigned int i = 0; i < s->ext.size(); i++)
+      {
+        int j = 0;
+        while (j < wf->neq && (MeshFunction*) ctx.u_ext[j] != s->ext[i]) j++;
+        if (j >= wf->neq) error("Unexpected external function in DiscreteProblem::assemble_parallel().");
+        s->ext[i] = u_ext[j];
+        s->fns[s->idx.size() + i] = u_ext[j];
+      }
+    }
+  }
+
+  // Assemble triangles and quads separately, so that each thread sets the modes of the
+  // shapesets and the order limiting tables (which are kept per thread) once per phase.
+  for (int mode = H2D_MODE_TRIANGLE; mode <= H2D_MODE_QUAD; mode++)
+  {
+    list.todo.clear();
+    for (int st = 0; st < nstates; st++)
+      if (list.states[st].mode == mode) list.todo.push_back(st);
+    if (list.todo.empty()) continue;
+    list.mode = mode;
+    list.next = 0;
+
+    std::vector<pthread_t> tid(num_threads);
+    for (int k = 0; k < num_threads; k++)
+      if (pthread_create(&tid[k], NULL, assemble_thread, threads[k]) != 0)
+        error("Could not create assembling thread %d.", k);
+    for (int k = 0; k < num_threads; k++)
+      pthread_join(tid[k], NULL);
+  }
+  pthread_mutex_destroy(&list.lock);
+
+  // Add the recorded contributions in the order of the serial assembling,
+  // so that the result does not depend on the number of threads.
+  for (int st = 0; st < nstates; st++)
+  {
+    AsmThread* t = threads[list.owner[st]];
+    int g = list.segment[st];
+    bool last = (g + 1 == (int) t->seg_mat.size());
+    if (static_condensation)
+    {
+      condense_state(&t->mat, t->seg_mat[g], last ? t->mat.get_num_blocks() : t->seg_mat[g+1],
+                     &t->dir, t->seg_dir[g], last ? t->dir.get_num_values() : t->seg_dir[g+1],
+                     &t->rhs, t->seg_rhs[g], last ? t->rhs.get_num_values() : t->seg_rhs[g+1],
+                     mat_ext, dir_ext, rhs_ext);
+      continue;
+    }
+    if (rhsonly == false)
+      t->mat.replay(mat_ext, t->seg_mat[g], last ? t->mat.get_num_blocks() : t->seg_mat[g+1]);
+    if (dir_ext != NULL)
+      t->dir.replay(dir_ext, t->seg_dir[g], last ? t->dir.get_num_values() : t->seg_dir[g+1]);
+    t->rhs.replay(rhs_ext, t->seg_rhs[g], last ? t->rhs.get_num_values() : t->seg_rhs[g+1]);
+  }
+  verbose("Assembled %d states by %d threads.", nstates, num_threads);
+
+  for (int k = 0; k < num_threads; k++)
+  {
+    AsmThread* t = threads[k];
+    t->dp->free_context(t->ctx);
+    for (int i = 0; i < wf->neq; i++)
+      if (t->ctx.u_ext[i] != NULL) delete t->ctx.u_ext[i];
+    delete [] t->dp->buffer;
+    delete t->dp;
+    delete t;
+  }
+}
+
+//// static condensation ///////////////////////////////////////////////////////////////////////////
+
+int DiscreteProblem::init_condensation(int ndof)
+{
+  // mark the bubble DOFs, then number the others in their original order
+  cond_dof.assign(ndof, 0);
+  for (int i = 0; i < wf->neq; i++)
+  {
+    Element* e;
+    for_all_active_elements(e, spaces[i]->get_mesh())
+    {
+      int first, step;
+      int n = spaces[i]->get_element_bubble_dofs(e, first, step);
+      for (int k = 0, dof = first; k < n; k++, dof += step)
+        cond_dof[dof] = -1;
+    }
+  }
+  int size = 0;
+  for (int i = 0; i < ndof; i++)
+    if (cond_dof[i] >= 0) cond_dof[i] = size++;
+
+  cond_ndof = size;
+  cond_ndof_full = ndof;
+  cond_local.assign(ndof, -1);
+  cond_states.clear();
+  cond_idx.clear();
+  cond_val.clear();
+  return size;
+}
+
+void DiscreteProblem::condense_state(AsmRecMatrix* mat, int mfirst, int mlast, AsmRecVector* dir,
+                                     int dfirst, int dlast, AsmRecVector* rhs, int rfirst, int rlast,
+                                     Matrix* mat_ext, Vector* dir_ext, Vector* rhs_ext)
+{
+  // collect the DOFs of the state, the interface DOFs first, then the bubble DOFs
+  std::vector<int>& dofs = cond_dofs;
+  int* local = &cond_local.front();
+  dofs.clear();
+  mat->get_dofs(mfirst, mlast, dofs);
+  dir->get_dofs(dfirst, dlast, dofs);
+  rhs->get_dofs(rfirst, rlast, dofs);
+  int n = 0, ni = 0;
+  for (unsigned int k = 0; k < dofs.size(); k++)
+  {
+    int dof = dofs[k];
+    if (local[dof] >= 0) continue;
+    local[dof] = 0;
+    dofs[n++] = dof;
+  }
+  for (int k = 0; k < n; k++)
+    if (cond_dof[dofs[k]] >= 0) std::swap(dofs[ni++], dofs[k]);
+  for (int k = 0; k < n; k++)
+  {
+    if (k >= ni && cond_dof[dofs[k]] != -1)
+      error("Bubble DOF %d is assembled in more than one traversal state. The static condensation "
+            "needs each element to be assembled at once.", dofs[k]);
+    local[dofs[k]] = k;
+  }
+  if (n == 0) return;
+
+  // the local system [A | rhs | dir] stored by rows
+  int lda = n + 2;
+  cond_sys.assign(n * lda, 0.0);
+  scalar* a = &cond_sys.front();
+  mat->add_to_dense(mfirst, mlast, local, a, lda);
+  rhs->add_to_dense(rfirst, rlast, local, a, lda, n);
+  dir->add_to_dense(dfirst, dlast, local, a, lda, n + 1);
+  for (int k = 0; k < n; k++)
+    local[dofs[k]] = -1;
+
+  // Gauss-Jordan elimination of the bubble columns, with pivoting among the bubble rows:
+  // the bubble block becomes the identity, the bubble rows become [X | y_rhs | y_dir] and
+  // the interface rows the Schur complement and the condensed vectors
+  for (int k = ni; k < n; k++)
+  {
+    int p = k;
+    for (int i = k + 1; i < n; i++)
+      if (std::abs(a[i*lda + k]) > std::abs(a[p*lda + k])) p = i;
+    if (a[p*lda + k] == 0.0)
+      error("Singular block of the bubble functions in DiscreteProblem::condense_state().");
+    if (p != k) std::swap_ranges(a + p*lda, a + (p+1)*lda, a + k*lda);
+
+    // the columns ni ... k-1 of the pivot row are already zero
+    scalar* rk = a + k*lda;
+    scalar piv = 1.0 / rk[k];
+    for (int j = 0; j < ni; j++) rk[j] *= piv;
+    for (int j = k; j < lda; j++) rk[j] *= piv;
+    for (int i = 0; i < n; i++)
+    {
+      scalar f = a[i*lda + k];
+      if (i == k || f == 0.0) continue;
+      scalar* ri = a + i*lda;
+      for (int j = 0; j < ni; j++) ri[j] -= f * rk[j];
+      for (int j = k; j < lda; j++) ri[j] -= f * rk[j];
+    }
+  }
+
+  // keep X and y for the recovery of the bubble DOFs
+  CondensedState cs = { (int) cond_idx.size(), ni, n - ni, cond_val.size() };
+  for (int k = 0; k < ni; k++)
+    cond_idx.push_back(cond_dof[dofs[k]]);
+  for (int k = ni; k < n; k++)
+  {
+    cond_idx.push_back(dofs[k]);
+    cond_dof[dofs[k]] = -2;
+    cond_val.insert(cond_val.end(), a + k*lda, a + k*lda + ni);
+  }
+  for (int k = ni; k < n; k++)
+    cond_val.push_back(a[k*lda + n] - a[k*lda + n + 1]);
+  if (cs.nb > 0) cond_states.push_back(cs);
+
+  // add the condensed system
+  if (ni == 0) return;
+  int* cidx = &cond_idx[cs.idx];
+  AUTOLA_OR(scalar*, rows, ni);
+  for (int i = 0; i < ni; i++)
+  {
+    rows[i] = a + i*lda;
+    rhs_ext->add(cidx[i], a[i*lda + n]);
+    if (dir_ext != NULL) dir_ext->add(cidx[i], a[i*lda + n + 1]);
+  }
+  mat_ext->add_block(cidx, ni, cidx, ni, rows);
+}
+
+static inline scalar get_value(Vector* vec, int i)
+{
+#ifdef H2D_COMPLEX
+  return vec->get_cplx(i);
+#else
+  return vec->get(i);
+#endif
+}
+
+void DiscreteProblem::recover_bubble_dofs(Vector* cond_vec, Vector* vec)
+{
+  if (!static_condensation)
+    error("The static condensation is not enabled in DiscreteProblem::recover_bubble_dofs().");
+  if (cond_vec->get_size() != cond_ndof)
+    error("The vector does not match the condensed system in DiscreteProblem::recover_bubble_dofs().");
+  if (vec->get_size() != cond_ndof_full)
+  {
+    vec->free_data();
+    vec->init(cond_ndof_full, cond_vec->is_complex());
+  }
+  vec->set_zero();
+
+  for (int i = 0; i < cond_ndof_full; i++)
+    if (cond_dof[i] >= 0) vec->set(i, get_value(cond_vec, cond_dof[i]));
+
+  std::vector<scalar> xi;
+  for (unsigned int s = 0; s < cond_states.size(); s++)
+  {
+    CondensedState* cs = &cond_states[s];
+    int* idx = &cond_idx[cs->idx];
+    scalar* x = &cond_val[cs->val];
+    scalar* y = x + cs->nb * cs->ni;
+    xi.resize(cs->ni);
+    for (int i = 0; i < cs->ni; i++)
+      xi[i] = get_value(cond_vec, idx[i]);
+    for (int k = 0; k < cs->nb; k++, x += cs->ni)
+    {
+      scalar val = y[k];
+      for (int i = 0; i < cs->ni; i++)
+        val -= x[i] * xi[i];
+      vec->set(idx[cs->ni + k], val);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Initialize integration order for external functions
+ExtData<Ord>* DiscreteProblem::init_ext_fns_ord(std::vector<MeshFunction *> &ext)
+{
+  ExtData<Ord>* fake_ext = new ExtData<Ord>;
+  fake_ext->nf = ext.size();
+  Func<Ord>** fake_ext_fn = new Func<Ord>*[fake_ext->nf];
+  for (int i = 0; i < fake_ext->nf; i++)
+    fake_ext_fn[i] = init_fn_ord(ext[i]->get_fn_order());
+  fake_ext->fn = fake_ext_fn;
+
+  return fake_ext;
+}
+
+// Initialize integration order on a given edge for external functions
+ExtData<Ord>* DiscreteProblem::init_ext_fns_ord(std::vector<MeshFunction *> &ext, int edge)
+{
+  ExtData<Ord>* fake_ext = new ExtData<Ord>;
+  fake_ext->nf = ext.size();
+  Func<Ord>** fake_ext_fn = new Func<Ord>*[fake_ext->nf];
+  for (int i = 0; i < fake_ext->nf; i++)
+    fake_ext_fn[i] = init_fn_ord(ext[i]->get_edge_fn_order(edge));
+  fake_ext->fn = fake_ext_fn;
+  
+  return fake_ext;
+}
+
+// Initialize external functions (obtain values, derivatives,...)
+ExtData<scalar>* DiscreteProblem::init_ext_fns(std::vector<MeshFunction *> &ext, RefMap *rm, const int order)
+{
+  ExtData<scalar>* ext_data = new ExtData<scalar>;
+  Func<scalar>** ext_fn = new Func<scalar>*[ext.size()];
+  for (unsigned int i = 0; i < ext.size(); i++) {
+    ext_fn[i] = get_fn(ext[i], rm, order);
+  }
+  ext_data->nf = ext.size();
+  ext_data->fn = ext_fn;
+
+  return ext_data;
+}
+
+// Initialize shape function values and derivatives (fill in the cache)
+Func<double>* DiscreteProblem::get_fn(PrecalcShapeset *fu, RefMap *rm, const int order)
+{
+  Key key(256 - fu->get_active_shape(), order, fu->get_transform(), fu->get_shapeset()->get_id());
+  if (cache_fn[key] == NULL)
+    cache_fn[key] = init_fn(fu, rm, order);
+
+  return cache_fn[key];
+}
+
+// Values of previous solutions and external functions depend only on the element
+// and the quadrature, so they are shared by all forms and shape functions.
+Func<scalar>* DiscreteProblem::get_fn(MeshFunction *fu, RefMap *rm, const int order)
+{
+  std::pair<MeshFunction*, int> key(fu, order);
+  if (cache_ext[key] == NULL)
+    cache_ext[key] = init_fn(fu, rm, order);
+
+  return cache_ext[key];
+}
+
+// Caching transformed values
+void DiscreteProblem::init_cache()
+{
+  for (int i = 0; i < g_max_quad + 1 + 4 * g_max_quad + 4; i++)
+  {
+    cache_e[i] = NULL;
+    cache_jwt[i] = NULL;
+  }
+}
+
+void DiscreteProblem::delete_cache()
+{
+  for (int i = 0; i < g_max_quad + 1 + 4 * g_max_quad + 4; i++)
+  {
     if (cache_e[i] != NULL)
     {
       cache_e[i]->free(); delete cache_e[i];
@@ -626,16 +1522,52 @@ void DiscreteProblem::delete_cache()
     (it->second)->free_fn(); delete (it->second);
   }
   cache_fn.clear();
+  for (std::map<std::pair<MeshFunction*, int>, Func<scalar>*>::iterator it = cache_ext.begin(); it != cache_ext.end(); it++)
+  {
+    (it->second)->free_fn(); delete (it->second);
+  }
+  cache_ext.clear();
 }
 
-//// evaluation of forms, general case ///////////////////////////////////////////////////////////
+//// integration orders of forms /////////////////////////////////////////////////////////////////
 
-// Actual evaluation of volume Jacobian form (calculates integral)
-scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> sln, 
-                        PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, RefMap *rv)
+// Fills in the part of the order key common to all kinds of forms.
+void DiscreteProblem::init_order_key(void* form, RefMap* rm, Tuple<Solution *> &sln, int inc, int edge)
+{
+  order_key.form = form;
+  order_key.mode = rm->get_active_element()->get_mode();
+  order_key.inv_ref_order = rm->get_inv_ref_order();
+  order_key.orders.clear();
+  if (sln != Tuple<Solution *>()) {
+    for (int i = 0; i < wf->neq; i++) {
+      if (sln[i] == NULL) order_key.orders.push_back(0);
+      else if (edge < 0) order_key.orders.push_back(sln[i]->get_fn_order() + inc);
+      else order_key.orders.push_back(sln[i]->get_edge_fn_order(edge) + inc);
+    }
+  }
+}
+
+// The integration orders are determined by evaluating the form with Ord arguments.
+// This depends only on the polynomial orders involved, so the result is cached and
+// reused for all elements and shape functions with the same orders.
+int DiscreteProblem::calc_order(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln,
+                                PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru)
 {
-  // Determine the integration order.
   int inc = (fu->get_num_components() == 2) ? 1 : 0;
+  return calc_order(mfv, sln, fu->get_fn_order() + inc, fv->get_fn_order() + inc, inc, ru);
+}
+
+int DiscreteProblem::calc_order(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln,
+                                int u_order, int v_order, int inc, RefMap *ru)
+{
+  // Look the order up in the cache first.
+  init_order_key(mfv, ru, sln, inc, -1);
+  order_key.orders.push_back(u_order);
+  order_key.orders.push_back(v_order);
+  for (unsigned int i = 0; i < mfv->ext.size(); i++)
+    order_key.orders.push_back(mfv->ext[i]->get_fn_order());
+  std::map<OrderKey, int>::iterator it = cache_order.find(order_key);
+  if (it != cache_order.end()) return it->second;
   
   // Order of solutions from the previous iteration level.
   AUTOLA_OR(Func<Ord>*, oi, wf->neq);
@@ -651,8 +1583,8 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *
   }
   
   // Order of shape functions.
-  Func<Ord>* ou = init_fn_ord(fu->get_fn_order() + inc);
-  Func<Ord>* ov = init_fn_ord(fv->get_fn_order() + inc);
+  Func<Ord>* ou = init_fn_ord(u_order);
+  Func<Ord>* ov = init_fn_ord(v_order);
   
   // Order of additional external functions.
   ExtData<Ord>* fake_ext = init_ext_fns_ord(mfv->ext);
@@ -668,7 +1600,6 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *
   int order = ru->get_inv_ref_order();
   
   order += o.get_order();
-  limit_order_nowarn(order);
   
   // Clean up.
   for (int i = 0; i < wf->neq; i++) {  
@@ -682,6 +1613,199 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *
   }
   if (fake_e != NULL) delete fake_e;
   if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
+
+  cache_order[order_key] = order;
+  return order;
+}
+
+int DiscreteProblem::calc_order(WeakForm::VectorFormVol *vfv, Tuple<Solution *> &sln,
+                                PrecalcShapeset *fv, RefMap *rv)
+{
+  int inc = (fv->get_num_components() == 2) ? 1 : 0;
+
+  // Look the order up in the cache first.
+  init_order_key(vfv, rv, sln, inc, -1);
+  order_key.orders.push_back(fv->get_fn_order() + inc);
+  for (unsigned int i = 0; i < vfv->ext.size(); i++)
+    order_key.orders.push_back(vfv->ext[i]->get_fn_order());
+  std::map<OrderKey, int>::iterator it = cache_order.find(order_key);
+  if (it != cache_order.end()) return it->second;
+  
+  // Order of solutions from the previous iteration level.
+  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
+  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
+  if (sln != Tuple<Solution *>()) {
+    for (int i = 0; i < wf->neq; i++) {
+      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
+      else oi[i] = init_fn_ord(0);
+    }
+  }
+  else {
+    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
+  }
+  
+  // Order of the shape function.
+  Func<Ord>* ov = init_fn_ord(fv->get_fn_order() + inc);
+  
+  // Order of additional external functions.
+  ExtData<Ord>* fake_ext = init_ext_fns_ord(vfv->ext);
+  
+  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
+  double fake_wt = 1.0;
+  Geom<Ord>* fake_e = init_geom_ord();
+  
+  // Total order of the vector form.
+  Ord o = vfv->ord(1, &fake_wt, oi, ov, fake_e, fake_ext);
+  
+  // Increase due to reference map.
+  int order = rv->get_inv_ref_order();
+  
+  order += o.get_order();
+
+  // Clean up.
+  for (int i = 0; i < wf->neq; i++) { 
+    if (oi[i] != NULL) {
+      oi[i]->free_ord(); delete oi[i]; 
+    }
+  }
+  if (ov != NULL) {ov->free_ord(); delete ov;}
+  if (fake_e != NULL) delete fake_e;
+  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
+
+  cache_order[order_key] = order;
+  return order;
+}
+
+int DiscreteProblem::calc_order(WeakForm::MatrixFormSurf *mfs, Tuple<Solution *> &sln,
+                                PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, EdgePos* ep)
+{
+  int inc = (fu->get_num_components() == 2) ? 1 : 0;
+
+  // Look the order up in the cache first.
+  init_order_key(mfs, ru, sln, inc, ep->edge);
+  order_key.orders.push_back(fu->get_edge_fn_order(ep->edge) + inc);
+  order_key.orders.push_back(fv->get_edge_fn_order(ep->edge) + inc);
+  for (unsigned int i = 0; i < mfs->ext.size(); i++)
+    order_key.orders.push_back(mfs->ext[i]->get_edge_fn_order(ep->edge));
+  std::map<OrderKey, int>::iterator it = cache_order.find(order_key);
+  if (it != cache_order.end()) return it->second;
+  
+  // Order of solutions from the previous iteration level.
+  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
+  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
+  if (sln != Tuple<Solution *>()) {
+    for (int i = 0; i < wf->neq; i++) {
+      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_edge_fn_order(ep->edge) + inc);
+      else oi[i] = init_fn_ord(0);
+    }
+  }
+  else {
+    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
+  }
+  
+  // Order of shape functions.
+  Func<Ord>* ou = init_fn_ord(fu->get_edge_fn_order(ep->edge) + inc);
+  Func<Ord>* ov = init_fn_ord(fv->get_edge_fn_order(ep->edge) + inc);
+  
+  // Order of additional external functions.
+  ExtData<Ord>* fake_ext = init_ext_fns_ord(mfs->ext, ep->edge);
+  
+  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
+  double fake_wt = 1.0;
+  Geom<Ord>* fake_e = init_geom_ord();
+  
+  // Total order of the matrix form.
+  Ord o = mfs->ord(1, &fake_wt, oi, ou, ov, fake_e, fake_ext);
+  
+  // Increase due to reference map.
+  int order = ru->get_inv_ref_order();
+  
+  order += o.get_order();
+  
+  // Clean up.
+  for (int i = 0; i < wf->neq; i++) {  
+    if (oi[i] != NULL) { oi[i]->free_ord(); delete oi[i]; }
+  }
+  if (ou != NULL) {
+    ou->free_ord(); delete ou;
+  }
+  if (ov != NULL) {
+    ov->free_ord(); delete ov;
+  }
+  if (fake_e != NULL) delete fake_e;
+  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
+
+  cache_order[order_key] = order;
+  return order;
+}
+
+int DiscreteProblem::calc_order(WeakForm::VectorFormSurf *vfs, Tuple<Solution *> &sln,
+                                PrecalcShapeset *fv, RefMap *rv, EdgePos* ep)
+{
+  int inc = (fv->get_num_components() == 2) ? 1 : 0;
+
+  // Look the order up in the cache first.
+  init_order_key(vfs, rv, sln, inc, ep->edge);
+  order_key.orders.push_back(fv->get_edge_fn_order(ep->edge) + inc);
+  for (unsigned int i = 0; i < vfs->ext.size(); i++)
+    order_key.orders.push_back(vfs->ext[i]->get_edge_fn_order(ep->edge));
+  std::map<OrderKey, int>::iterator it = cache_order.find(order_key);
+  if (it != cache_order.end()) return it->second;
+  
+  // Order of solutions from the previous iteration level.
+  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
+  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
+  if (sln != Tuple<Solution *>()) {
+    for (int i = 0; i < wf->neq; i++) {
+      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_edge_fn_order(ep->edge) + inc);
+      else oi[i] = init_fn_ord(0);
+    }
+  }
+  else {
+    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
+  }
+  
+  // Order of the shape function.
+  Func<Ord>* ov = init_fn_ord(fv->get_edge_fn_order(ep->edge) + inc);
+  
+  // Order of additional external functions.
+  ExtData<Ord>* fake_ext = init_ext_fns_ord(vfs->ext, ep->edge);
+  
+  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
+  double fake_wt = 1.0;
+  Geom<Ord>* fake_e = init_geom_ord();
+  
+  // Total order of the vector form.
+  Ord o = vfs->ord(1, &fake_wt, oi, ov, fake_e, fake_ext);
+  
+  // Increase due to reference map.
+  int order = rv->get_inv_ref_order();
+  
+  order += o.get_order();
+  
+  // Clean up.
+  for (int i = 0; i < wf->neq; i++) { 
+    if (oi[i] != NULL) {
+      oi[i]->free_ord(); delete oi[i]; 
+    }
+  }
+  if (ov != NULL) {ov->free_ord(); delete ov;}
+  if (fake_e != NULL) delete fake_e;
+  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
+
+  cache_order[order_key] = order;
+  return order;
+}
+
+//// evaluation of forms, general case ///////////////////////////////////////////////////////////
+
+// Actual evaluation of volume Jacobian form (calculates integral)
+scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> sln, 
+                        PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, RefMap *rv)
+{
+  // Determine the integration order.
+  int order = calc_order(mfv, sln, fu, fv, ru);
+  limit_order_nowarn(order);
   
   // Eval the form using the quadrature of the just calculated order.
   Quad2D* quad = fu->get_quad_2d();
@@ -705,77 +1829,359 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *
   //for (int i = 0; i < wf->neq; i++) prev[i]  = init_fn(sln[i], rv, order);
   if (sln != Tuple<Solution *>()) {
     for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) prev[i] = init_fn(sln[i], rv, order);
+      if (sln[i] != NULL) prev[i] = get_fn(sln[i], rv, order);
       else prev[i] = NULL;
     }
   }
-  else {
-    for (int i = 0; i < wf->neq; i++) prev[i] = NULL;
+  else {
+    for (int i = 0; i < wf->neq; i++) prev[i] = NULL;
+  }
+
+  Func<double>* u = get_fn(fu, ru, order);
+  Func<double>* v = get_fn(fv, rv, order);
+  ExtData<scalar>* ext = init_ext_fns(mfv->ext, rv, order);
+
+  scalar res = mfv->fn(np, jwt, prev, u, v, e, ext);
+
+  // Clean up (the function values are cached and freed in delete_cache()).
+  if (ext != NULL) {delete [] ext->fn; delete ext;}
+  return res;
+}
+
+
+// Copies values of the shape functions from the assembly list 'al' into the table 'blk'.
+void DiscreteProblem::init_fn_block(FuncBlock *blk, std::vector<double> &buf, PrecalcShapeset *fu,
+                                    RefMap *rm, AsmList *al, const int order, int np)
+{
+  int nf = al->cnt;
+  buf.resize(3 * nf * np);
+  blk->nf = nf;
+  blk->np = np;
+  blk->val = &buf[0];
+  blk->dx = blk->val + nf * np;
+  blk->dy = blk->dx + nf * np;
+
+  for (int k = 0; k < nf; k++)
+  {
+    fu->set_active_shape(al->idx[k]);
+    Func<double>* f = get_fn(fu, rm, order);
+    for (int i = 0; i < np; i++)
+    {
+      blk->val[i * nf + k] = f->val[i];
+      blk->dx[i * nf + k] = f->dx[i];
+      blk->dy[i * nf + k] = f->dy[i];
+    }
+  }
+}
+
+// Evaluation of a batched volume matrix form: fills mat[i][j] for all test functions
+// from 'am' and all basis functions from 'an' in one call of the form.
+void DiscreteProblem::eval_form_block(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln,
+                                      PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, RefMap *rv,
+                                      AsmList *an, AsmList *am, scalar **mat)
+{
+  if (fu->get_num_components() != 1 || fv->get_num_components() != 1)
+    error("Batched matrix forms are supported for scalar-valued spaces only.");
+  if (mfv->std_type != H2D_STD_NONE && eval_std_form_affine(mfv, fu, fv, ru, rv, an, am, mat))
+    return;
+
+  // Determine the integration order. All pairs share one quadrature, which is
+  // the one needed by the shape functions of the highest order.
+  int u_order = 0, v_order = 0;
+  for (int j = 0; j < an->cnt; j++) {
+    fu->set_active_shape(an->idx[j]);
+    u_order = std::max(u_order, fu->get_fn_order());
+  }
+  for (int i = 0; i < am->cnt; i++) {
+    fv->set_active_shape(am->idx[i]);
+    v_order = std::max(v_order, fv->get_fn_order());
+  }
+  int order = calc_order(mfv, sln, u_order, v_order, 0, ru);
+  limit_order_nowarn(order);
+
+  // Eval the form using the quadrature of the just calculated order.
+  Quad2D* quad = fu->get_quad_2d();
+  double3* pt = quad->get_points(order);
+  int np = quad->get_num_points(order);
+
+  // Init geometry and jacobian*weights.
+  if (cache_e[order] == NULL)
+  {
+    cache_e[order] = init_geom_vol(ru, order);
+    double* jac = ru->get_jacobian(order);
+    cache_jwt[order] = new double[np];
+    for(int i = 0; i < np; i++)
+      cache_jwt[order][i] = pt[i][2] * jac[i];
+  }
+  Geom<double>* e = cache_e[order];
+  double* jwt = cache_jwt[order];
+
+  // Function values and values of external functions.
+  AUTOLA_OR(Func<scalar>*, prev, wf->neq);
+  for (int i = 0; i < wf->neq; i++)
+    prev[i] = (sln != Tuple<Solution *>() && sln[i] != NULL) ? get_fn(sln[i], rv, order) : NULL;
+
+  FuncBlock u, v;
+  init_fn_block(&u, blk_buf_u, fu, ru, an, order, np);
+  init_fn_block(&v, blk_buf_v, fv, rv, am, order, np);
+  ExtData<scalar>* ext = init_ext_fns(mfv->ext, rv, order);
+
+  for (int i = 0; i < am->cnt; i++)
+    for (int j = 0; j < an->cnt; j++)
+      mat[i][j] = 0.0;
+  if (mfv->fn_block != NULL)
+    mfv->fn_block(np, jwt, prev, &u, &v, e, ext, mat);
+  else
+    eval_std_form(mfv, np, jwt, &u, &v, mat);
+
+  // Clean up (the function values are cached and freed in delete_cache()).
+  if (ext != NULL) {delete [] ext->fn; delete ext;}
+}
+
+
+// Integrals of a pair of shape functions over the reference element, from which the
+// standard forms are evaluated on elements with a constant jacobian. They only depend
+// on the shapesets, the element mode, the indices and the integration order, so one
+// table serves all DiscreteProblems and assembling threads.
+struct RefIntKey
+{
+  int su, sv;           ///< shapeset ids
+  int mode, iu, iv, order;
+
+  bool operator==(const RefIntKey& o) const
+  {
+    return su == o.su && sv == o.sv && mode == o.mode && iu == o.iu && iv == o.iv && order == o.order;
+  }
+
+  unsigned hash() const
+  {
+    // FNV-1a of the fields
+    int v[6] = { su, sv, mode, iu, iv, order };
+    unsigned h = 2166136261u;
+    for (int i = 0; i < 6; i++)
+      h = (h ^ (unsigned) v[i]) * 16777619u;
+    return h;
+  }
+};
+
+struct RefIntegrals
+{
+  double u_v;           ///< u * v
+  double du_v[2];       ///< du/dxi_a * v
+  double du_dv[2][2];   ///< du/dxi_a * dv/dxi_b
+};
+
+/// Open addressing hash table of the reference integrals with 2 * MAX_NUM slots. Entries
+/// are inserted under the lock and never moved or removed before the program exits, so
+/// they are looked up without locking. Integrals over the limit are not stored.
+class RefIntTable
+{
+public:
+  static const int MAX_NUM = 1 << 17;
+
+  struct Entry
+  {
+    RefIntKey key;
+    RefIntegrals ri;
+  };
+
+  RefIntTable() : slots(NULL), num(0) { pthread_mutex_init(&lock, NULL); }
+
+  ~RefIntTable()
+  {
+    if (slots != NULL)
+    {
+      for (int i = 0; i < 2 * MAX_NUM; i++)
+        delete slots[i];
+      delete [] (Entry**) slots;
+    }
+    pthread_mutex_destroy(&lock);
+  }
+
+  const RefIntegrals* find(const RefIntKey& key) const
+  {
+    Entry* volatile* s = slots;
+    if (s == NULL) return NULL;
+
+    // a slot is filled only once its entry is complete, and an empty slot ends the search
+    const unsigned mask = 2 * MAX_NUM - 1;
+    for (unsigned i = key.hash() & mask; ; i = (i + 1) & mask)
+    {
+      Entry* e = s[i];
+      if (e == NULL) return NULL;
+      if (e->key == key) return &e->ri;
+    }
+  }
+
+  /// Stores a copy of 'ri', returns the stored integrals, or NULL if the table is full.
+  const RefIntegrals* insert(const RefIntKey& key, const RefIntegrals& ri)
+  {
+    pthread_mutex_lock(&lock);
+    if (slots == NULL)
+    {
+      Entry** s = new Entry*[2 * MAX_NUM];
+      memset(s, 0, 2 * MAX_NUM * sizeof(Entry*));
+      H2D_MEMORY_BARRIER();
+      slots = s;
+    }
+
+    // another thread may have stored the same integrals meanwhile
+    const RefIntegrals* found = find(key);
+    if (found == NULL && num < MAX_NUM)
+    {
+      Entry* e = new Entry;
+      e->key = key;
+      e->ri = ri;
+      const unsigned mask = 2 * MAX_NUM - 1;
+      unsigned i = key.hash() & mask;
+      while (slots[i] != NULL)
+        i = (i + 1) & mask;
+      H2D_MEMORY_BARRIER();
+      slots[i] = e;
+      num++;
+      found = &e->ri;
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+  }
+
+private:
+  Entry* volatile* volatile slots;
+  int num;
+  pthread_mutex_t lock;
+};
+
+static RefIntTable ref_integrals;
+
+static void calc_ref_integrals(PrecalcShapeset *fu, PrecalcShapeset *fv, int order, RefIntegrals& ri)
+{
+  Quad2D* quad = fu->get_quad_2d();
+  double3* pt = quad->get_points(order);
+  int np = quad->get_num_points(order);
+  fu->set_quad_order(order, H2D_FN_ALL);
+  fv->set_quad_order(order, H2D_FN_ALL);
+  double *u = fu->get_fn_values(), *udx = fu->get_dx_values(), *udy = fu->get_dy_values();
+  double *v = fv->get_fn_values(), *vdx = fv->get_dx_values(), *vdy = fv->get_dy_values();
+
+  memset(&ri, 0, sizeof(RefIntegrals));
+  for (int k = 0; k < np; k++)
+  {
+    double w = pt[k][2];
+    ri.u_v += w * u[k] * v[k];
+    ri.du_v[0] += w * udx[k] * v[k];
+    ri.du_v[1] += w * udy[k] * v[k];
+    ri.du_dv[0][0] += w * udx[k] * vdx[k];
+    ri.du_dv[0][1] += w * udx[k] * vdy[k];
+    ri.du_dv[1][0] += w * udy[k] * vdx[k];
+    ri.du_dv[1][1] += w * udy[k] * vdy[k];
   }
+}
 
-  Func<double>* u = get_fn(fu, ru, order);
-  Func<double>* v = get_fn(fv, rv, order);
-  ExtData<scalar>* ext = init_ext_fns(mfv->ext, rv, order);
+// Evaluates a standard form on an element with a constant jacobian: the reference
+// integrals of the shape functions are combined with the constant inverse reference
+// map, no quadrature is done. Returns false if the element does not allow this, e.g.,
+// if it is curved or only a part of it is assembled (multi-mesh).
+bool DiscreteProblem::eval_std_form_affine(WeakForm::MatrixFormVol *mfv, PrecalcShapeset *fu,
+                                           PrecalcShapeset *fv, RefMap *ru, RefMap *rv,
+                                           AsmList *an, AsmList *am, scalar **mat)
+{
+  if (!ru->is_jacobian_const() || ru->get_active_element() != rv->get_active_element()) return false;
+  if (fu->get_transform() != 0 || fv->get_transform() != 0) return false;
+
+  // coefficients of the reference integrals
+  double jac = ru->get_const_jacobian();
+  double2x2& m = *ru->get_const_inv_ref_map();
+  double c0 = mfv->std_coef[0], c1 = mfv->std_coef[1];
+  double g[2][2], a[2];
+  for (int p = 0; p < 2; p++)
+  {
+    for (int q = 0; q < 2; q++)
+      g[p][q] = c0 * jac * (m[0][p] * m[0][q] + m[1][p] * m[1][q]);
+    a[p] = jac * (c0 * m[0][p] + c1 * m[1][p]);
+  }
 
-  scalar res = mfv->fn(np, jwt, prev, u, v, e, ext);
+  RefIntKey key;
+  key.su = fu->get_shapeset()->get_id();
+  key.sv = fv->get_shapeset()->get_id();
+  key.mode = ru->get_active_element()->get_mode();
+  Tuple<Solution *> no_sln;
 
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) {  
-    if (prev[i] != NULL) prev[i]->free_fn(); delete prev[i]; 
+  // the integration order only depends on the orders of the shape functions
+  const int max_fn_order = 16;
+  int orders[max_fn_order][max_fn_order];
+  memset(orders, -1, sizeof(orders));
+  int inc = (fu->get_num_components() == 2) ? 1 : 0;
+
+  RefIntegrals tmp;
+  for (int i = 0; i < am->cnt; i++)
+  {
+    key.iv = am->idx[i];
+    int v_order = fv->get_shapeset()->get_order(key.iv);
+    v_order = std::max(H2D_GET_H_ORDER(v_order), H2D_GET_V_ORDER(v_order)) + inc;
+    for (int j = 0; j < an->cnt; j++)
+    {
+      key.iu = an->idx[j];
+      int u_order = fu->get_shapeset()->get_order(key.iu);
+      u_order = std::max(H2D_GET_H_ORDER(u_order), H2D_GET_V_ORDER(u_order)) + inc;
+      bool small = (u_order < max_fn_order && v_order < max_fn_order);
+      if (small && orders[u_order][v_order] >= 0)
+        key.order = orders[u_order][v_order];
+      else
+      {
+        key.order = calc_order(mfv, no_sln, u_order, v_order, inc, ru);
+        limit_order_nowarn(key.order);
+        if (small) orders[u_order][v_order] = key.order;
+      }
+
+      const RefIntegrals* ri = ref_integrals.find(key);
+      if (ri == NULL)
+      {
+        fu->set_active_shape(key.iu);
+        fv->set_active_shape(key.iv);
+        calc_ref_integrals(fu, fv, key.order, tmp);
+        ri = ref_integrals.insert(key, tmp);
+        if (ri == NULL) ri = &tmp;
+      }
+
+      switch (mfv->std_type)
+      {
+        case H2D_STD_MASS:
+          mat[i][j] = c0 * jac * ri->u_v;
+          break;
+        case H2D_STD_LAPLACE:
+          mat[i][j] = g[0][0] * ri->du_dv[0][0] + g[0][1] * ri->du_dv[0][1]
+                    + g[1][0] * ri->du_dv[1][0] + g[1][1] * ri->du_dv[1][1];
+          break;
+        case H2D_STD_ADVECTION:
+          mat[i][j] = a[0] * ri->du_v[0] + a[1] * ri->du_v[1];
+          break;
+      }
+    }
   }
-  if (ext != NULL) {ext->free(); delete ext;}
-  return res;
+  return true;
 }
 
+// Evaluates a standard form by quadrature, on elements where the reference integrals
+// cannot be used.
+void DiscreteProblem::eval_std_form(WeakForm::MatrixFormVol *mfv, int np, double *jwt,
+                                    FuncBlock *u, FuncBlock *v, scalar **mat)
+{
+  double c0 = mfv->std_coef[0], c1 = mfv->std_coef[1];
+  switch (mfv->std_type)
+  {
+    case H2D_STD_MASS: int_u_v_block<scalar>(np, jwt, u, v, mat, c0); break;
+    case H2D_STD_LAPLACE: int_grad_u_grad_v_block<scalar>(np, jwt, u, v, mat, c0); break;
+    case H2D_STD_ADVECTION: int_c_nabla_u_v_block<scalar>(np, jwt, c0, c1, u, v, mat); break;
+  }
+}
 
 // Actual evaluation of volume vector form (calculates integral)
 scalar DiscreteProblem::eval_form(WeakForm::VectorFormVol *vfv, Tuple<Solution *> sln, PrecalcShapeset *fv, RefMap *rv)
 {
   // Determine the integration order.
-  int inc = (fv->get_num_components() == 2) ? 1 : 0;
-  
-  // Order of solutions from the previous iteration level.
-  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
-  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
-  if (sln != Tuple<Solution *>()) {
-    for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
-      else oi[i] = init_fn_ord(0);
-    }
-  }
-  else {
-    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
-  }
-  
-  // Order of the shape function.
-  Func<Ord>* ov = init_fn_ord(fv->get_fn_order() + inc);
-  
-  // Order of additional external functions.
-  ExtData<Ord>* fake_ext = init_ext_fns_ord(vfv->ext);
-  
-  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  
-  // Total order of the vector form.
-  Ord o = vfv->ord(1, &fake_wt, oi, ov, fake_e, fake_ext);
-  
-  // Increase due to reference map.
-  int order = rv->get_inv_ref_order();
-  
-  order += o.get_order();
+  int order = calc_order(vfv, sln, fv, rv);
   limit_order_nowarn(order);
 
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) { 
-    if (oi[i] != NULL) {
-      oi[i]->free_ord(); delete oi[i]; 
-    }
-  }
-  if (ov != NULL) {ov->free_ord(); delete ov;}
-  if (fake_e != NULL) delete fake_e;
-  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
-
   // Eval the form using the quadrature of the just calculated order.
   Quad2D* quad = fv->get_quad_2d();
   double3* pt = quad->get_points(order);
@@ -798,7 +2204,7 @@ scalar DiscreteProblem::eval_form(WeakForm::VectorFormVol *vfv, Tuple<Solution *
   //for (int i = 0; i < wf->neq; i++) prev[i]  = init_fn(sln[i], rv, order);
   if (sln != Tuple<Solution *>()) {
     for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) prev[i]  = init_fn(sln[i], rv, order);
+      if (sln[i] != NULL) prev[i]  = get_fn(sln[i], rv, order);
       else prev[i] = NULL;
     }
   }
@@ -811,13 +2217,8 @@ scalar DiscreteProblem::eval_form(WeakForm::VectorFormVol *vfv, Tuple<Solution *
 
   scalar res = vfv->fn(np, jwt, prev, v, e, ext);
 
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) { 
-    if (prev[i] != NULL) {
-      prev[i]->free_fn(); delete prev[i]; 
-    }
-  }
-  if (ext != NULL) {ext->free(); delete ext;}
+  // Clean up (the function values are cached and freed in delete_cache()).
+  if (ext != NULL) {delete [] ext->fn; delete ext;}
   
   return res;
 }
@@ -827,54 +2228,9 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormSurf *mfs, Tuple<Solution
                         PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, RefMap *rv, EdgePos* ep)
 {
   // Determine the integration order.
-  int inc = (fu->get_num_components() == 2) ? 1 : 0;
-  
-  // Order of solutions from the previous iteration level.
-  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
-  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
-  if (sln != Tuple<Solution *>()) {
-    for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_edge_fn_order(ep->edge) + inc);
-      else oi[i] = init_fn_ord(0);
-    }
-  }
-  else {
-    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
-  }
-  
-  // Order of shape functions.
-  Func<Ord>* ou = init_fn_ord(fu->get_edge_fn_order(ep->edge) + inc);
-  Func<Ord>* ov = init_fn_ord(fv->get_edge_fn_order(ep->edge) + inc);
-  
-  // Order of additional external functions.
-  ExtData<Ord>* fake_ext = init_ext_fns_ord(mfs->ext, ep->edge);
-  
-  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  
-  // Total order of the matrix form.
-  Ord o = mfs->ord(1, &fake_wt, oi, ou, ov, fake_e, fake_ext);
-  
-  // Increase due to reference map.
-  int order = ru->get_inv_ref_order();
-  
-  order += o.get_order();
+  int order = calc_order(mfs, sln, fu, fv, ru, ep);
   limit_order_nowarn(order);
   
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) {  
-    if (oi[i] != NULL) { oi[i]->free_ord(); delete oi[i]; }
-  }
-  if (ou != NULL) {
-    ou->free_ord(); delete ou;
-  }
-  if (ov != NULL) {
-    ov->free_ord(); delete ov;
-  }
-  if (fake_e != NULL) delete fake_e;
-  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
-  
   // Eval the form using the quadrature of the just calculated order.
   Quad2D* quad = fu->get_quad_2d();
   
@@ -899,7 +2255,7 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormSurf *mfs, Tuple<Solution
   //for (int i = 0; i < wf->neq; i++) prev[i]  = init_fn(sln[i], rv, eo);
   if (sln != Tuple<Solution *>()) {
     for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) prev[i]  = init_fn(sln[i], rv, eo);
+      if (sln[i] != NULL) prev[i]  = get_fn(sln[i], rv, eo);
       else prev[i] = NULL;
     }
   }
@@ -913,13 +2269,8 @@ scalar DiscreteProblem::eval_form(WeakForm::MatrixFormSurf *mfs, Tuple<Solution
 
   scalar res = mfs->fn(np, jwt, prev, u, v, e, ext);
 
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) { 
-    if (prev[i] != NULL) {
-      prev[i]->free_fn(); delete prev[i]; 
-    }
-  }
-  if (ext != NULL) {ext->free(); delete ext;}
+  // Clean up (the function values are cached and freed in delete_cache()).
+  if (ext != NULL) {delete [] ext->fn; delete ext;}
   
   return 0.5 * res; // Edges are parameterized from 0 to 1 while integration weights
                     // are defined in (-1, 1). Thus multiplying with 0.5 to correct
@@ -932,50 +2283,9 @@ scalar DiscreteProblem::eval_form(WeakForm::VectorFormSurf *vfs, Tuple<Solution
                         PrecalcShapeset *fv, RefMap *rv, EdgePos* ep)
 {
   // Determine the integration order.
-  int inc = (fv->get_num_components() == 2) ? 1 : 0;
-  
-  // Order of solutions from the previous iteration level.
-  AUTOLA_OR(Func<Ord>*, oi, wf->neq);
-  //for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(sln[i]->get_fn_order() + inc);
-  if (sln != Tuple<Solution *>()) {
-    for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) oi[i] = init_fn_ord(sln[i]->get_edge_fn_order(ep->edge) + inc);
-      else oi[i] = init_fn_ord(0);
-    }
-  }
-  else {
-    for (int i = 0; i < wf->neq; i++) oi[i] = init_fn_ord(0);
-  }
-  
-  // Order of the shape function.
-  Func<Ord>* ov = init_fn_ord(fv->get_edge_fn_order(ep->edge) + inc);
-  
-  // Order of additional external functions.
-  ExtData<Ord>* fake_ext = init_ext_fns_ord(vfs->ext, ep->edge);
-  
-  // Order of geometric attributes (eg. for multiplication of a solution with coordinates, normals, etc.).
-  double fake_wt = 1.0;
-  Geom<Ord>* fake_e = init_geom_ord();
-  
-  // Total order of the vector form.
-  Ord o = vfs->ord(1, &fake_wt, oi, ov, fake_e, fake_ext);
-  
-  // Increase due to reference map.
-  int order = rv->get_inv_ref_order();
-  
-  order += o.get_order();
+  int order = calc_order(vfs, sln, fv, rv, ep);
   limit_order_nowarn(order);
   
-  // Clean up.
-  for (int i = 0; i < wf->neq; i++) { 
-    if (oi[i] != NULL) {
-      oi[i]->free_ord(); delete oi[i]; 
-    }
-  }
-  if (ov != NULL) {ov->free_ord(); delete ov;}
-  if (fake_e != NULL) delete fake_e;
-  if (fake_ext != NULL) {fake_ext->free_ord(); delete fake_ext;}
-  
   // Eval the form using the quadrature of the just calculated order.
   Quad2D* quad = fv->get_quad_2d();
   
@@ -1000,7 +2310,7 @@ scalar DiscreteProblem::eval_form(WeakForm::VectorFormSurf *vfs, Tuple<Solution
   //for (int i = 0; i < wf->neq; i++) prev[i]  = init_fn(sln[i], rv, eo);
   if (sln != Tuple<Solution *>()) {
     for (int i = 0; i < wf->neq; i++) {
-      if (sln[i] != NULL) prev[i]  = init_fn(sln[i], rv, eo);
+      if (sln[i] != NULL) prev[i]  = get_fn(sln[i], rv, eo);
       else prev[i] = NULL;
     }
   }
@@ -1013,12 +2323,9 @@ scalar DiscreteProblem::eval_form(WeakForm::VectorFormSurf *vfs, Tuple<Solution
 
   scalar res = vfs->fn(np, jwt, prev, v, e, ext);
 
-  for (int i = 0; i < wf->neq; i++) {  
-    if (prev[i] != NULL) {prev[i]->free_fn(); delete prev[i]; }
-  }
-  if (ext != NULL) {ext->free(); delete ext;}
+  // Clean up (the function values are cached and freed in delete_cache()).
+  if (ext != NULL) {delete [] ext->fn; delete ext;}
   
-  // Clean up.
   return 0.5 * res; // Edges are parameterized from 0 to 1 while integration weights
                     // are defined in (-1, 1). Thus multiplying with 0.5 to correct
                     // the weights.
@@ -1032,6 +2339,7 @@ bool DiscreteProblem::solve_matrix_problem(Matrix* mat, Vector* vec)
 {
   // check matrix size
   int ndof = this->get_num_dofs();
+  if (static_condensation) ndof = cond_ndof;
   if (ndof == 0) error("ndof = 0 in DiscreteProblem::solve().");
   if (ndof != mat->get_size())
     error("Matrix size does not match ndof in DiscreteProblem:solve().");
@@ -1059,15 +2367,25 @@ bool DiscreteProblem::solve(Matrix* mat, Vector* rhs, Vector* vec)
   if (rhs == NULL) error("rhs is NULL in DiscreteProblem::solve().");
   if (vec == NULL) error("vec is NULL in DiscreteProblem::solve().");
   if (ndof == 0) error("ndof = 0 in DiscreteProblem::solve().");
-  if (ndof != mat->get_size())
+  int size = static_condensation ? cond_ndof : ndof;
+  if (size != mat->get_size())
     error("Matrix size does not match ndof in in DiscreteProblem:solve().");
 
   // copy "vec" into "delta" and solve the matrix problem with "mat", "delta"
-  Vector* delta = new AVector(ndof);
-  memcpy(delta->get_c_array(), rhs, sizeof(scalar) * ndof);
+  Vector* delta = new AVector(size);
+  memcpy(delta->get_c_array(), rhs->get_c_array(), sizeof(scalar) * size);
   bool flag = this->solve_matrix_problem(mat, delta);
   if (flag == false) return false;
 
+  // extend the solution of the condensed system to all DOFs
+  if (static_condensation)
+  {
+    Vector* full = new AVector(ndof);
+    recover_bubble_dofs(delta, full);
+    delete delta;
+    delta = full;
+  }
+
   // add the result which is in "delta" to the previous 
   // solution vector which is in "vec"
   for (int i = 0; i < ndof; i++) vec->add(i, delta->get_c_array()[i]);
@@ -1152,14 +2470,13 @@ int DiscreteProblem::assign_dofs()
 
   // assigning dofs to each space
   if (this->spaces == Tuple<Space *>()) error("this->spaces is empty in DiscreteProblem::assign_dofs().");
-  int ndof = 0;
+  Tuple<Space *> eq_spaces;
   for (int i = 0; i < this->wf->neq; i++) {
     if (this->spaces[i] == NULL) error("this->spaces[%d] is NULL in assign_dofs().", i);
-    int inc = this->spaces[i]->assign_dofs(ndof);
-    ndof += inc;
+    eq_spaces.push_back(this->spaces[i]);
   }
 
-  return ndof;
+  return ::assign_dofs(eq_spaces);
 }
 
 // Underlying function for global orthogonal projection.
@@ -1351,11 +2668,14 @@ void DiscreteProblem::update_essential_bc_values()
 // are incompatible.
 void init_matrix_solver(MatrixSolverType matrix_solver, int ndof, 
                         Matrix* &mat, Vector* &rhs, 
-                        CommonSolver* &solver, bool is_complex) 
+                        CommonSolver* &solver, bool is_complex, bool use_pattern_matrix) 
 {
   // Initialize stiffness matrix, load vector, and matrix solver.
-  // UMFpack.
-  CooMatrix* mat_umfpack = new CooMatrix(ndof, is_complex);
+  // UMFpack. A PatternMatrix gets its sparse structure in DiscreteProblem::assemble()
+  // before the numeric assembling, and keeps it for the following assemblings.
+  Matrix* mat_umfpack;
+  if (use_pattern_matrix) mat_umfpack = new PatternMatrix(ndof, is_complex);
+  else mat_umfpack = new CooMatrix(ndof, is_complex);
   Vector* rhs_umfpack = new AVector(ndof, is_complex);
   CommonSolverSciPyUmfpack* solver_umfpack = new CommonSolverSciPyUmfpack();
   //CommonSolverSciPyUmfpack* solver_umfpack = new CommonSolverSciPyUmfpack();
@@ -1414,38 +2734,37 @@ double get_l2_norm_cplx(Vector* vec)
   return sqrt(val);
 }
 
-// Basic Newton's method, takes a coefficient vector and returns a coefficient vector. 
-bool solve_newton(Tuple<Space *> spaces, WeakForm* wf, Vector* coeff_vec, 
-                  MatrixSolverType matrix_solver, double newton_tol, 
-                  int newton_max_iter, bool verbose, bool is_complex) 
+bool DiscreteProblem::solve_newton(Vector* coeff_vec, Matrix* mat, Vector* rhs, CommonSolver* solver,
+                                   double newton_tol, int newton_max_iter, int jac_lag,
+                                   double stall_ratio, bool verbose, bool is_complex)
 {
-  int ndof = get_num_dofs(spaces);
-  
   // sanity checks
-  if (coeff_vec == NULL) error("coeff_vec == NULL in solve_newton().");
-  int n = spaces.size();
-  if (spaces.size() != wf->neq) 
-    error("The number of spaces in newton_solve() must match the number of equation in the PDE system.");
-  for (int i=0; i < n; i++) {
-    if (spaces[i] == NULL) error("spaces[%d] is NULL in solve_newton().", i);
-  }
-  if (coeff_vec->get_size() != ndof) error("Bad vector length in solve_newton().");
-
-  // Initialize the discrete problem.
-  DiscreteProblem dp(wf, spaces);
-  //info("ndof = %d", dp.get_num_dofs());
+  if (coeff_vec == NULL) error("coeff_vec == NULL in DiscreteProblem::solve_newton().");
+  if (mat == NULL) error("mat == NULL in DiscreteProblem::solve_newton().");
+  if (rhs == NULL) error("rhs == NULL in DiscreteProblem::solve_newton().");
+  if (solver == NULL) error("solver == NULL in DiscreteProblem::solve_newton().");
+  if (jac_lag < 1) error("jac_lag must be at least 1 in DiscreteProblem::solve_newton().");
+  if (static_condensation) error("DiscreteProblem::solve_newton() does not support the static condensation.");
+  int ndof = this->get_num_dofs();
+  if (coeff_vec->get_size() != ndof) error("Bad vector length in DiscreteProblem::solve_newton().");
 
-  // Select matrix solver.
-  Matrix* mat; Vector* rhs; CommonSolver* solver;
-  init_matrix_solver(matrix_solver, ndof, mat, rhs, solver, is_complex);
+  memset(&newton_stats, 0, sizeof(NewtonStats));
+  TimePeriod cpu_time;
 
+  // Number of solves with the current Jacobian, -1 if there is none yet.
+  int jac_age = -1;
+  double last_norm = -1.0;
   int it = 1;
   while (1)
   {
-    // Assemble the Jacobian matrix and residual vector.
-    bool rhsonly = false;
+    // Assemble the residual vector, and the Jacobian matrix if it is due.
+    bool new_jac = (jac_age < 0 || jac_age >= jac_lag);
+    cpu_time.tick(HERMES_SKIP);
     // the NULL stands for the dir vector which is not needed here
-    dp.assemble(coeff_vec, mat, NULL, rhs, rhsonly, is_complex);
+    assemble(coeff_vec, mat, NULL, rhs, !new_jac, is_complex);
+    cpu_time.tick();
+    if (new_jac) { newton_stats.jac_time += cpu_time.last(); newton_stats.num_jac++; }
+    else { newton_stats.res_time += cpu_time.last(); newton_stats.num_res++; }
 
     // Multiply the residual vector with -1 since the matrix 
     // equation reads J(Y^n) \deltaY^{n+1} = -F(Y^n).
@@ -1458,29 +2777,93 @@ bool solve_newton(Tuple<Space *> spaces, WeakForm* wf, Vector* coeff_vec,
     double res_l2_norm;
     if (!is_complex) res_l2_norm = get_l2_norm_real(rhs);
     else res_l2_norm = get_l2_norm_cplx(rhs);
-    if (verbose) info("---- Newton iter %d, ndof %d, res. l2 norm %g", 
-                        it, get_num_dofs(spaces), res_l2_norm);
+    cpu_time.tick();
+    newton_stats.res_time += cpu_time.last();
+    if (verbose) info("---- Newton iter %d, ndof %d, res. l2 norm %g%s", 
+                      it, ndof, res_l2_norm, new_jac ? "" : " (lagged Jacobian)");
 
     // If l2 norm of the residual vector is in tolerance, quit.
-    if (res_l2_norm < newton_tol|| it > newton_max_iter) break;
+    if (res_l2_norm < newton_tol || it > newton_max_iter) break;
+
+    // The lagged Jacobian does not reduce the residual enough anymore,
+    // assemble it again at the current iterate.
+    if (!new_jac && res_l2_norm > stall_ratio * last_norm)
+    {
+      if (verbose) info("---- Residual reduction stalled, reassembling the Jacobian.");
+      cpu_time.tick(HERMES_SKIP);
+      assemble(coeff_vec, mat, NULL, rhs, false, is_complex);
+      if (is_complex)
+        for (int i = 0; i < ndof; i++) rhs->set(i, -rhs->get_cplx(i));
+      else
+        for (int i = 0; i < ndof; i++) rhs->set(i, -rhs->get(i));
+      cpu_time.tick();
+      newton_stats.jac_time += cpu_time.last();
+      newton_stats.num_jac++;
+      new_jac = true;
+    }
+    if (new_jac) jac_age = 0;
+    last_norm = res_l2_norm;
 
     // Solve the matrix problem.
+    solver->set_matrix_changed(new_jac);
+    cpu_time.tick(HERMES_SKIP);
     if (!solver->solve(mat, rhs)) error ("Matrix solver failed.\n");
+    cpu_time.tick();
+    newton_stats.solve_time += cpu_time.last();
+    newton_stats.num_iter++;
+    jac_age++;
 
     // Add \deltaY^{n+1} to Y^n.
     if (is_complex)
       for (int i = 0; i < ndof; i++) coeff_vec->add(i, rhs->get_cplx(i));
     else
       for (int i = 0; i < ndof; i++) coeff_vec->add(i, rhs->get(i));
-      
-    
+
     it++;
-  };
+  }
+  // The next user of the solver may pass a different matrix.
+  solver->set_matrix_changed(true);
+
+  verbose("Newton: %d iterations, %d Jacobians, %d residuals only", newton_stats.num_iter,
+          newton_stats.num_jac, newton_stats.num_res);
+  report_time("Newton: Jacobian assembling %g s, residual %g s, solve %g s",
+              newton_stats.jac_time, newton_stats.res_time, newton_stats.solve_time);
+
+  return (it <= newton_max_iter);
+}
+
+// Basic Newton's method, takes a coefficient vector and returns a coefficient vector. 
+bool solve_newton(Tuple<Space *> spaces, WeakForm* wf, Vector* coeff_vec, 
+                  MatrixSolverType matrix_solver, double newton_tol, 
+                  int newton_max_iter, bool verbose, bool is_complex) 
+{
+  int ndof = get_num_dofs(spaces);
+  
+  // sanity checks
+  if (coeff_vec == NULL) error("coeff_vec == NULL in solve_newton().");
+  int n = spaces.size();
+  if (spaces.size() != wf->neq) 
+    error("The number of spaces in newton_solve() must match the number of equation in the PDE system.");
+  for (int i=0; i < n; i++) {
+    if (spaces[i] == NULL) error("spaces[%d] is NULL in solve_newton().", i);
+  }
+  if (coeff_vec->get_size() != ndof) error("Bad vector length in solve_newton().");
+
+  // Initialize the discrete problem.
+  DiscreteProblem dp(wf, spaces);
+  //info("ndof = %d", dp.get_num_dofs());
+
+  // Select matrix solver.
+  Matrix* mat; Vector* rhs; CommonSolver* solver;
+  init_matrix_solver(matrix_solver, ndof, mat, rhs, solver, is_complex);
+
+  bool success = dp.solve_newton(coeff_vec, mat, rhs, solver, newton_tol, newton_max_iter,
+                                 1, 0.5, verbose, is_complex);
 
   delete rhs;
   delete mat;
   delete solver; // TODO: Create destructors for solvers.
-  return (it <= newton_max_iter);
+  return success;
 }
 
 // Solves a typical nonlinear problem using the Newton's method and 
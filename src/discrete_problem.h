@@ -37,6 +37,8 @@ class Space;
 class PrecalcShapeset;
 class WeakForm;
 class CommonSolver;
+class AsmRecMatrix;
+class AsmRecVector;
 
 // Default H2D projection norm in H1 norm.
 extern int H2D_DEFAULT_PROJ_NORM;
@@ -103,6 +105,96 @@ public:
   virtual void assemble(Vector* init_vec, Matrix* mat_ext, Vector* dir_ext, Vector* rhs_ext, 
                         bool rhsonly = false, bool is_complex = false);
 
+  /// Sets the number of threads used by assemble(). The default is one, i.e., the
+  /// serial assembling. With more threads, the traversal states are distributed among
+  /// the threads, each of them having its own precalculated shapesets, reference maps
+  /// and integration caches. The local matrices and vectors are recorded and added to
+  /// the global ones in the serial order afterwards, so the result is the same for any
+  /// number of threads. Weak forms with external functions are always assembled serially.
+  void set_num_threads(int num_threads);
+  int get_num_threads() const { return num_threads; }
+
+  /// Keeps the reference map tables (jacobians, inverse maps, physical coordinates) of
+  /// the elements between assemblings, up to max_memory bytes per mesh, so that repeated
+  /// assemblings on an unchanged mesh (Newton iterations, time steps) do not compute
+  /// the geometry again. The tables are dropped when the mesh changes; when the budget
+  /// is exceeded, the least recently used elements are dropped. Zero (the default)
+  /// switches the cache off. Only the serial assembling uses the cache.
+  void set_geom_cache(size_t max_memory);
+  size_t get_geom_cache_max_memory() const { return geom_cache_memory; }
+
+  /// Returns the geometry cache of the mesh of the i-th space, or NULL if there is none yet.
+  GeomCache* get_geom_cache(int i) const;
+
+  /// Returns how many times assemble() created the sparse structure of the matrix, and how
+  /// many times it reused the structure of the previous assembling. The structure of a
+  /// PatternMatrix is reused as long as the spaces (their DOF assignment and meshes) and the
+  /// weak form do not change, e.g., in Newton iterations and time steps. Only the values
+  /// are zeroed then.
+  int get_num_struct_created() const { return num_struct_created; }
+  int get_num_struct_reused() const { return num_struct_reused; }
+
+  /// Statistics of the sparse structure last created by assemble() in a PatternMatrix: the
+  /// number of nonzero entries, the memory taken by the matrix in bytes (the index arrays
+  /// and the values) and the CPU time of the symbolic phase. The structure is built from
+  /// the assembly lists of the elements; a block of the matrix gets entries only on the
+  /// elements (and boundary edges) where some form of the block is defined.
+  int get_struct_nnz() const { return struct_nnz; }
+  size_t get_struct_memory() const { return struct_memory; }
+  double get_struct_time() const { return struct_time; }
+
+  /// Enables the static condensation of the bubble DOFs. assemble() then eliminates the
+  /// bubble functions of each element from its local system (by the Schur complement of
+  /// their block) before adding it to the global one, which is thus smaller and sparser,
+  /// especially for high orders. The global system only has the other DOFs, numbered in
+  /// their original order without the gaps; its solution is extended to all DOFs by
+  /// recover_bubble_dofs(). Each element must be assembled at once, i.e., all spaces on
+  /// the same mesh and one assembling stage. The right-hand side only assembling and
+  /// solve_newton() are not supported.
+  void set_static_condensation(bool enable);
+  bool get_static_condensation() const { return static_condensation; }
+
+  /// Makes assemble() visit the base elements in the order of Mesh::reorder() (see
+  /// Traverse::set_base_order()), which improves the cache locality on a reordered mesh.
+  /// Disabled by default, as the entries are then summed in a different order.
+  void set_base_order_traversal(bool enable) { base_order_traversal = enable; }
+  bool get_base_order_traversal() const { return base_order_traversal; }
+
+  /// Returns the number of the DOFs eliminated by the last assemble(), zero if the static
+  /// condensation is disabled.
+  int get_num_condensed_dofs() const { return static_condensation ? cond_ndof_full - cond_ndof : 0; }
+
+  /// Calculates the coefficient vector of all DOFs 'vec' (it is resized if necessary) from
+  /// the solution 'cond_vec' of the condensed system mat * x = rhs - dir assembled by the
+  /// last assemble() (as LinearProblem::assemble() makes it, or mat * x = rhs if there was
+  /// no 'dir'). The bubble DOFs are obtained element by element from the stored factors.
+  void recover_bubble_dofs(Vector* cond_vec, Vector* vec);
+
+  /// Newton's method with a lagged Jacobian. Takes a coefficient vector and delivers
+  /// a coefficient vector. The Jacobian is assembled at most every 'jac_lag' iterations,
+  /// in the iterations between only the residual is assembled and the matrix of the last
+  /// Jacobian assembling is solved again. The solver is told that the matrix did not change
+  /// then, so a solver keeping its factorization does not refactorize it. The Jacobian is
+  /// reassembled earlier if a lagged iteration reduces the residual norm by less than the
+  /// factor 'stall_ratio'. The matrix solver must not overwrite 'mat'. With jac_lag = 1
+  /// this is the standard Newton's method. Returns true if the residual norm dropped
+  /// below 'newton_tol' within 'newton_max_iter' iterations.
+  bool solve_newton(Vector* coeff_vec, Matrix* mat, Vector* rhs, CommonSolver* solver,
+                    double newton_tol = 1e-5, int newton_max_iter = 100, int jac_lag = 1,
+                    double stall_ratio = 0.5, bool verbose = false, bool is_complex = false);
+
+  /// Statistics of the last solve_newton() call.
+  struct NewtonStats
+  {
+    int num_iter;       ///< number of Newton iterations, i.e., linear solves
+    int num_jac;        ///< number of Jacobian assemblings
+    int num_res;        ///< number of residual-only assemblings
+    double jac_time;    ///< time of the Jacobian assemblings (including their residuals)
+    double res_time;    ///< time of the residual-only assemblings and residual norms
+    double solve_time;  ///< time spent in the matrix solver
+  };
+  const NewtonStats& get_newton_stats() const { return newton_stats; }
+
   /// Basic function that just solves the matrix problem. The right-hand
   /// side enters through "vec" and the result is stored in "vec" as well. 
   bool solve_matrix_problem(Matrix* mat, Vector* vec); 
@@ -161,10 +253,83 @@ protected:
   void insert_block(Matrix *A, scalar** mat, int* iidx, int* jidx,
           int ilen, int jlen);
 
+  /// Symbolic phase of the assembling: registers the nonzero entries of all
+  /// element stiffness matrices in 'mat' and allocates its compressed structure.
+  void create_pattern(PatternMatrix* mat, int ndof);
+
+  /// Returns true if the spaces and the weak form have not changed since the
+  /// sparse structure of 'mat_ext' was created.
+  bool is_up_to_date(Matrix* mat_ext);
+
+  /// Data of one assembling thread: solutions from the previous iteration,
+  /// slave precalculated shapesets for test functions, reference maps and
+  /// assembly lists of all spaces.
+  struct AsmContext
+  {
+    Tuple<Solution*> u_ext;
+    std::vector<PrecalcShapeset*> spss;
+    RefMap* refmap;
+    std::vector<AsmList> al;
+    std::vector<bool> nat, isempty;
+  };
+
+  void init_context(AsmContext& ctx, Tuple<Solution*> u_ext);
+  void free_context(AsmContext& ctx);
+
+  /// Assembles all forms of the stage 's' on the current traversal state.
+  void assemble_state(WeakForm::Stage* s, Element** e, bool* bnd, EdgePos* ep, Element* base,
+                      AsmContext& ctx, Matrix* mat_ext, Vector* dir_ext, Vector* rhs_ext,
+                      bool rhsonly);
+
+  /// Multithreaded counterpart of the traversal loop in assemble().
+  void assemble_parallel(Vector* init_vec, std::vector<WeakForm::Stage>& stages, AsmContext& ctx,
+                         Matrix* mat_ext, Vector* dir_ext, Vector* rhs_ext, bool rhsonly);
+
+  /// Static condensation: the DOF numbers in the condensed system (-1 for the bubble DOFs
+  /// not eliminated yet, -2 for the eliminated ones) and the sizes of both systems.
+  bool static_condensation;
+  std::vector<int> cond_dof;
+  bool base_order_traversal;
+  int cond_ndof, cond_ndof_full;
+
+  /// Data of an eliminated traversal state: the bubble DOFs are x_b = y - X x_i, where x_i
+  /// are the interface DOFs. cond_idx holds the condensed numbers of the interface DOFs and
+  /// the numbers of the bubble DOFs from 'idx', cond_val holds the rows of X and then y from 'val'.
+  struct CondensedState { int idx, ni, nb; size_t val; };
+  std::vector<CondensedState> cond_states;
+  std::vector<int> cond_idx;
+  std::vector<scalar> cond_val;
+
+  /// Work arrays of condense_state(): local indices of the DOFs (-1 if not in the state),
+  /// the DOFs of the state and its dense local system.
+  std::vector<int> cond_local, cond_dofs;
+  std::vector<scalar> cond_sys;
+
+  /// Numbers the DOFs of the condensed system, returns its size.
+  int init_condensation(int ndof);
+
+  /// Eliminates the bubble DOFs from the local system recorded for one state and adds
+  /// the rest to the global matrix and vectors.
+  void condense_state(AsmRecMatrix* mat, int mfirst, int mlast, AsmRecVector* dir, int dfirst,
+                      int dlast, AsmRecVector* rhs, int rfirst, int rlast, Matrix* mat_ext,
+                      Vector* dir_ext, Vector* rhs_ext);
+  struct AsmState;
+  struct AsmStateList;
+  struct AsmThread;
+  DiscreteProblem* create_worker();
+  static void* assemble_thread(void* data);
+
+  int num_threads;
+
+  size_t geom_cache_memory;
+  std::vector<GeomCache*> geom_caches; ///< one per mesh, created on demand
+  GeomCache* acquire_geom_cache(int i);
+
   ExtData<Ord>* init_ext_fns_ord(std::vector<MeshFunction *> &ext);
   ExtData<Ord>* init_ext_fns_ord(std::vector<MeshFunction *> &ext, int edge);
   ExtData<scalar>* init_ext_fns(std::vector<MeshFunction *> &ext, RefMap *rm, const int order);
   Func<double>* get_fn(PrecalcShapeset *fu, RefMap *rm, const int order);
+  Func<scalar>* get_fn(MeshFunction *fu, RefMap *rm, const int order);
 
   // Key for caching transformed function values on elements
   struct Key
@@ -209,12 +374,49 @@ protected:
 
   // Caching transformed values for element
   std::map<Key, Func<double>*, Compare> cache_fn;
+  // Caching values of previous solutions and external functions for element
+  std::map<std::pair<MeshFunction*, int>, Func<scalar>*> cache_ext;
   Geom<double>* cache_e[g_max_quad + 1 + 4 * g_max_quad + 4];
   double* cache_jwt[g_max_quad + 1 + 4 * g_max_quad + 4];
 
   void init_cache();
   void delete_cache();
 
+  // Key for caching integration orders of forms
+  struct OrderKey
+  {
+    void* form;
+    int mode;
+    int inv_ref_order;
+    std::vector<int> orders; ///< orders of previous solutions, shape functions and ext. functions
+
+    bool operator<(const OrderKey& b) const
+    {
+      if (form != b.form) return form < b.form;
+      if (mode != b.mode) return mode < b.mode;
+      if (inv_ref_order != b.inv_ref_order) return inv_ref_order < b.inv_ref_order;
+      return orders < b.orders;
+    }
+  };
+
+  // Caching integration orders of forms (before limiting), kept across assemble() calls
+  // as long as the weak form does not change
+  std::map<OrderKey, int> cache_order;
+  OrderKey order_key;
+  int cache_order_seq;
+
+  void init_order_key(void* form, RefMap* rm, Tuple<Solution *> &sln, int inc, int edge);
+  int calc_order(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln, PrecalcShapeset *fu,
+                 PrecalcShapeset *fv, RefMap *ru);
+  int calc_order(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln, int u_order,
+                 int v_order, int inc, RefMap *ru);
+  int calc_order(WeakForm::VectorFormVol *vfv, Tuple<Solution *> &sln, PrecalcShapeset *fv,
+                 RefMap *rv);
+  int calc_order(WeakForm::MatrixFormSurf *mfs, Tuple<Solution *> &sln, PrecalcShapeset *fu,
+                 PrecalcShapeset *fv, RefMap *ru, EdgePos* ep);
+  int calc_order(WeakForm::VectorFormSurf *vfs, Tuple<Solution *> &sln, PrecalcShapeset *fv,
+                 RefMap *rv, EdgePos* ep);
+
   // evaluation of forms, general case
   scalar eval_form(WeakForm::MatrixFormVol *bf, Tuple<Solution *> sln, PrecalcShapeset *fu, 
                    PrecalcShapeset *fv, RefMap *ru, RefMap *rv);
@@ -225,6 +427,20 @@ protected:
   scalar eval_form(WeakForm::VectorFormSurf *lf, Tuple<Solution *> sln, PrecalcShapeset *fv, 
                    RefMap *rv, EdgePos* ep);
 
+  // evaluation of batched forms
+  void eval_form_block(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> &sln, PrecalcShapeset *fu,
+                       PrecalcShapeset *fv, RefMap *ru, RefMap *rv, AsmList *an, AsmList *am,
+                       scalar **mat);
+  void init_fn_block(FuncBlock *blk, std::vector<double> &buf, PrecalcShapeset *fu, RefMap *rm,
+                     AsmList *al, const int order, int np);
+  std::vector<double> blk_buf_u, blk_buf_v;
+
+  // evaluation of standard forms
+  bool eval_std_form_affine(WeakForm::MatrixFormVol *mfv, PrecalcShapeset *fu, PrecalcShapeset *fv,
+                            RefMap *ru, RefMap *rv, AsmList *an, AsmList *am, scalar **mat);
+  void eval_std_form(WeakForm::MatrixFormVol *mfv, int np, double *jwt, FuncBlock *u, FuncBlock *v,
+                     scalar **mat);
+
   scalar** get_matrix_buffer(int n)
   {
     if (n <= mat_size) return buffer;
@@ -237,6 +453,13 @@ protected:
 
   int* sp_seq;
   int wf_seq;
+  std::vector<unsigned> mesh_seq; ///< mesh sequence numbers of the spaces when the structure was created
+  Matrix* struct_mat;             ///< the matrix whose sparse structure corresponds to sp_seq, mesh_seq, wf_seq
+  int num_struct_created, num_struct_reused;
+  int struct_nnz;
+  size_t struct_memory;
+  double struct_time;
+  NewtonStats newton_stats;
   int num_user_pss;
   bool values_changed;
   bool struct_changed;
@@ -244,9 +467,12 @@ protected:
 
 H2D_API int get_num_dofs(Tuple<Space *> spaces);
 
+/// Creates the matrix, the right-hand side and the solver of the given type. The matrix is
+/// a CooMatrix, or a PatternMatrix if 'use_pattern_matrix' is true (see PatternMatrix).
 H2D_API void init_matrix_solver(MatrixSolverType matrix_solver, int ndof, 
                         Matrix* &mat, Vector* &rhs, 
-                        CommonSolver* &solver, bool is_complex = false);
+                        CommonSolver* &solver, bool is_complex = false,
+                        bool use_pattern_matrix = false);
 
 // Underlying function for global orthogonal projection.
 // Not intended for the user. NOTE: the weak form here must be 
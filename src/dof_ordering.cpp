@@ -0,0 +1,335 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include "dof_ordering.h"
+
+
+/// Breadth-first searches restricted to the vertices with a given label, shared by both
+/// orderings. Vertices which are already numbered have the label -1.
+class GraphSearch
+{
+public:
+
+  GraphSearch(int n, const int* xadj, const int* adj)
+    : n(n), xadj(xadj), adj(adj), label(n, 0), level(n, 0), mark(n, 0), stamp(0) {}
+
+  int degree(int v) const { return xadj[v+1] - xadj[v]; }
+
+  /// Builds the level structure rooted at 'root': 'verts' lists the reached vertices level
+  /// by level, the level 'l' starts at verts[lstart[l]].
+  void bfs(int root, int lab, std::vector<int>& verts, std::vector<int>& lstart)
+  {
+    verts.clear();
+    lstart.clear();
+    stamp++;
+    verts.push_back(root);
+    mark[root] = stamp;
+    level[root] = 0;
+    size_t begin = 0;
+    while (begin < verts.size())
+    {
+      size_t end = verts.size();
+      lstart.push_back(begin);
+      for (size_t k = begin; k < end; k++)
+      {
+        int v = verts[k];
+        for (int j = xadj[v]; j < xadj[v+1]; j++)
+        {
+          int w = adj[j];
+          if (label[w] == lab && mark[w] != stamp)
+          {
+            mark[w] = stamp;
+            level[w] = level[v] + 1;
+            verts.push_back(w);
+          }
+        }
+      }
+      begin = end;
+    }
+    lstart.push_back(verts.size());
+  }
+
+  /// Finds a pseudo-peripheral vertex of the component of 'root' (the algorithm of Gibbs,
+  /// Poole and Stockmeyer as modified by George and Liu). On return, 'verts' and 'lstart'
+  /// contain its level structure.
+  int pseudo_peripheral(int root, int lab, std::vector<int>& verts, std::vector<int>& lstart)
+  {
+    bfs(root, lab, verts, lstart);
+    while (true)
+    {
+      int nlev = lstart.size() - 1;
+      int best = -1;
+      for (int k = lstart[nlev-1]; k < lstart[nlev]; k++)
+        if (best < 0 || degree(verts[k]) < degree(best))
+          best = verts[k];
+
+      std::vector<int> v2, l2;
+      bfs(best, lab, v2, l2);
+      if ((int) l2.size() - 1 <= nlev) break;
+      root = best;
+      verts.swap(v2);
+      lstart.swap(l2);
+    }
+    // the last search was not accepted, repeat the one from the root
+    bfs(root, lab, verts, lstart);
+    return root;
+  }
+
+  int n;
+  const int* xadj;
+  const int* adj;
+  std::vector<int> label;
+  std::vector<int> level;
+  std::vector<int> mark;
+  int stamp;
+};
+
+
+void rcm_ordering(int n, const int* xadj, const int* adj, int* order)
+{
+  GraphSearch gs(n, xadj, adj);
+  std::vector<int> verts, lstart;
+  std::vector<std::pair<int, int> > nbrs;
+
+  int num = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (gs.label[i] < 0) continue;
+    int root = gs.pseudo_peripheral(i, 0, verts, lstart);
+
+    // Cuthill-McKee: number the vertices in the order of the search, the unnumbered
+    // neighbors of each vertex in the order of increasing degree
+    int first = num;
+    order[num++] = root;
+    gs.label[root] = -1;
+    for (int k = first; k < num; k++)
+    {
+      int v = order[k];
+      nbrs.clear();
+      for (int j = xadj[v]; j < xadj[v+1]; j++)
+        if (gs.label[adj[j]] >= 0)
+        {
+          nbrs.push_back(std::make_pair(gs.degree(adj[j]), adj[j]));
+          gs.label[adj[j]] = -1;
+        }
+      std::sort(nbrs.begin(), nbrs.end());
+      for (size_t j = 0; j < nbrs.size(); j++)
+        order[num++] = nbrs[j].second;
+    }
+  }
+  assert(num == n);
+  std::reverse(order, order + n);
+}
+
+
+/// Recursive part of the nested dissection.
+class NestedDissection : public GraphSearch
+{
+public:
+
+  NestedDissection(int n, const int* xadj, const int* adj, const int* weights, int* order)
+    : GraphSearch(n, xadj, adj), weights(weights), order(order), num(0), next_label(1) {}
+
+  static const int LEAF_SIZE = 32; ///< parts up to this size are not split
+
+  /// Numbers the vertices 'verts', all of which have the label 'lab'.
+  void dissect(const std::vector<int>& verts, int lab)
+  {
+    std::vector<int> lv, ls;
+    if ((int) verts.size() <= LEAF_SIZE) { number_leaf(verts, lab); return; }
+
+    bfs(verts[0], lab, lv, ls);
+    if (lv.size() < verts.size())
+    {
+      // split the part into its components first
+      std::vector<std::vector<int> > comps;
+      std::vector<int> labels;
+      for (size_t i = 0; i < verts.size(); i++)
+      {
+        if (label[verts[i]] != lab) continue;
+        bfs(verts[i], lab, lv, ls);
+        int l = next_label++;
+        for (size_t k = 0; k < lv.size(); k++)
+          label[lv[k]] = l;
+        comps.push_back(lv);
+        labels.push_back(l);
+      }
+      for (size_t c = 0; c < comps.size(); c++)
+        dissect(comps[c], labels[c]);
+      return;
+    }
+
+    pseudo_peripheral(verts[0], lab, lv, ls);
+    int nlev = ls.size() - 1;
+    if (nlev < 3) { number_leaf(verts, lab); return; }
+
+    // find the level at the median of the weights
+    int64_t total = 0, sum = 0;
+    for (size_t k = 0; k < lv.size(); k++)
+      total += weight(lv[k]);
+    int m;
+    for (m = 0; m < nlev - 2; m++)
+    {
+      for (int k = ls[m]; k < ls[m+1]; k++)
+        sum += weight(lv[k]);
+      if (2 * sum >= total) break;
+    }
+    if (m < 1) m = 1;
+
+    // the separator consists of the vertices of the level 'm' adjacent to the level 'm+1',
+    // the rest of the level goes to the first part
+    std::vector<int> part1, part2, sep;
+    int l1 = next_label++, l2 = next_label++;
+    for (int k = 0; k < ls[m]; k++)
+      part1.push_back(lv[k]);
+    for (int k = ls[m]; k < ls[m+1]; k++)
+    {
+      int v = lv[k];
+      bool adjacent = false;
+      for (int j = xadj[v]; j < xadj[v+1] && !adjacent; j++)
+        if (label[adj[j]] == lab && level[adj[j]] == m + 1)
+          adjacent = true;
+      (adjacent ? sep : part1).push_back(v);
+    }
+    for (int k = ls[m+1]; k < ls[nlev]; k++)
+      part2.push_back(lv[k]);
+
+    for (size_t k = 0; k < part1.size(); k++) label[part1[k]] = l1;
+    for (size_t k = 0; k < part2.size(); k++) label[part2[k]] = l2;
+    for (size_t k = 0; k < sep.size(); k++) label[sep[k]] = -1;
+
+    dissect(part1, l1);
+    dissect(part2, l2);
+    for (size_t k = 0; k < sep.size(); k++)
+      order[num++] = sep[k];
+  }
+
+  /// Numbers a small part in the order of breadth-first searches from pseudo-peripheral
+  /// vertices of its components.
+  void number_leaf(const std::vector<int>& verts, int lab)
+  {
+    std::vector<int> lv, ls;
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+      if (label[verts[i]] != lab) continue;
+      pseudo_peripheral(verts[i], lab, lv, ls);
+      for (size_t k = 0; k < lv.size(); k++)
+      {
+        order[num++] = lv[k];
+        label[lv[k]] = -1;
+      }
+    }
+  }
+
+  int weight(int v) const { return weights ? weights[v] : 1; }
+
+  const int* weights;
+  int* order;
+  int num;
+  int next_label;
+};
+
+
+void nested_dissection_ordering(int n, const int* xadj, const int* adj,
+                                const int* weights, int* order)
+{
+  if (n <= 0) return;
+  NestedDissection nd(n, xadj, adj, weights, order);
+  std::vector<int> verts(n);
+  for (int i = 0; i < n; i++)
+    verts[i] = i;
+  nd.dissect(verts, 0);
+  assert(nd.num == n);
+}
+
+
+void get_sparsity_stats(int n, const int* xadj, const int* adj, const int* order,
+                        SparsityStats& stats)
+{
+  std::vector<int> pos(n);
+  for (int k = 0; k < n; k++)
+    pos[order ? order[k] : k] = k;
+
+  stats.size = n;
+  stats.nnz = n + (n ? xadj[n] : 0);
+  stats.bandwidth = 0;
+  stats.profile = 0;
+  stats.factor_nnz = 0;
+
+  // the elimination tree (with path compression) and the row counts of L, which are
+  // the sizes of the row subtrees of the elimination tree
+  std::vector<int> parent(n), ancestor(n), mark(n);
+  for (int k = 0; k < n; k++)
+  {
+    int v = order ? order[k] : k;
+    parent[k] = ancestor[k] = -1;
+    int first = k;
+    for (int j = xadj[v]; j < xadj[v+1]; j++)
+    {
+      int c = pos[adj[j]];
+      stats.bandwidth = std::max(stats.bandwidth, abs(k - c));
+      if (c >= k) continue;
+      first = std::min(first, c);
+      for (int i = c; i != -1 && i < k; )
+      {
+        int next = ancestor[i];
+        ancestor[i] = k;
+        if (next == -1) parent[i] = k;
+        i = next;
+      }
+    }
+    stats.profile += k - first;
+
+    mark[k] = k;
+    stats.factor_nnz++;
+    for (int j = xadj[v]; j < xadj[v+1]; j++)
+    {
+      int c = pos[adj[j]];
+      if (c >= k) continue;
+      for (int i = c; mark[i] != k; i = parent[i])
+      {
+        mark[i] = k;
+        stats.factor_nnz++;
+      }
+    }
+  }
+}
+
+
+void get_sparsity_stats(int n, int nnz, const int* row, const int* col, SparsityStats& stats)
+{
+  std::vector<std::pair<int, int> > pairs;
+  pairs.reserve(2 * nnz);
+  for (int i = 0; i < nnz; i++)
+  {
+    if (row[i] == col[i]) continue;
+    pairs.push_back(std::make_pair(row[i], col[i]));
+    pairs.push_back(std::make_pair(col[i], row[i]));
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+  std::vector<int> xadj(n + 1, 0), adj(pairs.size());
+  for (size_t i = 0; i < pairs.size(); i++)
+  {
+    xadj[pairs[i].first + 1]++;
+    adj[i] = pairs[i].second;
+  }
+  for (int i = 0; i < n; i++)
+    xadj[i+1] += xadj[i];
+
+  get_sparsity_stats(n, &xadj[0], adj.empty() ? NULL : &adj[0], NULL, stats);
+}
@@ -0,0 +1,65 @@
+// This file is part of Hermes2D.
+//
+// Hermes2D is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// Hermes2D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Hermes2D.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef __H2D_DOF_ORDERING_H
+#define __H2D_DOF_ORDERING_H
+
+#include "common.h"
+
+// Orderings of sparse symmetric graphs, used by Space::assign_dofs() to renumber the DOFs.
+// A graph of 'n' vertices is given in the compressed form: the neighbors of the vertex 'i'
+// are adj[xadj[i]] ... adj[xadj[i+1]-1]. The adjacency must be symmetric and must not
+// contain the vertex itself. The resulting 'order' lists the vertices in their new order,
+// i.e., order[k] is the old index of the vertex which becomes k-th.
+
+
+/// Reverse Cuthill-McKee ordering. Each connected component is numbered by a breadth-first
+/// search from a pseudo-peripheral vertex, visiting the neighbors in the order of increasing
+/// degree; the result is reversed. Reduces the bandwidth and the profile of the matrix.
+H2D_API void rcm_ordering(int n, const int* xadj, const int* adj, int* order);
+
+/// Nested dissection ordering. The graph is split recursively by level-structure separators
+/// (a level of the breadth-first search from a pseudo-peripheral vertex, at the median of
+/// the weights); the separators are numbered after both parts. Small parts are numbered in
+/// the breadth-first order. Reduces the fill-in of the factorization.
+/// \param weights [in] Weights of the vertices (e.g., the number of DOFs they represent),
+///                     or NULL if all are equal to one.
+H2D_API void nested_dissection_ordering(int n, const int* xadj, const int* adj,
+                                        const int* weights, int* order);
+
+
+/// Characteristics of the sparsity pattern of a symmetric matrix.
+struct H2D_API SparsityStats
+{
+  int size;           ///< number of rows
+  int64_t nnz;        ///< number of nonzeros (including the diagonal)
+  int bandwidth;      ///< maximum of |i - j| over the nonzeros
+  int64_t profile;    ///< sum of the distances of the first nonzero in each row from the diagonal
+  int64_t factor_nnz; ///< number of nonzeros of the Cholesky factor L (including the diagonal)
+};
+
+/// Calculates the sparsity statistics of the matrix whose pattern is the graph plus the
+/// diagonal, numbered by 'order' (see above; NULL means the identity). The fill of the factor
+/// is obtained symbolically, from the elimination tree, i.e., without pivoting.
+H2D_API void get_sparsity_stats(int n, const int* xadj, const int* adj, const int* order,
+                                SparsityStats& stats);
+
+/// Calculates the sparsity statistics of a matrix given by its nonzeros (e.g., by
+/// CooMatrix::get_row_col_data()). The pattern is symmetrized.
+H2D_API void get_sparsity_stats(int n, int nnz, const int* row, const int* col,
+                                SparsityStats& stats);
+
+
+#endif
@@ -535,6 +535,8 @@ void FeProblem::delete_cache()
 // Actual evaluation of volume matrix form (calculates integral)
 scalar FeProblem::eval_form(WeakForm::MatrixFormVol *mfv, Tuple<Solution *> u_ext, PrecalcShapeset *fu, PrecalcShapeset *fv, RefMap *ru, RefMap *rv)
 {
+  if (mfv->fn == NULL) error("Batched matrix forms are supported by DiscreteProblem only.");
+
   // determine the integration order
   int inc = (fu->get_num_components() == 2) ? 1 : 0;
   AUTOLA_OR(Func<Ord>*, oi, wf->neq);
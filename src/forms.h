@@ -210,6 +210,21 @@ public:
   }
 };
 
+/// Values of all shape functions of an element at the integration points, as passed
+/// to batched matrix forms (see WeakForm::add_matrix_form_block()). The tables are
+/// stored point by point: the value of the k-th function at the i-th point is
+/// val[i * nf + k], so that loops over the functions run through contiguous memory.
+class FuncBlock
+{
+public:
+  int nf;               ///< number of functions
+  int np;               ///< number of integration points
+  double *val;          ///< function values
+  double *dx, *dy;      ///< derivatives
+
+  FuncBlock() : nf(0), np(0), val(NULL), dx(NULL), dy(NULL) {}
+};
+
 /// Init element geometry for calculating the integration order
 Geom<Ord>* init_geom_ord();
 /// Init element geometry for volumetric integrals
@@ -122,7 +122,13 @@ public:
   ///   H2D_FN_VAL | H2D_FN_DX | H2D_FN_DY. You can also use H2D_FN_ALL to precalculate everything.
   void set_quad_order(int order, int mask = H2D_FN_DEFAULT)
   {
-    pp_cur_node = (void**) JudyLIns(nodes, order, NULL);
+    if (order_table != NULL)
+    {
+      assert(order >= 0 && order < order_table_len);
+      pp_cur_node = (void**) (order_table + order);
+    }
+    else
+      pp_cur_node = (void**) JudyLIns(nodes, order, NULL);
     // if you get SIGSEGV here, you maybe forgot to include the function in the list
     // of external functions in WeakForm::add_biform()...
     cur_node = (Node*) *pp_cur_node;
@@ -254,6 +260,9 @@ protected:
   void*  overflow_nodes;
   Node*  cur_node;
 
+  Node** order_table;   ///< dense node table indexed by order; used instead of 'nodes' if not NULL
+  int order_table_len;  ///< number of entries in 'order_table'
+
   void update_nodes_ptr()
   {
     if (sub_idx > H2D_MAX_IDX)
@@ -277,6 +286,8 @@ protected:
   int total_mem;    ///< total memory in bytes used by the tables
   int max_mem;      ///< peak memory usage
 
+  int   node_size(int mask, int num_points); ///< size in bytes of a Node structure with the given tables
+  Node* init_node(void* mem, int mask, int num_points); ///< sets up a Node structure in preallocated memory
   Node* new_node(int mask, int num_points); ///< allocates a new Node structure
   void  free_nodes(void** nodes);
   void  free_sub_tables(void** sub);
@@ -324,6 +335,8 @@ Function<TYPE>::Function()
 
   nodes = NULL;
   cur_node = NULL;
+  order_table = NULL;
+  order_table_len = 0;
   sub_tables = NULL;
   overflow_nodes = NULL;
 
@@ -388,18 +401,24 @@ int Function<TYPE>::idx2mask[6][2] =
 
 
 template<typename TYPE>
-typename Function<TYPE>::Node* Function<TYPE>::new_node(int mask, int num_points)
+int Function<TYPE>::node_size(int mask, int num_points)
 {
   // get the number of tables
   int nt = 0, m = mask;
   if (num_components < 2) m &= H2D_FN_VAL_0 | H2D_FN_DX_0 | H2D_FN_DY_0 | H2D_FN_DXX_0 | H2D_FN_DYY_0 | H2D_FN_DXY_0;
   while (m) { nt += m & 1; m >>= 1; }
 
-  // allocate a node including its data part, init table pointers
-  int size = H2D_Node_HDR_SIZE + sizeof(TYPE) * num_points * nt; //Due to impl. reasons, the structure Node has non-zero length of data even though they can be zero.
-  Node* node = (Node*) malloc(size);
+  return H2D_Node_HDR_SIZE + sizeof(TYPE) * num_points * nt; //Due to impl. reasons, the structure Node has non-zero length of data even though they can be zero.
+}
+
+
+template<typename TYPE>
+typename Function<TYPE>::Node* Function<TYPE>::init_node(void* mem, int mask, int num_points)
+{
+  // init table pointers
+  Node* node = (Node*) mem;
   node->mask = mask;
-  node->size = size;
+  node->size = node_size(mask, num_points);
   memset(node->values, 0, sizeof(node->values));
   TYPE* data = node->data;
   for (int j = 0; j < num_components; j++) {
@@ -409,6 +428,16 @@ typename Function<TYPE>::Node* Function<TYPE>::new_node(int mask, int num_points
         data += num_points;
       }
   }
+  return node;
+}
+
+
+template<typename TYPE>
+typename Function<TYPE>::Node* Function<TYPE>::new_node(int mask, int num_points)
+{
+  // allocate a node including its data part
+  int size = node_size(mask, num_points);
+  Node* node = init_node(malloc(size), mask, num_points);
   // todo: maybe put here copying of the old node
 
   total_mem += size;
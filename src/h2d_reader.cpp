@@ -20,7 +20,10 @@
 #include "hash.h"
 #include "mesh_parser.h"
 
-extern unsigned g_mesh_seq;
+/// Guards the mesh parser, which keeps its state in global variables.
+static pthread_mutex_t parser_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+extern unsigned next_mesh_seq();
 
 H2DReader::H2DReader()
 {
@@ -347,7 +350,7 @@ void H2DReader::load_stream(FILE *f, Mesh *mesh)
       e->cm->update_refmap_coefs(e);
 
   fclose(f);
-  mesh->seq = g_mesh_seq++;
+  mesh->seq = next_mesh_seq();
 }
 
 /*************** OLD OLD OLD ***************************************************************/
@@ -484,6 +487,7 @@ bool H2DReader::load(const char *filename, Mesh *mesh)
   mesh->free();
 
   // parse the file
+  pthread_mutex_lock(&parser_mutex);
   mesh_parser_init(f, filename);
   mesh_parser_run(debug);
   fclose(f);
@@ -673,7 +677,8 @@ bool H2DReader::load(const char *filename, Mesh *mesh)
   mesh->ninitial = mesh->elements.get_num_items();
 
   mesh_parser_free();
-  mesh->seq = g_mesh_seq++;
+  pthread_mutex_unlock(&parser_mutex);
+  mesh->seq = next_mesh_seq();
 
   return true;
 }
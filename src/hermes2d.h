@@ -68,6 +68,8 @@
 
 #include "norm.h"
 #include "graph.h"
+#include "checkpoint.h"
+#include "dof_ordering.h"
 
 #include "views/view.h"
 #include "views/base_view.h"
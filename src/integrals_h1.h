@@ -17,6 +17,7 @@
 #define __H2D_INTEGRALS_H1_H
 
 #include "limit_order.h"
+#include "forms.h"
 
 //// the following integrals can be used in both volume and surface forms //////////////////////////////////////////////////////////////////////////////
 
@@ -137,6 +138,78 @@ Scalar int_w_nabla_u_v(int n, double *wt, Func<Real> *w1, Func<Real> *w2, Func<R
   return result;
 }
 
+//// batched integrals for forms added by WeakForm::add_matrix_form_block() ///////////////////////////////////////////
+
+// These add coef * (the integral) for all pairs of test functions v and basis functions u to
+// mat[i][j]. The innermost loops run over the basis functions, which are stored contiguously
+// for each integration point, and carry no dependence, so the compiler can vectorize them.
+
+template<typename Scalar>
+void int_u_v_block(int n, double *wt, FuncBlock *u, FuncBlock *v, Scalar **mat, double coef = 1.0)
+{
+  int nu = u->nf, nv = v->nf;
+  AUTOLA_OR(double, row_buf, nu);
+  double* row = row_buf;
+  for (int i = 0; i < nv; i++)
+  {
+    for (int j = 0; j < nu; j++) row[j] = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+      double w = coef * wt[k] * v->val[k * nv + i];
+      const double* uval = u->val + k * nu;
+      for (int j = 0; j < nu; j++)
+        row[j] += w * uval[j];
+    }
+    for (int j = 0; j < nu; j++)
+      mat[i][j] += row[j];
+  }
+}
+
+template<typename Scalar>
+void int_grad_u_grad_v_block(int n, double *wt, FuncBlock *u, FuncBlock *v, Scalar **mat, double coef = 1.0)
+{
+  int nu = u->nf, nv = v->nf;
+  AUTOLA_OR(double, row_buf, nu);
+  double* row = row_buf;
+  for (int i = 0; i < nv; i++)
+  {
+    for (int j = 0; j < nu; j++) row[j] = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+      double wx = coef * wt[k] * v->dx[k * nv + i];
+      double wy = coef * wt[k] * v->dy[k * nv + i];
+      const double* udx = u->dx + k * nu;
+      const double* udy = u->dy + k * nu;
+      for (int j = 0; j < nu; j++)
+        row[j] += wx * udx[j] + wy * udy[j];
+    }
+    for (int j = 0; j < nu; j++)
+      mat[i][j] += row[j];
+  }
+}
+
+template<typename Scalar>
+void int_c_nabla_u_v_block(int n, double *wt, double c0, double c1, FuncBlock *u, FuncBlock *v, Scalar **mat)
+{
+  int nu = u->nf, nv = v->nf;
+  AUTOLA_OR(double, row_buf, nu);
+  double* row = row_buf;
+  for (int i = 0; i < nv; i++)
+  {
+    for (int j = 0; j < nu; j++) row[j] = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+      double w = wt[k] * v->val[k * nv + i];
+      const double* udx = u->dx + k * nu;
+      const double* udy = u->dy + k * nu;
+      for (int j = 0; j < nu; j++)
+        row[j] += w * (c0 * udx[j] + c1 * udy[j]);
+    }
+    for (int j = 0; j < nu; j++)
+      mat[i][j] += row[j];
+  }
+}
+
 //// error calculation for adaptivity  //////////////////////////////////////////////////////////////////////////////
 
 template<typename Real, typename Scalar>
@@ -35,11 +35,37 @@ static int default_order_table_quad[] =
 
 static int* g_order_table_quad = default_order_table_quad;
 static int* g_order_table_tri  = default_order_table_tri;
-static bool warned_order = false;
 
-H2D_API int  g_max_order;
-H2D_API int  g_safe_max_order;
-H2D_API int* g_order_table = NULL;
+/// Order limiting state of the calling thread. The key only frees it when the thread exits.
+static H2D_THREAD_LOCAL LimitOrderState* limit_order_state = NULL;
+static pthread_key_t limit_order_key;
+static pthread_once_t limit_order_once = PTHREAD_ONCE_INIT;
+
+static void free_limit_order_state(void* los)
+{
+  delete (LimitOrderState*) los;
+  limit_order_state = NULL;
+}
+
+static void create_limit_order_key()
+{
+  if (pthread_key_create(&limit_order_key, free_limit_order_state) != 0)
+    error("Could not create the key of the order limiting state.");
+}
+
+H2D_API LimitOrderState* get_limit_order_state()
+{
+  LimitOrderState* los = limit_order_state;
+  if (los == NULL)
+  {
+    pthread_once(&limit_order_once, create_limit_order_key);
+    los = limit_order_state = new LimitOrderState;
+    los->warned = false;
+    pthread_setspecific(limit_order_key, los);
+    update_limit_table(H2D_MODE_TRIANGLE);
+  }
+  return los;
+}
 
 H2D_API void set_order_limit_table(int* tri_table, int* quad_table, int n)
 {
@@ -51,22 +77,23 @@ H2D_API void set_order_limit_table(int* tri_table, int* quad_table, int n)
 
 H2D_API void update_limit_table(int mode)
 {
+  LimitOrderState* los = get_limit_order_state();
   g_quad_2d_std.set_mode(mode);
-  g_max_order = g_quad_2d_std.get_max_order();
-  g_safe_max_order = g_quad_2d_std.get_safe_max_order();
-  g_order_table = (mode == H2D_MODE_TRIANGLE) ? g_order_table_tri : g_order_table_quad;
+  los->max_order = g_quad_2d_std.get_max_order();
+  los->safe_max_order = g_quad_2d_std.get_safe_max_order();
+  los->order_table = (mode == H2D_MODE_TRIANGLE) ? g_order_table_tri : g_order_table_quad;
 }
 
 H2D_API void reset_warn_order() {
-  warned_order = false;
+  get_limit_order_state()->warned = false;
 }
 
 H2D_API void warn_order()
 {
-  if (!warned_order)
+  LimitOrderState* los = get_limit_order_state();
+  if (!los->warned)
   {
     warn("Not enough integration rules for exact integration.");
-    warned_order = true;
+    los->warned = true;
   }
 }
-
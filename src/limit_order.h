@@ -16,32 +16,48 @@
 #ifndef __H2D_LIMIT_ORDER_H
 #define __H2D_LIMIT_ORDER_H
 
-// can be called to set a custom order limiting table
+// can be called to set a custom order limiting table; the tables are shared by all threads
 extern H2D_API void set_order_limit_table(int* tri_table, int* quad_table, int n);
 
+/// Order limiting state of one thread, set by update_limit_table() for the mode of the
+/// current element. Every thread has its own, so that problems in different threads
+/// can be integrated at the same time.
+struct LimitOrderState
+{
+  int  max_order;
+  int  safe_max_order;
+  int* order_table;
+  bool warned; ///< see warn_order()
+};
+
+/// Returns the order limiting state of the calling thread.
+extern H2D_API LimitOrderState* get_limit_order_state();
+
 // limit_order is used in integrals
-extern H2D_API int  g_safe_max_order;
-extern H2D_API int  g_max_order;
-extern H2D_API int* g_order_table;
+inline int  get_limit_safe_max_order() { return get_limit_order_state()->safe_max_order; }
+inline int  get_limit_max_order()      { return get_limit_order_state()->max_order; }
+inline int* get_limit_order_table()    { return get_limit_order_state()->order_table; }
 
 #ifndef DEBUG_ORDER
   #define limit_order(o) \
-    if (o > g_safe_max_order) { o = g_safe_max_order; warn_order(); } \
-    o = g_order_table[o];
+    { LimitOrderState* los = get_limit_order_state(); \
+      if (o > los->safe_max_order) { o = los->safe_max_order; warn_order(); } \
+      o = los->order_table[o]; }
   #define limit_order_nowarn(o) \
-    if (o > g_safe_max_order) o = g_safe_max_order; \
-    o = g_order_table[o];
+    { LimitOrderState* los = get_limit_order_state(); \
+      if (o > los->safe_max_order) o = los->safe_max_order; \
+      o = los->order_table[o]; }
 #else
   #define limit_order(o) \
-    if (o > g_max_order) warn_order(); \
-    o = g_safe_max_order;
+    if (o > get_limit_max_order()) warn_order(); \
+    o = get_limit_safe_max_order();
   #define limit_order_nowarn(o) \
-    o = g_safe_max_order;
+    o = get_limit_safe_max_order();
 #endif
 
-extern H2D_API void reset_warn_order(); ///< Resets warn order flag.
+extern H2D_API void reset_warn_order(); ///< Resets warn order flag of the calling thread.
 extern H2D_API void warn_order(); ///< Warns about integration order iff ward order flags it not set. Sets warn order flag.
-extern H2D_API void update_limit_table(int mode);
+extern H2D_API void update_limit_table(int mode); ///< Sets the order limiting state of the calling thread.
 
 #endif
 
@@ -45,19 +45,23 @@ void LinearProblem::assemble(Matrix* mat_ext, Vector* rhs_ext, bool rhsonly, boo
   // and for linear problems it has to be subtracted from the right hand side.
   // The NULL stands for the initial coefficient vector that is not used.
   DiscreteProblem::assemble(NULL, mat_ext, dir_ext, rhs_ext, rhsonly);
+  // The vectors are smaller than ndof with the static condensation.
+  int size = rhs_ext->get_size();
   // FIXME: Do we really need to handle the real and complex cases separately?
-  if (is_complex) for (int i=0; i < ndof; i++) rhs_ext->add(i, -dir_ext->get_cplx(i));
-  else for (int i=0; i < ndof; i++) rhs_ext->add(i, -dir_ext->get(i));
+  if (is_complex) for (int i=0; i < size; i++) rhs_ext->add(i, -dir_ext->get_cplx(i));
+  else for (int i=0; i < size; i++) rhs_ext->add(i, -dir_ext->get(i));
   delete dir_ext;
 }
 
 // Solve a typical linear problem (without automatic adaptivity).
 // Feel free to adjust this function for more advanced applications.
 bool solve_linear(Tuple<Space *> spaces, WeakForm* wf, MatrixSolverType matrix_solver, 
-                  Tuple<Solution *> solutions, Vector* coeff_vec, bool is_complex) 
+                  Tuple<Solution *> solutions, Vector* coeff_vec, bool is_complex,
+                  bool static_condensation) 
 {
   // Initialize the linear problem.
   LinearProblem lp(wf, spaces);
+  lp.set_static_condensation(static_condensation);
   int ndof = get_num_dofs(spaces);
   //info("ndof = %d", ndof);
 
@@ -74,6 +78,15 @@ bool solve_linear(Tuple<Space *> spaces, WeakForm* wf, MatrixSolverType matrix_s
   // Solve the matrix problem.
   if (!solver->solve(mat, rhs)) error ("Matrix solver failed.\n");
 
+  // Recover the eliminated bubble DOFs.
+  if (static_condensation) {
+    Vector* full = new AVector(ndof, is_complex);
+    lp.recover_bubble_dofs(rhs, full);
+    rhs->free_data();
+    delete rhs;
+    rhs = full;
+  }
+
   // Convert coefficient vector into a Solution.
   for (int i=0; i < solutions.size(); i++) {
     solutions[i]->set_fe_solution(spaces[i], rhs);
@@ -55,8 +55,12 @@ public:
 
 };
 
+/// Solves a linear problem. With 'static_condensation', the bubble DOFs are eliminated
+/// during the assembling and recovered before the solutions are set up, see
+/// DiscreteProblem::set_static_condensation().
 H2D_API bool solve_linear(Tuple<Space *> spaces, WeakForm* wf, MatrixSolverType matrix_solver, 
-                          Tuple<Solution *> solutions, Vector *coeff_vec = NULL, bool is_complex = false);
+                          Tuple<Solution *> solutions, Vector *coeff_vec = NULL, bool is_complex = false,
+                          bool static_condensation = false);
 
 // Solve a typical linear problem (without automatic adaptivity).
 // Feel free to adjust this function for more advanced applications.
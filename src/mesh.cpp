@@ -16,6 +16,7 @@
 #include "common.h"
 #include "mesh.h"
 #include "h2d_reader.h"
+#include "checkpoint.h"
 
 
 //// nodes, element ////////////////////////////////////////////////////////////////////////////////
@@ -123,13 +124,31 @@ double Element::get_diameter() const
 
 //// mesh //////////////////////////////////////////////////////////////////////////////////////////
 
-unsigned g_mesh_seq = 0;
+static unsigned g_mesh_seq = 0;
+static pthread_mutex_t mesh_seq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/// Returns a new sequence number, unique also among meshes changed by different threads.
+unsigned next_mesh_seq()
+{
+  pthread_mutex_lock(&mesh_seq_mutex);
+  unsigned seq = g_mesh_seq++;
+  pthread_mutex_unlock(&mesh_seq_mutex);
+  return seq;
+}
 
 
 Mesh::Mesh() : HashTable()
 {
   nbase = nactive = ntopvert = ninitial = 0;
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
+  grid = old_grid = NULL;
+  read_only = false;
+}
+
+
+void Mesh::check_writable() const
+{
+  if (read_only) error("The mesh is read-only, it is shared by solutions. Change a copy of it.");
 }
 
 
@@ -576,6 +595,7 @@ void Mesh::unrefine_element_internal(Element* e)
 
 void Mesh::refine_element(int id, int refinement)
 {
+  check_writable();
   Element* e = get_element(id);
   if (!e->used) error("Invalid element id number.");
   if (!e->active) error("Attempt to refine element #%d which has been refined already.", e->id);
@@ -585,7 +605,7 @@ void Mesh::refine_element(int id, int refinement)
   else
     refine_quad(e, refinement);
 
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 
@@ -611,6 +631,10 @@ void Mesh::refine_by_criterion(int (*criterion)(Element*), int depth)
 }
 
 
+// The criteria of refine_towards_vertex() and refine_towards_boundary() take their
+// parameters from these variables, which is why the refinements are serialized.
+static pthread_mutex_t refine_towards_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int rtv_id;
 
 static int rtv_criterion(Element* e)
@@ -623,8 +647,10 @@ static int rtv_criterion(Element* e)
 
 void Mesh::refine_towards_vertex(int vertex_id, int depth)
 {
+  pthread_mutex_lock(&refine_towards_mutex);
   rtv_id = vertex_id;
   refine_by_criterion(rtv_criterion, depth);
+  pthread_mutex_unlock(&refine_towards_mutex);
 }
 
 
@@ -657,6 +683,7 @@ static int rtb_criterion(Element* e)
 
 void Mesh::refine_towards_boundary(int marker, int depth, bool aniso)
 {
+  pthread_mutex_lock(&refine_towards_mutex);
   rtb_marker = marker;
   rtb_aniso  = aniso;
 
@@ -675,11 +702,13 @@ void Mesh::refine_towards_boundary(int marker, int depth, bool aniso)
     refine_by_criterion(rtb_criterion, 1);
     delete [] rtb_vert;
   }
+  pthread_mutex_unlock(&refine_towards_mutex);
 }
 
 
 void Mesh::unrefine_element(int id)
 {
+  check_writable();
   Element* e = get_element(id);
   if (!e->used) error("Invalid element id number.");
   if (e->active) return;
@@ -689,7 +718,7 @@ void Mesh::unrefine_element(int id)
       unrefine_element(e->sons[i]->id);
 
   unrefine_element_internal(e);
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 
@@ -839,6 +868,7 @@ void check_quad(int i, Node *&v0, Node *&v1, Node *&v2, Node *&v3)
 void Mesh::create(int nv, double2* verts, int nt, int4* tris,
                   int nq, int5* quads, int nm, int3* mark)
 {
+  check_writable();
   //printf("Calling Mesh::free() in Mesh::create().\n");
   free();
 
@@ -886,13 +916,14 @@ void Mesh::create(int nv, double2* verts, int nt, int4* tris,
   }
 
   nbase = nactive = ninitial = nt + nq;
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 //// mesh copy /////////////////////////////////////////////////////////////////////////////////////
 
 void Mesh::copy(const Mesh* mesh)
 {
+  check_writable();
   int i;
 
   //printf("Calling Mesh::free() in Mesh::copy().\n");
@@ -943,6 +974,7 @@ void Mesh::copy(const Mesh* mesh)
   nactive = mesh->nactive;
   ntopvert = mesh->ntopvert;
   ninitial = mesh->ninitial;
+  base_order = mesh->base_order;
   seq = mesh->seq;
 }
 
@@ -961,6 +993,7 @@ Node* Mesh::get_base_edge_node(Element* base, int edge)
 
 void Mesh::copy_base(Mesh* mesh)
 {
+  check_writable();
   //printf("Calling Mesh::free() in Mesh::copy_base().\n");
   free();
   HashTable::init();
@@ -1002,7 +1035,8 @@ void Mesh::copy_base(Mesh* mesh)
 
   nbase = nactive = ninitial = mesh->nbase;
   ntopvert = mesh->ntopvert;
-  seq = g_mesh_seq++;
+  base_order = mesh->base_order;
+  seq = next_mesh_seq();
 }
 
 
@@ -1021,10 +1055,139 @@ void Mesh::free()
 
   elements.free();
   HashTable::free();
+  free_point_grid();
+  base_order.clear();
+}
+
+
+//// point queries /////////////////////////////////////////////////////////////////////////////////
+
+/// Guards the builds of the point grids, see Mesh::get_point_candidates().
+static pthread_mutex_t point_grid_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void Mesh::free_point_grid()
+{
+  delete grid;
+  delete old_grid;
+  grid = old_grid = NULL;
+}
+
+
+// Calculates the bounding box of an active element. Curved edges may bulge out of
+// the box of the vertices, the box is enlarged by half of the diameter then, which
+// covers arcs up to a half circle.
+static void get_element_bbox(Element* e, double& x1, double& y1, double& x2, double& y2)
+{
+  x1 = x2 = e->vn[0]->x;
+  y1 = y2 = e->vn[0]->y;
+  for (unsigned int i = 1; i < e->nvert; i++)
+  {
+    x1 = std::min(x1, e->vn[i]->x);  x2 = std::max(x2, e->vn[i]->x);
+    y1 = std::min(y1, e->vn[i]->y);  y2 = std::max(y2, e->vn[i]->y);
+  }
+  if (e->is_curved())
+  {
+    double d = 0.5 * e->get_diameter();
+    x1 -= d;  y1 -= d;
+    x2 += d;  y2 += d;
+  }
+}
+
+
+void Mesh::build_point_grid()
+{
+  PointGrid* grid = new PointGrid;
+  grid->seq = seq;
+
+  // bounding box of the whole mesh
+  Element* e;
+  double x1, y1, x2, y2;
+  double bx1 = 1e100, by1 = 1e100, bx2 = -1e100, by2 = -1e100;
+  for_all_active_elements(e, this)
+  {
+    get_element_bbox(e, x1, y1, x2, y2);
+    bx1 = std::min(bx1, x1);  bx2 = std::max(bx2, x2);
+    by1 = std::min(by1, y1);  by2 = std::max(by2, y2);
+  }
+
+  // about one element per cell, with cells as square as possible; the grid is
+  // slightly larger than the mesh so that points on the boundary are found
+  double w = bx2 - bx1, h = by2 - by1;
+  double eps = 1e-8 * std::max(w, h);
+  bx1 -= eps;  by1 -= eps;
+  w += 2*eps;  h += 2*eps;
+  double n = std::max(nactive, 1);
+  grid->nx = std::max(1, std::min(1024, (int) ceil(sqrt(n * w / h))));
+  grid->ny = std::max(1, std::min(1024, (int) ceil(n / grid->nx)));
+  grid->x0 = bx1;
+  grid->y0 = by1;
+  grid->hx = w / grid->nx;
+  grid->hy = h / grid->ny;
+
+  // register each element in all cells its bounding box overlaps, in two passes:
+  // counting and filling
+  int ncells = grid->nx * grid->ny;
+  grid->start.assign(ncells + 1, 0);
+  for (int pass = 0; pass < 2; pass++)
+  {
+    std::vector<int> pos;
+    if (pass == 1)
+    {
+      for (int i = 0; i < ncells; i++) grid->start[i+1] += grid->start[i];
+      grid->elems.resize(grid->start[ncells]);
+      pos.assign(grid->start.begin(), grid->start.end() - 1);
+    }
+    for_all_active_elements(e, this)
+    {
+      get_element_bbox(e, x1, y1, x2, y2);
+      int i1 = std::max(0, (int) floor((x1 - eps - grid->x0) / grid->hx));
+      int i2 = std::min(grid->nx - 1, (int) floor((x2 + eps - grid->x0) / grid->hx));
+      int j1 = std::max(0, (int) floor((y1 - eps - grid->y0) / grid->hy));
+      int j2 = std::min(grid->ny - 1, (int) floor((y2 + eps - grid->y0) / grid->hy));
+      for (int j = j1; j <= j2; j++)
+        for (int i = i1; i <= i2; i++)
+        {
+          int c = j * grid->nx + i;
+          if (pass == 0) grid->start[c+1]++;
+          else grid->elems[pos[c]++] = e;
+        }
+    }
+  }
+
+  // publish the complete grid; the grid it replaces may still be read by a query that
+  // started before, the one before it cannot (the mesh has changed in between)
+  H2D_MEMORY_BARRIER();
+  delete old_grid;
+  old_grid = this->grid;
+  this->grid = grid;
+}
+
+
+int Mesh::get_point_candidates(double x, double y, Element** &elems)
+{
+  PointGrid* grid = this->grid;
+  if (grid == NULL || grid->seq != seq)
+  {
+    pthread_mutex_lock(&point_grid_mutex);
+    if (this->grid == NULL || this->grid->seq != seq) build_point_grid();
+    grid = this->grid;
+    pthread_mutex_unlock(&point_grid_mutex);
+  }
+
+  elems = NULL;
+  int i = (int) floor((x - grid->x0) / grid->hx);
+  int j = (int) floor((y - grid->y0) / grid->hy);
+  if (i < 0 || i >= grid->nx || j < 0 || j >= grid->ny) return 0;
+
+  int c = j * grid->nx + i;
+  int n = grid->start[c+1] - grid->start[c];
+  if (n > 0) elems = &grid->elems[grid->start[c]];
+  return n;
 }
 
 void Mesh::copy_converted(Mesh* mesh)
 {
+  check_writable();
   //printf("Calling Mesh::free() in Mesh::copy_converted().\n");
   free();
   HashTable::copy(mesh);
@@ -1104,7 +1267,7 @@ void Mesh::copy_converted(Mesh* mesh)
 
   nbase = nactive = ninitial = mesh->nactive;
   ntopvert = mesh->ntopvert = get_num_nodes();
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 ////convert a triangle element into three quadrilateral elements///////
@@ -1408,6 +1571,7 @@ void Mesh::refine_triangle_to_quads(Element* e)
 
 void Mesh::refine_element_to_quads(int id)
 {
+  check_writable();
   Element* e = get_element(id);
   if (!e->used) error("Invalid element id number.");
   if (!e->active) error("Attempt to refine element #%d which has been refined already.", e->id);
@@ -1417,7 +1581,7 @@ void Mesh::refine_element_to_quads(int id)
   else
     return;
 
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 
@@ -1604,6 +1768,7 @@ void Mesh::refine_quad_to_triangles(Element* e)
 
 void Mesh::refine_element_to_triangles(int id)
 {
+  check_writable();
   Element* e = get_element(id);
   if (!e->used) error("Invalid element id number.");
   if (!e->active) error("Attempt to refine element #%d which has been refined already.", e->id);
@@ -1613,7 +1778,7 @@ void Mesh::refine_element_to_triangles(int id)
   else
     refine_quad_to_triangles(e);
 
-  seq = g_mesh_seq++;
+  seq = next_mesh_seq();
 }
 
 void Mesh::load(const char* filename, bool debug)
@@ -1657,112 +1822,315 @@ void Mesh::load_str(char *mesh)
   loader.load_str(mesh, this);
 }
 
+//// reorder ///////////////////////////////////////////////////////////////////////////////////////
+
+// Returns the index of the point (x, y), 0 <= x, y < 2^16, along the Hilbert curve.
+static uint64_t hilbert_index(unsigned x, unsigned y)
+{
+  const unsigned n = 1 << 16;
+  uint64_t d = 0;
+  for (unsigned s = n / 2; s > 0; s /= 2)
+  {
+    unsigned rx = (x & s) ? 1 : 0, ry = (y & s) ? 1 : 0;
+    d += (uint64_t) s * s * ((3 * rx) ^ ry);
+    if (ry == 0)
+    {
+      if (rx == 1) { x = n-1 - x; y = n-1 - y; }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+
+int* Mesh::reorder()
+{
+  check_writable();
+  int i, id;
+  unsigned j;
+  Element* e;
+  Node* nd;
+
+  // order the base elements along a Hilbert curve through their centers
+  double x1 = 1e300, y1 = 1e300, x2 = -1e300, y2 = -1e300;
+  for_all_base_elements(e, this)
+    for (j = 0; j < e->nvert; j++)
+    {
+      x1 = std::min(x1, e->vn[j]->x);  x2 = std::max(x2, e->vn[j]->x);
+      y1 = std::min(y1, e->vn[j]->y);  y2 = std::max(y2, e->vn[j]->y);
+    }
+  double scale = 65535.0 / std::max(std::max(x2 - x1, y2 - y1), 1e-300);
+
+  std::vector<std::pair<uint64_t, int> > keys;
+  for_all_base_elements(e, this)
+  {
+    double cx = 0.0, cy = 0.0;
+    for (j = 0; j < e->nvert; j++)
+    {
+      cx += e->vn[j]->x;
+      cy += e->vn[j]->y;
+    }
+    cx = (cx / e->nvert - x1) * scale;
+    cy = (cy / e->nvert - y1) * scale;
+    keys.push_back(std::make_pair(hilbert_index((unsigned) cx, (unsigned) cy), e->id));
+  }
+  std::sort(keys.begin(), keys.end());
+
+  base_order.clear();
+  for (i = 0; i < (int) keys.size(); i++)
+    base_order.push_back(keys[i].second);
+  for (id = 0; id < nbase; id++) // unused base slots
+    if (!get_element_fast(id)->used)
+      base_order.push_back(id);
+
+  // new element ids: the refined elements in the order of the traversal; the initial
+  // refinements come first, since the elements with ids below 'ninitial' are treated
+  // as such by unrefine_all_elements()
+  int max_elem = elements.get_size();
+  std::vector<int> eperm(max_elem, -1);
+  for (id = 0; id < nbase; id++)
+    eperm[id] = id;
+  int next = nbase, new_ninitial = nbase;
+  std::vector<Element*> stack;
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (i = 0; i < nbase; i++)
+    {
+      if (!get_element_fast(base_order[i])->used) continue;
+      stack.push_back(get_element_fast(base_order[i]));
+      while (!stack.empty())
+      {
+        e = stack.back();
+        stack.pop_back();
+        if (e->id >= nbase && (e->id < ninitial) == (pass == 0))
+          eperm[e->id] = next++;
+        if (!e->active) // Traverse visits the sons from the last one
+          for (int k = 0; k < 4; k++)
+            if (e->sons[k] != NULL)
+              stack.push_back(e->sons[k]);
+      }
+    }
+    if (pass == 0) new_ninitial = next;
+  }
+  for (id = nbase; id < max_elem; id++) // not reachable from the base elements
+    if (eperm[id] < 0 && get_element_fast(id)->used)
+      eperm[id] = next++;
+  int num_elems = next;
+
+  std::vector<int> old_elem(num_elems);
+  for (id = 0; id < max_elem; id++)
+    if (eperm[id] >= 0)
+      old_elem[eperm[id]] = id;
+
+  // new node ids: in the order of the first use by the elements in the new order
+  int max_node = nodes.get_size();
+  std::vector<int> nperm(max_node, -1);
+  for (id = 0; id < ntopvert && id < max_node; id++)
+    nperm[id] = id;
+  next = std::min(ntopvert, max_node);
+  for (i = 0; i < num_elems; i++)
+  {
+    e = get_element_fast(old_elem[i]);
+    if (!e->used) continue;
+    for (j = 0; j < e->nvert; j++)
+      if (nperm[e->vn[j]->id] < 0)
+        nperm[e->vn[j]->id] = next++;
+    if (e->active)
+      for (j = 0; j < e->nvert; j++)
+        if (nperm[e->en[j]->id] < 0)
+          nperm[e->en[j]->id] = next++;
+  }
+  for_all_nodes(nd, this) // not used by any element
+    if (nperm[nd->id] < 0)
+      nperm[nd->id] = next++;
+  int num_nodes = next;
+
+  // move the nodes and elements to new arrays, replacing all pointers
+  Array<Node> new_nodes;
+  Array<Element> new_elems;
+  new_nodes.force_size(num_nodes);
+  new_elems.force_size(num_elems);
+  for (id = 0; id < new_nodes.get_size(); id++)
+    new_nodes[id].id = id;
+  for (id = 0; id < new_elems.get_size(); id++)
+    new_elems[id].id = id;
+
+  for_all_nodes(nd, this)
+  {
+    Node* n = &(new_nodes[nperm[nd->id]]);
+    id = n->id;
+    *n = *nd;
+    n->id = id;
+    n->next_hash = NULL;
+    if (n->p1 >= 0)
+    {
+      if (nperm[n->p1] < 0 || nperm[n->p2] < 0) error("Corrupt mesh: invalid node parents.");
+      n->p1 = nperm[n->p1];
+      n->p2 = nperm[n->p2];
+      if (n->p1 > n->p2) std::swap(n->p1, n->p2);
+    }
+    if (n->type == H2D_TYPE_EDGE)
+      for (i = 0; i < 2; i++)
+        if (n->elem[i] != NULL)
+          n->elem[i] = &(new_elems[eperm[n->elem[i]->id]]);
+  }
+
+  for_all_elements(e, this)
+  {
+    Element* f = &(new_elems[eperm[e->id]]);
+    id = f->id;
+    *f = *e;
+    f->id = id;
+    for (j = 0; j < e->nvert; j++)
+      f->vn[j] = &(new_nodes[nperm[e->vn[j]->id]]);
+    if (e->active)
+      for (j = 0; j < e->nvert; j++)
+        f->en[j] = &(new_nodes[nperm[e->en[j]->id]]);
+    else
+      for (j = 0; j < 4; j++)
+        if (e->sons[j] != NULL)
+          f->sons[j] = &(new_elems[eperm[e->sons[j]->id]]);
+    // the CurvMap is taken over, a refined element points to its base element
+    if (f->cm != NULL && !f->cm->toplevel)
+      f->cm->parent = &(new_elems[eperm[f->cm->parent->id]]);
+  }
+
+  nodes.swap(new_nodes);
+  elements.swap(new_elems);
+  nodes.post_load_scan();
+  elements.post_load_scan(nbase);
+  HashTable::rebuild();
+  if (ninitial > nbase) ninitial = new_ninitial;
+
+  free_point_grid();
+  seq = next_mesh_seq();
+
+  int* parents = (int*) malloc(sizeof(int) * std::max(get_max_element_id(), 1));
+  for (id = 0; id < get_max_element_id(); id++)
+    parents[id] = (id < num_elems) ? old_elem[id] : -1;
+  return parents;
+}
+
+
 //// save_raw, load_raw ////////////////////////////////////////////////////////////////////////////
 
-void Mesh::save_raw(FILE* f)
+// Node and element records of the version 2 of the raw format. Unused fields are zero.
+struct RawNode
+{
+  int id;
+  unsigned bits;     // ref | type << 29 | bnd << 30 | used << 31
+  int p1, p2;
+  double x, y;       // vertex nodes
+  int marker;        // edge nodes
+  int elem[2];       // edge nodes, -1 if NULL
+};
+
+struct RawElement
+{
+  int id;
+  unsigned bits;     // nvert | active << 30 | used << 31
+  int marker, userdata, iro_cache;
+  int vn[4];
+  int en_sons[4];    // edge nodes of active elements, sons (-1 if NULL) of inactive ones
+};
+
+void Mesh::save_raw(SaveBuffer& buf)
 {
-  int i, nn, mm;
-  int null = -1;
+  int i;
 
   assert(sizeof(int) == 4);
   assert(sizeof(double) == 8);
 
-  hermes2d_fwrite("H2DM\001\000\000\000", 1, 8, f);
-
-  #define output(n, type) \
-    hermes2d_fwrite(&(n), sizeof(type), 1, f)
-
-  output(nbase, int);
-  output(ntopvert, int);
-  output(nactive, int);
+  buf.write("H2DM\002\000\000\000", 1, 8);
 
-  nn = nodes.get_num_items();
-  mm = nodes.get_size();
-  output(nn, int);
-  output(mm, int);
+  int counts[3] = { nbase, ntopvert, nactive };
+  buf.write(counts, sizeof(int), 3);
 
-  // dump all nodes
+  // all nodes
+  std::vector<RawNode> rn;
+  rn.reserve(nodes.get_num_items());
   Node* n;
   for_all_nodes(n, this)
   {
-    output(n->id, int);
-    unsigned bits = n->ref | (n->type << 29) | (n->bnd << 30) | (n->used << 31);
-    output(bits, unsigned);
-
+    RawNode r;
+    memset(&r, 0, sizeof(r));
+    r.id = n->id;
+    r.bits = n->ref | (n->type << 29) | (n->bnd << 30) | (n->used << 31);
     if (n->type == H2D_TYPE_VERTEX)
     {
-      output(n->x, double);
-      output(n->y, double);
+      r.x = n->x;
+      r.y = n->y;
     }
     else
     {
-      output(n->marker, int);
-      output(n->elem[0] ? n->elem[0]->id : null, int);
-      output(n->elem[1] ? n->elem[1]->id : null, int);
+      r.marker = n->marker;
+      for (i = 0; i < 2; i++)
+        r.elem[i] = n->elem[i] ? n->elem[i]->id : -1;
     }
-
-    output(n->p1, int);
-    output(n->p2, int);
+    r.p1 = n->p1;
+    r.p2 = n->p2;
+    rn.push_back(r);
   }
+  int sizes[2] = { (int) rn.size(), nodes.get_size() };
+  buf.write(sizes, sizeof(int), 2);
+  buf.write(rn.empty() ? NULL : &rn[0], sizeof(RawNode), rn.size());
 
-  nn = elements.get_num_items();
-  mm = elements.get_size();
-  output(nn, int);
-  output(mm, int);
-
-  // dump all elements
+  // all elements
+  std::vector<RawElement> re;
+  re.reserve(elements.get_num_items());
   Element* e;
   for (int id = 0; id < get_max_element_id(); id++)
   {
     if ((e = get_element_fast(id))->used || id < nbase)
     {
-      output(e->id, int);
-      unsigned bits = e->nvert | (e->active << 30) | (e->used << 31);
-      output(bits, unsigned);
-
+      RawElement r;
+      memset(&r, 0, sizeof(r));
+      r.id = e->id;
+      r.bits = e->nvert | (e->active << 30) | (e->used << 31);
       if (e->used)
       {
-        output(e->marker, int);
-        output(e->userdata, int);
-        output(e->iro_cache, int);
-
+        if (e->is_curved()) error("Not implemented for curved elements yet.");
+        r.marker = e->marker;
+        r.userdata = e->userdata;
+        r.iro_cache = e->iro_cache;
         for (i = 0; i < e->nvert; i++)
-          output(e->vn[i]->id, int);
-
-        if (e->active)
-          for (i = 0; i < e->nvert; i++)
-            output(e->en[i]->id, int);
-        else
+        {
+          r.vn[i] = e->vn[i]->id;
+          r.en_sons[i] = e->active ? e->en[i]->id : -1;
+        }
+        if (!e->active)
           for (i = 0; i < 4; i++)
-            output(e->sons[i] ? e->sons[i]->id : null, int);
-
-        if (e->is_curved()) error("Not implemented for curved elements yet.");
+            r.en_sons[i] = e->sons[i] ? e->sons[i]->id : -1;
       }
+      re.push_back(r);
     }
   }
-  // TODO: curved elements
-
-  #undef output
+  sizes[0] = re.size();
+  sizes[1] = elements.get_size();
+  buf.write(sizes, sizeof(int), 2);
+  buf.write(re.empty() ? NULL : &re[0], sizeof(RawElement), re.size());
 }
 
 
-void Mesh::load_raw(FILE* f)
+void Mesh::load_raw(LoadBuffer& buf)
 {
-  int i, j, nv, mv, ne, me, id;
+  check_writable();
+  int i, j, nv = 0, mv = 0, ne = 0, me = 0, id;
 
   assert(sizeof(int) == 4);
   assert(sizeof(double) == 8);
 
   // check header
   struct { char magic[4]; int ver; } hdr;
-  hermes2d_fread(&hdr, sizeof(hdr), 1, f);
-  if (hdr.magic[0] != 'H' || hdr.magic[1] != '2' || hdr.magic[2] != 'D' || hdr.magic[3] != 'M')
+  if (!buf.try_read(&hdr, sizeof(hdr), 1) ||
+      hdr.magic[0] != 'H' || hdr.magic[1] != '2' || hdr.magic[2] != 'D' || hdr.magic[3] != 'M')
     error("Not a Hermes2D raw mesh file.");
-  if (hdr.ver > 1)
+  if (hdr.ver > 2)
     error("Unsupported file version.");
 
+  // the fields of a record are used only after all of them have been read
   #define input(n, type) \
-    hermes2d_fread(&(n), sizeof(type), 1, f)
+    do { if (!buf.try_read(&(n), sizeof(type), 1)) error("Corrupt data: premature end of file."); } while (0)
 
   //printf("Calling Mesh::free() in Mesh::load_raw().\n");
   free();
@@ -1776,35 +2144,59 @@ void Mesh::load_raw(FILE* f)
   nodes.force_size(mv);
 
   // load nodes
+  std::vector<RawNode> rn;
+  if (hdr.ver == 2)
+  {
+    rn.resize(nv);
+    buf.read(rn.empty() ? NULL : &rn[0], sizeof(RawNode), nv);
+  }
   for (i = 0; i < nv; i++)
   {
-    input(id, int);
-    if (id < 0 || id >= mv) error("Corrupt data.");
-    Node* n = &(nodes[id]);
-    n->id = id;
-    n->used = 1;
+    RawNode r = RawNode();
+    if (hdr.ver == 2)
+      r = rn[i];
+    else
+    {
+      input(r.id, int);
+      input(r.bits, unsigned);
+      if (((r.bits >> 29) & 0x1) == H2D_TYPE_VERTEX)
+      {
+        input(r.x, double);
+        input(r.y, double);
+      }
+      else
+      {
+        input(r.marker, int);
+        input(r.elem[0], int);
+        input(r.elem[1], int);
+      }
+      input(r.p1, int);
+      input(r.p2, int);
+    }
 
-    unsigned bits;
-    input(bits, unsigned);
-    n->ref  =  bits & 0x1fffffff;
-    n->type = (bits >> 29) & 0x1;
-    n->bnd  = (bits >> 30) & 0x1;
+    if (r.id < 0 || r.id >= mv) error("Corrupt data.");
+    Node* n = &(nodes[r.id]);
+    n->id = r.id;
+    n->used = 1;
+    n->ref  =  r.bits & 0x1fffffff;
+    n->type = (r.bits >> 29) & 0x1;
+    n->bnd  = (r.bits >> 30) & 0x1;
 
     if (n->type == H2D_TYPE_VERTEX)
     {
-      input(n->x, double);
-      input(n->y, double);
+      n->x = r.x;
+      n->y = r.y;
     }
     else
     {
-      input(n->marker, int);
-      n->elem[0] = n->elem[1] = NULL;
-      input(n->elem[0], int);
-      input(n->elem[1], int);
+      // element ids are replaced by pointers when the elements are loaded
+      n->marker = r.marker;
+      n->elem[0] = (Element*) (long) r.elem[0];
+      n->elem[1] = (Element*) (long) r.elem[1];
     }
 
-    input(n->p1, int);
-    input(n->p2, int);
+    n->p1 = r.p1;
+    n->p2 = r.p2;
   }
   nodes.post_load_scan();
 
@@ -1818,49 +2210,74 @@ void Mesh::load_raw(FILE* f)
   elements.force_size(me);
 
   // load elements
+  std::vector<RawElement> re;
+  if (hdr.ver == 2)
+  {
+    re.resize(ne);
+    buf.read(re.empty() ? NULL : &re[0], sizeof(RawElement), ne);
+  }
   for (i = 0; i < ne; i++)
   {
-    input(id, int);
-    if (id < 0 || id >= me) error("Corrupt data.");
-    Element* e = &(elements[id]);
-    e->id = id;
+    RawElement r = RawElement();
+    if (hdr.ver == 2)
+      r = re[i];
+    else
+    {
+      input(r.id, int);
+      input(r.bits, unsigned);
+      if ((r.bits >> 31) & 0x1)
+      {
+        input(r.marker, int);
+        input(r.userdata, int);
+        input(r.iro_cache, int);
+        int nvert = r.bits & 0x3fffffff;
+        if (nvert > 4) error("Corrupt data.");
+        for (j = 0; j < nvert; j++)
+          input(r.vn[j], int);
+        int nlinks = ((r.bits >> 30) & 0x1) ? nvert : 4;
+        for (j = 0; j < nlinks; j++)
+          input(r.en_sons[j], int);
+      }
+    }
 
-    unsigned bits;
-    input(bits, unsigned);
-    e->nvert  =  bits & 0x3fffffff;
-    e->active = (bits >> 30) & 0x1;
-    e->used   = (bits >> 31) & 0x1;
+    if (r.id < 0 || r.id >= me) error("Corrupt data.");
+    Element* e = &(elements[r.id]);
+    e->id = r.id;
+    e->nvert  =  r.bits & 0x3fffffff;
+    e->active = (r.bits >> 30) & 0x1;
+    e->used   = (r.bits >> 31) & 0x1;
 
     if (e->used)
     {
-      input(e->marker, int);
-      input(e->userdata, int);
-      input(e->iro_cache, int);
+      if (e->nvert > 4) error("Corrupt data.");
+      e->marker = r.marker;
+      e->userdata = r.userdata;
+      e->iro_cache = r.iro_cache;
 
-      // load vertex node ids
+      // vertex node ids
       for (j = 0; j < e->nvert; j++)
       {
-        input(id, int);
+        id = r.vn[j];
         if (id < 0 || id >= mv) error("Corrupt data.");
         e->vn[j] = get_node(id);
       }
 
       if (e->active)
       {
-        // load edge node ids
+        // edge node ids
         for (j = 0; j < e->nvert; j++)
         {
-          input(id, int);
+          id = r.en_sons[j];
           if (id < 0 || id >= mv) error("Corrupt data.");
           e->en[j] = get_node(id);
         }
       }
       else
       {
-        // load son ids
+        // son ids
         for (j = 0; j < 4; j++)
         {
-          input(id, int);
+          id = r.en_sons[j];
           if (id < 0)
             e->sons[j] = NULL;
           else if (id < me)
@@ -1883,5 +2300,222 @@ void Mesh::load_raw(FILE* f)
         n->elem[j] = get_element((int) (long) n->elem[j]);
 
   #undef input
-  seq++;
+  seq = next_mesh_seq();
+}
+
+
+//// save_binary, load_binary //////////////////////////////////////////////////////////////////////
+
+// The binary format stores the node and element arrays densely: the record i describes
+// the node (element) with id i, so that the records can be copied without any lookups.
+// Nodes and elements refer to each other by id numbers. The hash table is not stored,
+// it is rebuilt from the node parent ids.
+struct RawMeshInfo
+{
+  int nbase, ntopvert, nactive, ninitial;
+};
+
+void Mesh::save_binary(BinaryWriter& file)
+{
+  int i, id;
+
+  assert(sizeof(int) == 4);
+  assert(sizeof(double) == 8);
+
+  RawMeshInfo info = { nbase, ntopvert, nactive, ninitial };
+  file.add_section("MESH", &info, sizeof(RawMeshInfo), 1);
+
+  // all node slots
+  std::vector<RawNode> rn(nodes.get_size());
+  for (id = 0; id < nodes.get_size(); id++)
+  {
+    Node* n = &(nodes[id]);
+    RawNode& r = rn[id];
+    memset(&r, 0, sizeof(r));
+    r.id = id;
+    if (!n->used) continue;
+    r.bits = n->ref | (n->type << 29) | (n->bnd << 30) | (n->used << 31);
+    if (n->type == H2D_TYPE_VERTEX)
+    {
+      r.x = n->x;
+      r.y = n->y;
+    }
+    else
+    {
+      r.marker = n->marker;
+      for (i = 0; i < 2; i++)
+        r.elem[i] = n->elem[i] ? n->elem[i]->id : -1;
+    }
+    r.p1 = n->p1;
+    r.p2 = n->p2;
+  }
+  file.add_section("NODES", rn.empty() ? NULL : &rn[0], sizeof(RawNode), rn.size());
+
+  // all element slots, including the refinement tree
+  std::vector<RawElement> re(elements.get_size());
+  for (id = 0; id < elements.get_size(); id++)
+  {
+    Element* e = get_element_fast(id);
+    RawElement& r = re[id];
+    memset(&r, 0, sizeof(r));
+    r.id = id;
+    if (!e->used) continue;
+    if (e->is_curved()) error("Not implemented for curved elements yet.");
+    r.bits = e->nvert | (e->active << 30) | (e->used << 31);
+    r.marker = e->marker;
+    r.userdata = e->userdata;
+    r.iro_cache = e->iro_cache;
+    for (i = 0; i < e->nvert; i++)
+      r.vn[i] = e->vn[i]->id;
+    if (e->active)
+      for (i = 0; i < e->nvert; i++)
+        r.en_sons[i] = e->en[i]->id;
+    else
+      for (i = 0; i < 4; i++)
+        r.en_sons[i] = e->sons[i] ? e->sons[i]->id : -1;
+  }
+  file.add_section("ELEMS", re.empty() ? NULL : &re[0], sizeof(RawElement), re.size());
+
+  // traversal order of the base elements, see reorder()
+  if (get_base_order() != NULL)
+    file.add_section("BORDER", get_base_order(), sizeof(int), nbase);
+}
+
+
+void Mesh::save_binary(const char* filename)
+{
+  BinaryWriter file;
+  save_binary(file);
+  file.save(filename);
+}
+
+
+void Mesh::load_binary(const BinaryFile& file)
+{
+  check_writable();
+  int i, j, id;
+  size_t n;
+
+  const RawMeshInfo* info = (const RawMeshInfo*) file.get_section("MESH", sizeof(RawMeshInfo), n);
+  if (n != 1) error("Corrupt data.");
+  const RawNode* rn = (const RawNode*) file.get_section("NODES", sizeof(RawNode), n);
+  int mv = n;
+  const RawElement* re = (const RawElement*) file.get_section("ELEMS", sizeof(RawElement), n);
+  int me = n;
+
+  free();
+  nbase = info->nbase;
+  ntopvert = info->ntopvert;
+  nactive = info->nactive;
+  ninitial = info->ninitial;
+  if (nbase < 0 || nbase > me) error("Corrupt data.");
+
+  nodes.force_size(mv);
+  elements.force_size(me);
+
+  // unused slots keep their ids when they are reused by Array::add()
+  for (i = 0; i < nodes.get_size(); i++)
+    nodes[i].id = i;
+  for (i = 0; i < elements.get_size(); i++)
+    elements[i].id = i;
+
+  // nodes: element ids can be resolved right away, all slots exist already
+  for (i = 0; i < mv; i++)
+  {
+    const RawNode& r = rn[i];
+    if (!((r.bits >> 31) & 0x1)) continue;
+    if (r.id != i) error("Corrupt data.");
+
+    Node* nd = &(nodes[i]);
+    nd->used = 1;
+    nd->ref  =  r.bits & 0x1fffffff;
+    nd->type = (r.bits >> 29) & 0x1;
+    nd->bnd  = (r.bits >> 30) & 0x1;
+    if (nd->type == H2D_TYPE_VERTEX)
+    {
+      nd->x = r.x;
+      nd->y = r.y;
+    }
+    else
+    {
+      nd->marker = r.marker;
+      for (j = 0; j < 2; j++)
+      {
+        id = r.elem[j];
+        if (id >= me) error("Corrupt data.");
+        nd->elem[j] = (id < 0) ? NULL : &(elements[id]);
+      }
+    }
+    nd->p1 = r.p1;
+    nd->p2 = r.p2;
+  }
+  nodes.post_load_scan();
+
+  int hsize = H2D_DEFAULT_HASH_SIZE;
+  while (hsize < nodes.get_num_items()) hsize *= 2;
+  HashTable::init(hsize);
+  HashTable::rebuild();
+
+  // elements
+  for (i = 0; i < me; i++)
+  {
+    const RawElement& r = re[i];
+    Element* e = &(elements[i]);
+    if (!((r.bits >> 31) & 0x1)) continue;
+    if (r.id != i) error("Corrupt data.");
+
+    e->nvert  =  r.bits & 0x3fffffff;
+    e->active = (r.bits >> 30) & 0x1;
+    e->used   = 1;
+    if (e->nvert < 3 || e->nvert > 4) error("Corrupt data.");
+    e->marker = r.marker;
+    e->userdata = r.userdata;
+    e->iro_cache = r.iro_cache;
+
+    for (j = 0; j < (int) e->nvert; j++)
+    {
+      id = r.vn[j];
+      if (id < 0 || id >= mv || !nodes[id].used) error("Corrupt data.");
+      e->vn[j] = &(nodes[id]);
+    }
+
+    if (e->active)
+    {
+      for (j = 0; j < (int) e->nvert; j++)
+      {
+        id = r.en_sons[j];
+        if (id < 0 || id >= mv || !nodes[id].used) error("Corrupt data.");
+        e->en[j] = &(nodes[id]);
+      }
+    }
+    else
+    {
+      for (j = 0; j < 4; j++)
+      {
+        id = r.en_sons[j];
+        if (id >= me) error("Corrupt data.");
+        e->sons[j] = (id < 0) ? NULL : &(elements[id]);
+      }
+    }
+  }
+  elements.post_load_scan(nbase);
+
+  if (file.has_section("BORDER"))
+  {
+    const int* order = (const int*) file.get_section("BORDER", sizeof(int), n);
+    if ((int) n != nbase) error("Corrupt data.");
+    for (i = 0; i < nbase; i++)
+      if (order[i] < 0 || order[i] >= nbase) error("Corrupt data.");
+    base_order.assign(order, order + nbase);
+  }
+
+  seq = next_mesh_seq();
+}
+
+
+void Mesh::load_binary(const char* filename)
+{
+  BinaryFile file;
+  file.open(filename);
+  load_binary(file);
 }
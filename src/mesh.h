@@ -21,6 +21,10 @@
 
 struct Element;
 class HashTable;
+class SaveBuffer;
+class LoadBuffer;
+class BinaryWriter;
+class BinaryFile;
 class Space;
 struct MItem;
 
@@ -263,10 +267,50 @@ public:
   void transform(double2x2 m, double2 t);
   void transform(void (*fn)(double* x, double* y));
 
-  /// Loads the entire internal state from a (binary) file. DEPRECATED
-  void load_raw(FILE* f);
-  /// Saves the entire internal state to a (binary) file. DEPRECATED
-  void save_raw(FILE* f);
+  /// Renumbers the elements and nodes for cache locality. The base elements are ordered
+  /// along a Hilbert curve through their centers (see get_base_order()) and the refined
+  /// elements get consecutive ids in the order in which Traverse visits them. The nodes
+  /// are numbered in the order in which these elements use them. The ids of the base
+  /// elements and of the top-level vertices do not change. Like regularize(), returns
+  /// an array of the old ids of the elements, which can be passed to
+  /// Space::distribute_orders(). The array must be deallocated with ::free().
+  int* reorder();
+
+  /// Returns the order in which the base elements are traversed (set by reorder()),
+  /// or NULL if they are traversed in the order of their ids.
+  const int* get_base_order() const
+    { return ((int) base_order.size() == nbase && nbase > 0) ? &base_order[0] : NULL; }
+
+  /// Loads the entire internal state saved by save_raw() (both the current and the
+  /// old field-by-field version of the format).
+  void load_raw(LoadBuffer& buf);
+  /// Saves the entire internal state in a binary form. All nodes and all elements
+  /// are stored as one contiguous block each. Curved elements are not supported.
+  void save_raw(SaveBuffer& buf);
+
+  /// Adds the mesh, i.e., all nodes and elements including the refinement tree, to a file
+  /// in the binary format (see BinaryWriter). Curved elements are not supported.
+  void save_binary(BinaryWriter& file);
+  /// Saves the mesh to a binary file, see save_binary(BinaryWriter&).
+  void save_binary(const char* filename);
+  /// Loads the mesh from a mapped binary file. The node and element records are copied
+  /// to the mesh directly, only the hash table has to be rebuilt.
+  void load_binary(const BinaryFile& file);
+  /// Maps a binary file created by save_binary() and loads the mesh from it.
+  void load_binary(const char* filename);
+
+  /// Returns the active elements whose bounding boxes contain the point (x, y), i.e., the
+  /// candidates for the element containing the point, in 'elems', and their number. They
+  /// are taken from a uniform grid of element bounding boxes, which is built on the first
+  /// call and again after the mesh changes. The array is valid until the mesh changes.
+  /// Several threads may query a mesh concurrently: the grid is built under a lock by one
+  /// of them and read without locking.
+  int get_point_candidates(double x, double y, Element** &elems);
+
+  /// A read-only mesh cannot be refined, unrefined, reordered, created, copied to or loaded,
+  /// these calls end with an error. Used for the meshes shared by solutions, see Solution.
+  void set_read_only(bool read_only) { this->read_only = read_only; }
+  bool is_read_only() const { return read_only; }
 
   /// For internal use.
   int get_edge_sons(Element* e, int edge, int& son1, int& son2);
@@ -293,6 +337,25 @@ protected:
   int nbase, ntopvert;
   int nactive, ninitial;
   unsigned seq;
+  std::vector<int> base_order; ///< see get_base_order()
+  bool read_only;              ///< see set_read_only()
+
+  void check_writable() const;
+
+  /// Uniform grid over the bounding boxes of the active elements, see get_point_candidates().
+  struct PointGrid
+  {
+    unsigned seq;                 ///< mesh sequence number the grid was built for
+    int nx, ny;                   ///< number of cells in x and y
+    double x0, y0, hx, hy;        ///< origin and size of the cells
+    std::vector<int> start;       ///< elements of cell i are elems[start[i]] ... elems[start[i+1]-1]
+    std::vector<Element*> elems;
+  };
+  PointGrid* volatile grid;
+  PointGrid* old_grid;   ///< the grid replaced by the last build, a concurrent query may still read it
+
+  void build_point_grid();
+  void free_point_grid();
 
   Element* create_triangle(int marker, Node* v0, Node* v1, Node* v2, CurvMap* cm);
   Element* create_quad(int marker, Node* v0, Node* v1, Node* v2, Node* v3, CurvMap* cm);
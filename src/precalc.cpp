@@ -18,6 +18,10 @@
 #include "precalc.h"
 
 
+int PrecalcShapeset::default_storage = H2D_PSS_JUDY;
+
+static const uint64_t H2D_PSS_EMPTY_KEY = ~(uint64_t) 0;
+
 
 PrecalcShapeset::PrecalcShapeset(Shapeset* shapeset)
                : RealFunction()
@@ -28,6 +32,16 @@ PrecalcShapeset::PrecalcShapeset(Shapeset* shapeset)
   num_components = shapeset->get_num_components();
   assert(num_components == 1 || num_components == 2);
   tables = NULL;
+  storage = default_storage;
+  flat = NULL;
+  if (storage == H2D_PSS_FLAT)
+  {
+    flat = new FlatTables;
+    memset(flat->dense, 0, sizeof(flat->dense));
+    flat->keys = NULL;
+    flat->rows = NULL;
+    flat->hash_size = flat->hash_count = 0;
+  }
   update_max_index();
   set_quad_2d(&g_quad_2d_std);
 }
@@ -42,6 +56,8 @@ PrecalcShapeset::PrecalcShapeset(PrecalcShapeset* pss)
   shapeset = pss->shapeset;
   num_components = pss->num_components;
   tables = NULL;
+  storage = pss->storage;
+  flat = NULL;
   update_max_index();
   set_quad_2d(&g_quad_2d_std);
 }
@@ -89,18 +105,142 @@ void PrecalcShapeset::set_active_shape(int index)
   // is indexed solely by sub_idx. The last Judy array is the node table,
   // understood by the base class and indexed by order. The component and
   // val/d/dd indices are used directly in the Node structure.
+  //
+  // With the flat storage (H2D_PSS_FLAT), the node table of the given
+  // order is an array indexed by the order, see update_order_table().
+
+  if (get_storage() == H2D_PSS_FLAT)
+  {
+    this->index = index;
+    update_order_table();
+  }
+  else
+  {
+    unsigned key = cur_quad | (mode << 3) | ((unsigned) (max_index[mode] - index) << 4);
+    void** tab = (master_pss == NULL) ? &tables : &(master_pss->tables);
+    sub_tables = (void**) JudyLIns(tab, key, NULL);
+    update_nodes_ptr();
 
-  unsigned key = cur_quad | (mode << 3) | ((unsigned) (max_index[mode] - index) << 4);
-  void** tab = (master_pss == NULL) ? &tables : &(master_pss->tables);
-  sub_tables = (void**) JudyLIns(tab, key, NULL);
-  update_nodes_ptr();
+    this->index = index;
+  }
 
-  this->index = index;
   order = shapeset->get_order(index);
   order = std::max(H2D_GET_H_ORDER(order), H2D_GET_V_ORDER(order));
 }
 
 
+void PrecalcShapeset::update_order_table()
+{
+  if (sub_idx > H2D_MAX_IDX)
+  {
+    // tables of too deep sub-elements are not kept, see Function::handle_overflow_idx()
+    order_table = NULL;
+    handle_overflow_idx();
+    return;
+  }
+
+  // The standard shape functions on the element and on its sons are found in
+  // a dense array, the rest (deeper sub-elements, constrained shape functions)
+  // in a hash table keyed by the quadrature, mode, index and sub_idx.
+  FlatTables* ft = (master_pss == NULL) ? flat : master_pss->flat;
+  if (index >= 0 && sub_idx < (uint64_t) H2D_PSS_DENSE_SUB)
+  {
+    assert(index <= max_index[mode]);
+    Node*** &dense = ft->dense[cur_quad][mode];
+    if (dense == NULL)
+      dense = (Node***) ft->arena.calloc((max_index[mode] + 1) * H2D_PSS_DENSE_SUB * sizeof(Node**));
+    Node** &row = dense[index * H2D_PSS_DENSE_SUB + (int) sub_idx];
+    if (row == NULL) row = new_flat_row(ft);
+    order_table = row;
+  }
+  else
+  {
+    uint64_t key = ((uint64_t) (unsigned) index << 32) | (sub_idx << 3) | (cur_quad << 1) | mode;
+    order_table = find_flat_row(ft, key);
+  }
+  order_table_len = get_quad_2d()->get_num_tables(mode);
+}
+
+
+PrecalcShapeset::Node** PrecalcShapeset::new_flat_row(FlatTables* ft)
+{
+  return (Node**) ft->arena.calloc(get_quad_2d()->get_num_tables(mode) * sizeof(Node*));
+}
+
+
+static inline unsigned hash_key(uint64_t key)
+{
+  key *= (uint64_t) 0x9E3779B97F4A7C15ULL;
+  return (unsigned) (key >> 32);
+}
+
+
+PrecalcShapeset::Node** PrecalcShapeset::find_flat_row(FlatTables* ft, uint64_t key)
+{
+  unsigned mask = ft->hash_size - 1;
+  if (ft->hash_size)
+  {
+    for (unsigned i = hash_key(key) & mask; ft->keys[i] != H2D_PSS_EMPTY_KEY; i = (i + 1) & mask)
+      if (ft->keys[i] == key)
+        return ft->rows[i];
+  }
+
+  // not found: keep the table at most half full
+  if (2 * (ft->hash_count + 1) > ft->hash_size)
+  {
+    int old_size = ft->hash_size;
+    uint64_t* old_keys = ft->keys;
+    Node*** old_rows = ft->rows;
+
+    ft->hash_size = old_size ? 2 * old_size : 256;
+    ft->keys = new uint64_t[ft->hash_size];
+    ft->rows = new Node**[ft->hash_size];
+    memset(ft->keys, 0xff, ft->hash_size * sizeof(uint64_t));
+    mask = ft->hash_size - 1;
+
+    for (int j = 0; j < old_size; j++)
+    {
+      if (old_keys[j] == H2D_PSS_EMPTY_KEY) continue;
+      unsigned i = hash_key(old_keys[j]) & mask;
+      while (ft->keys[i] != H2D_PSS_EMPTY_KEY) i = (i + 1) & mask;
+      ft->keys[i] = old_keys[j];
+      ft->rows[i] = old_rows[j];
+    }
+    delete [] old_keys;
+    delete [] old_rows;
+  }
+
+  unsigned i = hash_key(key) & mask;
+  while (ft->keys[i] != H2D_PSS_EMPTY_KEY) i = (i + 1) & mask;
+  ft->keys[i] = key;
+  ft->rows[i] = new_flat_row(ft);
+  ft->hash_count++;
+  return ft->rows[i];
+}
+
+
+void PrecalcShapeset::push_transform(int son)
+{
+  RealFunction::push_transform(son);
+  if (get_storage() == H2D_PSS_FLAT) update_order_table();
+}
+
+
+void PrecalcShapeset::pop_transform()
+{
+  RealFunction::pop_transform();
+  if (get_storage() == H2D_PSS_FLAT) update_order_table();
+}
+
+
+void PrecalcShapeset::set_default_storage(int storage)
+{
+  if (storage != H2D_PSS_JUDY && storage != H2D_PSS_FLAT)
+    error("Invalid storage of precalculated tables (%d).", storage);
+  default_storage = storage;
+}
+
+
 void PrecalcShapeset::set_active_element(Element* e)
 {
   mode = e->get_mode();
@@ -121,36 +261,63 @@ void PrecalcShapeset::set_mode(int mode)  // used in curved.cpp
 
 void PrecalcShapeset::precalculate(int order, int mask)
 {
-  int i, j, k;
+  int j, k;
 
   // initialization
   Quad2D* quad = get_quad_2d();
   quad->set_mode(mode);
   H2D_CHECK_ORDER(quad, order);
   int np = quad->get_num_points(order);
-  double3* pt = quad->get_points(order);
 
   int oldmask = (cur_node != NULL) ? cur_node->mask : 0;
   int newmask = mask | oldmask;
-  Node* node = new_node(newmask, np);
 
-  // precalculate all required tables
+  // the tables shared by the shapeset are referenced by the node, only the other ones
+  // are stored in it
+  const double* shared[2][6];
+  int ownmask = 0;
+  for (j = 0; j < num_components; j++)
+    for (k = 0; k < 6; k++)
+      if (newmask & idx2mask[k][j])
+      {
+        shared[j][k] = shapeset->get_shape_table(k, index, quad, order, ctm, j);
+        if (shared[j][k] == NULL) ownmask |= idx2mask[k][j];
+      }
+
+  Node* node;
+  if (order_table != NULL)
+  {
+    // flat storage: the node is kept in the arena, the old one is just abandoned
+    FlatTables* ft = (master_pss == NULL) ? flat : master_pss->flat;
+    node = init_node(ft->arena.alloc(node_size(ownmask, np)), ownmask, np);
+  }
+  else
+    node = new_node(ownmask, np);
+  node->mask = newmask;
+
+  // the tables that are not shared are copied from the old node or calculated
   for (j = 0; j < num_components; j++)
   {
     for (k = 0; k < 6; k++)
     {
       if (newmask & idx2mask[k][j])
-        if (oldmask & idx2mask[k][j])
+        if (!(ownmask & idx2mask[k][j]))
+          node->values[j][k] = (double*) shared[j][k];
+        else if (oldmask & idx2mask[k][j])
           memcpy(node->values[j][k], cur_node->values[j][k], np * sizeof(double));
         else
-          for (i = 0; i < np; i++)
-            node->values[j][k][i] = shapeset->get_value(k, index, ctm->m[0] * pt[i][0] + ctm->t[0],
-                                                                  ctm->m[1] * pt[i][1] + ctm->t[1], j);
+          shapeset->calc_shape_table(k, index, quad, order, ctm, j, node->values[j][k]);
     }
   }
 
-  // remove the old node and attach the new one to the Judy array
-  replace_cur_node(node);
+  // remove the old node and attach the new one to the Judy array or the order table
+  if (order_table != NULL)
+  {
+    *pp_cur_node = node;
+    cur_node = node;
+  }
+  else
+    replace_cur_node(node);
 }
 
 
@@ -158,6 +325,12 @@ void PrecalcShapeset::free()
 {
   if (master_pss != NULL) return;
 
+  if (flat != NULL)
+  {
+    free_flat();
+    return;
+  }
+
   // iterate through the primary Judy array
   unsigned long key = 0;
   void** sub = (void**) JudyLFirst(tables, &key, NULL);
@@ -171,6 +344,54 @@ void PrecalcShapeset::free()
 }
 
 
+void PrecalcShapeset::free_flat()
+{
+  flat->arena.free();
+  memset(flat->dense, 0, sizeof(flat->dense));
+  delete [] flat->keys;
+  delete [] flat->rows;
+  flat->keys = NULL;
+  flat->rows = NULL;
+  flat->hash_size = flat->hash_count = 0;
+  order_table = NULL;
+  cur_node = NULL;
+}
+
+
+long PrecalcShapeset::get_mem_size()
+{
+  if (master_pss != NULL) return master_pss->get_mem_size();
+
+  if (flat != NULL)
+    return (long) flat->arena.get_size() + flat->hash_size * (sizeof(uint64_t) + sizeof(Node**));
+
+  // walk the three levels of Judy arrays
+  unsigned long key = 0;
+  long size = JudyLMemUsed(tables);
+  void** sub = (void**) JudyLFirst(tables, &key, NULL);
+  while (sub != NULL)
+  {
+    unsigned long idx = 0;
+    size += JudyLMemUsed(*sub);
+    void** nodes = (void**) JudyLFirst(*sub, &idx, NULL);
+    while (nodes != NULL)
+    {
+      unsigned long order = 0;
+      size += JudyLMemUsed(*nodes);
+      void** pp = (void**) JudyLFirst(*nodes, &order, NULL);
+      while (pp != NULL)
+      {
+        size += ((Node*) *pp)->size;
+        pp = JudyLNext(*nodes, &order, NULL);
+      }
+      nodes = JudyLNext(*sub, &idx, NULL);
+    }
+    sub = JudyLNext(tables, &key, NULL);
+  }
+  return size;
+}
+
+
 void PrecalcShapeset::dump_info(int quad, const char* filename)
 {
   FILE* f = fopen(filename, "w");
@@ -220,6 +441,7 @@ PrecalcShapeset::~PrecalcShapeset()
 {
   free();
   JudyLFreeArray(&tables, NULL);
+  delete flat;
 
   /*if (master_pss == NULL)
   {
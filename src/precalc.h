@@ -18,6 +18,14 @@
 
 #include "function.h"
 #include "shapeset.h"
+#include "arena.h"
+
+/// Storage backends of the precalculated tables, see PrecalcShapeset::set_default_storage().
+enum
+{
+  H2D_PSS_JUDY = 0, ///< three-level Judy array (shape -> sub-element -> order)
+  H2D_PSS_FLAT = 1  ///< dense tables indexed by shape, sub-element and order, allocated in an arena
+};
 
 
 /// \brief Caches precalculated shape function values.
@@ -45,6 +53,21 @@ public:
   /// Destructor.
   virtual ~PrecalcShapeset();
 
+  /// \brief Selects the storage backend of master instances constructed from now on.
+  /// \details With H2D_PSS_FLAT, the tables of the standard shape functions on the element
+  /// and on its immediate sons are found by plain array indexing, and the value tables
+  /// are allocated contiguously. Deeper sub-elements and constrained shape functions
+  /// are looked up in a hash table. Slave instances always use the storage of their master.
+  /// \param storage [in] H2D_PSS_JUDY (the default) or H2D_PSS_FLAT.
+  static void set_default_storage(int storage);
+
+  /// Returns the storage backend of the tables (H2D_PSS_JUDY or H2D_PSS_FLAT).
+  int get_storage() const { return (master_pss != NULL) ? master_pss->get_storage() : storage; }
+
+  /// Returns the number of bytes occupied by the precalculated tables, including
+  /// the lookup structures.
+  long get_mem_size();
+
   virtual void set_quad_2d(Quad2D* quad_2d);
 
   /// \brief Frees all precalculated tables.
@@ -72,6 +95,12 @@ public:
   /// Internal. Use set_active_element() instead.
   void set_mode(int mode);
 
+  /// See Transformable::push_transform()
+  virtual void push_transform(int son);
+
+  /// See Transformable::pop_transform()
+  virtual void pop_transform();
+
   /// For internal use only.
   void set_master_transform()
   {
@@ -93,6 +122,22 @@ protected:
 
   void* tables; ///< primary Judy array of shapes
 
+  /// Flat storage of the tables (H2D_PSS_FLAT). A row is an array of Node pointers
+  /// indexed by the integration rule order.
+  struct FlatTables
+  {
+    Arena arena;         ///< holds the rows, the dense indices and all Node structures
+    Node*** dense[4][2]; ///< [quad][mode]: rows of the standard shapes, (max_index + 1) * H2D_PSS_DENSE_SUB
+    uint64_t* keys;      ///< open addressing hash table of the remaining rows: keys...
+    Node*** rows;        ///< ...and the rows
+    int hash_size, hash_count;
+  };
+  FlatTables* flat;
+
+  static const int H2D_PSS_DENSE_SUB = H2D_TRF_QUAD_NUM + 1; ///< sub_idx stored densely: the element and its sons
+  static int default_storage;
+  int storage;
+
   int mode;
   int index;
   int max_index[2];
@@ -105,6 +150,11 @@ protected:
 
   void update_max_index();
 
+  void update_order_table();
+  Node** new_flat_row(FlatTables* ft);
+  Node** find_flat_row(FlatTables* ft, uint64_t key);
+  void free_flat();
+
   /// Forces a transform without using push_transform() etc.
   /// Used by the Solution class. <b>For internal use only</b>.
   void force_transform(uint64_t sub_idx, Trf* ctm)
@@ -69,7 +69,7 @@ class H2D_API Quad2D
 {
 public:
 
-  void set_mode(int mode) { this->mode = mode; }
+  void set_mode(int mode) { this->mode = mode; } // the mode is kept for every thread, see ThreadMode
   int  get_mode() const { return mode; }
 
   int get_num_points(int order)  const { return np[mode][order]; };
@@ -80,12 +80,13 @@ public:
   int get_max_order() const { return max_order[mode]; }
   int get_safe_max_order() const { return safe_max_order[mode]; }
   int get_num_tables() const { return num_tables[mode]; }
+  int get_num_tables(int mode) const { return num_tables[mode]; }
 
   double2* get_ref_vertex(int n) { return &ref_vert[mode][n]; }
 
 protected:
 
-  int mode;
+  ThreadMode mode;
 
   double3*** tables;
   int** np;
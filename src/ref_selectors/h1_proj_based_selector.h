@@ -34,6 +34,10 @@ namespace RefinementSelectors {
      *  \param[in] user_shapeset A shapeset. If NULL, it will use internal instance of the class H1Shapeset. */
     H1ProjBasedSelector(CandList cand_list = H2D_HP_ANISO, double conv_exp = 1.0, int max_order = H2DRS_DEFAULT_ORDER, H1Shapeset* user_shapeset = NULL);
   protected: //overloads
+    /// Creates a copy of the selector for a worker thread.
+    /**  Overriden function. For details, see Selector::clone(). */
+    virtual Selector* clone() const;
+
     /// A function expansion of a function f used by this selector.
     enum LocalFuncExpansion {
       H2D_H1FE_VALUE = 0, ///< A function expansion: f.
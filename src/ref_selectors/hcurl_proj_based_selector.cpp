@@ -20,6 +20,10 @@ namespace RefinementSelectors {
     delete[] precalc_rvals_curl;
   }
 
+  Selector* HcurlProjBasedSelector::clone() const {
+    return new HcurlProjBasedSelector(cand_list, conv_exp, max_order, static_cast<HcurlShapeset*>(shapeset));
+  }
+
   void HcurlProjBasedSelector::set_current_order_range(Element* element) {
     current_max_order = this->max_order;
     if (current_max_order == H2DRS_DEFAULT_ORDER)
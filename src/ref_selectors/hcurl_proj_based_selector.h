@@ -40,6 +40,10 @@ namespace RefinementSelectors {
     virtual ~HcurlProjBasedSelector();
 
   protected: //overloads
+    /// Creates a copy of the selector for a worker thread.
+    /**  Overriden function. For details, see Selector::clone(). */
+    virtual Selector* clone() const;
+
     /// A function expansion of a function f used by this selector.
     enum LocalFuncExpansion {
       H2D_HCFE_VALUE0 = 0, ///< A function expansion: f_0.
@@ -619,6 +619,12 @@ namespace RefinementSelectors {
 #endif
   }
 
+  void OptimumSelector::copy_settings(const Selector* src) {
+    const OptimumSelector* sel = static_cast<const OptimumSelector*>(src);
+    opt_symmetric_mesh = sel->opt_symmetric_mesh;
+    opt_apply_exp_dof = sel->opt_apply_exp_dof;
+  }
+
   void OptimumSelector::set_option(const SelOption option, bool enable) {
     switch(option) {
     case H2D_PREFER_SYMMETRIC_MESH: opt_symmetric_mesh = enable; break;
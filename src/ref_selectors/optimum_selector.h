@@ -208,6 +208,10 @@ namespace RefinementSelectors {
      */
     virtual void select_best_candidate(Element* e, const double avg_error, const double dev_error, int* selected_cand, int* selected_h_cand);
 
+    /// Copies options from a given selector.
+    /** Overriden function. For details, see Selector::copy_settings(). */
+    virtual void copy_settings(const Selector* src);
+
     /// Calculates error of candidates.
     /** This method has to be implemented in inherited classes.
      *  \param[in] e An element that is being refined.
@@ -16,11 +16,15 @@ namespace RefinementSelectors {
     //clean svals initialization state
     std::fill(cached_shape_vals_valid, cached_shape_vals_valid + H2D_NUM_MODES, false);
 
-    //clear matrix cache
+    //create matrix cache
+    proj_matrix_cache = new ProjMatrixCache;
     for(int m = 0; m < H2D_NUM_MODES; m++)
-      for(int i = 0; i < H2DRS_MAX_ORDER+1; i++)
-        for(int k = 0; k < H2DRS_MAX_ORDER+1; k++)
-          proj_matrix_cache[m][i][k] = NULL;
+      for(int i = 0; i < H2DRS_MAX_ORDER+2; i++)
+        for(int k = 0; k < H2DRS_MAX_ORDER+2; k++)
+          proj_matrix_cache->matrices[m][i][k] = NULL;
+    proj_matrix_cache->num_users = 1;
+    pthread_mutex_init(&proj_matrix_cache->lock, NULL);
+    num_proj_matrix_hits = 0;
 
     //allocate caches
     int max_inx = max_shape_inx[0];
@@ -28,16 +32,133 @@ namespace RefinementSelectors {
       max_inx = std::max(max_inx, max_shape_inx[i]);
     nonortho_rhs_cache.resize(max_inx + 1);
     ortho_rhs_cache.resize(max_inx + 1);
+
+    //allocate space for projections
+    unsigned int max_num_shapes = shape_indices[0].size();
+    for(int i = 1; i < H2D_NUM_MODES; i++)
+      max_num_shapes = std::max(max_num_shapes, (unsigned int)shape_indices[i].size());
+    proj_rhs.resize(max_num_shapes);
+    proj_shape_inxs.resize(max_num_shapes);
   }
 
   ProjBasedSelector::~ProjBasedSelector() {
+    release_proj_matrix_cache();
+  }
+
+  void ProjBasedSelector::release_proj_matrix_cache() {
+    pthread_mutex_lock(&proj_matrix_cache->lock);
+    proj_matrix_cache->stats.num_hits += num_proj_matrix_hits;
+    pthread_mutex_unlock(&proj_matrix_cache->lock);
+    num_proj_matrix_hits = 0;
+
+    if (--proj_matrix_cache->num_users > 0)
+      return;
+
     //delete matrix cache
     for(int m = 0; m < H2D_NUM_MODES; m++)
-      for(int i = 0; i < H2DRS_MAX_ORDER+1; i++)
-        for(int k = 0; k < H2DRS_MAX_ORDER+1; k++) {
-          if (proj_matrix_cache[m][i][k] != NULL)
-            delete[] proj_matrix_cache[m][i][k];
+      for(int i = 0; i < H2DRS_MAX_ORDER+2; i++)
+        for(int k = 0; k < H2DRS_MAX_ORDER+2; k++) {
+          ProjMatrixLU* matrix = proj_matrix_cache->matrices[m][i][k];
+          if (matrix != NULL) {
+            delete[] matrix->lu;
+            delete[] matrix->indx;
+            delete matrix;
+          }
         }
+    pthread_mutex_destroy(&proj_matrix_cache->lock);
+    delete proj_matrix_cache;
+  }
+
+  ProjBasedSelector::ProjMatrixCacheStats ProjBasedSelector::get_proj_matrix_cache_stats() const {
+    pthread_mutex_lock(&proj_matrix_cache->lock);
+    ProjMatrixCacheStats stats = proj_matrix_cache->stats;
+    pthread_mutex_unlock(&proj_matrix_cache->lock);
+    stats.num_hits += num_proj_matrix_hits;
+    return stats;
+  }
+
+  void ProjBasedSelector::precalc_proj_matrices(int max_order) {
+    //the modes of the shapeset and of the quadrature are restored at the end
+    Quad2D* quad = &g_quad_2d_std;
+    int shapeset_mode = shapeset->get_mode();
+    int quad_mode = quad->get_mode();
+
+    int* shape_inxs = &proj_shape_inxs[0];
+    for(int mode = 0; mode < H2D_NUM_MODES; mode++) {
+      //find the maximum order of shapes
+      int max_shape_order = 0;
+      for(unsigned int i = 0; i < shape_indices[mode].size(); i++)
+        max_shape_order = std::max(max_shape_order, std::max(shape_indices[mode][i].order_h, shape_indices[mode][i].order_v));
+      int order_limit = max_shape_order;
+      if (max_order != H2DRS_DEFAULT_ORDER)
+        order_limit = std::min(order_limit, max_order);
+      order_limit = std::min(order_limit, H2DRS_MAX_ORDER+1);
+
+      //matrices are built in the same way as in calc_projection_errors()
+      shapeset->set_mode(mode);
+      quad->set_mode(mode);
+      double3* gip_points = quad->get_points(H2DRS_INTR_GIP_ORDER);
+      int num_gip_points = quad->get_num_points(H2DRS_INTR_GIP_ORDER);
+
+      //triangles use uniform orders only
+      for(int order_h = 0; order_h <= order_limit; order_h++)
+        for(int order_v = (mode == H2D_MODE_TRIANGLE ? order_h : 0); order_v <= (mode == H2D_MODE_TRIANGLE ? order_h : order_limit); order_v++) {
+          int num_shapes = build_shape_inxs(mode, order_h, order_v, shape_inxs);
+          if (num_shapes > 0)
+            get_proj_matrix(mode, order_h, order_v, gip_points, num_gip_points, shape_inxs, num_shapes);
+        }
+    }
+
+    shapeset->set_mode(shapeset_mode);
+    quad->set_mode(quad_mode);
+
+#if defined(H2D_REPORT_VERBOSE) || defined(H2D_REPORT_RUNTIME_CONTROL)
+    ProjMatrixCacheStats stats = get_proj_matrix_cache_stats();
+    verbose("Precalculated %d projection matrices (%g MB).", stats.num_matrices, stats.memory / (1024.0 * 1024.0));
+#endif
+  }
+
+  const ProjBasedSelector::ProjMatrixLU* ProjBasedSelector::get_proj_matrix(int mode, int order_h, int order_v, double3* gip_points, int num_gip_points, const int* shape_inxs, int num_shapes) {
+    //a matrix in the cache is complete
+    ProjMatrixLU* matrix = proj_matrix_cache->matrices[mode][order_h][order_v];
+    if (matrix != NULL)
+      num_proj_matrix_hits++;
+    else {
+      pthread_mutex_lock(&proj_matrix_cache->lock);
+      matrix = proj_matrix_cache->matrices[mode][order_h][order_v];
+      if (matrix == NULL) {
+        matrix = new ProjMatrixLU;
+        matrix->size = num_shapes;
+        matrix->lu = build_projection_matrix(gip_points, num_gip_points, shape_inxs, num_shapes);
+        matrix->indx = new int[num_shapes];
+        double d;
+        ludcmp(matrix->lu, num_shapes, matrix->indx, &d);
+        H2D_MEMORY_BARRIER();
+        proj_matrix_cache->matrices[mode][order_h][order_v] = matrix;
+
+        ProjMatrixCacheStats& stats = proj_matrix_cache->stats;
+        stats.num_matrices++;
+        stats.memory += num_shapes * (sizeof(double*) + num_shapes * sizeof(double) + sizeof(int));
+        stats.num_misses++;
+      }
+      else
+        num_proj_matrix_hits++;
+      pthread_mutex_unlock(&proj_matrix_cache->lock);
+    }
+
+    assert_msg(matrix->size == num_shapes, "Projection matrix of orders (H:%d,V:%d) has %d rows but %d shapes requested", order_h, order_v, matrix->size, num_shapes);
+    return matrix;
+  }
+
+  int ProjBasedSelector::build_shape_inxs(int mode, int order_h, int order_v, int* shape_inxs) const {
+    const std::vector<ShapeInx>& full_shape_indices = shape_indices[mode];
+    int num_shapes = 0;
+    for(unsigned int inx_shape = 0; inx_shape < full_shape_indices.size(); inx_shape++) {
+      const ShapeInx& shape = full_shape_indices[inx_shape];
+      if (order_h >= shape.order_h && order_v >= shape.order_v)
+        shape_inxs[num_shapes++] = shape.inx;
+    }
+    return num_shapes;
   }
 
   void ProjBasedSelector::set_error_weights(double weight_h, double weight_p, double weight_aniso) {
@@ -46,6 +167,19 @@ namespace RefinementSelectors {
     error_weight_aniso = weight_aniso;
   }
 
+  void ProjBasedSelector::copy_settings(const Selector* src) {
+    OptimumSelector::copy_settings(src);
+    const ProjBasedSelector* sel = static_cast<const ProjBasedSelector*>(src);
+    set_error_weights(sel->error_weight_h, sel->error_weight_p, sel->error_weight_aniso);
+
+    //share factorized matrices
+    if (sel->proj_matrix_cache != proj_matrix_cache && sel->shapeset == shapeset) {
+      release_proj_matrix_cache();
+      proj_matrix_cache = sel->proj_matrix_cache;
+      proj_matrix_cache->num_users++;
+    }
+  }
+
   void ProjBasedSelector::evaluate_cands_error(Element* e, Solution* rsln, double* avg_error, double* dev_error) {
     bool tri = e->is_triangle();
 
@@ -257,15 +391,9 @@ namespace RefinementSelectors {
     , const CandsInfo& info
     , CandElemProjError errors_squared
     ) {
-    //allocate space
-    int max_num_shapes = next_order_shape[mode][current_max_order];
-    scalar* right_side = new scalar[max_num_shapes];
-    int* shape_inxs = new int[max_num_shapes];
-    int* indx = new int[max_num_shapes]; //solver data
-    double* d = new double[max_num_shapes]; //solver data
-    double** proj_matrix = new_matrix<double>(max_num_shapes, max_num_shapes);
-    ProjMatrixCache& proj_matrices = proj_matrix_cache[mode];
-    std::vector<ShapeInx>& full_shape_indices = shape_indices[mode];
+    //use preallocated space
+    scalar* right_side = &proj_rhs[0];
+    int* shape_inxs = &proj_shape_inxs[0];
 
     //check whether ortho-svals are available
     bool ortho_svals_available = true;
@@ -286,17 +414,7 @@ namespace RefinementSelectors {
       int order_h = H2D_GET_H_ORDER(quad_order), order_v = H2D_GET_V_ORDER(quad_order);
 
       //build a list of shape indices from the full list
-      int num_shapes = 0;
-      unsigned int inx_shape = 0;
-      while (inx_shape < full_shape_indices.size()) {
-        ShapeInx& shape = full_shape_indices[inx_shape];
-        if (order_h >= shape.order_h && order_v >= shape.order_v) {
-          assert_msg(num_shapes < max_num_shapes, "more shapes than predicted, possible incosistency");
-          shape_inxs[num_shapes] = shape.inx;
-          num_shapes++;
-        }
-        inx_shape++;
-      }
+      int num_shapes = build_shape_inxs(mode, order_h, order_v, shape_inxs);
 
       //continue only if there are shapes to process
       if (num_shapes > 0) {
@@ -307,13 +425,10 @@ namespace RefinementSelectors {
         std::vector< ValueCacheItem<scalar> >& rhs_cache = use_ortho ? ortho_rhs_cache : nonortho_rhs_cache;
         std::vector<TrfShapeExp>** sub_svals = use_ortho ? sub_ortho_svals : sub_nonortho_svals;
 
-        //calculate projection matrix iff no ortho is used
-        if (!use_ortho) {
-          //error_if(!use_ortho, "Non-ortho"); //DEBUG
-          if (proj_matrices[order_h][order_v] == NULL)
-            proj_matrices[order_h][order_v] = build_projection_matrix(gip_points, num_gip_points, shape_inxs, num_shapes);
-          copy_matrix(proj_matrix, proj_matrices[order_h][order_v], num_shapes, num_shapes); //copy projection matrix because original matrix will be modified
-        }
+        //obtain factorized projection matrix iff no ortho is used
+        const ProjMatrixLU* proj_matrix = NULL;
+        if (!use_ortho)
+          proj_matrix = get_proj_matrix(mode, order_h, order_v, gip_points, num_gip_points, shape_inxs, num_shapes);
 
         //build right side (fill cache values that are missing)
         for(int inx_sub = 0; inx_sub < num_sub; inx_sub++) {
@@ -341,11 +456,8 @@ namespace RefinementSelectors {
         }
 
         //solve iff no ortho is used
-        if (!use_ortho) {
-          //error_if(!use_ortho, "Non-ortho"); //DEBUG
-          ludcmp(proj_matrix, num_shapes, indx, d);
-          lubksb<scalar>(proj_matrix, num_shapes, indx, right_side);
-        }
+        if (!use_ortho)
+          lubksb<scalar>(proj_matrix->lu, num_shapes, proj_matrix->indx, right_side);
 
         //calculate error
         double error_squared = 0;
@@ -360,13 +472,6 @@ namespace RefinementSelectors {
         errors_squared[order_h][order_v] = error_squared * sub_area_corr_coef; //apply area correction coefficient
       }
     } while (order_perm.next());
-
-    //clenaup
-    delete[] proj_matrix;
-    delete[] right_side;
-    delete[] shape_inxs;
-    delete[] indx;
-    delete[] d;
   }
 
 }
@@ -59,6 +59,32 @@ namespace RefinementSelectors {
      *  \param[in] weight_aniso An error weight of ANISO-candidate. The default value is ::H2DRS_DEFAULT_ERR_WEIGHT_ANISO. */
     void set_error_weights(double weight_h = H2DRS_DEFAULT_ERR_WEIGHT_H, double weight_p = H2DRS_DEFAULT_ERR_WEIGHT_P, double weight_aniso = H2DRS_DEFAULT_ERR_WEIGHT_ANISO);
 
+    /// Statistics of the cache of factorized projection matrices.
+    struct ProjMatrixCacheStats {
+      int num_matrices; ///< A number of factorized matrices in the cache.
+      size_t memory; ///< A memory occupied by the factorized matrices (in bytes).
+      unsigned long num_hits; ///< A number of requests for a matrix which was found in the cache.
+      unsigned long num_misses; ///< A number of requests for a matrix which had to be built and factorized.
+
+      /// Returns a ratio of requests which were found in the cache.
+      /** \return A ratio of requests which were found in the cache. Zero if no request was made. */
+      double get_hit_rate() const { return (num_hits + num_misses) == 0 ? 0.0 : (double)num_hits / (num_hits + num_misses); };
+
+      ProjMatrixCacheStats() : num_matrices(0), memory(0), num_hits(0), num_misses(0) {}; ///< Constructor.
+    };
+
+    /// Returns statistics of the cache of factorized projection matrices.
+    /** The cache is shared with workers of the selector, see Selector::get_worker().
+     *  Hits of a worker are counted once the worker is deleted.
+     *  \return Statistics of the cache. */
+    ProjMatrixCacheStats get_proj_matrix_cache_stats() const;
+
+    /// Builds and factorizes projection matrices of all orders up to a given order.
+    /** Without calling this method, a matrix is built when it is needed for the first time.
+     *  Call it right after the selector is constructed in order to move the cost out of the adaptivity.
+     *  \param[in] max_order A maximum order. If ::H2DRS_DEFAULT_ORDER, the maximum order of the selector is used. */
+    void precalc_proj_matrices(int max_order = H2DRS_DEFAULT_ORDER);
+
   protected: //evaluated shape basis
     /// A transform shaped function expansions.
     /** The contents of the class can be accessed through an array index operator.
@@ -160,7 +186,7 @@ namespace RefinementSelectors {
 
   protected:
     /// Constructor.
-    /** Intializes attributes, projection matrix cache (ProjBasedSelector::proj_matrix_cache), and allocates rhs cache (ProjBasedSelector::rhs_cache).
+    /** Intializes attributes, creates projection matrix cache (ProjBasedSelector::proj_matrix_cache), and allocates rhs cache (ProjBasedSelector::rhs_cache).
      *  \param[in] cand_list A predefined list of candidates.
      *  \param[in] conv_exp A conversion exponent, see evaluate_cands_score().
      *  \param[in] max_order A maximum order which considered. If ::H2DRS_DEFAULT_ORDER, a maximum order supported by the selector is used.
@@ -209,17 +235,53 @@ namespace RefinementSelectors {
       T value; ///< A value stored in the item.
       int state; ///< A state of the image: ::H2DRS_VALCACHE_INVALID or ::H2DRS_VALCACHE_VALID or any other user-defined value. The first user defined state has to have number ::H2DRS_VALCACHE_USER.
     };
-    /// A projection matrix cache type.
-    /** Defines a cache of projection matrices for all possible permutations of orders. */
-    typedef double** ProjMatrixCache[H2DRS_MAX_ORDER+2][H2DRS_MAX_ORDER+2];
+    /// A factorized projection matrix.
+    struct ProjMatrixLU {
+      double** lu; ///< An LU decomposition of the matrix (see ludcmp()) allocated through the function new_matrix().
+      int* indx; ///< A permutation of rows of the decomposition.
+      int size; ///< A number of rows of the matrix.
+    };
 
-    /// An array of projection matrices.
-    /** The first index is the mode (see the enum ElementMode). The second and the third index
-     *  is the horizontal and the vertical order respectively.
-     *
-     *  All matrices are square dense matrices and they have to be created through the function new_matrix().
-     *  If record is NULL, the corresponding matrix has to be calculated. */
-    ProjMatrixCache proj_matrix_cache[H2D_NUM_MODES];
+    /// A cache of factorized projection matrices.
+    /** Since a projection matrix depends just on the mode and the orders, the matrix is
+     *  built and factorized once. The cache is shared by the selector and its workers (see Selector::get_worker()),
+     *  hence, matrices are built under a mutex. A matrix is stored only once it is factorized and never changes
+     *  then, so a matrix in the cache is returned without locking.
+     *  The number of users is changed only by the thread which creates workers. */
+    struct ProjMatrixCache {
+      ProjMatrixLU* volatile matrices[H2D_NUM_MODES][H2DRS_MAX_ORDER+2][H2DRS_MAX_ORDER+2]; ///< Factorized matrices. The first index is the mode (see the enum ElementMode), the second and the third index is the horizontal and the vertical order respectively. If NULL, the matrix was not built yet.
+      ProjMatrixCacheStats stats; ///< Statistics. Hits are counted by each user in ProjBasedSelector::num_proj_matrix_hits.
+      int num_users; ///< A number of selectors which use the cache.
+      pthread_mutex_t lock; ///< A lock which guards matrices and statistics.
+    };
+
+    ProjMatrixCache* proj_matrix_cache; ///< A cache of factorized projection matrices.
+    unsigned long num_proj_matrix_hits; ///< A number of matrices found in the cache by this selector, not added to the statistics of the cache yet.
+
+    /// Returns a factorized projection matrix. If it is not in the cache, it is built and factorized.
+    /** \param[in] mode A mode (enum ElementMode).
+     *  \param[in] order_h A horizontal order.
+     *  \param[in] order_v A vertical order.
+     *  \param[in] gip_points Integration points. The first index is an index of an integration point, the second index is defined through the enum GIP2DIndices.
+     *  \param[in] num_gip_points A number of integration points.
+     *  \param[in] shape_inxs Shape indices of the orders, see build_shape_inxs().
+     *  \param[in] num_shapes A number of shape indices.
+     *  \return A factorized projection matrix. It is owned by the cache. */
+    const ProjMatrixLU* get_proj_matrix(int mode, int order_h, int order_v, double3* gip_points, int num_gip_points, const int* shape_inxs, int num_shapes);
+
+    /// Releases the cache of factorized projection matrices. The cache is deallocated if no other selector uses it.
+    void release_proj_matrix_cache();
+
+    /// Lists shapes of an element of given orders.
+    /** \param[in] mode A mode (enum ElementMode).
+     *  \param[in] order_h A horizontal order.
+     *  \param[in] order_v A vertical order.
+     *  \param[out] shape_inxs Shape indices. The array has to be large enough to contain all shapes of the mode.
+     *  \return A number of shape indices. */
+    int build_shape_inxs(int mode, int order_h, int order_v, int* shape_inxs) const;
+
+    std::vector<scalar> proj_rhs; ///< A right-hand side of a projection. It is allocated in the constructor in order to avoid allocating for every element.
+    std::vector<int> proj_shape_inxs; ///< Shape indices of a projection. It is allocated in the constructor in order to avoid allocating for every element.
 
     /// An array of cached right-hand side values.
     /** The first index is an index of the shape function.
@@ -234,6 +296,11 @@ namespace RefinementSelectors {
     double error_weight_p; ///< A coefficient that multiplies error of P-candidate. The default value is ::H2DRS_DEFAULT_ERR_WEIGHT_P.
     double error_weight_aniso; ///< A coefficient that multiplies error of ANISO-candidate. The default value is ::H2DRS_DEFAULT_ERR_WEIGHT_ANISO.
 
+    /// Copies options and error weights from a given selector.
+    /** Overriden function. For details, see Selector::copy_settings().
+     *  If both selectors use the same shapeset, the cache of factorized projection matrices of \a src is shared. */
+    virtual void copy_settings(const Selector* src);
+
     /// Calculates error of candidates.
     /** Overriden function. For details, see OptimumSelector::evaluate_cands_error(). */
     virtual void evaluate_cands_error(Element* e, Solution* rsln, double* avg_error, double* dev_error);
@@ -5,6 +5,25 @@
 
 namespace RefinementSelectors {
 
+  Selector::~Selector() {
+    for (unsigned i = 0; i < workers.size(); i++)
+      delete workers[i];
+  }
+
+  Selector* Selector::get_worker(int k) {
+    if (is_reentrant())
+      return this;
+
+    while ((int)workers.size() <= k) {
+      Selector* worker = clone();
+      if (worker == NULL)
+        return NULL;
+      workers.push_back(worker);
+    }
+    workers[k]->copy_settings(this);
+    return workers[k];
+  }
+
   bool HOnlySelector::select_refinement(Element* element, int quad_order, Solution* rsln, ElementToRefine& refinement) {
     refinement.split = H2D_REFINEMENT_H;
     refinement.p[0] = refinement.p[1] = refinement.p[2] = refinement.p[3] = quad_order;
@@ -16,6 +16,8 @@
 #ifndef __H2D_REFINEMENT_SELECTOR_H
 #define __H2D_REFINEMENT_SELECTOR_H
 
+#include <vector>
+
 #ifndef _MSC_VER
 #include "../refinement_type.h"
 
@@ -70,8 +72,8 @@ namespace RefinementSelectors {
     /// Constructor
     /** \param[in] max_order A maximum order used by this selector. If it is ::H2DRS_DEFAULT_ORDER, a maximum supported order is used. */
     Selector(int max_order = H2DRS_DEFAULT_ORDER) : max_order(max_order) {};
-    /// Destructor.
-    virtual ~Selector() {};
+    /// Destructor. Deletes copies of the selector created by get_worker().
+    virtual ~Selector();
 
     /// Selects a refinement.
     /** This methods has to be implemented.
@@ -89,6 +91,31 @@ namespace RefinementSelectors {
      *  \param[out] tgt_quad_orders Generated encoded orders.
      *  \param[in] suggested_quad_orders Suggested encoded orders. If not NULL, the method should copy them to the output. If NULL, the method have to calculate orders. */
     virtual void generate_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders) = 0;
+
+    /// Returns a selector which selects refinements as this one and which can be used by a worker thread.
+    /** Used by Adapt::adapt() to select refinements of several elements at once. A reentrant selector
+     *  returns itself. Otherwise, a copy is created through clone() on the first request and kept,
+     *  together with its precalculated data, as long as this selector exists. The settings of the copy
+     *  are updated through copy_settings() on every request. The method has to be called by a single thread.
+     *  \param[in] k An index of the worker thread.
+     *  \return A selector of the worker. NULL if the selector cannot be used by several threads. */
+    Selector* get_worker(int k);
+
+  protected:
+    /// Returns true if select_refinement() does not modify the selector, i.e., if it can be called by several threads at once.
+    virtual bool is_reentrant() const { return false; };
+
+    /// Creates a copy of the selector for a worker thread, see get_worker().
+    /** Override to allow selecting refinements by several threads.
+     *  \return A new selector with the same parameters. NULL if not supported. */
+    virtual Selector* clone() const { return NULL; };
+
+    /// Copies settings that may change after the construction (options, weights) from a given selector.
+    /** \param[in] src A selector whose copy this selector is. */
+    virtual void copy_settings(const Selector* src) {};
+
+  private:
+    std::vector<Selector*> workers; ///< Copies of the selector created by get_worker().
   };
 
   /// A selector that selects H-refinements only. \ingroup g_selectors
@@ -105,6 +132,9 @@ namespace RefinementSelectors {
     /** If a parameter suggested_quad_orders is NULL, the method uses an encoded order in orig_quad_order.
      *  For details, see Selector::generate_shared_mesh_orders. */
     virtual void generate_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders);
+
+  protected:
+    virtual bool is_reentrant() const { return true; }; ///< The selector has no state. For details, see Selector::is_reentrant().
   };
 
   /// A selector that increases order (i.e., it selects P-refinements only). \ingroup g_selectors
@@ -126,6 +156,9 @@ namespace RefinementSelectors {
     /** If a parameter suggested_quad_orders is NULL, the method uses an encoded order in orig_quad_order.
      *  For details, see Selector::generate_shared_mesh_orders. */
     virtual void generate_shared_mesh_orders(const Element* element, const int orig_quad_order, const int refinement, int tgt_quad_orders[H2D_MAX_ELEMENT_SONS], const int* suggested_quad_orders);
+
+  protected:
+    virtual bool is_reentrant() const { return true; }; ///< The selector has no state. For details, see Selector::is_reentrant().
   };
 }
 
@@ -20,16 +20,49 @@
 
 
 H1ShapesetJacobi ref_map_shapeset;
-PrecalcShapeset ref_map_pss(&ref_map_shapeset);
+PrecalcShapeset ref_map_pss(&ref_map_shapeset); // used by CurvMap, see curved.cpp
+
+
+static pthread_key_t thread_pss_key;
+static pthread_once_t thread_pss_once = PTHREAD_ONCE_INIT;
+
+static void free_thread_pss(void* pss)
+{
+  delete (PrecalcShapeset*) pss;
+}
+
+static void create_thread_pss_key()
+{
+  if (pthread_key_create(&thread_pss_key, free_thread_pss) != 0)
+    error("Could not create the key of the reference map shapesets.");
+}
+
+/// Returns the PrecalcShapeset shared by the reference maps of the calling thread.
+/// It is deleted when the thread exits.
+static PrecalcShapeset* get_thread_pss()
+{
+  pthread_once(&thread_pss_once, create_thread_pss_key);
+  PrecalcShapeset* pss = (PrecalcShapeset*) pthread_getspecific(thread_pss_key);
+  if (pss == NULL)
+  {
+    pss = new PrecalcShapeset(&ref_map_shapeset);
+    pthread_setspecific(thread_pss_key, pss);
+  }
+  return pss;
+}
 
 
 RefMap::RefMap()
 {
+  pss = NULL;
+  private_pss = false;
   quad_2d = NULL;
   num_tables = 0;
   nodes = NULL;
   cur_node = NULL;
   overflow = NULL;
+  geom_cache = NULL;
+  cache_held = false;
   set_quad_2d(&g_quad_2d_std); // default quadrature
 }
 
@@ -39,7 +72,48 @@ void RefMap::set_quad_2d(Quad2D* quad_2d)
 {
   free();
   this->quad_2d = quad_2d;
-  ref_map_pss.set_quad_2d(quad_2d);
+  if (private_pss)
+    pss->set_quad_2d(quad_2d);
+  else
+    update_shared_pss();
+  if (geom_cache != NULL && geom_cache->get_quad_2d() != quad_2d) geom_cache = NULL;
+}
+
+
+void RefMap::set_geom_cache(GeomCache* cache)
+{
+  if (cache == geom_cache) return;
+  if (cache != NULL && cache->get_quad_2d() != quad_2d)
+    error("The geometry cache uses a different quadrature than the reference map.");
+  free();
+  element = NULL; // the next set_active_element() must pick up a node again
+  geom_cache = cache;
+}
+
+
+void RefMap::set_private_pss(bool enable)
+{
+  if (enable == private_pss) return;
+  private_pss = enable;
+  if (enable)
+  {
+    pss = new PrecalcShapeset(&ref_map_shapeset);
+    if (quad_2d != NULL) pss->set_quad_2d(quad_2d);
+  }
+  else
+  {
+    delete pss;
+    pss = NULL;
+    if (quad_2d != NULL) update_shared_pss();
+  }
+}
+
+
+void RefMap::update_shared_pss()
+{
+  // the reference map may be used by another thread than the last time
+  pss = get_thread_pss();
+  if (pss->get_quad_2d() != quad_2d) pss->set_quad_2d(quad_2d);
 }
 
 
@@ -47,7 +121,8 @@ void RefMap::set_active_element(Element* e)
 {
   if (e != element) free();
 
-  ref_map_pss.set_active_element(e);
+  if (!private_pss) update_shared_pss();
+  pss->set_active_element(e);
   quad_2d->set_mode(e->get_mode());
   num_tables = quad_2d->get_num_tables();
   assert(num_tables <= H2D_MAX_TABLES);
@@ -129,13 +204,13 @@ void RefMap::calc_inv_ref_map(int order)
 
   AUTOLA_OR(double2x2, m, np);
   memset(m, 0, m.size);
-  ref_map_pss.force_transform(sub_idx, ctm);
+  pss->force_transform(sub_idx, ctm);
   for (i = 0; i < nc; i++)
   {
     double *dx, *dy;
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    ref_map_pss.get_dx_dy_values(dx, dy);
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    pss->get_dx_dy_values(dx, dy);
     for (j = 0; j < np; j++)
     {
       m[j][0][0] += coefs[i][0] * dx[j];
@@ -149,6 +224,7 @@ void RefMap::calc_inv_ref_map(int order)
   double trj = get_transform_jacobian();
   double2x2* irm = cur_node->inv_ref_map[order] = new double2x2[np];
   double* jac = cur_node->jacobian[order] = new double[np];
+  cur_node->memory += np * (sizeof(double2x2) + sizeof(double));
   for (i = 0; i < np; i++)
   {
     jac[i] = (m[i][0][0] * m[i][1][1] - m[i][0][1] * m[i][1][0]);
@@ -174,15 +250,15 @@ void RefMap::calc_second_ref_map(int order)
 
   AUTOLA_OR(double3x2, k, np);
   memset(k, 0, k.size);
-  ref_map_pss.force_transform(sub_idx, ctm);
+  pss->force_transform(sub_idx, ctm);
   for (i = 0; i < nc; i++)
   {
     double *dxy, *dxx, *dyy;
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order, H2D_FN_ALL);
-    dxx = ref_map_pss.get_dxx_values();
-    dyy = ref_map_pss.get_dyy_values();
-    dxy = ref_map_pss.get_dxy_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order, H2D_FN_ALL);
+    dxx = pss->get_dxx_values();
+    dyy = pss->get_dyy_values();
+    dxy = pss->get_dxy_values();
     for (j = 0; j < np; j++)
     {
       k[j][0][0] += coefs[i][0] * dxx[j];
@@ -195,6 +271,7 @@ void RefMap::calc_second_ref_map(int order)
   }
 
   double3x2* mm = cur_node->second_ref_map[order] = new double3x2[np];
+  cur_node->memory += np * sizeof(double3x2);
   double2x2* m = get_inv_ref_map(order);
   for (j = 0; j < np; j++)
   {
@@ -262,13 +339,14 @@ void RefMap::calc_phys_x(int order)
   // transform all x coordinates of the integration points
   int i, j, np = quad_2d->get_num_points(order);
   double* x = cur_node->phys_x[order] = new double[np];
+  cur_node->memory += np * sizeof(double);
   memset(x, 0, np * sizeof(double));
-  ref_map_pss.force_transform(sub_idx, ctm);
+  pss->force_transform(sub_idx, ctm);
   for (i = 0; i < nc; i++)
   {
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    double* fn = ref_map_pss.get_fn_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    double* fn = pss->get_fn_values();
     for (j = 0; j < np; j++)
       x[j] += coefs[i][0] * fn[j];
   }
@@ -280,13 +358,14 @@ void RefMap::calc_phys_y(int order)
   // transform all y coordinates of the integration points
   int i, j, np = quad_2d->get_num_points(order);
   double* y = cur_node->phys_y[order] = new double[np];
+  cur_node->memory += np * sizeof(double);
   memset(y, 0, np * sizeof(double));
-  ref_map_pss.force_transform(sub_idx, ctm);
+  pss->force_transform(sub_idx, ctm);
   for (i = 0; i < nc; i++)
   {
-    ref_map_pss.set_active_shape(indices[i]);
-    ref_map_pss.set_quad_order(order);
-    double* fn = ref_map_pss.get_fn_values();
+    pss->set_active_shape(indices[i]);
+    pss->set_quad_order(order);
+    double* fn = pss->get_fn_values();
     for (j = 0; j < np; j++)
       y[j] += coefs[i][1] * fn[j];
   }
@@ -298,6 +377,8 @@ void RefMap::calc_tangent(int edge, int eo)
   int i, j;
   int np = quad_2d->get_num_points(eo);
   double3* tan = cur_node->tan[edge] = new double3[np];
+  cur_node->tan_np[edge] = np;
+  cur_node->memory += np * sizeof(double3);
   int a = edge, b = element->next_vert(edge);
 
   if (!element->is_curved())
@@ -317,16 +398,16 @@ void RefMap::calc_tangent(int edge, int eo)
   else
   {
     // construct jacobi matrices of the direct reference map at integration points along the edge
-    static double2x2 m[15];
+    double2x2 m[15];
     assert(np <= 15);
     memset(m, 0, np*sizeof(double2x2));
-    ref_map_pss.force_transform(sub_idx, ctm);
+    pss->force_transform(sub_idx, ctm);
     for (i = 0; i < nc; i++)
     {
       double *dx, *dy;
-      ref_map_pss.set_active_shape(indices[i]);
-      ref_map_pss.set_quad_order(eo);
-      ref_map_pss.get_dx_dy_values(dx, dy);
+      pss->set_active_shape(indices[i]);
+      pss->set_quad_order(eo);
+      pss->get_dx_dy_values(dx, dy);
       for (j = 0; j < np; j++)
       {
         m[j][0][0] += coefs[i][0] * dx[j];
@@ -464,19 +545,21 @@ void RefMap::init_node(Node** pp)
 {
   Node* node = *pp = new Node;
 
-  // reset all precalculated tables
-  memset(node->inv_ref_map, 0, num_tables * sizeof(double2x2*));
-  memset(node->second_ref_map, 0, num_tables * sizeof(double3x2*));
-  memset(node->phys_x, 0, num_tables * sizeof(double*));
-  memset(node->phys_y, 0, num_tables * sizeof(double*));
+  // reset all precalculated tables; all of them, since a cached node may
+  // later be freed by a reference map set to a different mode
+  memset(node->inv_ref_map, 0, sizeof(node->inv_ref_map));
+  memset(node->second_ref_map, 0, sizeof(node->second_ref_map));
+  memset(node->phys_x, 0, sizeof(node->phys_x));
+  memset(node->phys_y, 0, sizeof(node->phys_y));
   memset(node->tan, 0, sizeof(node->tan));
+  node->memory = sizeof(Node);
 }
 
 
 void RefMap::free_node(Node* node)
 {
   // destroy all precalculated tables
-  for (int i = 0; i < num_tables; i++)
+  for (int i = 0; i < H2D_MAX_TABLES; i++)
   {
     if (node->inv_ref_map[i] != NULL)
     {
@@ -498,6 +581,8 @@ void RefMap::free_node(Node* node)
 
 void RefMap::free()
 {
+  release_cached_node();
+
   unsigned long idx = 0;
   Node** pp = (Node**) JudyLFirst(nodes, &idx, NULL);
   while (pp != NULL)
@@ -517,3 +602,118 @@ RefMap::Node** RefMap::handle_overflow()
   overflow = NULL;
   return &overflow;
 }
+
+
+void RefMap::update_cached_node()
+{
+  if (cache_held && cache_id == element->id && cache_sub_idx == sub_idx) return;
+  release_cached_node();
+  cur_node = geom_cache->acquire(element->id, sub_idx);
+  cache_held = true;
+  cache_id = element->id;
+  cache_sub_idx = sub_idx;
+}
+
+
+void RefMap::release_cached_node()
+{
+  if (!cache_held) return;
+  geom_cache->release(cache_id, cache_sub_idx);
+  cache_held = false;
+  cur_node = NULL;
+}
+
+
+//// GeomCache /////////////////////////////////////////////////////////////////////////////////////
+
+GeomCache::GeomCache(Mesh* mesh, size_t max_memory, Quad2D* quad_2d)
+         : mesh(mesh), seq(mesh->get_seq()), quad_2d(quad_2d), max_memory(max_memory),
+           memory(0), num_hits(0), num_misses(0)
+{
+}
+
+
+GeomCache::~GeomCache()
+{
+  clear();
+}
+
+
+void GeomCache::validate()
+{
+  if (seq == mesh->get_seq()) return;
+  clear();
+  seq = mesh->get_seq();
+}
+
+
+void GeomCache::clear()
+{
+  std::map<Key, Entry>::iterator it;
+  for (it = entries.begin(); it != entries.end(); ++it)
+  {
+    if (it->second.locks > 0)
+      error("GeomCache::clear(): an entry is still in use by a reference map.");
+    RefMap::free_node(it->second.node);
+  }
+  entries.clear();
+  lru.clear();
+  memory = 0;
+}
+
+
+RefMap::Node* GeomCache::acquire(int id, uint64_t sub_idx)
+{
+  Key key(id, sub_idx);
+  std::map<Key, Entry>::iterator it = entries.find(key);
+  if (it != entries.end())
+  {
+    Entry& en = it->second;
+    lru.splice(lru.begin(), lru, en.lru);
+    en.locks++;
+    num_hits++;
+    return en.node;
+  }
+
+  Entry en;
+  RefMap::Node* node = NULL;
+  RefMap::init_node(&node);
+  en.node = node;
+  en.locks = 1;
+  en.memory = 0;
+  en.lru = lru.insert(lru.begin(), key);
+  entries[key] = en;
+  num_misses++;
+  return node;
+}
+
+
+void GeomCache::release(int id, uint64_t sub_idx)
+{
+  std::map<Key, Entry>::iterator it = entries.find(Key(id, sub_idx));
+  assert(it != entries.end() && it->second.locks > 0);
+  Entry& en = it->second;
+  en.locks--;
+
+  // the reference map may have added tables while it was using the node
+  memory += en.node->memory - en.memory;
+  en.memory = en.node->memory;
+  if (memory > max_memory) evict();
+}
+
+
+void GeomCache::evict()
+{
+  std::list<Key>::iterator k = lru.end();
+  while (memory > max_memory && k != lru.begin())
+  {
+    --k;
+    std::map<Key, Entry>::iterator it = entries.find(*k);
+    if (it->second.locks > 0) continue;
+
+    memory -= it->second.memory;
+    RefMap::free_node(it->second.node);
+    entries.erase(it);
+    k = lru.erase(k);
+  }
+}
@@ -19,8 +19,11 @@
 #include "common.h"
 #include "precalc.h"
 #include "quad_all.h"
+#include <list>
 
 struct Element;
+class Mesh;
+class GeomCache;
 
 
 /// \brief Represents the reference mapping.
@@ -36,7 +39,7 @@ class H2D_API RefMap : public Transformable
 public:
 
   RefMap();
-  ~RefMap() { free(); }
+  ~RefMap() { free(); if (private_pss) delete pss; }
 
   /// Sets the quadrature points in which the reference map will be evaluated.
   /// \param quad_2d [in] The quadrature points.
@@ -45,6 +48,21 @@ public:
   /// Returns the current quadrature points.
   Quad2D* get_quad_2d() const { return quad_2d; }
 
+  /// By default, all reference maps of one thread evaluate the geometry through
+  /// one PrecalcShapeset shared by them; each thread has its own. A reference map
+  /// which is moved between threads, or whose tables should not be mixed with the
+  /// other ones, can have a private PrecalcShapeset instead.
+  void set_private_pss(bool enable);
+
+  /// Makes the reference map take its tables from (and leave them in) the given
+  /// geometry cache instead of recomputing them for every element. The cache
+  /// must belong to the mesh of the elements passed to set_active_element()
+  /// and use the same quadrature. Pass NULL to switch the cache off.
+  void set_geom_cache(GeomCache* cache);
+
+  /// Returns the geometry cache in use, or NULL.
+  GeomCache* get_geom_cache() const { return geom_cache; }
+
   /// Returns the 1D quadrature for use in surface integrals.
   const Quad1D* get_quad_1d() const { return &quad_1d; }
 
@@ -126,6 +144,7 @@ public:
     {
       delete[] cur_node->tan[edge];
       cur_node->tan[edge] = NULL;
+      cur_node->memory -= cur_node->tan_np[edge] * sizeof(double3);
     }
     calc_tangent(edge, order);
     
@@ -161,6 +180,10 @@ public:
 
 protected:
 
+  PrecalcShapeset* pss; ///< either the one shared by the thread or a private one
+  bool private_pss;
+
+  void update_shared_pss();
   Quad2D* quad_2d;
   int num_tables;
 
@@ -180,14 +203,22 @@ protected:
     double* phys_x[H2D_MAX_TABLES];
     double* phys_y[H2D_MAX_TABLES];
     double3* tan[4];
+    int tan_np[4];
+    size_t memory;  ///< bytes taken by the node and its tables
   };
 
   void* nodes;
   Node* cur_node;
   Node* overflow;
 
+  GeomCache* geom_cache;
+  bool cache_held;        ///< cur_node is locked in geom_cache under the key below
+  int cache_id;
+  uint64_t cache_sub_idx;
+
   void update_cur_node()
   {
+    if (geom_cache != NULL) { update_cached_node(); return; }
     Node** pp = NULL;
     if (sub_idx > H2D_MAX_IDX)
       pp = handle_overflow();
@@ -213,10 +244,13 @@ protected:
   int calc_inv_ref_order();
 
 
-  void init_node(Node** pp);
-  void free_node(Node* node);
+  static void init_node(Node** pp);
+  static void free_node(Node* node);
   Node** handle_overflow();
 
+  void update_cached_node();
+  void release_cached_node();
+
   Quad1DStd quad_1d;
 
   int indices[70];
@@ -224,6 +258,76 @@ protected:
   double2* coefs;
   double2  lin_coefs[4];
 
+  friend class GeomCache;
+};
+
+
+/// \brief Keeps the reference map tables of a mesh across assemblies.
+///
+/// Without a cache, RefMap computes the jacobians, inverse maps and physical
+/// coordinates of every element again on each assembly, although they only
+/// change when the mesh does. A GeomCache stores them per (element id,
+/// sub-element transform), each entry holding the tables of all quadrature
+/// orders requested so far. The cache is tied to the sequence number of the
+/// mesh and empties itself in validate() when the mesh has been changed.
+/// When its memory exceeds the budget, the least recently used entries not
+/// currently in use by a RefMap are dropped.
+///
+/// A cache may only be used by one thread at a time.
+///
+class H2D_API GeomCache
+{
+public:
+
+  GeomCache(Mesh* mesh, size_t max_memory, Quad2D* quad_2d = &g_quad_2d_std);
+  ~GeomCache();
+
+  /// Empties the cache if the mesh has changed since the last call.
+  void validate();
+
+  /// Drops all entries. No RefMap may be using the cache.
+  void clear();
+
+  /// Sets the memory budget in bytes, evicting entries if necessary.
+  void set_max_memory(size_t max_memory) { this->max_memory = max_memory; evict(); }
+  size_t get_max_memory() const { return max_memory; }
+
+  /// Returns the memory of the cached tables in bytes.
+  size_t get_memory() const { return memory; }
+
+  int get_num_entries() const { return (int) entries.size(); }
+  int get_num_hits() const { return num_hits; }
+  int get_num_misses() const { return num_misses; }
+
+  Mesh* get_mesh() const { return mesh; }
+  Quad2D* get_quad_2d() const { return quad_2d; }
+
+protected:
+
+  typedef std::pair<int, uint64_t> Key; ///< element id, sub-element transform
+
+  struct Entry
+  {
+    RefMap::Node* node;
+    int locks;      ///< number of reference maps currently using the node
+    size_t memory;  ///< node memory accounted for in the cache total
+    std::list<Key>::iterator lru;
+  };
+
+  Mesh* mesh;
+  unsigned seq;
+  Quad2D* quad_2d;
+  size_t max_memory, memory;
+  int num_hits, num_misses;
+
+  std::map<Key, Entry> entries;
+  std::list<Key> lru; ///< most recently used first
+
+  RefMap::Node* acquire(int id, uint64_t sub_idx);
+  void release(int id, uint64_t sub_idx);
+  void evict();
+
+  friend class RefMap;
 };
 
 
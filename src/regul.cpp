@@ -260,6 +260,7 @@ void Mesh::flatten()
 
   elements.copy(new_elements);
   nbase = nactive = elements.get_num_items();
+  base_order.clear();
 
   for_all_edge_nodes(node, this)
   {
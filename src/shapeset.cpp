@@ -15,6 +15,8 @@
 
 #include "common.h"
 #include "shapeset.h"
+#include "quad.h"
+#include "transform.h"
 #include "matrix_old.h"
 
 
@@ -120,6 +122,9 @@ double* Shapeset::calculate_constrained_edge_combination(int order, int part, in
 }
 
 
+/// Guards comb_table, which may be filled by several assembling threads at once.
+static pthread_mutex_t comb_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /// Returns the coefficients for the linear combination forming a constrained edge function.
 /// This function performs the storage (caching) of these coefficients, so that they can be
 /// calculated only once.
@@ -127,6 +132,7 @@ double* Shapeset::calculate_constrained_edge_combination(int order, int part, in
 double* Shapeset::get_constrained_edge_combination(int order, int part, int ori, int& nitems)
 {
   int index = 2*((max_order + 1 - ebias)*part + (order - ebias)) + ori;
+  pthread_mutex_lock(&comb_table_mutex);
 
   // allocate/reallocate the array if necessary
   if (comb_table == NULL)
@@ -156,7 +162,9 @@ double* Shapeset::get_constrained_edge_combination(int order, int part, int ori,
   }
 
   nitems = order + 1 - ebias;
-  return comb_table[index];
+  double* comb = comb_table[index];
+  pthread_mutex_unlock(&comb_table_mutex);
+  return comb;
 }
 
 
@@ -175,6 +183,153 @@ void Shapeset::free_constrained_edge_combinations()
 }
 
 
+bool Shapeset::ShapeTableKey::operator==(const ShapeTableKey& other) const
+{
+  return quad == other.quad && mode == other.mode && index == other.index && order == other.order &&
+         n == other.n && component == other.component && m[0] == other.m[0] && m[1] == other.m[1] &&
+         t[0] == other.t[0] && t[1] == other.t[1];
+}
+
+
+unsigned Shapeset::ShapeTableKey::hash() const
+{
+  // FNV-1a of the fields; the doubles are hashed by their bits, 0.0 and -0.0 do not
+  // occur in the transformations
+  unsigned h = 2166136261u;
+  const double* d[4] = { &m[0], &m[1], &t[0], &t[1] };
+  for (int i = 0; i < 4; i++)
+  {
+    const unsigned char* b = (const unsigned char*) d[i];
+    for (unsigned j = 0; j < sizeof(double); j++)
+      h = (h ^ b[j]) * 16777619u;
+  }
+  int v[6] = { (int) (size_t) quad, mode, index, order, n, component };
+  for (int i = 0; i < 6; i++)
+    h = (h ^ (unsigned) v[i]) * 16777619u;
+  return h;
+}
+
+
+Shapeset::ShapeTable* Shapeset::find_shape_table(const ShapeTableKey& key) const
+{
+  ShapeTable* volatile* slots = shape_table_slots;
+  if (slots == NULL) return NULL;
+
+  // a slot is filled only once its table is complete, and an empty slot ends the search
+  const unsigned mask = 2 * H2D_SHAPE_TABLE_MAX_NUM - 1;
+  for (unsigned i = key.hash() & mask; ; i = (i + 1) & mask)
+  {
+    ShapeTable* table = slots[i];
+    if (table == NULL) return NULL;
+    if (table->key == key) return table;
+  }
+}
+
+
+void Shapeset::calc_shape_table(int n, int index, Quad2D* quad, int order, const Trf* ctm, int component,
+                                double* table)
+{
+  int np = quad->get_num_points(order);
+  double3* pt = quad->get_points(order);
+  for (int i = 0; i < np; i++)
+    table[i] = get_value(n, index, ctm->m[0] * pt[i][0] + ctm->t[0],
+                                    ctm->m[1] * pt[i][1] + ctm->t[1], component);
+}
+
+
+const double* Shapeset::get_shape_table(int n, int index, Quad2D* quad, int order, const Trf* ctm, int component)
+{
+  // The values depend only on the points of the quadrature and on the transformation,
+  // which is why the key contains the transformation itself rather than sub_idx.
+  ShapeTableKey key;
+  key.quad = quad;
+  key.m[0] = ctm->m[0]; key.m[1] = ctm->m[1];
+  key.t[0] = ctm->t[0]; key.t[1] = ctm->t[1];
+  key.mode = mode | (quad->get_mode() << 1);
+  key.index = index;
+  key.order = order;
+  key.n = n;
+  key.component = component;
+
+  ShapeTable* table = find_shape_table(key);
+  if (table != NULL) return table->values;
+
+  // the registry is bounded: tables of deep sub-elements, which are rarely visited again,
+  // and the tables over the limits are not shared
+  const double min_scale = 1.0 / (1 << H2D_SHAPE_TABLE_MAX_LEVEL);
+  int np = quad->get_num_points(order);
+  size_t size = offsetof(ShapeTable, values) + np * sizeof(double);
+  if (std::min(ctm->m[0], ctm->m[1]) < min_scale * 0.999 || num_shape_tables >= H2D_SHAPE_TABLE_MAX_NUM ||
+      shape_table_mem + size > H2D_SHAPE_TABLE_MAX_MEM)
+    return NULL;
+
+  // calculate the table outside of the lock (constrained functions lock comb_table_mutex)
+  table = (ShapeTable*) malloc(size);
+  table->key = key;
+  calc_shape_table(n, index, quad, order, ctm, component, table->values);
+
+  pthread_mutex_lock(&shape_table_mutex);
+  if (shape_table_slots == NULL)
+  {
+    ShapeTable** slots = new ShapeTable*[2 * H2D_SHAPE_TABLE_MAX_NUM];
+    memset(slots, 0, 2 * H2D_SHAPE_TABLE_MAX_NUM * sizeof(ShapeTable*));
+    H2D_MEMORY_BARRIER();
+    shape_table_slots = slots;
+  }
+
+  // another thread may have calculated the same table meanwhile, or filled the registry
+  ShapeTable* found = find_shape_table(key);
+  if (found == NULL && num_shape_tables < H2D_SHAPE_TABLE_MAX_NUM && shape_table_mem + size <= H2D_SHAPE_TABLE_MAX_MEM)
+  {
+    const unsigned mask = 2 * H2D_SHAPE_TABLE_MAX_NUM - 1;
+    unsigned i = key.hash() & mask;
+    while (shape_table_slots[i] != NULL)
+      i = (i + 1) & mask;
+    H2D_MEMORY_BARRIER();
+    shape_table_slots[i] = table;
+    num_shape_tables++;
+    shape_table_mem += size;
+    pthread_mutex_unlock(&shape_table_mutex);
+    return table->values;
+  }
+  pthread_mutex_unlock(&shape_table_mutex);
+
+  ::free(table);
+  return (found != NULL) ? found->values : NULL;
+}
+
+
+void Shapeset::free_shape_tables()
+{
+  pthread_mutex_lock(&shape_table_mutex);
+  if (shape_table_slots != NULL)
+  {
+    for (int i = 0; i < 2 * H2D_SHAPE_TABLE_MAX_NUM; i++)
+      ::free(shape_table_slots[i]);
+    delete [] (ShapeTable**) shape_table_slots;
+    shape_table_slots = NULL;
+  }
+  num_shape_tables = 0;
+  shape_table_mem = 0;
+  pthread_mutex_unlock(&shape_table_mutex);
+}
+
+
+/// Guards the last reported combination in warn_undefined_expansion().
+static pthread_mutex_t expansion_warn_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void Shapeset::warn_undefined_expansion(int n, int index)
+{
+  // just to keep the number of warnings low: warn just once about a given combination of n, mode, and index
+  static int warned_mode = -1, warned_index = -1, warned_n = 1;
+  int m = mode;
+  pthread_mutex_lock(&expansion_warn_mutex);
+  warn_if(warned_mode != m || warned_index != index || warned_n != n, "Requested undefined expansion %d (mode: %d) of a shape %d, returning 0", n, m, index);
+  warned_mode = m; warned_index = index; warned_n = n;
+  pthread_mutex_unlock(&expansion_warn_mutex);
+}
+
+
 #define parse_index \
     int part = (unsigned) index >> 7, \
         order = (index >> 3) & 15, \
@@ -18,10 +18,12 @@
 
 #include "common.h"
 
+struct Trf;
+class Quad2D;
 
 #define H2D_CHECK_MODE      assert(mode == H2D_MODE_TRIANGLE || mode == H2D_MODE_QUAD)
-#define H2D_CHECK_VERTEX    assert(vertex >= 0 && vertex < nvert)
-#define H2D_CHECK_EDGE      assert(edge >= 0 && edge < nvert)
+#define H2D_CHECK_VERTEX    assert(vertex >= 0 && vertex < (mode == H2D_MODE_TRIANGLE ? 3 : 4))
+#define H2D_CHECK_EDGE      assert(edge >= 0 && edge < (mode == H2D_MODE_TRIANGLE ? 3 : 4))
 #define H2D_CHECK_ORDER(o)  assert((o) >= 0 && (o) <= max_order)
 #define H2D_CHECK_PART      assert(part >= 0)
 #define H2D_CHECK_INDEX     assert(index >= 0 && index <= max_index[mode])
@@ -45,7 +47,8 @@ enum FunctionExpansionIndex {
 ///
 /// The class returns shape function values for both triangles and quads, depending on
 /// what mode it is in. Use the function set_mode() to switch between H2D_MODE_TRIANGLE and
-/// H2D_MODE_QUAD.
+/// H2D_MODE_QUAD. The mode is kept for every thread separately (see ThreadMode), so that one
+/// shapeset can be used by several threads at once.
 ///
 /// Each shape function is assigned a unique number - 'index'. For standard shape functions,
 /// index is positive and not greater than the value returned by get_max_index(). Negative
@@ -73,14 +76,20 @@ class H2D_API Shapeset
 {
 public:
 
-  ~Shapeset() { free_constrained_edge_combinations(); }
+  Shapeset() : mode(H2D_MODE_TRIANGLE), shape_table_slots(NULL), num_shape_tables(0), shape_table_mem(0)
+    { pthread_mutex_init(&shape_table_mutex, NULL); }
+  ~Shapeset()
+  {
+    free_constrained_edge_combinations();
+    free_shape_tables();
+    pthread_mutex_destroy(&shape_table_mutex);
+  }
 
-  /// Selects H2D_MODE_TRIANGLE or H2D_MODE_QUAD.
+  /// Selects H2D_MODE_TRIANGLE or H2D_MODE_QUAD in the calling thread.
   void set_mode(int mode)
   {
     H2D_CHECK_MODE;
     this->mode = mode;
-    nvert = (mode == H2D_MODE_TRIANGLE) ? 3 : 4;
   }
 
   /// Returns the current mode.
@@ -162,9 +171,7 @@ public:
       H2D_CHECK_INDEX; H2D_CHECK_COMPONENT;
       Shapeset::shape_fn_t** shape_expansion = shape_table[n][mode];
       if (shape_expansion == NULL) { // requested exansion (f, df/dx, df/dy, ddf/dxdx, ...) is not defined
-        static int warned_mode = -1, warned_index = -1, warned_n = 1; //just to keep the number of warnings low: warn just once about a given combinations of n, mode, and index.
-        warn_if(warned_mode != mode || warned_index != index || warned_n != n, "Requested undefined expansion %d (mode: %d) of a shape %d, returning 0", n, mode, index);
-        warned_mode = mode; warned_index = index; warned_n = n;
+        warn_undefined_expansion(n, index);
         return 0;
       }
       else
@@ -181,6 +188,34 @@ public:
   inline double get_dyy_value(int index, double x, double y, int component) { return get_value(4, index, x, y, component); }
   inline double get_dxy_value(int index, double x, double y, int component) { return get_value(5, index, x, y, component); }
 
+  /// Calculates the values (n as in get_value()) of the given shape function at the points
+  /// of the integration rule 'order' of 'quad', transformed to the sub-element given by 'ctm'.
+  void calc_shape_table(int n, int index, Quad2D* quad, int order, const Trf* ctm, int component,
+                        double* table);
+
+  /// Returns the table of calc_shape_table() shared by all users of the shapeset, e.g., all
+  /// PrecalcShapeset instances, also in different threads. Each table is calculated on the
+  /// first request only. Returns NULL if the table is not shared: sub-elements deeper than
+  /// H2D_SHAPE_TABLE_MAX_LEVEL and tables beyond H2D_SHAPE_TABLE_MAX_NUM or
+  /// H2D_SHAPE_TABLE_MAX_MEM are left to the caller. Looking up a table takes no lock.
+  /// The table is valid until free_shape_tables() is called or the shapeset is destroyed.
+  const double* get_shape_table(int n, int index, Quad2D* quad, int order, const Trf* ctm, int component);
+
+  /// Releases all tables returned by get_shape_table(). Nobody may use the shapeset
+  /// meanwhile, and PrecalcShapeset instances must have freed their values (they refer to
+  /// the shared tables).
+  void free_shape_tables();
+
+  /// Returns the number of the shared tables.
+  int get_num_shape_tables() const { return num_shape_tables; }
+
+  /// Returns the memory taken by the shared tables in bytes.
+  size_t get_shape_table_mem() const { return shape_table_mem; }
+
+  static const int H2D_SHAPE_TABLE_MAX_LEVEL = 6;           ///< deepest sub-element with shared tables
+  static const int H2D_SHAPE_TABLE_MAX_NUM = 1 << 16;       ///< maximum number of shared tables
+  static const size_t H2D_SHAPE_TABLE_MAX_MEM = 64 << 20;   ///< maximum memory of shared tables (bytes)
+
 
   /// Returns the coordinates of the reference domain vertices.
   double2* get_ref_vertex(int vertex)
@@ -197,8 +232,7 @@ public:
 
 protected:
 
-  int mode;
-  int nvert;
+  ThreadMode mode;
 
   shape_fn_t*** shape_table[6];
 
@@ -226,6 +260,36 @@ protected:
 
   double get_constrained_value(int n, int index, double x, double y, int component);
 
+  void warn_undefined_expansion(int n, int index);
+
+  /// Identifies a table returned by get_shape_table().
+  struct ShapeTableKey
+  {
+    Quad2D* quad;
+    double m[2], t[2]; ///< the sub-element transformation
+    int mode, index, order, n, component;
+
+    bool operator==(const ShapeTableKey& other) const;
+    unsigned hash() const;
+  };
+
+  /// A shared table, allocated with the values following the key.
+  struct ShapeTable
+  {
+    ShapeTableKey key;
+    double values[1];
+  };
+
+  /// Open addressing hash table of the shared tables with 2 * H2D_SHAPE_TABLE_MAX_NUM slots.
+  /// Tables are inserted under shape_table_mutex and never moved or removed (except by
+  /// free_shape_tables()), so they can be looked up without locking.
+  ShapeTable* volatile* volatile shape_table_slots;
+  int num_shape_tables;
+  size_t shape_table_mem;
+  pthread_mutex_t shape_table_mutex;
+
+  ShapeTable* find_shape_table(const ShapeTableKey& key) const;
+
 };
 
 // TODO : promyslet moznost ulozeni shapesetu jako tabulky monomialnich koeficientu
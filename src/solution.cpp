@@ -19,6 +19,7 @@
 #include "precalc.h"
 #include "refmap.h"
 #include "auto_local_array.h"
+#include "checkpoint.h"
 
 //// MeshFunction //////////////////////////////////////////////////////////////////////////////////
 
@@ -45,6 +46,46 @@ MeshFunction::~MeshFunction()
 }
 
 
+// Orders the points along a Z-order (Morton) curve over their bounding box.
+static void sort_points(const double* x, const double* y, int n, std::vector<int>& order)
+{
+  double x1 = x[0], x2 = x[0], y1 = y[0], y2 = y[0];
+  for (int i = 1; i < n; i++)
+  {
+    x1 = std::min(x1, x[i]);  x2 = std::max(x2, x[i]);
+    y1 = std::min(y1, y[i]);  y2 = std::max(y2, y[i]);
+  }
+  double sx = (x2 > x1) ? 65535.0 / (x2 - x1) : 0.0;
+  double sy = (y2 > y1) ? 65535.0 / (y2 - y1) : 0.0;
+
+  std::vector<std::pair<uint32_t, int> > keys(n);
+  for (int i = 0; i < n; i++)
+  {
+    uint32_t ix = (uint32_t) ((x[i] - x1) * sx), iy = (uint32_t) ((y[i] - y1) * sy);
+    uint32_t key = 0;
+    for (int b = 0; b < 16; b++)
+      key |= ((ix >> b) & 1) << (2*b) | ((iy >> b) & 1) << (2*b + 1);
+    keys[i] = std::make_pair(key, i);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  order.resize(n);
+  for (int i = 0; i < n; i++)
+    order[i] = keys[i].second;
+}
+
+void MeshFunction::get_pt_values(const double* x, const double* y, int n, scalar* values, int item)
+{
+  if (n <= 0) return;
+
+  // nearby points are evaluated one after another, so that they are mostly found
+  // in the last visited element or its neighbors
+  std::vector<int> order;
+  sort_points(x, y, n, order);
+  for (int i = 0; i < n; i++)
+    values[order[i]] = get_pt_value(x[order[i]], y[order[i]], item);
+}
+
 void MeshFunction::set_quad_2d(Quad2D* quad_2d)
 {
   ScalarFunction::set_quad_2d(quad_2d);
@@ -92,15 +133,15 @@ public:
 
     int i, j, k, n, m;
     double3* pt;
-    for (mode = 0; mode <= 1; mode++)
+    for (int md = 0; md <= 1; md++)
     {
       for (k = 0; k <= 10; k++)
       {
-        np[mode][k] = n = mode ? sqr(k+1) : (k+1)*(k+2)/2;
-        tables[mode][k] = pt = new double3[n];
+        np[md][k] = n = md ? sqr(k+1) : (k+1)*(k+2)/2;
+        tables[md][k] = pt = new double3[n];
 
         for (i = k, m = 0; i >= 0; i--)
-          for (j = k; j >= (mode ? 0 : k-i); j--, m++) {
+          for (j = k; j >= (md ? 0 : k-i); j--, m++) {
             pt[m][0] = k ? cos(j * M_PI / k) : 1.0;
             pt[m][1] = k ? cos(i * M_PI / k) : 1.0;
             pt[m][2] = 1.0;
@@ -121,6 +162,104 @@ public:
 } g_quad_2d_cheb;
 
 
+//// mesh sharing //////////////////////////////////////////////////////////////////////////////////
+//
+//  Solutions keep their own copy of the mesh so that they stay valid when the original mesh
+//  is refined later. Creating a new copy on every set_fe_solution() is expensive (Newton
+//  iterations and time stepping create many Solutions on the same mesh), so the copies are
+//  shared and reference-counted. A copy is registered under the seq number of the mesh it was
+//  made from; as long as that mesh is not changed, its seq stays the same and further Solutions
+//  just take another reference. The shared copies are therefore read-only (Mesh::set_read_only()):
+//  whoever wants to change the mesh of a Solution has to change a copy of it. The last few
+//  unreferenced copies are kept around, since DiscreteProblem deletes its Solutions at the end
+//  of each assembling and creates new ones in the next.
+//
+
+static const int H2D_MAX_IDLE_MESHES = 4;
+
+struct SharedMeshes
+{
+  std::map<unsigned, Mesh*> by_seq;  ///< shared copies available for reuse
+  std::map<Mesh*, int> refs;         ///< reference counts of all shared copies
+  std::vector<Mesh*> idle;           ///< unreferenced copies, most recently released first
+};
+
+static SharedMeshes* shared_meshes()
+{
+  // never freed, so that Solutions destroyed at program exit can still release their meshes
+  static SharedMeshes* sm = new SharedMeshes;
+  return sm;
+}
+
+static pthread_mutex_t shared_meshes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Unregisters a shared copy and returns it for deletion.
+static Mesh* drop_shared_mesh(SharedMeshes* sm, Mesh* mesh)
+{
+  sm->refs.erase(mesh);
+  std::map<unsigned, Mesh*>::iterator it = sm->by_seq.find(mesh->get_seq());
+  if (it != sm->by_seq.end() && it->second == mesh)
+    sm->by_seq.erase(it);
+  return mesh;
+}
+
+/// Returns a (possibly shared) copy of 'mesh'. Must be released by release_mesh().
+static Mesh* acquire_mesh(Mesh* mesh)
+{
+  pthread_mutex_lock(&shared_meshes_lock);
+  SharedMeshes* sm = shared_meshes();
+  Mesh* copy = NULL;
+
+  std::map<unsigned, Mesh*>::iterator it = sm->by_seq.find(mesh->get_seq());
+  if (it != sm->by_seq.end())
+    copy = it->second;
+
+  if (copy == NULL)
+  {
+    copy = new Mesh;
+    copy->copy(mesh);
+    copy->set_read_only(true);
+    sm->by_seq[mesh->get_seq()] = copy;
+    sm->refs[copy] = 0;
+  }
+  else if (sm->refs[copy] == 0)
+    sm->idle.erase(std::find(sm->idle.begin(), sm->idle.end(), copy));
+  sm->refs[copy]++;
+
+  pthread_mutex_unlock(&shared_meshes_lock);
+  return copy;
+}
+
+/// Releases a mesh owned by a Solution: drops a reference to a shared copy or deletes
+/// a private one (e.g., a mesh loaded from a file).
+static void release_mesh(Mesh* mesh)
+{
+  pthread_mutex_lock(&shared_meshes_lock);
+  SharedMeshes* sm = shared_meshes();
+  Mesh* del = NULL;
+
+  std::map<Mesh*, int>::iterator it = sm->refs.find(mesh);
+  if (it == sm->refs.end())
+    del = mesh;
+  else if (--(it->second) == 0)
+  {
+    sm->idle.insert(sm->idle.begin(), mesh);
+    if ((int) sm->idle.size() > H2D_MAX_IDLE_MESHES)
+    {
+      del = drop_shared_mesh(sm, sm->idle.back());
+      sm->idle.pop_back();
+    }
+  }
+
+  pthread_mutex_unlock(&shared_meshes_lock);
+  if (del != NULL)
+  {
+    del->set_read_only(false);
+    delete del;
+  }
+}
+
+
 //// Solution //////////////////////////////////////////////////////////////////////////////////////
 
 //  The higher-order solution on elements is best calculated not as a linear  combination
@@ -237,9 +376,7 @@ void Solution::copy(const Solution* sln)
 
   free();
 
-  mesh = new Mesh;
-  //printf("Copying mesh from Solution and setting own_mesh = true.\n");
-  mesh->copy(sln->mesh);
+  mesh = acquire_mesh(sln->mesh);
   own_mesh = true;
 
   type = sln->type;
@@ -295,8 +432,7 @@ void Solution::free()
 
   if (own_mesh == true && mesh != NULL)
   {
-    //printf("Deleting mesh in Solution (own_mesh == true).\n");
-    delete mesh;
+    release_mesh(mesh);
     own_mesh = false;
   }
 
@@ -322,9 +458,34 @@ public:
   double** mat[2][11];
   int* perm[2][11];
 
+  // monomial coefficients of the shape functions, i.e., the transformation from the
+  // basis to the monomials for each shapeset, mode, order and shape function; they are
+  // kept in dense tables by the shapeset id, mode, order and component, indexed by the
+  // shape function, which are filled under mono_lu_mutex and read without locking
+  static const int H2D_MONO_NUM_IDS = 40;
+  double* volatile* shapes[H2D_MONO_NUM_IDS][2][11][2];
+  int num_shapes[H2D_MONO_NUM_IDS][2][11][2];
+
+  // constrained shape functions (negative indices) and shapesets with other ids
+  struct ShapeKey
+  {
+    int shapeset, mode, order, index, component;
+
+    bool operator<(const ShapeKey& other) const
+    {
+      if (shapeset != other.shapeset) return shapeset < other.shapeset;
+      if (mode != other.mode) return mode < other.mode;
+      if (order != other.order) return order < other.order;
+      if (index != other.index) return index < other.index;
+      return component < other.component;
+    }
+  };
+  std::map<ShapeKey, double*> other_shapes;
+
   mono_lu_init()
   {
     memset(mat, 0, sizeof(mat));
+    memset(shapes, 0, sizeof(shapes));
   }
 
   ~mono_lu_init()
@@ -335,12 +496,28 @@ public:
           delete [] mat[m][i];
           delete [] perm[m][i];
         }
+    for (int id = 0; id < H2D_MONO_NUM_IDS; id++)
+      for (int m = 0; m <= 1; m++)
+        for (int i = 0; i <= 10; i++)
+          for (int c = 0; c < 2; c++)
+            if (shapes[id][m][i][c] != NULL)
+            {
+              for (int j = 0; j < num_shapes[id][m][i][c]; j++)
+                delete [] shapes[id][m][i][c][j];
+              delete [] (double**) shapes[id][m][i][c];
+            }
+    std::map<ShapeKey, double*>::iterator it;
+    for (it = other_shapes.begin(); it != other_shapes.end(); ++it)
+      delete [] it->second;
   }
 }
 mono_lu;
 
+/// Guards mono_lu, which is shared by all Solutions.
+static pthread_mutex_t mono_lu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
-double** Solution::calc_mono_matrix(int o, int*& perm)
+double** Solution::calc_mono_matrix(int mode, int o, int*& perm)
 {
   int i, j, k, l, m, row;
   double x, y, xn, yn;
@@ -366,6 +543,76 @@ double** Solution::calc_mono_matrix(int o, int*& perm)
   return mat;
 }
 
+
+/// Returns the coefficients of the shape function 'index' in the monomial basis of order 'o'.
+/// The shapeset and g_quad_2d_cheb have to be set to 'mode'.
+const double* Solution::get_mono_shape(Shapeset* shapeset, int mode, int o, int index, int component)
+{
+  int id = shapeset->get_id();
+  bool dense = (index >= 0 && id >= 0 && id < mono_lu_init::H2D_MONO_NUM_IDS);
+  mono_lu_init::ShapeKey key = { id, mode, o, index, component };
+  double* coefs = NULL;
+  if (dense)
+  {
+    double* volatile* table = mono_lu.shapes[id][mode][o][component];
+    if (table != NULL && (coefs = table[index]) != NULL) return coefs;
+  }
+  else
+  {
+    pthread_mutex_lock(&mono_lu_mutex);
+    std::map<mono_lu_init::ShapeKey, double*>::iterator it = mono_lu.other_shapes.find(key);
+    if (it != mono_lu.other_shapes.end()) coefs = it->second;
+    pthread_mutex_unlock(&mono_lu_mutex);
+    if (coefs != NULL) return coefs;
+  }
+
+  // values at the chebyshev points, converted the same way as a solution on an element
+  int np = g_quad_2d_cheb.get_num_points(o);
+  coefs = new double[np];
+  shapeset->calc_shape_table(0, index, &g_quad_2d_cheb, o, &quad_trf[H2D_TRF_IDENTITY], component, coefs);
+
+  pthread_mutex_lock(&mono_lu_mutex);
+  if (mono_lu.mat[mode][o] == NULL)
+    mono_lu.mat[mode][o] = calc_mono_matrix(mode, o, mono_lu.perm[mode][o]);
+  lubksb(mono_lu.mat[mode][o], np, mono_lu.perm[mode][o], coefs);
+
+  // another thread may have calculated the same coefficients meanwhile; the coefficients
+  // and the tables are published complete
+  double* found = NULL;
+  if (dense)
+  {
+    double* volatile* table = mono_lu.shapes[id][mode][o][component];
+    if (table == NULL)
+    {
+      int n = shapeset->get_max_index() + 1;
+      double** t = new double*[n];
+      memset(t, 0, n * sizeof(double*));
+      H2D_MEMORY_BARRIER();
+      mono_lu.shapes[id][mode][o][component] = table = t;
+      mono_lu.num_shapes[id][mode][o][component] = n;
+    }
+    if ((found = table[index]) == NULL)
+    {
+      H2D_MEMORY_BARRIER();
+      table[index] = coefs;
+    }
+  }
+  else
+  {
+    std::pair<std::map<mono_lu_init::ShapeKey, double*>::iterator, bool> ins =
+      mono_lu.other_shapes.insert(std::make_pair(key, coefs));
+    if (!ins.second) found = ins.first->second;
+  }
+  pthread_mutex_unlock(&mono_lu_mutex);
+
+  if (found != NULL)
+  {
+    delete [] coefs;
+    coefs = found;
+  }
+  return coefs;
+}
+
 // for public use
 void Solution::set_fe_solution(Space* space, Vector* vec, double dir)
 {
@@ -404,10 +651,8 @@ void Solution::set_fe_solution(Space* space, PrecalcShapeset* pss, Vector* vec,
   type = SLN;
   num_dofs = space->get_num_dofs();
 
-  // copy the mesh   TODO: share meshes between solutions
-  mesh = new Mesh;
-  //printf("Copying mesh from Space and setting own_mesh = true.\n");
-  mesh->copy(space->get_mesh());
+  // copy the mesh, or share the copy made for a previous Solution on the same mesh
+  mesh = acquire_mesh(space->get_mesh());
   own_mesh = true;
 
   // allocate the coefficient arrays
@@ -441,47 +686,41 @@ void Solution::set_fe_solution(Space* space, PrecalcShapeset* pss, Vector* vec,
   num_coefs *= num_components;
   mono_coefs = new scalar[num_coefs];
 
-  // express the solution on elements as a linear combination of monomials
+  // express the solution on elements as a linear combination of monomials: the monomial
+  // coefficients of the shape functions are precalculated, so that this is just a sum
+  // of the coefficient vectors of the element's shape functions
+  Shapeset* shapeset = space->get_shapeset();
   Quad2D* quad = &g_quad_2d_cheb;
-  pss->set_quad_2d(quad);
   scalar* mono = mono_coefs;
+  AsmList al;
   for_all_active_elements(e, mesh)
   {
     mode = e->get_mode();
+    shapeset->set_mode(mode);
     quad->set_mode(mode);
     o = elem_orders[e->id];
     int np = quad->get_num_points(o);
 
-    AsmList al;
     space->get_element_assembly_list(e, &al);
-    pss->set_active_element(e);
 
     for (int l = 0; l < num_components; l++)
     {
-      // obtain solution values for the current element
       scalar* val = mono;
       elem_coefs[l][e->id] = (int) (mono - mono_coefs);
       memset(val, 0, sizeof(scalar)*np);
       for (int k = 0; k < al.cnt; k++)
       {
-        pss->set_active_shape(al.idx[k]);
-        pss->set_quad_order(o, H2D_FN_VAL);
         int dof = al.dof[k];
 #ifdef H2D_COMPLEX
         scalar coef = al.coef[k] * (dof >= 0 ? vec->get_cplx(dof) : dir);
 #else
         scalar coef = al.coef[k] * (dof >= 0 ? vec->get(dof) : dir);
 #endif
-        double* shape = pss->get_fn_values(l);
+        const double* shape = get_mono_shape(shapeset, mode, o, al.idx[k], l);
         for (int i = 0; i < np; i++)
           val[i] += shape[i] * coef;
       }
       mono += np;
-
-      // solve for the monomial coefficients
-      if (mono_lu.mat[mode][o] == NULL)
-        mono_lu.mat[mode][o] = calc_mono_matrix(o, mono_lu.perm[mode][o]);
-      lubksb(mono_lu.mat[mode][o], np, mono_lu.perm[mode][o], val);
     }
   }
 
@@ -992,7 +1231,7 @@ void Solution::precalculate(int order, int mask)
 
 //// save & load ///////////////////////////////////////////////////////////////////////////////////
 
-void Solution::save(const char* filename, bool compress)
+void Solution::save(const char* filename, bool compress, CheckpointWriter* writer)
 {
   int i;
 
@@ -1000,48 +1239,31 @@ void Solution::save(const char* filename, bool compress)
   if (type == CNST)  error("Constant solution cannot be saved to a file.");
   if (type == UNDEF) error("Cannot save -- uninitialized solution.");
 
-  // open the stream
   std::string fname = filename;
   if (compress) fname += ".gz";
-  FILE* f = fopen(fname.c_str(), "wb");
-  if (f == NULL) error("Could not open %s for writing.", filename);
-
-  if (compress)
-  {
-    fclose(f);
-    std::stringstream cmdline;
-    cmdline << "gzip > " << filename << ".gz";
-    f = popen(cmdline.str().c_str(), "w");
-    if (f == NULL) error("Could not create compressed stream (command line: %s).", cmdline.str().c_str());
-  }
 
   // write header
-  hermes2d_fwrite("H2DS\001\000\000\000", 1, 8, f);
+  SaveBuffer buf;
+  buf.write("H2DS\002\000\000\000", 1, 8);
   int ssize = sizeof(scalar);
-  hermes2d_fwrite(&ssize, sizeof(int), 1, f);
-  hermes2d_fwrite(&num_components, sizeof(int), 1, f);
-  hermes2d_fwrite(&num_elems, sizeof(int), 1, f);
-  hermes2d_fwrite(&num_coefs, sizeof(int), 1, f);
-
-  // write monomial coefficients
-  hermes2d_fwrite(mono_coefs, sizeof(scalar), num_coefs, f);
-
-  // write element orders
-  char* temp_orders = new char[num_elems];
-  for (i = 0; i < num_elems; i++) {
-    temp_orders[i] = elem_orders[i];
-  }
-  hermes2d_fwrite(temp_orders, sizeof(char), num_elems, f);
-  delete [] temp_orders;
-
-  // write element coef table
+  buf.write(&ssize, sizeof(int), 1);
+  buf.write(&num_components, sizeof(int), 1);
+  buf.write(&num_elems, sizeof(int), 1);
+  buf.write(&num_coefs, sizeof(int), 1);
+
+  // write monomial coefficients, element orders and element coef table
+  buf.write(mono_coefs, sizeof(scalar), num_coefs);
+  buf.write(elem_orders, sizeof(int), num_elems);
   for (i = 0; i < num_components; i++)
-    hermes2d_fwrite(elem_coefs[i], sizeof(int), num_elems, f);
+    buf.write(elem_coefs[i], sizeof(int), num_elems);
 
   // write the mesh
-  mesh->save_raw(f);
+  mesh->save_raw(buf);
 
-  if (compress) pclose(f); else fclose(f);
+  if (writer != NULL)
+    writer->save(buf, fname.c_str(), compress);
+  else
+    buf.save(fname.c_str(), compress);
 }
 
 
@@ -1052,33 +1274,21 @@ void Solution::load(const char* filename)
   free();
   type = SLN;
 
-  int len = strlen(filename);
-  bool compressed = (len > 3 && !strcmp(filename + len - 3, ".gz"));
-
-  // open the stream
-  FILE* f = fopen(filename, "rb");
-  if (f == NULL) error("Could not open %s", filename);
-
-  if (compressed)
-  {
-    fclose(f);
-    std::stringstream cmdline;
-    cmdline << "gunzip < " << filename << ".gz";
-    f = popen(cmdline.str().c_str(), "r");
-    if (f == NULL) error("Could not read from compressed stream (command line: %s).", cmdline.str().c_str());
-  }
+  // read the whole file, decompress if needed
+  LoadBuffer buf;
+  buf.load(filename);
 
   // load header
   struct {
     char magic[4];
     int  ver, ss, nc, ne, nf;
   } hdr;
-  hermes2d_fread(&hdr, sizeof(hdr), 1, f);
+  buf.read(&hdr, sizeof(hdr), 1);
 
   // some checks
   if (hdr.magic[0] != 'H' || hdr.magic[1] != '2' || hdr.magic[2] != 'D' || hdr.magic[3] != 'S')
     error("Not a Hermes2D solution file.");
-  if (hdr.ver > 1)
+  if (hdr.ver > 2)
     error("Unsupported file version.");
 
   // load monomial coefficients
@@ -1086,7 +1296,7 @@ void Solution::load(const char* filename)
   if (hdr.ss == sizeof(double))
   {
     double* temp = new double[num_coefs];
-    hermes2d_fread(temp, sizeof(double), num_coefs, f);
+    buf.read(temp, sizeof(double), num_coefs);
 
     #ifndef H2D_COMPLEX
       mono_coefs = temp;
@@ -1102,7 +1312,7 @@ void Solution::load(const char* filename)
     #ifndef H2D_COMPLEX
       warn("Ignoring imaginary part of the complex solution since this is not H2D_COMPLEX code.");
       scalar* temp = new double[num_coefs*2];
-      hermes2d_fread(temp, sizeof(scalar), num_coefs*2, f);
+      buf.read(temp, sizeof(scalar), num_coefs*2);
       mono_coefs = new double[num_coefs];
       for (i = 0; i < num_coefs; i++)
         mono_coefs[i] = temp[2*i];
@@ -1110,36 +1320,123 @@ void Solution::load(const char* filename)
 
     #else
       mono_coefs = new scalar[num_coefs];;
-      hermes2d_fread(mono_coefs, sizeof(scalar), num_coefs, f);
+      buf.read(mono_coefs, sizeof(scalar), num_coefs);
     #endif
   }
   else
     error("Corrupt solution file.");
 
-  // load element orders
+  // load element orders (version 1 stored them as chars)
   num_elems = hdr.ne;
-  char* temp_orders = new char[num_elems];
-  hermes2d_fread(temp_orders, sizeof(char), num_elems, f);
   elem_orders = new int[num_elems];
-  for (i = 0; i < num_elems; i++)
-    elem_orders[i] = temp_orders[i];
-  delete [] temp_orders;
+  if (hdr.ver == 1)
+  {
+    char* temp_orders = new char[num_elems];
+    buf.read(temp_orders, sizeof(char), num_elems);
+    for (i = 0; i < num_elems; i++)
+      elem_orders[i] = temp_orders[i];
+    delete [] temp_orders;
+  }
+  else
+    buf.read(elem_orders, sizeof(int), num_elems);
 
   // load element coef table
   num_components = hdr.nc;
   for (i = 0; i < num_components; i++)
   {
     elem_coefs[i] = new int[num_elems];
-    hermes2d_fread(elem_coefs[i], sizeof(int), num_elems, f);
+    buf.read(elem_coefs[i], sizeof(int), num_elems);
   }
 
   // load the mesh
   mesh = new Mesh;
-  mesh->load_raw(f);
+  mesh->load_raw(buf);
   //printf("Loading mesh from file and setting own_mesh = true.\n");
   own_mesh = true;
 
-  if (compressed) pclose(f); else fclose(f);
+  init_dxdy_buffer();
+}
+
+
+// Header section of a solution in the binary format, see save_binary().
+struct RawSolutionInfo
+{
+  int ssize, num_components, num_elems, num_coefs;
+};
+
+static const char* ecoef_section[2] = { "ECOEF0", "ECOEF1" };
+
+void Solution::save_binary(const char* filename)
+{
+  if (type == EXACT) error("Exact solution cannot be saved to a file.");
+  if (type == CNST)  error("Constant solution cannot be saved to a file.");
+  if (type == UNDEF) error("Cannot save -- uninitialized solution.");
+
+  BinaryWriter file;
+  RawSolutionInfo info = { sizeof(scalar), num_components, num_elems, num_coefs };
+  file.add_section("SLN", &info, sizeof(RawSolutionInfo), 1);
+  file.add_section("MONO", mono_coefs, sizeof(scalar), num_coefs);
+  file.add_section("ORDERS", elem_orders, sizeof(int), num_elems);
+  for (int i = 0; i < num_components; i++)
+    file.add_section(ecoef_section[i], elem_coefs[i], sizeof(int), num_elems);
+  mesh->save_binary(file);
+  file.save(filename);
+}
+
+
+void Solution::load_binary(const char* filename)
+{
+  int i;
+  size_t n;
+
+  free();
+  type = SLN;
+
+  BinaryFile file;
+  file.open(filename);
+
+  const RawSolutionInfo* info = (const RawSolutionInfo*) file.get_section("SLN", sizeof(RawSolutionInfo), n);
+  if (n != 1 || info->num_components < 1 || info->num_components > 2)
+    error("Corrupt solution file.");
+  num_components = info->num_components;
+  num_elems = info->num_elems;
+  num_coefs = info->num_coefs;
+
+  // monomial coefficients, converted if the file was saved by the real/complex version
+  int ss = info->ssize;
+  if (ss != sizeof(double) && ss != 2*sizeof(double)) error("Corrupt solution file.");
+  const char* mono = (const char*) file.get_section("MONO", ss, n);
+  if ((int) n != num_coefs) error("Corrupt solution file.");
+  mono_coefs = new scalar[num_coefs];
+  if (ss == sizeof(scalar))
+    memcpy(mono_coefs, mono, sizeof(scalar) * num_coefs);
+  else if (ss == sizeof(double))
+    for (i = 0; i < num_coefs; i++)
+      mono_coefs[i] = ((const double*) mono)[i];
+  else
+  {
+    warn("Ignoring imaginary part of the complex solution since this is not H2D_COMPLEX code.");
+    for (i = 0; i < num_coefs; i++)
+      mono_coefs[i] = ((const double*) mono)[2*i];
+  }
+
+  // element orders and element coef table
+  const int* orders = (const int*) file.get_section("ORDERS", sizeof(int), n);
+  if ((int) n != num_elems) error("Corrupt solution file.");
+  elem_orders = new int[num_elems];
+  memcpy(elem_orders, orders, sizeof(int) * num_elems);
+  for (i = 0; i < num_components; i++)
+  {
+    const int* ec = (const int*) file.get_section(ecoef_section[i], sizeof(int), n);
+    if ((int) n != num_elems) error("Corrupt solution file.");
+    elem_coefs[i] = new int[num_elems];
+    memcpy(elem_coefs[i], ec, sizeof(int) * num_elems);
+  }
+
+  // the mesh
+  mesh = new Mesh;
+  mesh->load_binary(file);
+  own_mesh = true;
 
   init_dxdy_buffer();
 }
@@ -1277,10 +1574,12 @@ scalar Solution::get_pt_value(double x, double y, int item)
       }
   }
 
-  // go through all elements
-  Element *e;
-  for_all_active_elements(e, mesh)
+  // go through the elements whose bounding boxes contain the point
+  Element** elems;
+  int n = mesh->get_point_candidates(x, y, elems);
+  for (int i = 0; i < n; i++)
   {
+    Element* e = elems[i];
     refmap->set_active_element(e);
     refmap->untransform(e, x, y, xi1, xi2);
     if (is_in_ref_domain(e, xi1, xi2))
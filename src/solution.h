@@ -22,6 +22,7 @@
 #include "matrix.h"
 
 class PrecalcShapeset;
+class CheckpointWriter;
 
 
 /// \brief Represents a function defined on a mesh.
@@ -54,6 +55,12 @@ public:
 
   virtual scalar get_pt_value(double x, double y, int item = H2D_FN_VAL_0) = 0;
 
+  /// Evaluates the function at 'n' points (x[i], y[i]) and stores the results in 'values'.
+  /// The points are processed in an order that keeps consecutive points close to each
+  /// other, which makes the element search of get_pt_value() cheap.
+  virtual void get_pt_values(const double* x, const double* y, int n, scalar* values,
+                             int item = H2D_FN_VAL_0);
+
 protected:
 
   int mode;
@@ -67,6 +74,9 @@ public:
     { ScalarFunction::force_transform(mf->get_transform(), mf->get_ctm()); }
   void update_refmap()
     { refmap->force_transform(sub_idx, ctm); }
+  /// See RefMap::set_private_pss().
+  void set_private_refmap_pss(bool enable)
+    { refmap->set_private_pss(enable); }
   void force_transform(uint64_t sub_idx, Trf* ctm)
   {
     this->sub_idx = sub_idx;
@@ -123,16 +133,28 @@ public:
   /// mapping matrix. The default is enabled (true).
   void enable_transform(bool enable = true);
 
+  /// Returns true if the transformation is enabled, see enable_transform().
+  bool is_transform_enabled() const { return transform; }
+
   /// Saves the complete solution (i.e., including the internal copy of the mesh and
-  /// element orders) to a binary file. On Linux, if `compress` is true, the file is
-  /// compressed with gzip and a ".gz" suffix added to the file name.
-  void save(const char* filename, bool compress = true);
+  /// element orders) to a binary file. If `compress` is true, the file is compressed
+  /// by zlib in the gzip format and a ".gz" suffix added to the file name. If `writer`
+  /// is given, the data is copied and the file is compressed and written in the background
+  /// (see CheckpointWriter), the solution can be changed right after the call.
+  void save(const char* filename, bool compress = true, CheckpointWriter* writer = NULL);
 
   /// Loads the solution from a file previously created by Solution::save(). This completely
-  /// restores the solution in the memory. The file name has to include the ".gz" suffix,
-  /// in which case the file is piped through gzip to decompress the data (Linux only).
+  /// restores the solution in the memory. Compressed files are recognized by their contents.
   void load(const char* filename);
 
+  /// Saves the solution and its mesh to an uncompressed file in the binary format (see
+  /// BinaryWriter), which can be mapped into the memory when loading. Meant for fast restarts.
+  void save_binary(const char* filename);
+
+  /// Loads the solution from a file created by save_binary(). The file is mapped and the
+  /// coefficient arrays are copied from it without any conversion.
+  void load_binary(const char* filename);
+
   /// Returns solution value or derivatives at element e, in its reference domain point (xi1, xi2).
   /// 'item' controls the returned value: 0 = value, 1 = dx, 2 = dy, 3 = dxx, 4 = dyy, 5 = dxy.
   /// NOTE: This function should be used for postprocessing only, it is not effective
@@ -201,7 +223,8 @@ protected:
   scalar* dxdy_coefs[2][6];
   scalar* dxdy_buffer;
 
-  double** calc_mono_matrix(int o, int*& perm);
+  static double** calc_mono_matrix(int mode, int o, int*& perm);
+  static const double* get_mono_shape(Shapeset* shapeset, int mode, int o, int index, int component);
   void init_dxdy_buffer();
   void free_tables();
 
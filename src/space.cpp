@@ -18,6 +18,17 @@
 #include "matrix_old.h"
 #include "auto_local_array.h"
 
+static int g_space_uid = 0;
+static pthread_mutex_t space_uid_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int next_space_uid()
+{
+  pthread_mutex_lock(&space_uid_mutex);
+  int uid = g_space_uid++;
+  pthread_mutex_unlock(&space_uid_mutex);
+  return uid;
+}
+
 Space::Space(Mesh* mesh, Shapeset* shapeset, BCType (*bc_type_callback)(int), 
              scalar (*bc_value_callback_by_coord)(int, double, double), int p_init)
      : mesh(mesh), shapeset(shapeset)
@@ -31,8 +42,12 @@ Space::Space(Mesh* mesh, Shapeset* shapeset, BCType (*bc_type_callback)(int),
   this->ndata_allocated = 0;
   this->mesh_seq = -1;
   this->seq = 0;
+  this->uid = next_space_uid();
   this->was_assigned = false;
   this->ndof = 0;
+  this->dof_ordering = H2D_DOF_ORDER_NATURAL;
+  this->calc_ordering_stats = false;
+  memset(ordering_stats, 0, sizeof(ordering_stats));
 
   this->set_bc_types_init(bc_type_callback);
   this->set_essential_bc_values(bc_value_callback_by_coord);
@@ -309,6 +324,93 @@ void Space::distribute_orders(Mesh* mesh, int* parents)
 //// dof assignment ////////////////////////////////////////////////////////////////////////////////
 
 int Space::assign_dofs(int first_dof, int stride)
+{
+  if (dof_ordering != H2D_DOF_ORDER_NATURAL)
+    return assign_ordered_dofs(Tuple<Space*>(this), first_dof, stride, dof_ordering, calc_ordering_stats);
+
+  begin_dof_assignment(first_dof, stride);
+  finish_dof_assignment();
+
+  return this->ndof;
+}
+
+int Space::assign_ordered_dofs(Tuple<Space*> spaces, int first_dof, int stride,
+                               DofOrdering ordering, bool calc_stats)
+{
+  int n = spaces.size();
+  int next = first_dof;
+  for (int i = 0; i < n; i++)
+  {
+    spaces[i]->begin_dof_assignment(next, stride);
+    next = spaces[i]->next_dof;
+  }
+  if (next == first_dof)
+  {
+    for (int i = 0; i < n; i++)
+      spaces[i]->finish_dof_assignment();
+    return 0;
+  }
+
+  std::vector<int> key;
+  get_ordering_key(spaces, first_dof, stride, ordering, calc_stats, key);
+  bool cached = true;
+  for (int i = 0; i < n; i++)
+    cached = cached && (spaces[i]->ordering_key == key);
+
+  if (!cached)
+  {
+    // the graph of the DOF blocks is obtained from the assembly lists, so the natural
+    // numbering is completed first; then the DOFs are assigned again and moved
+    for (int i = 0; i < n; i++)
+    {
+      spaces[i]->get_dof_blocks();
+      spaces[i]->finish_dof_assignment();
+    }
+    order_dof_blocks(spaces, ordering, calc_stats);
+    for (int i = 0; i < n; i++)
+    {
+      Space* space = spaces[i];
+      space->assign_natural_dofs();
+      space->ordered_node_blocks = space->node_blocks;
+      space->ordered_elem_blocks = space->elem_blocks;
+      space->ordering_key = key;
+    }
+  }
+  else
+  {
+    // the natural numbering is the same as when the ordering was calculated
+    for (int i = 0; i < n; i++)
+    {
+      spaces[i]->node_blocks = spaces[i]->ordered_node_blocks;
+      spaces[i]->elem_blocks = spaces[i]->ordered_elem_blocks;
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    spaces[i]->set_dof_blocks();
+    spaces[i]->finish_dof_assignment();
+  }
+  return (next - first_dof) / stride;
+}
+
+void Space::get_ordering_key(Tuple<Space*> spaces, int first_dof, int stride,
+                             DofOrdering ordering, bool calc_stats, std::vector<int>& key)
+{
+  key.clear();
+  key.push_back(first_dof);
+  key.push_back(stride);
+  key.push_back(ordering);
+  key.push_back(calc_stats);
+  for (unsigned i = 0; i < spaces.size(); i++)
+  {
+    key.push_back(spaces[i]->uid);
+    key.push_back(spaces[i]->seq);
+    key.push_back(spaces[i]->mesh->get_seq());
+  }
+}
+
+void Space::begin_dof_assignment(int first_dof, int stride)
 {
   if (first_dof < 0) error("Invalid first_dof.");
   if (stride < 1)    error("Invalid stride.");
@@ -333,14 +435,22 @@ int Space::assign_dofs(int first_dof, int stride)
     }
   }
 
-  this->first_dof = next_dof = first_dof;
+  this->first_dof = first_dof;
   this->stride = stride;
+  assign_natural_dofs();
+}
 
+void Space::assign_natural_dofs()
+{
+  next_dof = first_dof;
   reset_dof_assignment();
   assign_vertex_dofs();
   assign_edge_dofs();
   assign_bubble_dofs();
+}
 
+void Space::finish_dof_assignment()
+{
   free_extra_data();
   update_essential_bc_values();
   update_constraints();
@@ -349,8 +459,180 @@ int Space::assign_dofs(int first_dof, int stride)
   mesh_seq = mesh->get_seq();
   was_assigned = true;
   this->ndof = (next_dof - first_dof) / stride;
+}
 
-  return this->ndof;
+void Space::get_dof_blocks()
+{
+  // constrained nodes are not assigned DOFs yet at this point
+  node_blocks.assign(mesh->get_max_node_id(), -1);
+  for (int i = 0; i < mesh->get_max_node_id(); i++)
+    if (ndata[i].dof >= 0 && ndata[i].n > 0)
+      node_blocks[i] = ndata[i].dof;
+
+  Element* e;
+  elem_blocks.assign(mesh->get_max_element_id(), -1);
+  for_all_active_elements(e, mesh)
+    if (edata[e->id].n > 0)
+      elem_blocks[e->id] = edata[e->id].bdof;
+}
+
+void Space::set_dof_blocks()
+{
+  for (int i = 0; i < mesh->get_max_node_id(); i++)
+    if (ndata[i].dof >= 0 && ndata[i].n > 0)
+      ndata[i].dof = node_blocks[i];
+
+  Element* e;
+  for_all_active_elements(e, mesh)
+    if (edata[e->id].n > 0)
+      edata[e->id].bdof = elem_blocks[e->id];
+
+  std::vector<int>().swap(node_blocks);
+  std::vector<int>().swap(elem_blocks);
+}
+
+void Space::order_dof_blocks(Tuple<Space*> spaces, DofOrdering ordering, bool calc_stats)
+{
+  // list the blocks of all spaces; the DOF d belongs to the block block[d]
+  int max_dof = 0;
+  for (unsigned s = 0; s < spaces.size(); s++)
+    max_dof = std::max(max_dof, spaces[s]->next_dof);
+  std::vector<int> block(max_dof, -1), bstart, bsize, bspace, bid, slots;
+  for (unsigned s = 0; s < spaces.size(); s++)
+  {
+    Space* space = spaces[s];
+    for (int i = 0; i < (int) space->node_blocks.size(); i++)
+      if (space->node_blocks[i] >= 0)
+      {
+        bstart.push_back(space->node_blocks[i]);
+        bsize.push_back(space->ndata[i].n);
+        bspace.push_back(s);
+        bid.push_back(i);
+      }
+    for (int i = 0; i < (int) space->elem_blocks.size(); i++)
+      if (space->elem_blocks[i] >= 0)
+      {
+        bstart.push_back(space->elem_blocks[i]);
+        bsize.push_back(space->edata[i].n);
+        bspace.push_back(s);
+        bid.push_back(-1 - i);
+      }
+  }
+  int nb = bstart.size();
+  for (int b = 0; b < nb; b++)
+    for (int k = 0, dof = bstart[b]; k < bsize[b]; k++, dof += spaces[bspace[b]]->stride)
+    {
+      block[dof] = b;
+      slots.push_back(dof);
+    }
+  std::sort(slots.begin(), slots.end());
+
+  // the graph of the blocks: two blocks are adjacent if they share an element; the blocks
+  // of the spaces on the same mesh are coupled on each element
+  Element* e;
+  AsmList al;
+  std::vector<int> eblocks;
+  std::vector<std::pair<int, int> > pairs;
+  std::vector<bool> done(spaces.size(), false);
+  for (unsigned s = 0; s < spaces.size(); s++)
+  {
+    if (done[s]) continue;
+    Mesh* mesh = spaces[s]->get_mesh();
+    for_all_active_elements(e, mesh)
+    {
+      eblocks.clear();
+      for (unsigned t = s; t < spaces.size(); t++)
+      {
+        if (spaces[t]->get_mesh() != mesh) continue;
+        spaces[t]->get_element_assembly_list(e, &al);
+        for (int i = 0; i < al.cnt; i++)
+          if (al.dof[i] >= 0)
+            eblocks.push_back(block[al.dof[i]]);
+      }
+      std::sort(eblocks.begin(), eblocks.end());
+      eblocks.erase(std::unique(eblocks.begin(), eblocks.end()), eblocks.end());
+      for (size_t i = 0; i < eblocks.size(); i++)
+        for (size_t j = 0; j < eblocks.size(); j++)
+          if (i != j)
+            pairs.push_back(std::make_pair(eblocks[i], eblocks[j]));
+    }
+    for (unsigned t = s; t < spaces.size(); t++)
+      if (spaces[t]->get_mesh() == mesh)
+        done[t] = true;
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+  std::vector<int> xadj(nb + 1, 0), adj(pairs.size() + 1);
+  for (size_t i = 0; i < pairs.size(); i++)
+  {
+    xadj[pairs[i].first + 1]++;
+    adj[i] = pairs[i].second;
+  }
+  for (int b = 0; b < nb; b++)
+    xadj[b+1] += xadj[b];
+
+  std::vector<int> order(nb);
+  if (ordering == H2D_DOF_ORDER_RCM)
+    rcm_ordering(nb, &xadj[0], &adj[0], &order[0]);
+  else
+    nested_dissection_ordering(nb, &xadj[0], &adj[0], &bsize[0], &order[0]);
+
+  // move the blocks to the DOF numbers in the new order; the DOFs of a block stay
+  // 'stride' apart, since a single space has a constant step and the spaces of a system
+  // have the stride 1
+  std::vector<int> new_pos(nb);
+  for (int k = 0, pos = 0; k < nb; k++)
+  {
+    int b = order[k];
+    Space* space = spaces[bspace[b]];
+    new_pos[b] = pos;
+    assert(bsize[b] == 0 || slots[pos + bsize[b] - 1] == slots[pos] + (bsize[b] - 1) * space->stride);
+    if (bid[b] >= 0)
+      space->node_blocks[bid[b]] = slots[pos];
+    else
+      space->elem_blocks[-1 - bid[b]] = slots[pos];
+    pos += bsize[b];
+  }
+
+  SparsityStats stats[2];
+  memset(stats, 0, sizeof(stats));
+  if (calc_stats)
+  {
+    // the DOFs of adjacent blocks and of the same block are coupled; the DOFs are
+    // indexed by their positions in 'slots'
+    int nd = slots.size();
+    std::vector<int> index(max_dof, -1);
+    for (int i = 0; i < nd; i++)
+      index[slots[i]] = i;
+    std::vector<int> dxadj(nd + 1, 0), dadj, dorder(nd);
+    for (int i = 0; i < nd; i++)
+    {
+      int b = block[slots[i]];
+      int st = spaces[bspace[b]]->stride;
+      int k0 = (slots[i] - bstart[b]) / st;
+      for (int k = 0; k < bsize[b]; k++)
+        if (k != k0)
+          dadj.push_back(index[bstart[b] + k * st]);
+      for (int j = xadj[b]; j < xadj[b+1]; j++)
+      {
+        int c = adj[j];
+        for (int k = 0; k < bsize[c]; k++)
+          dadj.push_back(index[bstart[c] + k * spaces[bspace[c]]->stride]);
+      }
+      dxadj[i+1] = dadj.size();
+      dorder[new_pos[b] + k0] = i;
+    }
+    dadj.push_back(0);
+    get_sparsity_stats(nd, &dxadj[0], &dadj[0], NULL, stats[0]);
+    get_sparsity_stats(nd, &dxadj[0], &dadj[0], &dorder[0], stats[1]);
+    verbose("DOF ordering: bandwidth %d -> %d, profile %lld -> %lld, factor nnz %lld -> %lld.",
+            stats[0].bandwidth, stats[1].bandwidth,
+            (long long) stats[0].profile, (long long) stats[1].profile,
+            (long long) stats[0].factor_nnz, (long long) stats[1].factor_nnz);
+  }
+  for (unsigned s = 0; s < spaces.size(); s++)
+    memcpy(spaces[s]->ordering_stats, stats, sizeof(stats));
 }
 
 void Space::reset_dof_assignment() {
@@ -493,6 +775,8 @@ void Space::copy_callbacks(const Space* space)
   bc_type_callback = space->bc_type_callback;
   bc_value_callback_by_coord = space->bc_value_callback_by_coord;
   bc_value_callback_by_edge  = space->bc_value_callback_by_edge;
+  dof_ordering = space->dof_ordering;
+  calc_ordering_stats = space->calc_ordering_stats;
 }
 
 
@@ -619,13 +903,25 @@ void Space::free_extra_data()
 H2D_API int assign_dofs(Tuple<Space*> spaces) 
 {
   int n = spaces.size();
+  // if all spaces have the same ordering, the DOFs of the system are ordered together,
+  // otherwise each space is ordered separately
+  DofOrdering ordering = (n > 1) ? spaces[0]->dof_ordering : H2D_DOF_ORDER_NATURAL;
+  bool calc_stats = false;
+  for (int i = 0; i < n; i++) {
+    if (spaces[i]->dof_ordering != ordering) ordering = H2D_DOF_ORDER_NATURAL;
+    calc_stats |= spaces[i]->calc_ordering_stats;
+  }
+
   // assigning dofs to each space
   int ndof = 0;  
-  for (int i = 0; i < n; i++) {
-    ndof += spaces[i]->assign_dofs(ndof);
+  if (ordering == H2D_DOF_ORDER_NATURAL) {
+    for (int i = 0; i < n; i++) {
+      ndof += spaces[i]->assign_dofs(ndof);
+    }
+    return ndof;
   }
 
-  return ndof;
+  return Space::assign_ordered_dofs(spaces, 0, 1, ordering, calc_stats);
 }
 
 // updating time-dependent essential BC
@@ -21,6 +21,7 @@
 #include "asmlist.h"
 #include "precalc.h"
 #include "quad_all.h"
+#include "dof_ordering.h"
 
 
 // Possible return values for bc_type_callback():
@@ -33,6 +34,15 @@ enum BCType
 };
 
 
+/// Orderings of the DOFs, see Space::set_dof_ordering().
+enum DofOrdering
+{
+  H2D_DOF_ORDER_NATURAL, ///< Vertex, edge and bubble DOFs in the order of the elements (default).
+  H2D_DOF_ORDER_RCM,     ///< Reverse Cuthill-McKee, reduces the bandwidth and the profile.
+  H2D_DOF_ORDER_ND       ///< Nested dissection, reduces the fill-in of direct solvers.
+};
+
+
 /// \brief Represents a finite element space over a domain.
 ///
 /// The Space class represents a finite element space over a domain defined by 'mesh', spanned
@@ -154,6 +164,31 @@ public:
   /// \return The number of basis functions contained in the space.
   virtual int assign_dofs(int first_dof = 0, int stride = 1);
 
+  /// \brief Sets the ordering of the DOFs, which takes effect in the next assign_dofs().
+  /// \details The DOFs are first assigned in the natural order. Then a graph of the DOF
+  /// blocks (the DOFs of a vertex, an edge or the bubble functions of an element), coupled
+  /// if they share an element, is built from the assembly lists and reordered. The blocks
+  /// are renumbered in the new order, each of them keeps its DOFs 'stride' apart. The set
+  /// of the DOF numbers (from 'first_dof' with the step 'stride') does not change.
+  /// If all spaces of a system have the same ordering, assign_dofs(Tuple<Space*>) orders
+  /// their DOFs together: the DOFs of all spaces then form the range 0 ... ndof-1, but
+  /// those of a single space need not be contiguous. The spaces on the same mesh are
+  /// coupled on each element.
+  /// The ordering is remembered, assign_dofs() calculates it again only after a space of
+  /// the system or its mesh has changed.
+  /// \param calc_stats [in] If true, assign_dofs() also calculates the sparsity statistics
+  /// before and after the reordering (see get_dof_ordering_stats()).
+  void set_dof_ordering(DofOrdering ordering, bool calc_stats = false)
+    { dof_ordering = ordering; calc_ordering_stats = calc_stats; seq++; }
+  DofOrdering get_dof_ordering() const { return dof_ordering; }
+
+  /// Returns the sparsity statistics of the matrix of the space (or of the system the space
+  /// was ordered with, all DOFs coupled on each element) in the natural order and in the
+  /// order set by set_dof_ordering(), as calculated by the last assign_dofs(). Both are
+  /// zero if the DOFs are in the natural order or if the statistics were not requested.
+  void get_dof_ordering_stats(SparsityStats& natural, SparsityStats& ordered) const
+    { natural = ordering_stats[0]; ordered = ordering_stats[1]; }
+
   /// \brief Returns the number of basis functions contained in the space.
   int get_num_dofs() { return ndof; }
   /// \brief Returns the DOF number of the last basis function.
@@ -186,6 +221,11 @@ public:
   /// Obtains an edge assembly list (contains shape functions that are nonzero on the specified edge).
   void get_edge_assembly_list(Element* e, int edge, AsmList* al);
 
+  /// Returns the number of the bubble functions of an active element, i.e., of the DOFs
+  /// which belong to this element only. Their DOF numbers are first, first + step, ...
+  int get_element_bubble_dofs(Element* e, int& first, int& step) const
+    { first = edata[e->id].bdof; step = stride; return edata[e->id].n; }
+
   /// Updates essential BC values. Typically used for time-dependent 
   /// essnetial boundary conditions.
   void update_essential_bc_values();
@@ -200,8 +240,13 @@ protected:
   int first_dof, next_dof;
   int stride;
   int seq, mesh_seq;
+  int uid; ///< unique number of the instance, identifies the space in the key of the DOF ordering
   bool was_assigned;
 
+  DofOrdering dof_ordering;
+  bool calc_ordering_stats;
+  SparsityStats ordering_stats[2];
+
   struct BaseComponent
   {
     int dof;
@@ -264,6 +309,38 @@ protected: //debugging support
   virtual void assign_edge_dofs() = 0;
   virtual void assign_bubble_dofs() = 0;
 
+  /// Checks the element orders and assigns the DOFs in the natural order.
+  void begin_dof_assignment(int first_dof, int stride);
+  /// Assigns the DOFs in the natural order, i.e., the vertex, edge and bubble DOFs in the
+  /// order of the elements.
+  void assign_natural_dofs();
+  /// Processes the assigned DOFs: BC values, constraints etc.
+  void finish_dof_assignment();
+
+  /// First DOFs of the DOF blocks of the nodes and the elements (-1 if none), used only
+  /// while the DOFs are reordered.
+  std::vector<int> node_blocks, elem_blocks;
+  /// Stores the first DOFs of the blocks in the natural order to node_blocks, elem_blocks.
+  void get_dof_blocks();
+  /// Moves the DOF blocks to the first DOFs in node_blocks, elem_blocks.
+  void set_dof_blocks();
+  /// Reorders the DOF blocks of the spaces together. The blocks are moved within the set
+  /// of the DOF numbers of all spaces. Uses the assembly lists of the natural numbering.
+  static void order_dof_blocks(Tuple<Space*> spaces, DofOrdering ordering, bool calc_stats);
+  /// Assigns the DOFs of the spaces from 'first_dof' in the given ordering. The ordering is
+  /// taken from the ordered blocks of the last call if the key of the spaces is the same.
+  static int assign_ordered_dofs(Tuple<Space*> spaces, int first_dof, int stride,
+                                 DofOrdering ordering, bool calc_stats);
+  /// Fills the key of an ordering: the arguments and the uid, seq and mesh seq of the spaces.
+  static void get_ordering_key(Tuple<Space*> spaces, int first_dof, int stride,
+                               DofOrdering ordering, bool calc_stats, std::vector<int>& key);
+
+  /// The ordered DOF blocks of the last reordering and the key they were calculated for.
+  std::vector<int> ordered_node_blocks, ordered_elem_blocks;
+  std::vector<int> ordering_key;
+
+  friend H2D_API int assign_dofs(Tuple<Space*> spaces);
+
   virtual void get_vertex_assembly_list(Element* e, int iv, AsmList* al) = 0;
   virtual void get_edge_assembly_list_internal(Element* e, int ie, AsmList* al) = 0;
   virtual void get_bubble_assembly_list(Element* e, AsmList* al);
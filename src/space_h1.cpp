@@ -23,12 +23,21 @@ double** H1Space::h1_proj_mat = NULL;
 double*  H1Space::h1_chol_p   = NULL;
 int      H1Space::h1_proj_ref = 0;
 
+/// Guards the projection matrices and the default shapeset shared by all spaces of this type.
+static pthread_mutex_t h1_proj_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Shapeset* h1_default_shapeset = NULL; ///< used by the spaces created without a shapeset
+
 H1Space::H1Space(Mesh* mesh, BCType (*bc_type_callback)(int), 
                  scalar (*bc_value_callback_by_coord)(int, double, double), int p_init, 
                  Shapeset* shapeset)
         : Space(mesh, shapeset, bc_type_callback, bc_value_callback_by_coord, p_init)
 {
-  if (shapeset == NULL) this->shapeset = new H1Shapeset;
+  pthread_mutex_lock(&h1_proj_mutex);
+  if (shapeset == NULL)
+  {
+    if (h1_default_shapeset == NULL) h1_default_shapeset = new H1Shapeset;
+    this->shapeset = h1_default_shapeset;
+  }
 
   if (!h1_proj_ref++)
   {
@@ -37,6 +46,7 @@ H1Space::H1Space(Mesh* mesh, BCType (*bc_type_callback)(int),
   }
   proj_mat = h1_proj_mat;
   chol_p   = h1_chol_p;
+  pthread_mutex_unlock(&h1_proj_mutex);
 
   // set uniform poly order in elements
   if (p_init < 1) error("P_INIT must be >=  1 in an H1 space.");
@@ -49,11 +59,13 @@ H1Space::H1Space(Mesh* mesh, BCType (*bc_type_callback)(int),
 
 H1Space::~H1Space()
 {
+  pthread_mutex_lock(&h1_proj_mutex);
   if (!--h1_proj_ref)
   {
     delete [] h1_proj_mat;
     delete [] h1_chol_p;
   }
+  pthread_mutex_unlock(&h1_proj_mutex);
 }
 
 Space* H1Space::dup(Mesh* mesh) const
@@ -24,12 +24,21 @@ double** HcurlSpace::hcurl_proj_mat = NULL;
 double*  HcurlSpace::hcurl_chol_p   = NULL;
 int      HcurlSpace::hcurl_proj_ref = 0;
 
+/// Guards the projection matrices and the default shapeset shared by all spaces of this type.
+static pthread_mutex_t hcurl_proj_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Shapeset* hcurl_default_shapeset = NULL; ///< used by the spaces created without a shapeset
+
 HcurlSpace::HcurlSpace(Mesh* mesh, BCType (*bc_type_callback)(int), 
 		       scalar (*bc_value_callback_by_coord)(int, double, double), int p_init,
                        Shapeset* shapeset)
           : Space(mesh, shapeset, bc_type_callback, bc_value_callback_by_coord, p_init)
 {
-  if (shapeset == NULL) this->shapeset = new HcurlShapeset;
+  pthread_mutex_lock(&hcurl_proj_mutex);
+  if (shapeset == NULL)
+  {
+    if (hcurl_default_shapeset == NULL) hcurl_default_shapeset = new HcurlShapeset;
+    this->shapeset = hcurl_default_shapeset;
+  }
   if (this->shapeset->get_num_components() < 2) error("HcurlSpace requires a vector shapeset.");
 
   if (!hcurl_proj_ref++)
@@ -39,6 +48,7 @@ HcurlSpace::HcurlSpace(Mesh* mesh, BCType (*bc_type_callback)(int),
 
   proj_mat = hcurl_proj_mat;
   chol_p   = hcurl_chol_p;
+  pthread_mutex_unlock(&hcurl_proj_mutex);
 
   // set uniform poly order in elements
   if (p_init < 0) error("P_INIT must be >= 0 in an Hcurl space.");
@@ -51,11 +61,13 @@ HcurlSpace::HcurlSpace(Mesh* mesh, BCType (*bc_type_callback)(int),
 
 HcurlSpace::~HcurlSpace()
 {
+  pthread_mutex_lock(&hcurl_proj_mutex);
   if (!--hcurl_proj_ref)
   {
     delete [] hcurl_proj_mat;
     delete [] hcurl_chol_p;
   }
+  pthread_mutex_unlock(&hcurl_proj_mutex);
 }
 
 
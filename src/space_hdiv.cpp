@@ -24,13 +24,22 @@ double** HdivSpace::hdiv_proj_mat = NULL;
 double*  HdivSpace::hdiv_chol_p   = NULL;
 int      HdivSpace::hdiv_proj_ref = 0;
 
+/// Guards the projection matrices and the default shapeset shared by all spaces of this type.
+static pthread_mutex_t hdiv_proj_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Shapeset* hdiv_default_shapeset = NULL; ///< used by the spaces created without a shapeset
+
 
 HdivSpace::HdivSpace(Mesh* mesh, BCType (*bc_type_callback)(int), 
                  scalar (*bc_value_callback_by_coord)(int, double, double), int p_init, 
                  Shapeset* shapeset)
           : Space(mesh, shapeset, bc_type_callback, bc_value_callback_by_coord, p_init)
 {
-  if (shapeset == NULL) this->shapeset = new HdivShapeset;
+  pthread_mutex_lock(&hdiv_proj_mutex);
+  if (shapeset == NULL)
+  {
+    if (hdiv_default_shapeset == NULL) hdiv_default_shapeset = new HdivShapeset;
+    this->shapeset = hdiv_default_shapeset;
+  }
   if (this->shapeset->get_num_components() < 2) error("HdivSpace requires a vector shapeset.");
 
   if (!hdiv_proj_ref++)
@@ -40,6 +49,7 @@ HdivSpace::HdivSpace(Mesh* mesh, BCType (*bc_type_callback)(int),
 
   proj_mat = hdiv_proj_mat;
   chol_p   = hdiv_chol_p;
+  pthread_mutex_unlock(&hdiv_proj_mutex);
 
   // set uniform poly order in elements
   if (p_init < 0) error("P_INIT must be >= 0 in an Hdiv space.");
@@ -52,11 +62,13 @@ HdivSpace::HdivSpace(Mesh* mesh, BCType (*bc_type_callback)(int),
 
 HdivSpace::~HdivSpace()
 {
+  pthread_mutex_lock(&hdiv_proj_mutex);
   if (!--hdiv_proj_ref)
   {
     delete [] hdiv_proj_mat;
     delete [] hdiv_chol_p;
   }
+  pthread_mutex_unlock(&hdiv_proj_mutex);
 }
 
 
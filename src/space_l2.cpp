@@ -19,10 +19,20 @@
 #include "quad_all.h"
 #include "shapeset_l2_all.h"
 
+/// Guards the default shapeset shared by all spaces of this type.
+static pthread_mutex_t l2_shapeset_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Shapeset* l2_default_shapeset = NULL; ///< used by the spaces created without a shapeset
+
 L2Space::L2Space(Mesh* mesh, int p_init, Shapeset* shapeset)
   : Space(mesh, shapeset, NULL, NULL, p_init)
 {
-  if (shapeset == NULL) this->shapeset = new L2Shapeset;
+  if (shapeset == NULL)
+  {
+    pthread_mutex_lock(&l2_shapeset_mutex);
+    if (l2_default_shapeset == NULL) l2_default_shapeset = new L2Shapeset;
+    this->shapeset = l2_default_shapeset;
+    pthread_mutex_unlock(&l2_shapeset_mutex);
+  }
   ldata = NULL;
   lsize = 0;
 
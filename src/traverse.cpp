@@ -252,7 +252,7 @@ Element** Traverse::get_next_state(bool* bnd, EdgePos* ep)
         for (i = 0; i < num; i++)
         {
 					// Retrieve the Element with this id on the i-th mesh.
-          s->e[i] = meshes[i]->get_element(id);
+          s->e[i] = meshes[i]->get_element(order ? order[id] : id);
           if (!s->e[i]->used) 
 					{ 
 						s->e[i] = NULL; 
@@ -506,6 +506,7 @@ void Traverse::begin(int n, Mesh** meshes, Transformable** fn)
   sons = new int4[num];
   subs = new uint64_t[num];
   id = 0;
+  order = use_base_order ? meshes[0]->get_base_order() : NULL;
 
 #ifndef H2D_DISABLE_MULTIMESH_TESTS
   // Test whether all master mashes have the same number of elements
@@ -31,12 +31,20 @@ struct UniData
 
 /// Traverse is a multi-mesh traversal utility class. Given N meshes sharing the
 /// same base mesh it walks through all (pseudo-)elements of the union of all
-/// the N meshes.
+/// the N meshes. The base elements are visited in the order of their ids, or in the
+/// order of the first mesh (see Mesh::reorder()) after set_base_order(true); the
+/// elements below each of them in the tree order.
 ///
 class H2D_API Traverse
 {
 public:
 
+  Traverse() : use_base_order(false) {}
+
+  /// Visits the base elements in the order of the first mesh (see Mesh::get_base_order())
+  /// instead of the order of their ids. Applies to the next begin().
+  void set_base_order(bool enable) { use_base_order = enable; }
+
   void begin(int n, Mesh** meshes, Transformable** fn = NULL);
   void finish();
 
@@ -55,6 +63,8 @@ private:
   int top, size;
 
   int id;
+  bool use_base_order;
+  const int* order; ///< order of the base elements, see Mesh::get_base_order()
   bool tri;
   Element* base;
   int4* sons;
@@ -76,6 +76,49 @@ void WeakForm::add_matrix_form(matrix_form_val_t fn, matrix_form_ord_t ord, SymF
   seq++;
 }
 
+void WeakForm::add_matrix_form_block(int i, int j, matrix_form_block_t fn, matrix_form_ord_t ord,
+                                     SymFlag sym, int area, Tuple<MeshFunction*>ext)
+{
+  if (fn == NULL)
+    error("A batched matrix form must be given.");
+
+  add_matrix_form(i, j, NULL, ord, sym, area, ext);
+  mfvol.back().fn_block = fn;
+}
+
+// single equation case
+void WeakForm::add_matrix_form_block(matrix_form_block_t fn, matrix_form_ord_t ord, SymFlag sym,
+                                     int area, Tuple<MeshFunction*>ext)
+{
+  add_matrix_form_block(0, 0, fn, ord, sym, area, ext);
+}
+
+// The order of all standard forms is that of the product of the shape functions.
+static Ord std_form_ord(int n, double *wt, Func<Ord> *u_ext[], Func<Ord> *u, Func<Ord> *v,
+                        Geom<Ord> *e, ExtData<Ord> *ext)
+{
+  return u->val[0] * v->val[0];
+}
+
+void WeakForm::add_matrix_form_std(int i, int j, StdFormType type, double c0, double c1, int area)
+{
+  if (type != H2D_STD_MASS && type != H2D_STD_LAPLACE && type != H2D_STD_ADVECTION)
+    error("Invalid type of a standard form.");
+
+  // the diagonal blocks of the mass and Laplace forms are symmetric
+  SymFlag sym = (type != H2D_STD_ADVECTION && i == j) ? H2D_SYM : H2D_UNSYM;
+  add_matrix_form(i, j, NULL, std_form_ord, sym, area);
+  mfvol.back().std_type = type;
+  mfvol.back().std_coef[0] = c0;
+  mfvol.back().std_coef[1] = c1;
+}
+
+// single equation case
+void WeakForm::add_matrix_form_std(StdFormType type, double c0, double c1, int area)
+{
+  add_matrix_form_std(0, 0, type, c0, c1, area);
+}
+
 void WeakForm::add_matrix_form_surf(int i, int j, matrix_form_val_t fn, matrix_form_ord_t ord, int area, Tuple<MeshFunction*>ext)
 {
   if (i < 0 || i >= neq || j < 0 || j >= neq)
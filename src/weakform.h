@@ -33,6 +33,7 @@ class Shapeset;
 template<typename T> class Func;
 template<typename T> class Geom;
 template<typename T> class ExtData;
+class FuncBlock;
 
 // Bilinear form symmetry flag, see WeakForm::add_matrix_form
 enum SymFlag
@@ -42,6 +43,15 @@ enum SymFlag
   H2D_SYM = 1
 };
 
+// Standard bilinear forms with constant coefficients, see WeakForm::add_matrix_form_std
+enum StdFormType
+{
+  H2D_STD_NONE = 0,
+  H2D_STD_MASS,       ///< c0 * u * v
+  H2D_STD_LAPLACE,    ///< c0 * grad u . grad v
+  H2D_STD_ADVECTION   ///< (c0 * du/dx + c1 * du/dy) * v
+};
+
 /// \brief Represents the weak formulation of a problem.
 ///
 /// The WeakForm class represents the weak formulation of a system of linear PDEs.
@@ -65,6 +75,10 @@ public:
   typedef scalar (*vector_form_val_t)(int n, double *wt, Func<scalar> *u[], Func<double> *vi, Geom<double> *e, ExtData<scalar> *);
   typedef Ord (*vector_form_ord_t)(int n, double *wt, Func<Ord> *u[], Func<Ord> *vi, Geom<Ord> *e, ExtData<Ord> *);
 
+  // batched case: the form fills the local matrix of all pairs of shape functions of the
+  // element at once, mat[i][j] being the value for the i-th test and j-th basis function
+  typedef void (*matrix_form_block_t)(int n, double *wt, Func<scalar> *u[], FuncBlock *u_blk, FuncBlock *v_blk, Geom<double> *e, ExtData<scalar> *, scalar **mat);
+
   // general case
   void add_matrix_form(int i, int j, matrix_form_val_t fn, matrix_form_ord_t ord, 
 		   SymFlag sym = H2D_UNSYM, int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>());
@@ -74,6 +88,16 @@ public:
 			int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>());
   void add_matrix_form_surf(matrix_form_val_t fn, matrix_form_ord_t ord, 
 			int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>()); // single equation case
+  // batched case (volume matrix forms on scalar-valued spaces only)
+  void add_matrix_form_block(int i, int j, matrix_form_block_t fn, matrix_form_ord_t ord,
+       SymFlag sym = H2D_UNSYM, int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>());
+  void add_matrix_form_block(matrix_form_block_t fn, matrix_form_ord_t ord,
+       SymFlag sym = H2D_UNSYM, int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>()); // single equation case
+  // standard forms with constant coefficients (volume matrix forms on scalar-valued spaces
+  // only): on elements with a constant jacobian, they are evaluated from integrals of the
+  // shape functions over the reference element instead of by quadrature
+  void add_matrix_form_std(int i, int j, StdFormType type, double c0, double c1 = 0.0, int area = H2D_ANY);
+  void add_matrix_form_std(StdFormType type, double c0, double c1 = 0.0, int area = H2D_ANY); // single equation case
   void add_vector_form(int i, vector_form_val_t fn, vector_form_ord_t ord, 
 		   int area = H2D_ANY, Tuple<MeshFunction*>ext = Tuple<MeshFunction*>());
   void add_vector_form(vector_form_val_t fn, vector_form_ord_t ord, 
@@ -111,7 +135,9 @@ protected:
     Ord evaluate_ord(int point_cnt, double *weights, Func<Ord> *values_v, Geom<Ord> *geometry, ExtData<Ord> *values_ext_fnc, Element* element, Shapeset* shape_set, int shape_inx); ///< Evaluate order of the user defined function.
 
   // general case
-  struct MatrixFormVol  {  int i, j, sym, area;  matrix_form_val_t fn;  matrix_form_ord_t ord;  std::vector<MeshFunction *> ext; };
+  struct MatrixFormVol  {  int i, j, sym, area;  matrix_form_val_t fn;  matrix_form_ord_t ord;  std::vector<MeshFunction *> ext;
+                           matrix_form_block_t fn_block;     // fn == NULL for batched forms
+                           int std_type; double std_coef[2]; };  // fn, fn_block == NULL for standard forms
   struct MatrixFormSurf {  int i, j, area;       matrix_form_val_t fn;  matrix_form_ord_t ord;  std::vector<MeshFunction *> ext; };
   struct VectorFormVol  {  int i, area;          vector_form_val_t fn;  vector_form_ord_t ord;  std::vector<MeshFunction *> ext; };
   struct VectorFormSurf {  int i, area;          vector_form_val_t fn;  vector_form_ord_t ord;  std::vector<MeshFunction *> ext; };
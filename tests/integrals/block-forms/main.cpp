@@ -0,0 +1,97 @@
+#define H2D_REPORT_WARN
+#define H2D_REPORT_INFO
+#define H2D_REPORT_VERBOSE
+#define H2D_REPORT_FILE "application.log"
+#include "hermes2d.h"
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                              -1
+
+// This test makes sure that a batched matrix form (WeakForm::add_matrix_form_block)
+// assembles the same stiffness matrix and Dirichlet lift as the equivalent form
+// evaluated for each pair of shape functions.
+
+const int P_INIT = 3;             // Uniform polynomial degree of mesh elements.
+const int INIT_REF_NUM = 1;       // Number of initial uniform mesh refinements.
+const double K = 3.0;             // Reaction coefficient.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return (marker == 1) ? BC_ESSENTIAL : BC_NATURAL;
+}
+
+// Dirichlet boundary condition values.
+scalar essential_bc_values(int marker, double x, double y)
+{
+  return 1.0 + x;
+}
+
+// Bilinear form evaluated for each pair of shape functions.
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Scalar> *u_ext[], Func<Real> *u, Func<Real> *v,
+                     Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v) + K * int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+// The same bilinear form evaluated for all pairs at once.
+void bilinear_form_block(int n, double *wt, Func<scalar> *u_ext[], FuncBlock *u, FuncBlock *v,
+                         Geom<double> *e, ExtData<scalar> *ext, scalar **mat)
+{
+  int_grad_u_grad_v_block(n, wt, u, v, mat);
+  int_u_v_block(n, wt, u, v, mat, K);
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Scalar> *u_ext[], Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh, refine it and create a hanging node.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("motor.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_element(mesh.get_max_element_id() - 1);
+
+  H1Space space(&mesh, bc_types, essential_bc_values, P_INIT);
+  int ndof = get_num_dofs(&space);
+
+  WeakForm wf_pair, wf_block;
+  wf_pair.add_matrix_form(callback(bilinear_form), H2D_SYM);
+  wf_pair.add_vector_form(callback(linear_form));
+  wf_block.add_matrix_form_block(bilinear_form_block, bilinear_form<Ord, Ord>, H2D_SYM);
+  wf_block.add_vector_form(callback(linear_form));
+
+  CooMatrix mat_pair(ndof), mat_block(ndof);
+  AVector rhs_pair(ndof), rhs_block(ndof), dir_pair(ndof), dir_block(ndof);
+  DiscreteProblem dp_pair(&wf_pair, &space);
+  dp_pair.assemble(NULL, &mat_pair, &dir_pair, &rhs_pair);
+  DiscreteProblem dp_block(&wf_block, &space);
+  dp_block.assemble(NULL, &mat_block, &dir_block, &rhs_block);
+
+  // Compare the results.
+  bool success = (mat_pair.get_nnz() == mat_block.get_nnz());
+  int nnz = mat_pair.get_nnz();
+  int *row = new int[nnz], *col = new int[nnz];
+  double *val = new double[nnz];
+  mat_pair.get_row_col_data(row, col, val);
+  for (int i = 0; i < nnz; i++)
+    if (fabs(mat_block.get(row[i], col[i]) - val[i]) > 1e-10 * (1.0 + fabs(val[i]))) success = false;
+  for (int i = 0; i < ndof; i++)
+    if (fabs(dir_block.get(i) - dir_pair.get(i)) > 1e-10 * (1.0 + fabs(dir_pair.get(i)))) success = false;
+  delete [] row; delete [] col; delete [] val;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,99 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test measures the scaling of the multithreaded error estimation in
+// Adapt::calc_elem_errors() and makes sure that the element errors and the
+// total error do not depend on the number of threads. The coarse and the
+// reference solutions are given by random coefficient vectors on a curved
+// mesh with triangles and quads; the reference space is refined in h and p.
+
+const int INIT_REF_NUM = 3;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int MAX_THREADS = 4;               // Errors are calculated by 1, 2, ..., MAX_THREADS threads.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Sets the solution to a random coefficient vector on the space.
+static void set_random_solution(Space* space, Solution* sln)
+{
+  int ndof = get_num_dofs(space);
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, -1.0 + 2.0 * rand() / RAND_MAX);
+  PrecalcShapeset pss(space->get_shapeset());
+  sln->set_fe_solution(space, &pss, &vec);
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("domain.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  // The coarse space and the reference space.
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  Mesh ref_mesh;
+  ref_mesh.copy(&mesh);
+  ref_mesh.refine_all_elements();
+  Space* ref_space = space.dup(&ref_mesh);
+  ref_space->copy_orders(&space, 1);
+  info("ndof = %d, reference ndof = %d", get_num_dofs(&space), get_num_dofs(ref_space));
+
+  srand(1);
+  Solution sln, ref_sln;
+  set_random_solution(&space, &sln);
+  set_random_solution(ref_space, &ref_sln);
+
+  bool success = true;
+  double err_ref = 0.0, time_ref = 0.0;
+  std::vector<double> errors_ref;
+  for (int nt = 1; nt <= MAX_THREADS; nt++)
+  {
+    Adapt hp(&space, H2D_H1_NORM);
+    hp.set_num_threads(nt);
+    hp.set_solutions(&sln, &ref_sln);
+
+    TimePeriod cpu_time;
+    double err = hp.calc_elem_errors(H2D_TOTAL_ERROR_REL | H2D_ELEMENT_ERROR_REL);
+    double time = cpu_time.tick().last();
+    if (nt == 1) time_ref = time;
+    info("threads: %d, error estimation time: %g s, speedup: %g", nt, time, time_ref / time);
+
+    std::vector<double> errors;
+    Element* e;
+    for_all_active_elements(e, &mesh)
+      errors.push_back(hp.get_element_error_squared(0, e->id));
+
+    if (nt == 1)
+    {
+      err_ref = err;
+      errors_ref = errors;
+      continue;
+    }
+
+    // The results must be bitwise identical to the serial evaluation.
+    if (err != err_ref || errors != errors_ref)
+    {
+      info("Errors calculated by %d threads differ from the serial ones.", nt);
+      success = false;
+    }
+  }
+  delete ref_space;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
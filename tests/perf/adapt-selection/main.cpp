@@ -0,0 +1,121 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+using namespace RefinementSelectors;
+
+// This test measures the scaling of the multithreaded selection of refinements
+// in Adapt::adapt() and makes sure that the refinements do not depend on the
+// number of threads. The coarse and the reference solutions are given by random
+// coefficient vectors on a curved mesh with triangles and quads; the reference
+// space is refined in h and p. Every run adapts its own copy of the coarse mesh.
+
+const int INIT_REF_NUM = 3;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const double THRESHOLD = 0.3;            // Parameter of the refinement strategy.
+const int STRATEGY = 1;                  // Refinement strategy, see Adapt::adapt().
+const CandList CAND_LIST = H2D_HP_ANISO; // Candidates of the refinement selector.
+const int MAX_THREADS = 4;               // Refinements are selected by 1, 2, ..., MAX_THREADS threads.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Sets the solution to a random coefficient vector on the space.
+static void set_random_solution(Space* space, Solution* sln)
+{
+  int ndof = get_num_dofs(space);
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, -1.0 + 2.0 * rand() / RAND_MAX);
+  PrecalcShapeset pss(space->get_shapeset());
+  sln->set_fe_solution(space, &pss, &vec);
+}
+
+// Compares the refinements including the orders of the sons.
+static bool same_refinement(const ElementToRefine& a, const ElementToRefine& b)
+{
+  if (a.id != b.id || a.comp != b.comp || a.split != b.split) return false;
+  for (int i = 0; i < a.get_num_sons(); i++)
+    if (a.p[i] != b.p[i]) return false;
+  return !memcmp(a.q, b.q, sizeof(a.q));
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("domain.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  // The coarse space and the reference space.
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  Mesh ref_mesh;
+  ref_mesh.copy(&mesh);
+  ref_mesh.refine_all_elements();
+  Space* ref_space = space.dup(&ref_mesh);
+  ref_space->copy_orders(&space, 1);
+  info("ndof = %d, reference ndof = %d", get_num_dofs(&space), get_num_dofs(ref_space));
+
+  srand(1);
+  Solution sln, ref_sln;
+  set_random_solution(&space, &sln);
+  set_random_solution(ref_space, &ref_sln);
+
+  // One selector is used by all runs, its workers are kept between them.
+  H1ProjBasedSelector selector(CAND_LIST, 1.0, H2DRS_DEFAULT_ORDER);
+
+  bool success = true;
+  double time_ref = 0.0;
+  std::vector<ElementToRefine> refs_ref;
+  for (int nt = 1; nt <= MAX_THREADS; nt++)
+  {
+    Mesh run_mesh;
+    run_mesh.copy(&mesh);
+    Space* run_space = space.dup(&run_mesh);
+    run_space->copy_orders(&space);
+
+    Adapt hp(run_space, H2D_H1_NORM);
+    hp.set_num_threads(nt);
+    hp.set_solutions(&sln, &ref_sln);
+    hp.calc_elem_errors(H2D_TOTAL_ERROR_REL | H2D_ELEMENT_ERROR_REL);
+
+    TimePeriod cpu_time;
+    hp.adapt(&selector, THRESHOLD, STRATEGY);
+    double time = cpu_time.tick().last();
+    if (nt == 1) time_ref = time;
+    const std::vector<ElementToRefine>& refs = hp.get_last_refinements();
+    info("threads: %d, refined elements: %d, adaptation time: %g s, speedup: %g",
+         nt, (int) refs.size(), time, time_ref / time);
+
+    if (nt == 1)
+      refs_ref = refs;
+    else
+    {
+      // The refinements must be the same as the serial ones.
+      bool same = (refs.size() == refs_ref.size());
+      for (unsigned i = 0; same && i < refs.size(); i++)
+        same = same_refinement(refs[i], refs_ref[i]);
+      if (!same)
+      {
+        info("Refinements selected by %d threads differ from the serial ones.", nt);
+        success = false;
+      }
+    }
+    delete run_space;
+  }
+  delete ref_space;
+
+  if (success && !refs_ref.empty()) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,153 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test measures the scaling of the multithreaded assembling on the
+// mesh of tutorial example 10-adapt and makes sure that the matrix and the
+// right-hand side do not depend on the number of threads. The same is checked
+// on the mesh of tutorial example 01-mesh with triangles and quads, where the
+// threads switch the mode of the shared shapeset.
+
+const int INIT_REF_NUM = 2;              // Number of initial uniform mesh refinements.
+const int MIXED_REF_NUM = 4;             // Number of uniform refinements of the mesh with triangles.
+const int P_INIT = 4;                    // Polynomial degree of all mesh elements.
+const int MAX_THREADS = 4;               // Assembling is measured for 1, 2, ..., MAX_THREADS threads.
+
+// Problem parameters.
+const int OMEGA_1 = 1;
+const int OMEGA_2 = 2;
+const int STATOR_BDY = 2;
+const double EPS_1 = 1.0;                // Relative electric permittivity in Omega_1.
+const double EPS_2 = 10.0;               // Relative electric permittivity in Omega_2.
+const double VOLTAGE = 50.0;             // Voltage on the stator.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return (ess_bdy_marker == STATOR_BDY) ? VOLTAGE : 0.0;
+}
+
+// Weak forms.
+template<typename Real, typename Scalar>
+Scalar biform1(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v, 
+               Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return EPS_1 * int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar biform2(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v, 
+               Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return EPS_2 * int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar liform(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v, 
+              Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+// Assembles with 1, 2, ..., MAX_THREADS threads, returns false if the results differ.
+static bool assemble_threads(WeakForm* wf, Space* space)
+{
+  int ndof = get_num_dofs(space);
+  info("ndof = %d", ndof);
+
+  bool success = true;
+  int nnz_ref = 0;
+  int *row_ref = NULL, *col_ref = NULL;
+  double *data_ref = NULL, *rhs_ref = NULL;
+  double time_ref = 0.0;
+  for (int nt = 1; nt <= MAX_THREADS; nt++)
+  {
+    LinearProblem lp(wf, space);
+    lp.set_num_threads(nt);
+    CooMatrix mat(ndof);
+    AVector rhs(ndof);
+
+    TimePeriod cpu_time;
+    lp.assemble(&mat, &rhs);
+    double time = cpu_time.tick().last();
+    if (nt == 1) time_ref = time;
+    info("threads: %d, assembling time: %g s, speedup: %g", nt, time, time_ref / time);
+
+    int nnz = mat.get_nnz();
+    int* row = new int[nnz];
+    int* col = new int[nnz];
+    double* data = new double[nnz];
+    mat.get_row_col_data(row, col, data);
+
+    if (nt == 1)
+    {
+      nnz_ref = nnz; row_ref = row; col_ref = col; data_ref = data;
+      rhs_ref = new double[ndof];
+      memcpy(rhs_ref, rhs.get_c_array(), ndof * sizeof(double));
+      continue;
+    }
+
+    // The results must be bitwise identical to the serial assembling.
+    if (nnz != nnz_ref) success = false;
+    for (int i = 0; success && i < nnz; i++)
+      if (row[i] != row_ref[i] || col[i] != col_ref[i] || data[i] != data_ref[i]) success = false;
+    if (memcmp(rhs.get_c_array(), rhs_ref, ndof * sizeof(double))) success = false;
+    if (!success) info("Results assembled by %d threads differ from the serial ones.", nt);
+
+    delete [] row;
+    delete [] col;
+    delete [] data;
+  }
+  delete [] row_ref;
+  delete [] col_ref;
+  delete [] data_ref;
+  delete [] rhs_ref;
+  return success;
+}
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("motor.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  // Create an H1 space with default shapeset.
+  H1Space space(&mesh, bc_types, essential_bc_values, P_INIT);
+
+  // Initialize the weak formulation.
+  WeakForm wf;
+  wf.add_matrix_form(callback(biform1), H2D_SYM, OMEGA_1);
+  wf.add_matrix_form(callback(biform2), H2D_SYM, OMEGA_2);
+  wf.add_vector_form(callback(liform));
+
+  bool success = assemble_threads(&wf, &space);
+
+  // The mesh with triangles and quads.
+  Mesh mixed_mesh;
+  mloader.load("domain.mesh", &mixed_mesh);
+  for (int i = 0; i < MIXED_REF_NUM; i++) mixed_mesh.refine_all_elements();
+  H1Space mixed_space(&mixed_mesh, bc_types, essential_bc_values, P_INIT);
+  WeakForm mixed_wf;
+  mixed_wf.add_matrix_form(callback(biform1), H2D_SYM);
+  mixed_wf.add_vector_form(callback(liform));
+  if (!assemble_threads(&mixed_wf, &mixed_space)) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
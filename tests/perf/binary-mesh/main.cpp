@@ -0,0 +1,185 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test compares the ways a refined mesh can be restored from a file: parsing
+// the H2D format with the refinements replayed, Mesh::load_raw() and the binary
+// format mapped into the memory (Mesh::load_binary()). It checks that all of them
+// restore exactly the same mesh, that the binary mesh can be refined further like
+// the original one, and that a solution is restored by Solution::load_binary().
+
+const int INIT_REF_NUM = 7;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int NUM_POINTS = 50;               // Values are compared on a grid of NUM_POINTS x NUM_POINTS points.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Returns true if the meshes have the same nodes and elements, including the refinement tree.
+static bool same_meshes(Mesh* a, Mesh* b)
+{
+  if (a->get_num_nodes() != b->get_num_nodes() || a->get_num_elements() != b->get_num_elements() ||
+      a->get_num_active_elements() != b->get_num_active_elements() ||
+      a->get_num_base_elements() != b->get_num_base_elements())
+    return false;
+
+  for (int id = 0; id < std::max(a->get_max_node_id(), b->get_max_node_id()); id++)
+  {
+    bool ua = id < a->get_max_node_id() && a->get_node(id)->used;
+    bool ub = id < b->get_max_node_id() && b->get_node(id)->used;
+    if (ua != ub) return false;
+    if (!ua) continue;
+    Node* n = a->get_node(id), *m = b->get_node(id);
+    if (n->type != m->type || n->ref != m->ref || n->bnd != m->bnd || n->p1 != m->p1 || n->p2 != m->p2)
+      return false;
+    if (n->type == H2D_TYPE_VERTEX && (n->x != m->x || n->y != m->y)) return false;
+    if (n->type == H2D_TYPE_EDGE)
+    {
+      if (n->marker != m->marker) return false;
+      for (int j = 0; j < 2; j++)
+        if ((n->elem[j] ? n->elem[j]->id : -1) != (m->elem[j] ? m->elem[j]->id : -1)) return false;
+    }
+  }
+
+  for (int id = 0; id < std::max(a->get_max_element_id(), b->get_max_element_id()); id++)
+  {
+    bool ua = id < a->get_max_element_id() && a->get_element_fast(id)->used;
+    bool ub = id < b->get_max_element_id() && b->get_element_fast(id)->used;
+    if (ua != ub) return false;
+    if (!ua) continue;
+    Element* e = a->get_element_fast(id), *f = b->get_element_fast(id);
+    if (e->nvert != f->nvert || e->active != f->active || e->marker != f->marker) return false;
+    for (unsigned j = 0; j < e->nvert; j++)
+      if (e->vn[j]->id != f->vn[j]->id) return false;
+    for (int j = 0; j < (e->active ? (int) e->nvert : 4); j++)
+    {
+      int ie = e->active ? e->en[j]->id : (e->sons[j] ? e->sons[j]->id : -1);
+      int jf = f->active ? f->en[j]->id : (f->sons[j] ? f->sons[j]->id : -1);
+      if (ie != jf) return false;
+    }
+  }
+  return true;
+}
+
+// Returns true if the values of the solutions are bitwise identical on a grid of points.
+static bool same_values(Solution* a, Solution* b)
+{
+  for (int i = 0; i < NUM_POINTS; i++)
+    for (int j = 0; j < NUM_POINTS; j++)
+    {
+      double x = -0.99 + 1.98 * i / (NUM_POINTS - 1), y = -0.99 + 1.98 * j / (NUM_POINTS - 1);
+      if (a->get_pt_value(x, y) != b->get_pt_value(x, y)) return false;
+    }
+  return true;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2 made of a quad and a triangle, refined towards a corner.
+  double2 verts[5] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int4 tris[1] = { { 1, 2, 3, 0 } };
+  int5 quads[1] = { { 0, 1, 3, 4, 0 } };
+  int3 mark[5] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 4, 1 }, { 4, 0, 1 } };
+  Mesh mesh;
+  mesh.create(5, verts, 1, tris, 1, quads, 5, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 4);
+  info("elements = %d, nodes = %d", mesh.get_num_active_elements(), mesh.get_num_nodes());
+
+  bool success = true;
+
+  // Save the mesh in all three formats.
+  H2DReader mloader;
+  TimePeriod cpu_time;
+  mloader.save("mesh.mesh", &mesh);
+  double time_save_text = cpu_time.tick().last();
+  SaveBuffer buf;
+  mesh.save_raw(buf);
+  buf.save("mesh.raw", false);
+  double time_save_raw = cpu_time.tick().last();
+  mesh.save_binary("mesh.h2db");
+  double time_save_bin = cpu_time.tick().last();
+  info("save: text %g s, raw %g s, binary %g s", time_save_text, time_save_raw, time_save_bin);
+
+  // Load them back.
+  Mesh text, raw, bin;
+  cpu_time.tick(HERMES_SKIP);
+  mloader.load("mesh.mesh", &text);
+  double time_text = cpu_time.tick().last();
+  LoadBuffer lbuf;
+  lbuf.load("mesh.raw");
+  raw.load_raw(lbuf);
+  double time_raw = cpu_time.tick().last();
+  bin.load_binary("mesh.h2db");
+  double time_bin = cpu_time.tick().last();
+  info("load: text + refinements %g s, raw %g s, binary %g s (%.1fx faster than text, %.1fx than raw)",
+       time_text, time_raw, time_bin, time_text / time_bin, time_raw / time_bin);
+
+  if (text.get_num_active_elements() != mesh.get_num_active_elements())
+  {
+    info("The mesh loaded from the text file differs.");
+    success = false;
+  }
+  if (!same_meshes(&mesh, &raw) || !same_meshes(&mesh, &bin))
+  {
+    info("The mesh loaded from the raw or binary file differs.");
+    success = false;
+  }
+
+  // The loaded mesh can be refined further. The free slots may be reused in a different
+  // order than in the original mesh, so only the sizes and the ids are checked.
+  mesh.unrefine_all_elements();
+  bin.unrefine_all_elements();
+  mesh.refine_towards_vertex(2, 3);
+  bin.refine_towards_vertex(2, 3);
+  bool ids_ok = true;
+  for (int id = 0; id < bin.get_max_node_id(); id++)
+    if (bin.get_node(id)->used && bin.get_node(id)->id != id) ids_ok = false;
+  for (int id = 0; id < bin.get_max_element_id(); id++)
+    if (bin.get_element_fast(id)->used && bin.get_element_fast(id)->id != id) ids_ok = false;
+  if (!ids_ok || bin.get_num_nodes() != mesh.get_num_nodes() ||
+      bin.get_num_active_elements() != mesh.get_num_active_elements())
+  {
+    info("The binary mesh differs from the original after further refinements.");
+    success = false;
+  }
+
+  // Solutions.
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  int ndof = get_num_dofs(&space);
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, sin(0.1 * i));
+  Solution sln;
+  sln.set_fe_solution(&space, &vec);
+  info("ndof = %d", ndof);
+
+  cpu_time.tick(HERMES_SKIP);
+  sln.save("sln.h2d", false);
+  sln.save_binary("sln.h2db");
+  cpu_time.tick(HERMES_SKIP);
+  Solution loaded, loaded_bin;
+  loaded.load("sln.h2d");
+  double time_sln = cpu_time.tick().last();
+  loaded_bin.load_binary("sln.h2db");
+  double time_sln_bin = cpu_time.tick().last();
+  info("solution load: %g s, binary %g s", time_sln, time_sln_bin);
+  if (!same_values(&sln, &loaded_bin) || !same_meshes(sln.get_mesh(), loaded_bin.get_mesh()))
+  {
+    info("The solution loaded from the binary file differs.");
+    success = false;
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
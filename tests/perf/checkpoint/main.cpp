@@ -0,0 +1,151 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test saves a solution on a locally refined mesh uncompressed, compressed,
+// and repeatedly in the background by a CheckpointWriter, as a time-stepping code
+// would do. It loads the files back and checks that the solution values are the
+// same as the original ones. The times of the saves, of the calls which hand the
+// data to the writer, and of the loads are reported.
+
+const int INIT_REF_NUM = 6;              // Number of initial uniform mesh refinements.
+const int P_INIT = 4;                    // Polynomial degree of all mesh elements.
+const int NUM_SAVES = 10;                // Number of saves in the background.
+const int NUM_POINTS = 50;               // Values are compared on a grid of NUM_POINTS x NUM_POINTS points.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Returns true if the values of the solutions are bitwise identical on a grid of points.
+static bool same_values(Solution* a, Solution* b)
+{
+  for (int i = 0; i < NUM_POINTS; i++)
+    for (int j = 0; j < NUM_POINTS; j++)
+    {
+      double x = -0.99 + 1.98 * i / (NUM_POINTS - 1), y = -0.99 + 1.98 * j / (NUM_POINTS - 1);
+      if (a->get_pt_value(x, y) != b->get_pt_value(x, y)) return false;
+    }
+  return true;
+}
+
+// Returns the size of a file in bytes.
+static long file_size(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) return -1;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2 made of a quad and two triangles, refined towards a corner.
+  double2 verts[5] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int4 tris[1] = { { 1, 2, 3, 0 } };
+  int5 quads[1] = { { 0, 1, 3, 4, 0 } };
+  int3 mark[5] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 4, 1 }, { 4, 0, 1 } };
+  Mesh mesh;
+  mesh.create(5, verts, 1, tris, 1, quads, 5, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 4);
+
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  int ndof = get_num_dofs(&space);
+  info("ndof = %d, elements = %d", ndof, mesh.get_num_active_elements());
+
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, sin(0.1 * i));
+  Solution sln;
+  sln.set_fe_solution(&space, &vec);
+
+  bool success = true;
+
+  // Saving and loading in the foreground.
+  TimePeriod cpu_time;
+  sln.save("sln.h2d", false);
+  double time_save = cpu_time.tick().last();
+  sln.save("sln.h2d", true);
+  double time_save_gz = cpu_time.tick().last();
+  info("save: %g s (%ld B), compressed: %g s (%ld B)", time_save, file_size("sln.h2d"),
+       time_save_gz, file_size("sln.h2d.gz"));
+
+  Solution loaded, loaded_gz;
+  cpu_time.tick(HERMES_SKIP);
+  loaded.load("sln.h2d");
+  double time_load = cpu_time.tick().last();
+  loaded_gz.load("sln.h2d.gz");
+  double time_load_gz = cpu_time.tick().last();
+  info("load: %g s, compressed: %g s", time_load, time_load_gz);
+  if (!same_values(&sln, &loaded) || !same_values(&sln, &loaded_gz))
+  {
+    info("Loaded values differ.");
+    success = false;
+  }
+
+#ifdef WITH_ZLIB
+  // The compressed file is in the gzip format (without zlib it is stored uncompressed).
+  unsigned char magic[2] = { 0, 0 };
+  FILE* f = fopen("sln.h2d.gz", "rb");
+  if (f == NULL || fread(magic, 1, 2, f) != 2 || magic[0] != 0x1f || magic[1] != 0x8b)
+  {
+    info("The compressed file is not in the gzip format.");
+    success = false;
+  }
+  if (f != NULL) fclose(f);
+#endif
+
+  // Saving in the background: the solution changes right after every save.
+  {
+    CheckpointWriter writer;
+    double time_calls = 0.0;
+    cpu_time.tick(HERMES_SKIP);
+    for (int i = 0; i < NUM_SAVES; i++)
+    {
+      char filename[64];
+      sprintf(filename, "sln-%d.h2d", i);
+      TimePeriod call_time;
+      sln.save(filename, true, &writer);
+      time_calls += call_time.tick().last();
+
+      vec.set(0, vec.get(0) + 1.0);
+      sln.set_fe_solution(&space, &vec);
+    }
+    writer.wait();
+    double time_total = cpu_time.tick().last();
+    info("%d saves in the background: calls %g s, writing %g s, total %g s", NUM_SAVES, time_calls,
+         writer.get_write_time(), time_total);
+  }
+
+  // Every file contains the solution as it was at the time of the save.
+  vec.set(0, vec.get(0) - NUM_SAVES);
+  for (int i = 0; i < NUM_SAVES; i++)
+  {
+    Solution expected, saved;
+    expected.set_fe_solution(&space, &vec);
+    char filename[64];
+    sprintf(filename, "sln-%d.h2d.gz", i);
+    saved.load(filename);
+    if (!same_values(&expected, &saved))
+    {
+      info("Values saved in the background to %s differ.", filename);
+      success = false;
+    }
+    vec.set(0, vec.get(0) + 1.0);
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,243 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+#include <pthread.h>
+
+// This test solves several independent Poisson problems at the same time, each in
+// its own thread with its own mesh, space and weak form. The problems differ in the
+// polynomial degree, the refinements and the right-hand side, and the mesh contains
+// curved elements, triangles and quads, so the threads use the global quadrature,
+// the shapesets and the order limiting tables in different modes concurrently.
+// The matrix, the right-hand side and the norm of a Solution must be bitwise
+// identical to those computed when the problems are solved one after another.
+// It also checks that more ThreadMode instances than thread-specific data keys keep
+// their modes separately in every thread, and reports the cost of reading a mode and
+// of Shapeset::get_value() compared to a plain variable.
+
+const int INIT_REF_NUM = 2;              // Number of initial uniform mesh refinements.
+const int NUM_PROBLEMS = 8;              // Number of problems solved concurrently.
+const int NUM_ROUNDS = 3;                // Number of times all problems are solved concurrently.
+const int NUM_MODES = 4096;              // Number of ThreadMode instances (more than PTHREAD_KEYS_MAX).
+const int NUM_READS = 10000000;          // Number of reads of a mode timed.
+
+// Boundary markers.
+const int CURVED_BDY = 2;
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return (marker == CURVED_BDY) ? BC_ESSENTIAL : BC_NATURAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return x * y;
+}
+
+// Weak forms.
+template<typename Real, typename Scalar>
+Scalar bilinear_form(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                     Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real>
+Real rhs(Real x, Real y)
+{
+  return sin(x) * y + 1.0;
+}
+
+template<typename Real, typename Scalar>
+Scalar linear_form(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v,
+                   Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_F_v<Real, Scalar>(n, wt, rhs, v, e);
+}
+
+// Input and results of one problem.
+struct Problem
+{
+  int index;
+  int ndof, nnz;
+  int *row, *col;
+  double *data, *rhs;
+  double norm;
+};
+
+// Assembles the problem and computes the H1 norm of the Solution given by the
+// right-hand side used as a coefficient vector.
+static void* solve_problem(void* arg)
+{
+  Problem* pb = (Problem*) arg;
+
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("domain.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_towards_boundary(CURVED_BDY, pb->index % 3);
+
+  H1Space space(&mesh, bc_types, essential_bc_values, 2 + pb->index % 4);
+  int ndof = pb->ndof = get_num_dofs(&space);
+
+  WeakForm wf;
+  wf.add_matrix_form(callback(bilinear_form), H2D_SYM);
+  wf.add_vector_form(callback(linear_form));
+
+  LinearProblem lp(&wf, &space);
+  lp.set_num_threads(1);
+  CooMatrix mat(ndof);
+  AVector vec(ndof);
+  lp.assemble(&mat, &vec);
+
+  pb->nnz = mat.get_nnz();
+  pb->row = new int[pb->nnz];
+  pb->col = new int[pb->nnz];
+  pb->data = new double[pb->nnz];
+  mat.get_row_col_data(pb->row, pb->col, pb->data);
+  pb->rhs = new double[ndof];
+  memcpy(pb->rhs, vec.get_c_array(), ndof * sizeof(double));
+
+  PrecalcShapeset pss(space.get_shapeset());
+  Solution sln;
+  sln.set_fe_solution(&space, &pss, &vec);
+  pb->norm = calc_norm(&sln, H2D_H1_NORM);
+  return NULL;
+}
+
+// Sets the modes in a thread to a pattern given by the parity, returns the number of
+// instances that do not read back the pattern.
+struct ModeCheck
+{
+  ThreadMode* modes;
+  int parity;
+  int nerr;
+};
+
+static void* check_modes(void* arg)
+{
+  ModeCheck* mc = (ModeCheck*) arg;
+  mc->nerr = 0;
+  for (int i = 0; i < NUM_MODES; i++)
+    if (mc->modes[i] != H2D_MODE_TRIANGLE) mc->nerr++;
+  for (int i = 0; i < NUM_MODES; i++)
+    mc->modes[i] = (i + mc->parity) % 2;
+  for (int i = 0; i < NUM_MODES; i++)
+    if (mc->modes[i] != (i + mc->parity) % 2) mc->nerr++;
+  return NULL;
+}
+
+// Sums the mode over NUM_READS reads, returns the time. The pointer is volatile so
+// that the reads are not hoisted out of the loop.
+template<typename T>
+static double time_reads(T* volatile mode, int& sum)
+{
+  TimePeriod cpu_time;
+  for (int i = 0; i < NUM_READS; i++)
+    sum += *mode;
+  return cpu_time.tick().last();
+}
+
+static void free_problem(Problem* pb)
+{
+  delete [] pb->row;
+  delete [] pb->col;
+  delete [] pb->data;
+  delete [] pb->rhs;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Solve the problems one after another.
+  Problem ref[NUM_PROBLEMS];
+  TimePeriod cpu_time;
+  for (int k = 0; k < NUM_PROBLEMS; k++)
+  {
+    ref[k].index = k;
+    solve_problem(ref + k);
+  }
+  info("%d problems solved serially: %g s", NUM_PROBLEMS, cpu_time.tick().last());
+
+  bool success = true;
+  for (int r = 0; r < NUM_ROUNDS; r++)
+  {
+    // Solve all of them at once.
+    Problem pb[NUM_PROBLEMS];
+    pthread_t threads[NUM_PROBLEMS];
+    cpu_time.tick(HERMES_SKIP);
+    for (int k = 0; k < NUM_PROBLEMS; k++)
+    {
+      pb[k].index = k;
+      if (pthread_create(threads + k, NULL, solve_problem, pb + k))
+        error("Could not create a thread.");
+    }
+    for (int k = 0; k < NUM_PROBLEMS; k++)
+      pthread_join(threads[k], NULL);
+    info("round %d: %d problems solved concurrently: %g s", r, NUM_PROBLEMS, cpu_time.tick().last());
+
+    // The results must be bitwise identical to the serial ones.
+    for (int k = 0; k < NUM_PROBLEMS; k++)
+    {
+      bool same = (pb[k].ndof == ref[k].ndof) && (pb[k].nnz == ref[k].nnz) && (pb[k].norm == ref[k].norm);
+      for (int i = 0; same && i < pb[k].nnz; i++)
+        if (pb[k].row[i] != ref[k].row[i] || pb[k].col[i] != ref[k].col[i] || pb[k].data[i] != ref[k].data[i])
+          same = false;
+      if (same && memcmp(pb[k].rhs, ref[k].rhs, pb[k].ndof * sizeof(double))) same = false;
+      if (!same) { info("round %d: results of problem %d differ from the serial ones.", r, k); success = false; }
+      free_problem(pb + k);
+    }
+  }
+  for (int k = 0; k < NUM_PROBLEMS; k++)
+    free_problem(ref + k);
+
+  // Many instances keep the modes of each thread apart.
+  ThreadMode* modes = new ThreadMode[NUM_MODES];
+  ModeCheck mc[2];
+  pthread_t threads[2];
+  for (int k = 0; k < 2; k++)
+  {
+    mc[k].modes = modes;
+    mc[k].parity = k;
+    if (pthread_create(threads + k, NULL, check_modes, mc + k))
+      error("Could not create a thread.");
+  }
+  int nerr = 0;
+  for (int k = 0; k < 2; k++)
+  {
+    pthread_join(threads[k], NULL);
+    nerr += mc[k].nerr;
+  }
+  for (int i = 0; i < NUM_MODES; i++)
+    if (modes[i] != H2D_MODE_TRIANGLE) nerr++;
+  delete [] modes;
+  if (nerr > 0) { info("%d of %d thread modes were not kept per thread.", nerr, NUM_MODES); success = false; }
+
+  // The cost of reading a mode, alone and in the shape functions.
+  ThreadMode mode;
+  mode = H2D_MODE_QUAD;
+  int plain = H2D_MODE_QUAD;
+  int sum = 0;
+  double time_plain = time_reads(&plain, sum);
+  double time_mode = time_reads(&mode, sum);
+  H1Shapeset shapeset;
+  shapeset.set_mode(H2D_MODE_QUAD);
+  TimePeriod cpu_time_fn;
+  double val = 0.0;
+  for (int i = 0; i < NUM_READS / 10; i++)
+    val += shapeset.get_fn_value(i % shapeset.get_max_index(), 0.3, -0.2, 0);
+  double time_fn = cpu_time_fn.tick().last();
+  info("mode read: %g ns (plain variable %g ns), Shapeset::get_fn_value(): %g ns (checksum %d, %g)",
+       time_mode / NUM_READS * 1e9, time_plain / NUM_READS * 1e9, time_fn / (NUM_READS / 10) * 1e9, sum, val);
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,329 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test assembles a system of two equations on a mesh refined towards a corner, as
+// adaptivity would produce it, with the DOFs in the natural order, in the reverse
+// Cuthill-McKee order and in the nested dissection order (Space::set_dof_ordering()).
+// It reports the bandwidth, the profile and the number of nonzeros of the Cholesky factor
+// of the assembled matrix, and the time of the matrix-vector product. It checks that the
+// reorderings reduce the bandwidth (RCM) and the fill-in (ND), that the assembled systems
+// are the same up to the numbering, and that a space assigned with a stride keeps its set
+// of DOF numbers. The DOFs of both spaces are ordered together, the statistics calculated
+// by Space::assign_dofs() must match the assembled matrix. Repeated assignments of unchanged
+// spaces must reuse the ordering, and a changed space must get the ordering of a new one.
+
+const int N = 16;                        // The base mesh has N x N quads.
+const int NUM_LEVELS = 5;                // Number of refinements towards the corner.
+const int NUM_SPMV = 50;                 // Number of matrix-vector products timed.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return x + y;
+}
+
+// Weak forms.
+template<typename Real, typename Scalar>
+Scalar biform_diag(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                   Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v) + int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar biform_coupling(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                       Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return 0.5 * int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar liform(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v,
+              Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+// A simple deterministic random number generator.
+static unsigned rnd_state = 12345;
+static int rnd(int n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return (rnd_state >> 16) % n;
+}
+
+struct Result
+{
+  int ndof;
+  SparsityStats stats;
+  SparsityStats predicted;     // by Space::assign_dofs() from the assembly lists
+  double spmv_time;
+  double sum, trace, rhs_sum;  // invariant under renumbering
+};
+
+// Assembles the system with the DOFs of both spaces in the given order.
+static void assemble(WeakForm* wf, Space* s1, Space* s2, DofOrdering ordering, Result& res)
+{
+  s1->set_dof_ordering(ordering, true);
+  s2->set_dof_ordering(ordering, true);
+  TimePeriod cpu_time;
+  LinearProblem lp(wf, Tuple<Space*>(s1, s2));
+  double assign_time = cpu_time.tick().last();
+  res.ndof = lp.get_num_dofs();
+  PatternMatrix mat(res.ndof);
+  AVector rhs(res.ndof);
+  lp.assemble(&mat, &rhs);
+
+  int* Ap = mat.get_Ap();
+  int* Ai = mat.get_Ai();
+  double* Ax = mat.get_Ax();
+  int nnz = Ap[res.ndof];
+  std::vector<int> row(nnz), col(nnz);
+  res.sum = res.trace = res.rhs_sum = 0.0;
+  for (int j = 0; j < res.ndof; j++)
+    for (int k = Ap[j]; k < Ap[j+1]; k++)
+    {
+      row[k] = Ai[k];
+      col[k] = j;
+      res.sum += sqr(Ax[k]);
+      if (Ai[k] == j) res.trace += Ax[k];
+    }
+  for (int i = 0; i < res.ndof; i++)
+    res.rhs_sum += sqr(rhs.get(i));
+  get_sparsity_stats(res.ndof, nnz, &row[0], &col[0], res.stats);
+
+  std::vector<double> x(res.ndof, 1.0), y(res.ndof);
+  cpu_time.tick(HERMES_SKIP);
+  for (int r = 0; r < NUM_SPMV; r++)
+    mat.times_vector(&x[0], &y[0], res.ndof);
+  res.spmv_time = cpu_time.tick().last();
+
+  SparsityStats natural;
+  SparsityStats& ordered = res.predicted;
+  s1->get_dof_ordering_stats(natural, ordered);
+  info("%-8s ndof %d, bandwidth %d, profile %lld, factor nnz %lld, %d x SpMV %g s, assign %g s",
+       ordering == H2D_DOF_ORDER_NATURAL ? "natural" : ordering == H2D_DOF_ORDER_RCM ? "RCM" : "ND",
+       res.ndof, res.stats.bandwidth, (long long) res.stats.profile,
+       (long long) res.stats.factor_nnz, NUM_SPMV, res.spmv_time, assign_time);
+  if (ordering != H2D_DOF_ORDER_NATURAL)
+    info("         predicted: nnz %lld, bandwidth %d -> %d, profile %lld -> %lld, factor nnz %lld -> %lld",
+         (long long) ordered.nnz, natural.bandwidth, ordered.bandwidth, (long long) natural.profile,
+         (long long) ordered.profile, (long long) natural.factor_nnz,
+         (long long) ordered.factor_nnz);
+}
+
+// Lists the DOFs of the assembly lists of both spaces on all elements.
+static void list_dofs(Space* s1, Space* s2, std::vector<int>& dofs)
+{
+  dofs.clear();
+  AsmList al;
+  Element* e;
+  for_all_active_elements(e, s1->get_mesh())
+    for (int i = 0; i < 2; i++)
+    {
+      (i ? s2 : s1)->get_element_assembly_list(e, &al);
+      dofs.insert(dofs.end(), al.dof, al.dof + al.cnt);
+    }
+}
+
+// Assigns the DOFs of both spaces, returns the time.
+static double assign(Space* s1, Space* s2, std::vector<int>& dofs)
+{
+  TimePeriod cpu_time;
+  assign_dofs(Tuple<Space*>(s1, s2));
+  double time = cpu_time.tick().last();
+  list_dofs(s1, s2, dofs);
+  return time;
+}
+
+static bool close(double a, double b)
+{
+  return fabs(a - b) <= 1e-10 * std::max(fabs(a), fabs(b));
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Base mesh: a grid of quads.
+  int nv = (N+1) * (N+1);
+  double2* verts = new double2[nv];
+  for (int i = 0; i <= N; i++)
+    for (int j = 0; j <= N; j++)
+    {
+      verts[i*(N+1) + j][0] = (double) j / N;
+      verts[i*(N+1) + j][1] = (double) i / N;
+    }
+  int5* quads = new int5[N*N];
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++)
+    {
+      int* q = quads[i*N + j];
+      q[0] = i*(N+1) + j;     q[1] = i*(N+1) + j+1;
+      q[2] = (i+1)*(N+1) + j+1; q[3] = (i+1)*(N+1) + j;
+      q[4] = 0;
+    }
+  int3* mark = new int3[4*N];
+  for (int k = 0; k < N; k++)
+  {
+    int3 m[4] = { { k, k+1, 1 }, { N*(N+1) + k, N*(N+1) + k+1, 1 },
+                  { k*(N+1), (k+1)*(N+1), 1 }, { k*(N+1) + N, (k+1)*(N+1) + N, 1 } };
+    memcpy(mark + 4*k, m, sizeof(m));
+  }
+  Mesh mesh;
+  mesh.create(nv, verts, 0, NULL, N*N, quads, 4*N, mark);
+  delete [] verts;
+  delete [] quads;
+  delete [] mark;
+
+  // Refinements towards the corner (0,0), the new elements get the highest ids.
+  double radius = 0.5;
+  for (int r = 0; r < NUM_LEVELS; r++, radius *= 0.6)
+  {
+    std::vector<int> ids;
+    Element* e;
+    for_all_active_elements(e, &mesh)
+    {
+      double x = 0, y = 0;
+      for (unsigned j = 0; j < e->nvert; j++) { x += e->vn[j]->x; y += e->vn[j]->y; }
+      if (sqrt(sqr(x / e->nvert) + sqr(y / e->nvert)) < radius) ids.push_back(e->id);
+    }
+    for (unsigned i = 0; i < ids.size(); i++)
+      mesh.refine_element(ids[i]);
+  }
+  info("elements = %d", mesh.get_num_active_elements());
+
+  // Two spaces with random element orders.
+  H1Space s1(&mesh, bc_types, essential_bc_values, 1);
+  H1Space s2(&mesh, bc_types, essential_bc_values, 1);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+  {
+    int p = 2 + rnd(3);
+    s1.set_element_order_internal(e->id, H2D_MAKE_QUAD_ORDER(p, p));
+    s2.set_element_order_internal(e->id, H2D_MAKE_QUAD_ORDER(p - 1, p - 1));
+  }
+
+  WeakForm wf(2);
+  wf.add_matrix_form(0, 0, callback(biform_diag));
+  wf.add_matrix_form(1, 1, callback(biform_diag));
+  wf.add_matrix_form(0, 1, callback(biform_coupling));
+  wf.add_matrix_form(1, 0, callback(biform_coupling));
+  wf.add_vector_form(0, callback(liform));
+  wf.add_vector_form(1, callback(liform));
+
+  Result nat, rcm, nd;
+  assemble(&wf, &s1, &s2, H2D_DOF_ORDER_NATURAL, nat);
+  assemble(&wf, &s1, &s2, H2D_DOF_ORDER_RCM, rcm);
+  assemble(&wf, &s1, &s2, H2D_DOF_ORDER_ND, nd);
+
+  bool success = true;
+
+  Result* res[2] = { &rcm, &nd };
+  for (int i = 0; i < 2; i++)
+    if (res[i]->ndof != nat.ndof || res[i]->stats.nnz != nat.stats.nnz ||
+        !close(res[i]->sum, nat.sum) || !close(res[i]->trace, nat.trace) ||
+        !close(res[i]->rhs_sum, nat.rhs_sum))
+    {
+      info("The system assembled in the %s order differs from the natural one.", i ? "ND" : "RCM");
+      success = false;
+    }
+    else if (res[i]->predicted.nnz != res[i]->stats.nnz ||
+             res[i]->predicted.bandwidth != res[i]->stats.bandwidth ||
+             res[i]->predicted.profile != res[i]->stats.profile ||
+             res[i]->predicted.factor_nnz != res[i]->stats.factor_nnz)
+    {
+      info("The statistics of the %s order do not match the assembled matrix.", i ? "ND" : "RCM");
+      success = false;
+    }
+
+  if (rcm.stats.bandwidth >= nat.stats.bandwidth || rcm.stats.profile >= nat.stats.profile)
+  {
+    info("RCM did not reduce the bandwidth and the profile.");
+    success = false;
+  }
+  if (nd.stats.factor_nnz >= nat.stats.factor_nnz || nd.stats.factor_nnz >= rcm.stats.factor_nnz)
+  {
+    info("Nested dissection did not reduce the fill-in.");
+    success = false;
+  }
+
+  // With a stride, the reordered space has the same DOF numbers as the natural one.
+  int first = 1, stride = 3;
+  std::vector<bool> used[2];
+  for (int i = 0; i < 2; i++)
+  {
+    s1.set_dof_ordering(i ? H2D_DOF_ORDER_ND : H2D_DOF_ORDER_NATURAL);
+    int ndof = s1.assign_dofs(first, stride);
+    used[i].assign(first + ndof * stride, false);
+    AsmList al;
+    for_all_active_elements(e, &mesh)
+    {
+      s1.get_element_assembly_list(e, &al);
+      for (int k = 0; k < al.cnt; k++)
+        if (al.dof[k] >= 0)
+        {
+          if (al.dof[k] >= (int) used[i].size() || (al.dof[k] - first) % stride)
+          {
+            info("Invalid DOF number %d.", al.dof[k]);
+            success = false;
+            break;
+          }
+          used[i][al.dof[k]] = true;
+        }
+    }
+  }
+  if (used[0] != used[1])
+  {
+    info("The reordered space does not have the same DOF numbers.");
+    success = false;
+  }
+
+  // The ordering of unchanged spaces is reused, changed spaces are ordered again.
+  s1.set_dof_ordering(H2D_DOF_ORDER_ND);
+  s2.set_dof_ordering(H2D_DOF_ORDER_ND);
+  std::vector<int> dofs[3];
+  double time_new = assign(&s1, &s2, dofs[0]);
+  double time_reused = assign(&s1, &s2, dofs[1]);
+  info("ND assignment %g s, with the reused ordering %g s", time_new, time_reused);
+  if (dofs[0] != dofs[1])
+  {
+    info("The reused ordering differs.");
+    success = false;
+  }
+  for_all_active_elements(e, &mesh)
+  {
+    s2.set_element_order_internal(e->id, H2D_MAKE_QUAD_ORDER(4, 4));
+    break;
+  }
+  assign(&s1, &s2, dofs[1]);
+  H1Space s3(&mesh, bc_types, essential_bc_values, 1);
+  H1Space s4(&mesh, bc_types, essential_bc_values, 1);
+  s3.copy_orders(&s1);
+  s4.copy_orders(&s2);
+  s3.set_dof_ordering(H2D_DOF_ORDER_ND);
+  s4.set_dof_ordering(H2D_DOF_ORDER_ND);
+  assign(&s3, &s4, dofs[2]);
+  if (dofs[1] != dofs[2] || dofs[1] == dofs[0])
+  {
+    info("The ordering was not calculated again after a space had changed.");
+    success = false;
+  }
+
+  if (success)
+  {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,191 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test repeatedly assembles a nonlinear problem on a mesh of general
+// quadrilaterals, as in Newton iterations, once without and once with the
+// geometry cache of DiscreteProblem. The matrices and right hand sides have to
+// be identical, the cache has to be filled in the first assembling only, keep
+// to its memory budget when that is too small for the whole mesh, and empty
+// itself after the mesh is refined. The assembling times are reported.
+
+const int INIT_REF_NUM = 4;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int NUM_STEPS = 5;                 // Number of assemblings on the same mesh.
+const size_t CACHE_MEMORY = 256 << 20;   // Memory budget of the geometry cache.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return (marker == 1) ? BC_ESSENTIAL : BC_NATURAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return 0.0;
+}
+
+// Jacobian and residual of -div((1 + u^2) grad u) = x, with a Neumann
+// condition on the boundary with the marker 2.
+template<typename Real, typename Scalar>
+Scalar jac(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+           Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * (2 * u_prev->val[i] * u->val[i] * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       + (1 + sqr(u_prev->val[i])) * (u->dx[i] * v->dx[i] + u->dy[i] * v->dy[i]));
+  return result;
+}
+
+template<typename Real, typename Scalar>
+Scalar res(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * ((1 + sqr(u_prev->val[i])) * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       - e->x[i] * v->val[i]);
+  return result;
+}
+
+template<typename Real, typename Scalar>
+Scalar res_surf(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  for (int i = 0; i < n; i++)
+    result += wt[i] * e->y[i] * v->val[i];
+  return result;
+}
+
+// Returns true if both matrices have the same structure and values.
+static bool same_matrix(PatternMatrix* a, PatternMatrix* b)
+{
+  int n = a->get_size();
+  if (n != b->get_size() || a->get_nnz() != b->get_nnz()) return false;
+  if (memcmp(a->get_Ap(), b->get_Ap(), (n + 1) * sizeof(int))) return false;
+  if (memcmp(a->get_Ai(), b->get_Ai(), a->get_nnz() * sizeof(int))) return false;
+  return !memcmp(a->get_Ax(), b->get_Ax(), a->get_nnz() * sizeof(double));
+}
+
+static bool same_vector(AVector* a, AVector* b)
+{
+  if (a->get_size() != b->get_size()) return false;
+  for (int i = 0; i < a->get_size(); i++)
+    if (a->get(i) != b->get(i)) return false;
+  return true;
+}
+
+// Assembles NUM_STEPS times and returns the average time of the assemblings
+// after the first one.
+static double assemble(DiscreteProblem* dp, Vector* coeff_vec, PatternMatrix* mat, AVector* rhs)
+{
+  double time = 0.0;
+  for (int step = 0; step < NUM_STEPS; step++)
+  {
+    TimePeriod cpu_time;
+    dp->assemble(coeff_vec, mat, NULL, rhs);
+    if (step > 0) time += cpu_time.tick().last() / (NUM_STEPS - 1);
+  }
+  return time;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A general quadrilateral, so that the reference maps of the elements are not affine.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 0.6, 1 }, { -1, 0.8 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 2 }, { 2, 3, 1 }, { 3, 0, 2 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  H1Space space(&mesh, bc_types, essential_bc_values, P_INIT);
+  int ndof = get_num_dofs(&space);
+  info("ndof = %d, elements = %d", ndof, mesh.get_num_active_elements());
+
+  WeakForm wf;
+  wf.add_matrix_form(callback(jac), H2D_UNSYM, H2D_ANY);
+  wf.add_vector_form(callback(res), H2D_ANY);
+  wf.add_vector_form_surf(callback(res_surf), 2);
+
+  // A nonzero previous iteration.
+  AVector coeff_vec(ndof);
+  for (int i = 0; i < ndof; i++) coeff_vec.set(i, 0.01 * (i % 7));
+
+  DiscreteProblem dp(&wf, &space);
+  PatternMatrix mat(ndof);
+  AVector rhs(ndof);
+  double time = assemble(&dp, &coeff_vec, &mat, &rhs);
+
+  DiscreteProblem dp_cached(&wf, &space);
+  dp_cached.set_geom_cache(CACHE_MEMORY);
+  PatternMatrix mat_cached(ndof);
+  AVector rhs_cached(ndof);
+  double time_cached = assemble(&dp_cached, &coeff_vec, &mat_cached, &rhs_cached);
+
+  GeomCache* cache = dp_cached.get_geom_cache(0);
+  info("assembling time: %g s without the geometry cache, %g s with it", time, time_cached);
+  info("geometry cache: %d entries, %g MB, %d hits, %d misses", cache->get_num_entries(),
+       cache->get_memory() / 1048576.0, cache->get_num_hits(), cache->get_num_misses());
+
+  bool success = true;
+  if (!same_matrix(&mat, &mat_cached) || !same_vector(&rhs, &rhs_cached))
+  {
+    info("The system assembled with the geometry cache differs.");
+    success = false;
+  }
+  // All elements are computed in the first assembling and reused in the others.
+  if (cache->get_num_misses() != cache->get_num_entries() ||
+      cache->get_num_hits() < (NUM_STEPS - 1) * cache->get_num_misses())
+  {
+    info("The geometry cache was not reused.");
+    success = false;
+  }
+
+  // A budget for a quarter of the mesh.
+  DiscreteProblem dp_small(&wf, &space);
+  size_t small_memory = cache->get_memory() / 4;
+  dp_small.set_geom_cache(small_memory);
+  PatternMatrix mat_small(ndof);
+  AVector rhs_small(ndof);
+  assemble(&dp_small, &coeff_vec, &mat_small, &rhs_small);
+  GeomCache* cache_small = dp_small.get_geom_cache(0);
+  info("small geometry cache: %d entries, %g MB, %d hits, %d misses", cache_small->get_num_entries(),
+       cache_small->get_memory() / 1048576.0, cache_small->get_num_hits(), cache_small->get_num_misses());
+  if (!same_matrix(&mat, &mat_small) || !same_vector(&rhs, &rhs_small) ||
+      cache_small->get_memory() > small_memory)
+  {
+    info("The geometry cache does not keep to its memory budget.");
+    success = false;
+  }
+
+  // After the mesh is refined, the cache must not return the geometry of the old elements.
+  mesh.refine_all_elements();
+  space.set_uniform_order(P_INIT);
+  ndof = get_num_dofs(&space);
+  AVector coeff_vec_ref(ndof);
+  for (int i = 0; i < ndof; i++) coeff_vec_ref.set(i, 0.01 * (i % 5));
+  int misses = cache->get_num_misses();
+  dp.assemble(&coeff_vec_ref, &mat, NULL, &rhs);
+  dp_cached.assemble(&coeff_vec_ref, &mat_cached, NULL, &rhs_cached);
+  if (!same_matrix(&mat, &mat_cached) || !same_vector(&rhs, &rhs_cached) ||
+      cache->get_num_misses() - misses != cache->get_num_entries())
+  {
+    info("The geometry cache was not invalidated after the mesh had changed.");
+    success = false;
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,279 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test renumbers an adapted mesh by Mesh::reorder() and compares the assembling
+// on the original and on the reordered mesh. The base mesh is a grid of quads stored
+// in a random order (as a mesh generator may produce it), which is then refined in
+// several random rounds, as adaptivity would do. It checks that the reordered mesh
+// is consistent, that the elements are traversed in the order of their ids (with the
+// base order of the reordered mesh), that the element orders are kept by
+// Space::distribute_orders() and that the assembled matrices are the same up to the
+// numbering of the DOFs.
+
+const int N = 40;                        // The base mesh has N x N quads.
+const int NUM_ROUNDS = 4;                // Number of rounds of random refinements.
+const int NUM_REPEATS = 3;               // The best of NUM_REPEATS assembling times is reported.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Weak forms.
+template<typename Real, typename Scalar>
+Scalar biform(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+              Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v) + int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar liform(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v,
+              Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_v<Real, Scalar>(n, wt, v);
+}
+
+// A simple deterministic random number generator.
+static unsigned rnd_state = 12345;
+static int rnd(int n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return (rnd_state >> 16) % n;
+}
+
+// Assembles the problem NUM_REPEATS times, returns the best time, the sum of squares of the
+// matrix entries, its trace and the sum of squares of the right-hand side. These do not
+// depend on the numbering of the DOFs nor on the orientation of the edge functions.
+static double assemble(WeakForm* wf, Space* space, bool base_order, double& sum, double& trace,
+                       double& rhs_sum)
+{
+  int ndof = get_num_dofs(space);
+  double best = 1e100;
+  for (int r = 0; r < NUM_REPEATS; r++)
+  {
+    LinearProblem lp(wf, space);
+    lp.set_base_order_traversal(base_order);
+    CooMatrix mat(ndof);
+    AVector rhs(ndof);
+    TimePeriod cpu_time;
+    lp.assemble(&mat, &rhs);
+    best = std::min(best, cpu_time.tick().last());
+
+    int nnz = mat.get_nnz();
+    int* row = new int[nnz];
+    int* col = new int[nnz];
+    double* data = new double[nnz];
+    mat.get_row_col_data(row, col, data);
+    sum = trace = rhs_sum = 0.0;
+    for (int i = 0; i < nnz; i++)
+    {
+      sum += sqr(data[i]);
+      if (row[i] == col[i]) trace += data[i];
+    }
+    for (int i = 0; i < ndof; i++)
+      rhs_sum += sqr(rhs.get(i));
+    delete [] row;
+    delete [] col;
+    delete [] data;
+  }
+  return best;
+}
+
+static bool close(double a, double b)
+{
+  return fabs(a - b) <= 1e-10 * std::max(fabs(a), fabs(b));
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Base mesh: a grid of quads with randomly permuted vertices and elements.
+  int nv = (N+1) * (N+1);
+  std::vector<int> vperm(nv);
+  for (int i = 0; i < nv; i++) vperm[i] = i;
+  for (int i = nv-1; i > 0; i--) std::swap(vperm[i], vperm[rnd(i+1)]);
+  double2* verts = new double2[nv];
+  for (int i = 0; i <= N; i++)
+    for (int j = 0; j <= N; j++)
+    {
+      verts[vperm[i*(N+1) + j]][0] = (double) j / N;
+      verts[vperm[i*(N+1) + j]][1] = (double) i / N;
+    }
+  std::vector<int> qperm(N*N);
+  for (int i = 0; i < N*N; i++) qperm[i] = i;
+  for (int i = N*N-1; i > 0; i--) std::swap(qperm[i], qperm[rnd(i+1)]);
+  int5* quads = new int5[N*N];
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++)
+    {
+      int* q = quads[qperm[i*N + j]];
+      q[0] = vperm[i*(N+1) + j];     q[1] = vperm[i*(N+1) + j+1];
+      q[2] = vperm[(i+1)*(N+1) + j+1]; q[3] = vperm[(i+1)*(N+1) + j];
+      q[4] = 0;
+    }
+  int3* mark = new int3[4*N];
+  for (int k = 0; k < N; k++)
+  {
+    int3 m[4] = { { vperm[k], vperm[k+1], 1 }, { vperm[N*(N+1) + k], vperm[N*(N+1) + k+1], 1 },
+                  { vperm[k*(N+1)], vperm[(k+1)*(N+1)], 1 }, { vperm[k*(N+1) + N], vperm[(k+1)*(N+1) + N], 1 } };
+    memcpy(mark + 4*k, m, sizeof(m));
+  }
+  Mesh mesh;
+  mesh.create(nv, verts, 0, NULL, N*N, quads, 4*N, mark);
+  delete [] verts;
+  delete [] quads;
+  delete [] mark;
+
+  // Random refinements, including anisotropic ones.
+  for (int r = 0; r < NUM_ROUNDS; r++)
+  {
+    std::vector<int> ids;
+    Element* e;
+    for_all_active_elements(e, &mesh)
+      if (rnd(10) < 3) ids.push_back(e->id);
+    for (unsigned i = 0; i < ids.size(); i++)
+      mesh.refine_element(ids[i], rnd(3));
+  }
+  info("elements = %d, nodes = %d", mesh.get_num_active_elements(), mesh.get_num_nodes());
+
+  // The space on the original mesh has random element orders.
+  H1Space space(&mesh, bc_types, NULL, 1);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+  {
+    int p = 1 + rnd(3);
+    space.set_element_order_internal(e->id, H2D_MAKE_QUAD_ORDER(p, p));
+  }
+  space.assign_dofs();
+
+  // A copy of the mesh with the same orders is reordered, the orders are moved along.
+  Mesh sorted;
+  sorted.copy(&mesh);
+  H1Space sorted_space(&sorted, bc_types, NULL, 1);
+  for_all_active_elements(e, &sorted)
+    sorted_space.set_element_order_internal(e->id, space.get_element_order(e->id));
+  TimePeriod cpu_time;
+  int* parents = sorted.reorder();
+  info("reorder: %g s", cpu_time.tick().last());
+  sorted_space.distribute_orders(&sorted, parents);
+  sorted_space.assign_dofs();
+
+  bool success = true;
+
+  // The elements correspond to the original ones and have the same orders.
+  for_all_active_elements(e, &sorted)
+  {
+    Element* orig = mesh.get_element(parents[e->id]);
+    bool same = orig->active && orig->nvert == e->nvert &&
+                sorted_space.get_element_order(e->id) == space.get_element_order(orig->id);
+    for (unsigned j = 0; same && j < e->nvert; j++)
+      same = (orig->vn[j]->x == e->vn[j]->x && orig->vn[j]->y == e->vn[j]->y);
+    if (!same)
+    {
+      info("Reordered element %d does not match the original element %d.", e->id, parents[e->id]);
+      success = false;
+      break;
+    }
+  }
+  ::free(parents);
+
+  // The hash table finds all nodes by their parents.
+  Node* n;
+  for_all_nodes(n, &sorted)
+    if (n->p1 >= 0)
+    {
+      Node* found = (n->type == H2D_TYPE_VERTEX) ? sorted.peek_vertex_node(n->p1, n->p2)
+                                                 : sorted.peek_edge_node(n->p1, n->p2);
+      if (found != n)
+      {
+        info("Node %d is not found in the hash table.", n->id);
+        success = false;
+        break;
+      }
+    }
+
+  // The base elements are traversed in the order of their ids by default.
+  Traverse trav;
+  Mesh* meshes[1] = { &sorted };
+  trav.begin(1, meshes);
+  int last_base = -1;
+  while (trav.get_next_state(NULL, NULL) != NULL)
+  {
+    int id = trav.get_base()->id;
+    if (id < last_base)
+    {
+      info("Base elements are not traversed in the order of their ids.");
+      success = false;
+      break;
+    }
+    last_base = id;
+  }
+  trav.finish();
+
+  // With the base order of the reordered mesh, the refined elements are traversed
+  // in the order of their ids.
+  trav.set_base_order(true);
+  trav.begin(1, meshes);
+  Element** ee;
+  int last = -1, count = 0;
+  while ((ee = trav.get_next_state(NULL, NULL)) != NULL)
+  {
+    count++;
+    if (ee[0]->id < sorted.get_num_base_elements()) continue;
+    if (ee[0]->id < last)
+    {
+      info("Elements are not traversed in the order of their ids.");
+      success = false;
+      break;
+    }
+    last = ee[0]->id;
+  }
+  trav.finish();
+  if (count != sorted.get_num_active_elements()) success = false;
+
+  // Assembling on both meshes.
+  WeakForm wf;
+  wf.add_matrix_form(callback(biform), H2D_SYM);
+  wf.add_vector_form(callback(liform));
+
+  double sum, trace, rhs_sum, sorted_sum, sorted_trace, sorted_rhs_sum;
+  double time = assemble(&wf, &space, false, sum, trace, rhs_sum);
+  double sorted_time = assemble(&wf, &sorted_space, true, sorted_sum, sorted_trace, sorted_rhs_sum);
+  info("ndof = %d, assembling: original %g s, reordered %g s, speedup %g",
+       get_num_dofs(&space), time, sorted_time, time / sorted_time);
+  if (get_num_dofs(&space) != get_num_dofs(&sorted_space) || !close(sum, sorted_sum) ||
+      !close(trace, sorted_trace) || !close(rhs_sum, sorted_rhs_sum))
+  {
+    info("The assembled systems differ (sum %g / %g, trace %g / %g, rhs %g / %g).", sum, sorted_sum,
+         trace, sorted_trace, rhs_sum, sorted_rhs_sum);
+    success = false;
+  }
+
+  // The reordered mesh can be refined and unrefined further.
+  mesh.refine_all_elements();
+  sorted.refine_all_elements();
+  if (mesh.get_num_active_elements() != sorted.get_num_active_elements() ||
+      mesh.get_num_nodes() != sorted.get_num_nodes())
+    success = false;
+  mesh.unrefine_all_elements();
+  sorted.unrefine_all_elements();
+  if (mesh.get_num_active_elements() != sorted.get_num_active_elements() ||
+      mesh.get_num_nodes() != sorted.get_num_nodes())
+  {
+    info("The reordered mesh differs from the original after further refinements.");
+    success = false;
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,99 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test checks that Solutions created on an unchanged mesh share one copy of
+// the mesh, also when the Solutions are deleted and created again (as it happens
+// in the Newton's method), and that a Solution created after the mesh is refined
+// gets a new copy while the old Solutions keep their values. The shared copies are
+// read-only, a copy of them can be refined. The times of making the Solutions with
+// and without copying the mesh are reported.
+
+const int INIT_REF_NUM = 5;              // Number of initial uniform mesh refinements.
+const int P_INIT = 2;                    // Polynomial degree of all mesh elements.
+const int NUM_SOLUTIONS = 50;            // Number of Solutions created in the timing loop.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  int ndof = get_num_dofs(&space);
+  info("ndof = %d, elements = %d", ndof, mesh.get_num_active_elements());
+
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, sin(0.1 * i));
+
+  bool success = true;
+
+  // Solutions on the same mesh share the copy.
+  Solution sln1, sln2, sln3;
+  sln1.set_fe_solution(&space, &vec);
+  sln2.set_fe_solution(&space, &vec);
+  sln3.copy(&sln1);
+  if (sln1.get_mesh() == &mesh) success = false;
+  if (sln2.get_mesh() != sln1.get_mesh() || sln3.get_mesh() != sln1.get_mesh()) success = false;
+
+  // ... also when they are deleted and created again.
+  TimePeriod cpu_time;
+  for (int i = 0; i < NUM_SOLUTIONS; i++)
+  {
+    Solution* sln = new Solution(&mesh);
+    sln->set_fe_solution(&space, &vec);
+    if (sln->get_mesh() != sln1.get_mesh()) success = false;
+    delete sln;
+  }
+  double time_shared = cpu_time.tick().last();
+  for (int i = 0; i < NUM_SOLUTIONS; i++)
+  {
+    Mesh copy;
+    copy.copy(&mesh);
+  }
+  double time_copy = cpu_time.tick().last();
+  info("%d Solutions: %g s, %d mesh copies alone: %g s", NUM_SOLUTIONS, time_shared,
+       NUM_SOLUTIONS, time_copy);
+
+  // A refined mesh gets a new copy, the old Solutions are not affected.
+  const double x = 0.31, y = -0.47;
+  scalar val = sln1.get_pt_value(x, y);
+  mesh.refine_all_elements();
+  space.set_uniform_order(P_INIT);
+  ndof = space.assign_dofs();
+  AVector vec_ref(ndof);
+  Solution sln_ref;
+  sln_ref.set_fe_solution(&space, &vec_ref);
+  if (sln_ref.get_mesh() == sln1.get_mesh()) success = false;
+  if (sln_ref.get_mesh()->get_num_active_elements() != mesh.get_num_active_elements()) success = false;
+  if (sln1.get_mesh()->get_num_active_elements() * 4 != mesh.get_num_active_elements()) success = false;
+  if (sln1.get_pt_value(x, y) != val || sln2.get_pt_value(x, y) != val) success = false;
+
+  // The shared copies are read-only, a copy of them can be changed.
+  if (!sln1.get_mesh()->is_read_only() || mesh.is_read_only()) success = false;
+  Mesh own;
+  own.copy(sln1.get_mesh());
+  own.refine_all_elements();
+  if (own.is_read_only() || own.get_num_active_elements() != mesh.get_num_active_elements()) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
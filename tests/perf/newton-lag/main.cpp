@@ -0,0 +1,121 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test solves a nonlinear problem by the Newton's method of DiscreteProblem,
+// once with the Jacobian assembled in every iteration and once with the Jacobian
+// lagged for several iterations. Both have to converge to the same solution, and
+// the lagged variant has to assemble fewer Jacobians than it makes iterations.
+// The times of assembling, residuals and solves are reported.
+
+const int INIT_REF_NUM = 3;              // Number of initial uniform mesh refinements.
+const int P_INIT = 2;                    // Polynomial degree of all mesh elements.
+const double NEWTON_TOL = 1e-8;          // Stopping criterion for the Newton's method.
+const int NEWTON_MAX_ITER = 100;         // Maximum allowed number of Newton iterations.
+const int JAC_LAG = 4;                   // Maximum number of solves with one Jacobian.
+MatrixSolverType matrix_solver = SOLVER_UMFPACK;  // Possibilities: SOLVER_UMFPACK, SOLVER_PETSC,
+                                                  // SOLVER_MUMPS, and more are coming.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return 0.0;
+}
+
+// Jacobian and residual of -div((1 + u^2) grad u) = 4.
+template<typename Real, typename Scalar>
+Scalar jac(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+           Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * (2 * u_prev->val[i] * u->val[i] * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       + (1 + sqr(u_prev->val[i])) * (u->dx[i] * v->dx[i] + u->dy[i] * v->dy[i]));
+  return result;
+}
+
+template<typename Real, typename Scalar>
+Scalar res(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * ((1 + sqr(u_prev->val[i])) * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       - 4.0 * v->val[i]);
+  return result;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+// Solves the problem from zero with the given Jacobian lag.
+static bool solve(WeakForm* wf, Space* space, int jac_lag, Vector* coeff_vec)
+{
+  int ndof = get_num_dofs(space);
+  for (int i = 0; i < ndof; i++) coeff_vec->set(i, 0.0);
+
+  DiscreteProblem dp(wf, space);
+  Matrix* mat; Vector* rhs; CommonSolver* solver;
+  init_matrix_solver(matrix_solver, ndof, mat, rhs, solver);
+  bool converged = dp.solve_newton(coeff_vec, mat, rhs, solver, NEWTON_TOL, NEWTON_MAX_ITER, jac_lag);
+
+  const DiscreteProblem::NewtonStats& st = dp.get_newton_stats();
+  info("jac_lag = %d: %d iterations, %d Jacobians, %d residuals only", jac_lag, st.num_iter,
+       st.num_jac, st.num_res);
+  info("  Jacobian assembling %g s, residuals %g s, solves %g s", st.jac_time, st.res_time,
+       st.solve_time);
+
+  bool success = converged;
+  if (jac_lag == 1 && st.num_jac != st.num_iter + 1) success = false;
+  if (jac_lag > 1 && st.num_jac >= st.num_iter) success = false;
+
+  delete rhs;
+  delete mat;
+  delete solver;
+  return success;
+}
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  H1Space space(&mesh, bc_types, essential_bc_values, P_INIT);
+  int ndof = get_num_dofs(&space);
+  info("ndof = %d", ndof);
+
+  WeakForm wf;
+  wf.add_matrix_form(callback(jac), H2D_UNSYM, H2D_ANY);
+  wf.add_vector_form(callback(res), H2D_ANY);
+
+  AVector coeff_vec(ndof), coeff_vec_lag(ndof);
+  bool success = solve(&wf, &space, 1, &coeff_vec);
+  if (!solve(&wf, &space, JAC_LAG, &coeff_vec_lag)) success = false;
+
+  // Both variants have to arrive at the same solution.
+  double diff = 0.0;
+  for (int i = 0; i < ndof; i++)
+    diff = std::max(diff, fabs(coeff_vec.get(i) - coeff_vec_lag.get(i)));
+  info("max. difference of the coefficients: %g", diff);
+  if (diff > 1e-6) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,209 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test repeatedly assembles a nonlinear problem into a PatternMatrix, as
+// in Newton iterations or time steps. It makes sure that the sparse structure
+// is created only once while the space does not change, that it is created
+// again after the space changes, and that the reused structure gives the same
+// matrix as a fresh one. Further, the structure has to be exact, i.e., have as
+// many entries as a CooMatrix assembled from scratch, also for forms defined on
+// a part of the domain and on a part of the boundary only. The assembling times
+// with and without creating the structure are reported. init_matrix_solver() has
+// to create a CooMatrix unless a PatternMatrix is requested.
+
+const int INIT_REF_NUM = 4;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int NUM_STEPS = 10;                // Number of assemblings with the same space.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return 0.0;
+}
+
+// Jacobian and residual of -div((1 + u^2) grad u) = 1.
+template<typename Real, typename Scalar>
+Scalar jac(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+           Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * (2 * u_prev->val[i] * u->val[i] * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       + (1 + sqr(u_prev->val[i])) * (u->dx[i] * v->dx[i] + u->dy[i] * v->dy[i]));
+  return result;
+}
+
+template<typename Real, typename Scalar>
+Scalar res(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v, Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  Func<Scalar>* u_prev = u_ext[0];
+  for (int i = 0; i < n; i++)
+    result += wt[i] * ((1 + sqr(u_prev->val[i])) * (u_prev->dx[i] * v->dx[i] + u_prev->dy[i] * v->dy[i])
+                       - v->val[i]);
+  return result;
+}
+
+// Mass matrix forms.
+template<typename Real, typename Scalar>
+Scalar mass(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+            Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar mass_surf(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                 Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+BCType bc_types_natural(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Returns true if the structure created by the DiscreteProblem has as many entries as
+// a CooMatrix, which only gets the entries actually added in the assembling.
+static bool is_exact(WeakForm* wf, Space* space, Vector* init_vec, const char* name)
+{
+  int ndof = get_num_dofs(space);
+  DiscreteProblem dp(wf, space);
+  PatternMatrix mat(ndof);
+  AVector rhs(ndof);
+  dp.assemble(init_vec, &mat, NULL, &rhs);
+
+  DiscreteProblem dp_coo(wf, space);
+  CooMatrix coo(ndof);
+  AVector rhs_coo(ndof);
+  dp_coo.assemble(init_vec, &coo, NULL, &rhs_coo);
+
+  info("%s: ndof = %d, nnz = %d (CooMatrix %d), %g MB, symbolic phase %g s", name, ndof,
+       dp.get_struct_nnz(), coo.get_nnz(), dp.get_struct_memory() / 1048576.0, dp.get_struct_time());
+  return dp.get_struct_nnz() == mat.get_nnz() && mat.get_nnz() == coo.get_nnz();
+}
+
+// Returns true if both matrices have the same structure and values.
+static bool same_matrix(PatternMatrix* a, PatternMatrix* b)
+{
+  int n = a->get_size();
+  if (n != b->get_size() || a->get_nnz() != b->get_nnz()) return false;
+  if (memcmp(a->get_Ap(), b->get_Ap(), (n + 1) * sizeof(int))) return false;
+  if (memcmp(a->get_Ai(), b->get_Ai(), a->get_nnz() * sizeof(int))) return false;
+  return !memcmp(a->get_Ax(), b->get_Ax(), a->get_nnz() * sizeof(double));
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  H1Space space(&mesh, bc_types, essential_bc_values, P_INIT);
+  int ndof = get_num_dofs(&space);
+  info("ndof = %d", ndof);
+
+  WeakForm wf;
+  wf.add_matrix_form(callback(jac), H2D_UNSYM, H2D_ANY);
+  wf.add_vector_form(callback(res), H2D_ANY);
+
+  // A nonzero previous iteration.
+  AVector coeff_vec(ndof);
+  for (int i = 0; i < ndof; i++) coeff_vec.set(i, 0.01 * (i % 7));
+
+  DiscreteProblem dp(&wf, &space);
+  PatternMatrix mat(ndof);
+  AVector rhs(ndof);
+  double time_first = 0.0, time_reused = 0.0;
+  for (int step = 0; step < NUM_STEPS; step++)
+  {
+    TimePeriod cpu_time;
+    dp.assemble(&coeff_vec, &mat, NULL, &rhs);
+    double time = cpu_time.tick().last();
+    if (step == 0) time_first = time;
+    else time_reused += time / (NUM_STEPS - 1);
+  }
+  info("assembling time: %g s with creating the structure, %g s with reusing it", time_first, time_reused);
+
+  bool success = (dp.get_num_struct_created() == 1 && dp.get_num_struct_reused() == NUM_STEPS - 1);
+  if (!success) info("Structure created %d times, reused %d times.", dp.get_num_struct_created(), dp.get_num_struct_reused());
+
+  // The reused structure must give the same matrix as a fresh one.
+  DiscreteProblem dp_fresh(&wf, &space);
+  PatternMatrix mat_fresh(ndof);
+  AVector rhs_fresh(ndof);
+  dp_fresh.assemble(&coeff_vec, &mat_fresh, NULL, &rhs_fresh);
+  if (!same_matrix(&mat, &mat_fresh))
+  {
+    info("The matrix assembled with a reused structure differs from a fresh one.");
+    success = false;
+  }
+
+  // After the space changes, the structure has to be created again.
+  space.set_uniform_order(P_INIT + 1);
+  ndof = get_num_dofs(&space);
+  AVector coeff_vec_2(ndof);
+  dp.assemble(&coeff_vec_2, &mat, NULL, &rhs);
+  if (dp.get_num_struct_created() != 2 || mat.get_size() != ndof)
+  {
+    info("The structure was not recreated after the space had changed.");
+    success = false;
+  }
+
+  if (!is_exact(&wf, &space, &coeff_vec_2, "whole domain")) success = false;
+
+  // Two elements with different markers; the volume form is defined on the right one,
+  // the surface form on the left edge of the left one.
+  double2 verts_2[6] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { 1, 1 }, { 0, 1 }, { -1, 1 } };
+  int5 quads_2[2] = { { 0, 1, 4, 5, 0 }, { 1, 2, 3, 4, 1 } };
+  int3 mark_2[6] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 4, 1 }, { 4, 5, 1 }, { 5, 0, 2 } };
+  Mesh mesh_2;
+  mesh_2.create(6, verts_2, 0, NULL, 2, quads_2, 6, mark_2);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh_2.refine_all_elements();
+  H1Space space_2(&mesh_2, bc_types_natural, NULL, P_INIT);
+
+  WeakForm wf_2;
+  wf_2.add_matrix_form(callback(mass), H2D_SYM, 1);
+  wf_2.add_matrix_form_surf(callback(mass_surf), 2);
+  if (!is_exact(&wf_2, &space_2, NULL, "part of the domain")) success = false;
+
+  // init_matrix_solver() creates a PatternMatrix only on request.
+  for (int k = 0; k < 2; k++)
+  {
+    Matrix* m; Vector* v; CommonSolver* solver;
+    init_matrix_solver(SOLVER_UMFPACK, ndof, m, v, solver, false, k == 1);
+    bool pattern = (dynamic_cast<PatternMatrix*>(m) != NULL), coo = (dynamic_cast<CooMatrix*>(m) != NULL);
+    if (k == 0 ? !coo : !pattern)
+    {
+      info("init_matrix_solver() created a wrong type of matrix.");
+      success = false;
+    }
+    delete v;
+    delete m;
+    delete solver;
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,182 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test checks the point queries of a mesh with curved elements. For random
+// points, the element containing the point, found by going through all active
+// elements, has to be among the candidates returned by the point grid of the mesh,
+// also after the mesh is refined. Further, the batched Solution::get_pt_values()
+// has to give the same values as get_pt_value(). The times of the point search by
+// going through all elements and by the grid are reported. Finally, several threads
+// query the refined mesh at once, so that its grid is built concurrently.
+
+const int INIT_REF_NUM = 4;              // Number of initial uniform mesh refinements.
+const int P_INIT = 2;                    // Polynomial degree of all mesh elements.
+const int NUM_POINTS = 2000;             // Number of random points.
+const int NUM_THREADS = 4;               // Number of threads querying the mesh concurrently.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Function to project.
+scalar fn(double x, double y, scalar& dx, scalar& dy)
+{
+  dx = cos(x) * y;
+  dy = sin(x) + 1.0;
+  return sin(x) * y + y;
+}
+
+static inline bool is_in_ref_domain(Element* e, double xi1, double xi2)
+{
+  const double TOL = 1e-11;
+  if (e->is_triangle())
+    return (xi1 + xi2 <= TOL) && (xi1 + 1.0 >= -TOL) && (xi2 + 1.0 >= -TOL);
+  else
+    return (xi1 - 1.0 <= TOL) && (xi1 + 1.0 >= -TOL) && (xi2 - 1.0 <= TOL) && (xi2 + 1.0 >= -TOL);
+}
+
+// Returns the element containing the point by going through all active elements.
+static Element* find_element(Mesh* mesh, RefMap* refmap, double x, double y)
+{
+  Element* e;
+  double xi1, xi2;
+  for_all_active_elements(e, mesh)
+  {
+    refmap->set_active_element(e);
+    refmap->untransform(e, x, y, xi1, xi2);
+    if (is_in_ref_domain(e, xi1, xi2)) return e;
+  }
+  return NULL;
+}
+
+// Checks that the elements containing the points are among the candidates.
+static bool check_candidates(Mesh* mesh, double* x, double* y, int n)
+{
+  RefMap refmap;
+  int found = 0, missing = 0;
+  TimePeriod cpu_time;
+  std::vector<Element*> elems(n);
+  for (int i = 0; i < n; i++)
+    elems[i] = find_element(mesh, &refmap, x[i], y[i]);
+  double time_scan = cpu_time.tick().last();
+
+  Element** cand;
+  for (int i = 0; i < n; i++)
+  {
+    if (elems[i] == NULL) continue;
+    found++;
+    int nc = mesh->get_point_candidates(x[i], y[i], cand);
+    if (std::find(cand, cand + nc, elems[i]) == cand + nc) missing++;
+  }
+  double time_grid = cpu_time.tick().last();
+
+  info("elements: %d, points in the mesh: %d, missing candidates: %d", mesh->get_num_active_elements(),
+       found, missing);
+  info("search time: %g s through all elements, %g s with the grid", time_scan, time_grid);
+  return found > 0 && missing == 0;
+}
+
+// A thread checking the candidates of the points, the elements containing them are known.
+struct QueryThread
+{
+  Mesh* mesh;
+  double *x, *y;
+  Element** elems;
+  int n, missing;
+  pthread_t thread;
+};
+
+static void* query_thread(void* arg)
+{
+  QueryThread* q = (QueryThread*) arg;
+  Element** cand;
+  for (int i = 0; i < q->n; i++)
+  {
+    if (q->elems[i] == NULL) continue;
+    int nc = q->mesh->get_point_candidates(q->x[i], q->y[i], cand);
+    if (std::find(cand, cand + nc, q->elems[i]) == cand + nc) q->missing++;
+  }
+  return NULL;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("domain.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_towards_vertex(3, 3);
+
+  // Random points in the bounding box of the mesh.
+  srand(1);
+  std::vector<double> x(NUM_POINTS), y(NUM_POINTS);
+  for (int i = 0; i < NUM_POINTS; i++)
+  {
+    x[i] = -1.0 + 2.0 * rand() / RAND_MAX;
+    y[i] = -1.0 + 2.0 * rand() / RAND_MAX;
+  }
+
+  bool success = check_candidates(&mesh, &x[0], &y[0], NUM_POINTS);
+
+  // The batched evaluation gives the same values as the single one.
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  ExactSolution exact(&mesh, fn);
+  Solution sln;
+  project_global(&space, H2D_H1_NORM, &exact, &sln);
+
+  std::vector<scalar> values(NUM_POINTS);
+  TimePeriod cpu_time;
+  sln.get_pt_values(&x[0], &y[0], NUM_POINTS, &values[0]);
+  info("get_pt_values(): %g s for %d points", cpu_time.tick().last(), NUM_POINTS);
+  int nan = 0, diff = 0;
+  for (int i = 0; i < NUM_POINTS; i++)
+  {
+    scalar v = sln.get_pt_value(x[i], y[i]);
+    if (v != v) { nan++; if (values[i] == values[i]) diff++; }
+    else if (v != values[i]) diff++;
+  }
+  info("points outside of the mesh: %d, different values: %d", nan, diff);
+  if (diff > 0) success = false;
+
+  // The grid is rebuilt after the mesh changes.
+  mesh.refine_all_elements();
+  if (!check_candidates(&mesh, &x[0], &y[0], NUM_POINTS / 10)) success = false;
+
+  // Concurrent queries of the changed mesh.
+  mesh.refine_towards_vertex(3, 2);
+  int n = NUM_POINTS / 10;
+  std::vector<Element*> elems(n);
+  RefMap refmap;
+  for (int i = 0; i < n; i++)
+    elems[i] = find_element(&mesh, &refmap, x[i], y[i]);
+  QueryThread threads[NUM_THREADS];
+  for (int t = 0; t < NUM_THREADS; t++)
+  {
+    QueryThread q = { &mesh, &x[0], &y[0], &elems[0], n, 0 };
+    threads[t] = q;
+    pthread_create(&threads[t].thread, NULL, query_thread, &threads[t]);
+  }
+  int missing = 0;
+  for (int t = 0; t < NUM_THREADS; t++)
+  {
+    pthread_join(threads[t].thread, NULL);
+    missing += threads[t].missing;
+  }
+  info("concurrent queries by %d threads, missing candidates: %d", NUM_THREADS, missing);
+  if (missing > 0) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,104 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test compares the two storage backends of PrecalcShapeset (the Judy
+// arrays and the flat tables) for H1 shape functions of orders 1..10 on a
+// quad. It measures the latency of set_active_shape() + set_quad_order() on
+// the element and its four sons once the tables are precalculated, reports
+// the memory used by the tables, and checks that both backends return the
+// same values.
+
+const int MAX_P = 10;      // Shape functions of orders 1..MAX_P are measured.
+const int NUM_REPS = 200;  // Number of timed sweeps over all shape functions and sub-elements.
+
+// Sets the sub-element 'sub' (0 = the element, 1..4 = its sons).
+static void set_sub(PrecalcShapeset* pss, int sub)
+{
+  pss->reset_transform();
+  if (sub > 0) pss->push_transform(sub - 1);
+}
+
+// Visits all shape functions on the element and its sons, returns a checksum.
+static double sweep(PrecalcShapeset* pss, int* idx, int nidx, int order)
+{
+  double sum = 0.0;
+  for (int sub = 0; sub < 5; sub++)
+  {
+    set_sub(pss, sub);
+    for (int i = 0; i < nidx; i++)
+    {
+      pss->set_active_shape(idx[i]);
+      pss->set_quad_order(order);
+      sum += pss->get_fn_values()[0] + pss->get_dx_values()[0];
+    }
+  }
+  return sum;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh with a single reference quad.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  Element* e = mesh.get_element(0);
+
+  H1Shapeset shapeset;
+  shapeset.set_mode(H2D_MODE_QUAD);
+
+  bool success = true;
+  for (int p = 1; p <= MAX_P; p++)
+  {
+    // indices of all shape functions of an element of order p
+    std::vector<int> idx;
+    for (int i = 0; i < 4; i++)
+      idx.push_back(shapeset.get_vertex_index(i));
+    for (int o = 2; o <= p; o++)
+      for (int i = 0; i < 4; i++)
+        idx.push_back(shapeset.get_edge_index(i, 0, o));
+    int bo = H2D_MAKE_QUAD_ORDER(p, p);
+    int* bubbles = shapeset.get_bubble_indices(bo);
+    for (int i = 0; i < shapeset.get_num_bubbles(bo); i++)
+      idx.push_back(bubbles[i]);
+    int order = 2*p;
+
+    double time[2], sum[2];
+    long mem[2];
+    for (int s = 0; s < 2; s++)
+    {
+      PrecalcShapeset::set_default_storage(s == 0 ? H2D_PSS_JUDY : H2D_PSS_FLAT);
+      PrecalcShapeset pss(&shapeset);
+      pss.set_active_element(e);
+
+      sum[s] = sweep(&pss, &idx[0], idx.size(), order); // precalculation
+      TimePeriod cpu_time;
+      for (int r = 0; r < NUM_REPS; r++)
+        sweep(&pss, &idx[0], idx.size(), order);
+      time[s] = cpu_time.tick().last() / (NUM_REPS * 5.0 * idx.size()) * 1e9;
+      mem[s] = pss.get_mem_size();
+    }
+    info("p = %2d, shapes: %3d, lookup: judy %6.1f ns, flat %6.1f ns (%.2fx), memory: judy %7ld KB, flat %7ld KB",
+         p, (int) idx.size(), time[0], time[1], time[0] / time[1], mem[0] / 1024, mem[1] / 1024);
+
+    if (sum[0] != sum[1])
+    {
+      info("The flat tables differ from the Judy ones for p = %d.", p);
+      success = false;
+    }
+  }
+  PrecalcShapeset::set_default_storage(H2D_PSS_JUDY);
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
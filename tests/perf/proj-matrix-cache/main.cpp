@@ -0,0 +1,158 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+using namespace RefinementSelectors;
+
+// This test measures the selection of refinements by a projection-based selector
+// which factorizes projection matrices lazily and by a selector which factorizes
+// them in advance, and makes sure that both select the same refinements. It also
+// checks the statistics of the caches of the factorized matrices: the lazy cache
+// has to be reused, the precalculated one must not miss at all. The coarse and
+// the reference solutions are given by random coefficient vectors on a curved
+// mesh with triangles and quads, the orders of the elements are not uniform.
+
+const int INIT_REF_NUM = 3;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const double THRESHOLD = 0.3;            // Parameter of the refinement strategy.
+const int STRATEGY = 1;                  // Refinement strategy, see Adapt::adapt().
+const CandList CAND_LIST = H2D_HP_ANISO; // Candidates of the refinement selectors.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Sets the solution to a random coefficient vector on the space.
+static void set_random_solution(Space* space, Solution* sln)
+{
+  int ndof = get_num_dofs(space);
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, -1.0 + 2.0 * rand() / RAND_MAX);
+  PrecalcShapeset pss(space->get_shapeset());
+  sln->set_fe_solution(space, &pss, &vec);
+}
+
+// Compares the refinements including the orders of the sons.
+static bool same_refinement(const ElementToRefine& a, const ElementToRefine& b)
+{
+  if (a.id != b.id || a.comp != b.comp || a.split != b.split) return false;
+  for (int i = 0; i < a.get_num_sons(); i++)
+    if (a.p[i] != b.p[i]) return false;
+  return !memcmp(a.q, b.q, sizeof(a.q));
+}
+
+// Adapts a copy of the mesh and the space, returns the refinements.
+static std::vector<ElementToRefine> adapt_copy(Mesh* mesh, Space* space, Solution* sln, Solution* ref_sln, Selector* selector, double* time)
+{
+  Mesh run_mesh;
+  run_mesh.copy(mesh);
+  Space* run_space = space->dup(&run_mesh);
+  run_space->copy_orders(space);
+
+  Adapt hp(run_space, H2D_H1_NORM);
+  hp.set_solutions(sln, ref_sln);
+  hp.calc_elem_errors(H2D_TOTAL_ERROR_REL | H2D_ELEMENT_ERROR_REL);
+
+  TimePeriod cpu_time;
+  hp.adapt(selector, THRESHOLD, STRATEGY);
+  *time = cpu_time.tick().last();
+
+  std::vector<ElementToRefine> refs = hp.get_last_refinements();
+  delete run_space;
+  return refs;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Load the mesh.
+  Mesh mesh;
+  H2DReader mloader;
+  mloader.load("domain.mesh", &mesh);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+
+  // The coarse space with random orders and the reference space.
+  H1Space space(&mesh, bc_types, NULL, P_INIT);
+  srand(1);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+  {
+    int order_h = 1 + rand() % 5, order_v = 1 + rand() % 5;
+    space.set_element_order(e->id, e->is_triangle() ? order_h : H2D_MAKE_QUAD_ORDER(order_h, order_v));
+  }
+  Mesh ref_mesh;
+  ref_mesh.copy(&mesh);
+  ref_mesh.refine_all_elements();
+  Space* ref_space = space.dup(&ref_mesh);
+  ref_space->copy_orders(&space, 1);
+  info("ndof = %d, reference ndof = %d", get_num_dofs(&space), get_num_dofs(ref_space));
+
+  Solution sln, ref_sln;
+  set_random_solution(&space, &sln);
+  set_random_solution(ref_space, &ref_sln);
+
+  // Matrices factorized when needed.
+  H1ProjBasedSelector lazy_selector(CAND_LIST, 1.0, H2DRS_DEFAULT_ORDER);
+  double lazy_time;
+  std::vector<ElementToRefine> lazy_refs = adapt_copy(&mesh, &space, &sln, &ref_sln, &lazy_selector, &lazy_time);
+  ProjBasedSelector::ProjMatrixCacheStats lazy_stats = lazy_selector.get_proj_matrix_cache_stats();
+  info("lazy: refined elements: %d, time: %g s, matrices: %d (%g kB), hit rate: %g",
+       (int) lazy_refs.size(), lazy_time, lazy_stats.num_matrices, lazy_stats.memory / 1024.0, lazy_stats.get_hit_rate());
+
+  // Matrices factorized in advance. The modes of the shapeset and of the quadrature
+  // are restored afterwards.
+  H1Shapeset precalc_shapeset;
+  H1ProjBasedSelector precalc_selector(CAND_LIST, 1.0, H2DRS_DEFAULT_ORDER, &precalc_shapeset);
+  precalc_shapeset.set_mode(H2D_MODE_TRIANGLE);
+  g_quad_2d_std.set_mode(H2D_MODE_TRIANGLE);
+  TimePeriod cpu_time;
+  precalc_selector.precalc_proj_matrices();
+  double factorization_time = cpu_time.tick().last();
+  bool modes_restored = precalc_shapeset.get_mode() == H2D_MODE_TRIANGLE &&
+                        g_quad_2d_std.get_mode() == H2D_MODE_TRIANGLE;
+  ProjBasedSelector::ProjMatrixCacheStats init_stats = precalc_selector.get_proj_matrix_cache_stats();
+  double precalc_time;
+  std::vector<ElementToRefine> precalc_refs = adapt_copy(&mesh, &space, &sln, &ref_sln, &precalc_selector, &precalc_time);
+  ProjBasedSelector::ProjMatrixCacheStats precalc_stats = precalc_selector.get_proj_matrix_cache_stats();
+  info("precalculated: refined elements: %d, time: %g s (+%g s), matrices: %d (%g kB), hit rate: %g",
+       (int) precalc_refs.size(), precalc_time, factorization_time, precalc_stats.num_matrices,
+       precalc_stats.memory / 1024.0, precalc_stats.get_hit_rate());
+  delete ref_space;
+
+  bool success = !lazy_refs.empty();
+  if (!modes_restored)
+  {
+    info("The modes were not restored by precalc_proj_matrices().");
+    success = false;
+  }
+  if (lazy_stats.num_hits <= lazy_stats.num_misses)
+  {
+    info("The lazy cache is not reused.");
+    success = false;
+  }
+  if (precalc_stats.num_misses != init_stats.num_misses || init_stats.num_hits != 0)
+  {
+    info("The precalculated cache misses.");
+    success = false;
+  }
+  bool same = (lazy_refs.size() == precalc_refs.size());
+  for (unsigned i = 0; same && i < lazy_refs.size(); i++)
+    same = same_refinement(lazy_refs[i], precalc_refs[i]);
+  if (!same)
+  {
+    info("Refinements of the selectors differ.");
+    success = false;
+  }
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,185 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test checks the shape tables shared by a shapeset (Shapeset::get_shape_table()).
+// It visits the shape functions of an H1 and an H(curl) shapeset on triangles and quads,
+// on sub-elements down to below H2D_SHAPE_TABLE_MAX_LEVEL, and checks that the values of
+// PrecalcShapeset agree with the shape functions evaluated directly at the transformed
+// integration points. It checks that two instances refer to the same shared table, that
+// the registry does not grow when the same sub-elements are visited again and that it has
+// no tables of the deep sub-elements. It reports the precalculation times of an instance
+// with and without the shared tables.
+
+const int DEPTH = Shapeset::H2D_SHAPE_TABLE_MAX_LEVEL + 2;  // The deepest sub-element visited.
+const int NUM_PATHS = 8;                                    // Number of random paths to the deepest level.
+
+// A simple deterministic random number generator.
+static unsigned rnd_state = 12345;
+static int rnd(int n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return (rnd_state >> 16) % n;
+}
+
+// Visits all shape functions on the sub-element, returns the number of wrong values.
+static int check(PrecalcShapeset* pss, Shapeset* shapeset, int order)
+{
+  int nerr = 0;
+  Quad2D* quad = pss->get_quad_2d();
+  Trf* ctm = pss->get_ctm();
+  int np = quad->get_num_points(order);
+  double3* pt = quad->get_points(order);
+  for (int index = 0; index <= shapeset->get_max_index(); index++)
+  {
+    pss->set_active_shape(index);
+    pss->set_quad_order(order, H2D_FN_VAL | H2D_FN_DX | H2D_FN_DY);
+    for (int c = 0; c < shapeset->get_num_components(); c++)
+      for (int n = 0; n < 3; n++)
+      {
+        double* values = pss->get_values(c, n);
+        for (int i = 0; i < np; i++)
+          if (values[i] != shapeset->get_value(n, index, ctm->m[0] * pt[i][0] + ctm->t[0],
+                                               ctm->m[1] * pt[i][1] + ctm->t[1], c))
+          {
+            nerr++;
+            break;
+          }
+      }
+  }
+  return nerr;
+}
+
+// Checks all sub-elements along NUM_PATHS random paths, returns the number of errors.
+static int check_paths(PrecalcShapeset* pss, Shapeset* shapeset, int order, Element* e)
+{
+  int nerr = 0;
+  int nsons = e->is_triangle() ? 4 : 8;
+  pss->set_active_element(e);
+  unsigned state = rnd_state;
+  for (int path = 0; path < NUM_PATHS; path++)
+  {
+    pss->reset_transform();
+    nerr += check(pss, shapeset, order);
+    for (int level = 1; level <= DEPTH; level++)
+    {
+      pss->push_transform(rnd(nsons));
+      nerr += check(pss, shapeset, order);
+    }
+  }
+  rnd_state = state;
+  return nerr;
+}
+
+// Precalculates all shape functions on the element and its sons, returns the time.
+static double precalculate(Shapeset* shapeset, int order, Element* e)
+{
+  PrecalcShapeset pss(shapeset);
+  pss.set_active_element(e);
+  TimePeriod cpu_time;
+  for (int son = -1; son < 4; son++)
+  {
+    pss.reset_transform();
+    if (son >= 0) pss.push_transform(son);
+    for (int index = 0; index <= shapeset->get_max_index(); index++)
+    {
+      pss.set_active_shape(index);
+      pss.set_quad_order(order, H2D_FN_VAL | H2D_FN_DX | H2D_FN_DY);
+    }
+  }
+  return cpu_time.tick().last();
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh with a reference triangle and a reference quad.
+  double2 verts[6] = { { -1, -1 }, { 1, -1 }, { -1, 1 }, { 2, -1 }, { 4, -1 }, { 4, 1 } };
+  int4 tris[1] = { { 0, 1, 2, 0 } };
+  int5 quads[1] = { { 1, 3, 5, 2, 0 } };
+  int3 mark[5] = { { 0, 1, 1 }, { 2, 0, 1 }, { 1, 3, 1 }, { 3, 5, 1 }, { 5, 2, 1 } };
+  Mesh mesh;
+  mesh.create(6, verts, 1, tris, 1, quads, 5, mark);
+  H1Shapeset h1;
+  HcurlShapeset hcurl;
+  Shapeset* shapesets[2] = { &h1, &hcurl };
+  const char* names[2] = { "H1", "Hcurl" };
+
+  bool success = true;
+  for (int s = 0; s < 2; s++)
+    for (int mode = 0; mode < H2D_NUM_MODES; mode++)
+    {
+      Shapeset* shapeset = shapesets[s];
+      Element* e = mesh.get_element(0);
+      if (e->get_mode() != mode) e = mesh.get_element(1);
+      shapeset->set_mode(mode);
+      int order = 8;
+
+      // the precalculation without and with the shared tables
+      shapeset->free_shape_tables();
+      double cold = precalculate(shapeset, order, e);
+      double warm = precalculate(shapeset, order, e);
+
+      // the values agree with the shape functions, also when taken from the registry
+      PrecalcShapeset pss(shapeset);
+      int nerr = check_paths(&pss, shapeset, order, e);
+      int num = shapeset->get_num_shape_tables();
+      PrecalcShapeset pss2(shapeset);
+      nerr += check_paths(&pss2, shapeset, order, e);
+      info("%-5s %s: %d shared tables, %ld KB, precalculation %g ms, with shared tables %g ms, %d errors",
+           names[s], mode ? "quad" : "triangle", num, (long) (shapeset->get_shape_table_mem() / 1024),
+           cold * 1e3, warm * 1e3, nerr);
+      if (nerr > 0)
+      {
+        info("The precalculated values differ from the shape functions.");
+        success = false;
+      }
+
+      // the second visit of the same sub-elements adds no tables
+      if (shapeset->get_num_shape_tables() != num)
+      {
+        info("The registry grows when the same sub-elements are visited again.");
+        success = false;
+      }
+
+      // the instances refer to the same table on shallow sub-elements, deep ones are not shared
+      int index = shapeset->get_max_index();
+      Quad2D* quad = pss.get_quad_2d();
+      pss.reset_transform();
+      pss2.reset_transform();
+      pss.set_active_shape(index);
+      pss2.set_active_shape(index);
+      pss.set_quad_order(order);
+      pss2.set_quad_order(order);
+      if (pss.get_fn_values() != pss2.get_fn_values())
+      {
+        info("The instances do not share the table of the element.");
+        success = false;
+      }
+      for (int level = 0; level < DEPTH; level++)
+        pss.push_transform(0);
+      if (shapeset->get_shape_table(0, index, quad, order, pss.get_ctm(), 0) != NULL)
+      {
+        info("A table of a sub-element of level %d is shared.", DEPTH);
+        success = false;
+      }
+      if (shapeset->get_num_shape_tables() > Shapeset::H2D_SHAPE_TABLE_MAX_NUM ||
+          shapeset->get_shape_table_mem() > Shapeset::H2D_SHAPE_TABLE_MAX_MEM)
+      {
+        info("The registry exceeds its limits.");
+        success = false;
+      }
+    }
+
+  if (success)
+  {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
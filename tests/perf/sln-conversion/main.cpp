@@ -0,0 +1,136 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test checks the conversion of a coefficient vector into a Solution, which
+// uses precalculated monomial coefficients of the shape functions. The monomial
+// coefficients of the Solution are compared with the ones obtained pointwise, by
+// evaluating the solution at the Chebyshev points of each element and solving
+// with the LU decomposition of the monomial matrix, as it was done originally. An H1 and an Hcurl
+// space are checked, on a mesh with hanging nodes. The times of both ways are
+// reported.
+
+const int INIT_REF_NUM = 4;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int NUM_REPEAT = 10;               // Number of conversions timed.
+const double TOL = 1e-10;                // Allowed difference of the monomial coefficients.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_NATURAL;
+}
+
+// Gives access to the monomial coefficients of the Solution.
+class TestSolution : public Solution
+{
+public:
+  // Converts the coefficient vector the original way and returns the maximum
+  // difference from the monomial coefficients of this Solution.
+  double compare_pointwise(Space* space, Vector* vec)
+  {
+    Shapeset* shapeset = space->get_shapeset();
+    double** mat[2][12] = { { NULL } };
+    int* perm[2][12];
+    double diff = 0.0;
+
+    AsmList al;
+    Element* e;
+    for_all_active_elements(e, mesh)
+    {
+      int mode = e->get_mode();
+      int o = elem_orders[e->id];
+      int np = mode ? sqr(o+1) : (o+1)*(o+2)/2;
+      space->get_element_assembly_list(e, &al);
+      shapeset->set_mode(mode);
+
+      // the Chebyshev points in the order of the rows of the monomial matrix
+      std::vector<double> x, y;
+      for (int k = o; k >= 0; k--)
+        for (int j = o; j >= (mode ? 0 : o-k); j--)
+        {
+          x.push_back(o ? cos(j * M_PI / o) : 1.0);
+          y.push_back(o ? cos(k * M_PI / o) : 1.0);
+        }
+
+      for (int l = 0; l < num_components; l++)
+      {
+        std::vector<scalar> val(np, 0.0);
+        for (int k = 0; k < al.cnt; k++)
+        {
+          int dof = al.dof[k];
+          scalar coef = al.coef[k] * (dof >= 0 ? vec->get(dof) : 1.0);
+          for (int i = 0; i < np; i++)
+            val[i] += shapeset->get_fn_value(al.idx[k], x[i], y[i], l) * coef;
+        }
+        if (mat[mode][o] == NULL) mat[mode][o] = calc_mono_matrix(mode, o, perm[mode][o]);
+        lubksb(mat[mode][o], np, perm[mode][o], &val[0]);
+
+        scalar* mono = mono_coefs + elem_coefs[l][e->id];
+        for (int i = 0; i < np; i++)
+          diff = std::max(diff, (double) std::abs(mono[i] - val[i]));
+      }
+    }
+
+    for (int m = 0; m < 2; m++)
+      for (int o = 0; o < 12; o++)
+        if (mat[m][o] != NULL) { delete [] mat[m][o]; delete [] perm[m][o]; }
+    return diff;
+  }
+};
+
+// Converts a random coefficient vector on the space both ways.
+static bool check_space(Space* space, const char* name)
+{
+  int ndof = get_num_dofs(space);
+  AVector vec(ndof);
+  for (int i = 0; i < ndof; i++) vec.set(i, -1.0 + 2.0 * rand() / RAND_MAX);
+  PrecalcShapeset pss(space->get_shapeset());
+
+  TimePeriod cpu_time;
+  TestSolution sln;
+  for (int i = 0; i < NUM_REPEAT; i++)
+    sln.set_fe_solution(space, &pss, &vec);
+  double time_mono = cpu_time.tick().last();
+
+  double diff = 0.0;
+  for (int i = 0; i < NUM_REPEAT; i++)
+    diff = sln.compare_pointwise(space, &vec);
+  double time_pointwise = cpu_time.tick().last();
+
+  info("%s: ndof = %d, max. difference of the monomial coefficients: %g", name, ndof, diff);
+  info("%s: %d conversions: %g s, pointwise: %g s", name, NUM_REPEAT, time_mono, time_pointwise);
+  return diff < TOL;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // A mesh of the square (-1, 1)^2 with hanging nodes.
+  double2 verts[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+  int5 quads[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(4, verts, 0, NULL, 1, quads, 4, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  mesh.refine_towards_vertex(0, 3);
+
+  srand(1);
+  bool success = true;
+
+  H1Space h1_space(&mesh, bc_types, NULL, P_INIT);
+  if (!check_space(&h1_space, "H1")) success = false;
+
+  HcurlSpace hcurl_space(&mesh, bc_types, NULL, P_INIT);
+  if (!check_space(&hcurl_space, "Hcurl")) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,289 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test assembles a system of an H1 equation of orders 4 - 6 and an L2 equation of
+// order 4 on a mesh with hanging nodes, once as usual and once with the static condensation
+// of the bubble DOFs (DiscreteProblem::set_static_condensation()). It reports the size, the
+// number of nonzeros and the nonzeros of the Cholesky factor of both matrices, and the times
+// of the assembling and of the CG solution. It checks that the condensed system has no
+// bubble DOFs, that the recovered solution solves the full system and agrees with its
+// solution, and that the condensed system assembled by more threads is the same.
+
+const int N = 12;                        // The base mesh has N x N quads.
+const int NUM_LEVELS = 2;                // Number of refinements towards the corner.
+const int L2_ORDER = 4;                  // Order of the L2 space.
+const int NUM_THREADS = 4;               // Number of threads of the parallel assembling.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return x + y;
+}
+
+// Weak forms.
+template<typename Real, typename Scalar>
+Scalar biform_h1(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                 Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_grad_u_grad_v<Real, Scalar>(n, wt, u, v) + int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar biform_l2(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                 Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar biform_coupling(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                       Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return 0.5 * int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar liform(int n, double *wt, Func<Real> *u_ext[], Func<Real> *v,
+              Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  for (int i = 0; i < n; i++)
+    result += wt[i] * (e->x[i] * e->y[i] + 1.0) * v->val[i];
+  return result;
+}
+
+// A simple deterministic random number generator.
+static unsigned rnd_state = 12345;
+static int rnd(int n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return (rnd_state >> 16) % n;
+}
+
+// Conjugate gradients to a relative tolerance.
+class CGSolver : public CommonSolver
+{
+public:
+  virtual bool _solve(Matrix* mat, double* res)
+  {
+    double norm = 0.0;
+    for (int i = 0; i < mat->get_size(); i++)
+      norm += sqr(res[i]);
+    return solve_linear_system_cg(mat, res, 1e-12 * sqrt(norm), 100000);
+  }
+  virtual bool _solve(Matrix* mat, cplx* res) { return false; }
+};
+
+struct Result
+{
+  int size;
+  SparsityStats stats;
+  double asm_time, solve_time;
+};
+
+// Assembles and solves the system, 'x' gets the solution of all DOFs.
+static void solve(LinearProblem* lp, PatternMatrix& mat, AVector& rhs, AVector& x, Result& res)
+{
+  CGSolver cg;
+  lp->solver = &cg;
+  TimePeriod cpu_time;
+  lp->assemble(&mat, &rhs);
+  res.asm_time = cpu_time.tick().last();
+  res.size = mat.get_size();
+
+  int* Ap = mat.get_Ap();
+  int* Ai = mat.get_Ai();
+  int nnz = Ap[res.size];
+  std::vector<int> row(nnz), col(nnz);
+  for (int j = 0; j < res.size; j++)
+    for (int k = Ap[j]; k < Ap[j+1]; k++)
+    {
+      row[k] = Ai[k];
+      col[k] = j;
+    }
+  get_sparsity_stats(res.size, nnz, &row[0], &col[0], res.stats);
+
+  x.init(lp->get_num_dofs());
+  x.set_zero();
+  cpu_time.tick(HERMES_SKIP);
+  if (!lp->solve(&mat, &rhs, &x)) error("CG did not converge.");
+  res.solve_time = cpu_time.tick().last();
+  lp->solver = NULL;
+
+  info("%-9s size %d, nnz %lld, factor nnz %lld, assembled in %g s, solved in %g s",
+       lp->get_static_condensation() ? "condensed" : "full", res.size, (long long) res.stats.nnz,
+       (long long) res.stats.factor_nnz, res.asm_time, res.solve_time);
+}
+
+static double norm(AVector& v)
+{
+  double sum = 0.0;
+  for (int i = 0; i < v.get_size(); i++)
+    sum += sqr(v.get(i));
+  return sqrt(sum);
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Base mesh: a grid of quads.
+  int nv = (N+1) * (N+1);
+  double2* verts = new double2[nv];
+  for (int i = 0; i <= N; i++)
+    for (int j = 0; j <= N; j++)
+    {
+      verts[i*(N+1) + j][0] = (double) j / N;
+      verts[i*(N+1) + j][1] = (double) i / N;
+    }
+  int5* quads = new int5[N*N];
+  for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++)
+    {
+      int* q = quads[i*N + j];
+      q[0] = i*(N+1) + j;     q[1] = i*(N+1) + j+1;
+      q[2] = (i+1)*(N+1) + j+1; q[3] = (i+1)*(N+1) + j;
+      q[4] = 0;
+    }
+  int3* mark = new int3[4*N];
+  for (int k = 0; k < N; k++)
+  {
+    int3 m[4] = { { k, k+1, 1 }, { N*(N+1) + k, N*(N+1) + k+1, 1 },
+                  { k*(N+1), (k+1)*(N+1), 1 }, { k*(N+1) + N, (k+1)*(N+1) + N, 1 } };
+    memcpy(mark + 4*k, m, sizeof(m));
+  }
+  Mesh mesh;
+  mesh.create(nv, verts, 0, NULL, N*N, quads, 4*N, mark);
+  delete [] verts;
+  delete [] quads;
+  delete [] mark;
+
+  // Refinements towards the corner (0,0), which create hanging nodes.
+  double radius = 0.4;
+  for (int r = 0; r < NUM_LEVELS; r++, radius *= 0.5)
+  {
+    std::vector<int> ids;
+    Element* e;
+    for_all_active_elements(e, &mesh)
+    {
+      double x = 0, y = 0;
+      for (unsigned j = 0; j < e->nvert; j++) { x += e->vn[j]->x; y += e->vn[j]->y; }
+      if (sqrt(sqr(x / e->nvert) + sqr(y / e->nvert)) < radius) ids.push_back(e->id);
+    }
+    for (unsigned i = 0; i < ids.size(); i++)
+      mesh.refine_element(ids[i]);
+  }
+  info("elements = %d", mesh.get_num_active_elements());
+
+  H1Space s1(&mesh, bc_types, essential_bc_values, 1);
+  L2Space s2(&mesh, L2_ORDER);
+  Element* e;
+  for_all_active_elements(e, &mesh)
+  {
+    int p = 4 + rnd(3);
+    s1.set_element_order_internal(e->id, H2D_MAKE_QUAD_ORDER(p, p));
+  }
+  Tuple<Space*> spaces(&s1, &s2);
+
+  WeakForm wf(2);
+  wf.add_matrix_form(0, 0, callback(biform_h1));
+  wf.add_matrix_form(1, 1, callback(biform_l2));
+  wf.add_matrix_form(0, 1, callback(biform_coupling));
+  wf.add_matrix_form(1, 0, callback(biform_coupling));
+  wf.add_vector_form(0, callback(liform));
+  wf.add_vector_form(1, callback(liform));
+
+  LinearProblem full_lp(&wf, spaces);
+  int ndof = full_lp.get_num_dofs();
+  PatternMatrix full_mat(ndof);
+  AVector full_rhs(ndof), full_x;
+  Result full;
+  solve(&full_lp, full_mat, full_rhs, full_x, full);
+
+  LinearProblem cond_lp(&wf, spaces);
+  cond_lp.set_static_condensation(true);
+  PatternMatrix cond_mat(ndof);
+  AVector cond_rhs(ndof), cond_x;
+  Result cond;
+  solve(&cond_lp, cond_mat, cond_rhs, cond_x, cond);
+
+  bool success = true;
+
+  // The condensed system consists of all but the bubble DOFs.
+  int nbubbles = 0;
+  for (int i = 0; i < 2; i++)
+    for_all_active_elements(e, &mesh)
+    {
+      int first, step;
+      nbubbles += spaces[i]->get_element_bubble_dofs(e, first, step);
+    }
+  info("ndof = %d, bubble DOFs = %d", ndof, nbubbles);
+  if (cond.size != ndof - nbubbles || cond_lp.get_num_condensed_dofs() != nbubbles ||
+      full.size != ndof)
+  {
+    info("The condensed system does not have the expected size.");
+    success = false;
+  }
+  if (cond.stats.nnz >= full.stats.nnz || cond.stats.factor_nnz >= full.stats.factor_nnz)
+  {
+    info("The condensed matrix is not sparser.");
+    success = false;
+  }
+
+  // The recovered solution solves the full system.
+  AVector res(ndof), diff(ndof);
+  full_mat.times_vector(cond_x.get_c_array(), res.get_c_array(), ndof);
+  for (int i = 0; i < ndof; i++)
+  {
+    res.add(i, -full_rhs.get(i));
+    diff.set(i, cond_x.get(i) - full_x.get(i));
+  }
+  double res_norm = norm(res) / norm(full_rhs), diff_norm = norm(diff) / norm(full_x);
+  info("relative residual of the recovered solution %g, difference from the full solution %g",
+       res_norm, diff_norm);
+  if (res_norm > 1e-8 || diff_norm > 1e-6)
+  {
+    info("The recovered solution does not solve the full system.");
+    success = false;
+  }
+
+  // The parallel assembling gives the same condensed system and recovery.
+  LinearProblem par_lp(&wf, spaces);
+  par_lp.set_static_condensation(true);
+  par_lp.set_num_threads(NUM_THREADS);
+  PatternMatrix par_mat(ndof);
+  AVector par_rhs(ndof), par_x;
+  par_lp.assemble(&par_mat, &par_rhs);
+  par_lp.recover_bubble_dofs(&cond_rhs, &par_x);
+  AVector cond_rec;
+  cond_lp.recover_bubble_dofs(&cond_rhs, &cond_rec);
+  int nnz = cond_mat.get_Ap()[cond.size];
+  bool same = (par_mat.get_size() == cond.size && par_mat.get_Ap()[cond.size] == nnz &&
+               !memcmp(par_mat.get_Ap(), cond_mat.get_Ap(), (cond.size + 1) * sizeof(int)) &&
+               !memcmp(par_mat.get_Ai(), cond_mat.get_Ai(), nnz * sizeof(int)) &&
+               !memcmp(par_mat.get_Ax(), cond_mat.get_Ax(), nnz * sizeof(double)) &&
+               !memcmp(par_rhs.get_c_array(), cond_rhs.get_c_array(), cond.size * sizeof(double)) &&
+               !memcmp(par_x.get_c_array(), cond_rec.get_c_array(), ndof * sizeof(double)));
+  if (!same)
+  {
+    info("The condensed system assembled by %d threads differs.", NUM_THREADS);
+    success = false;
+  }
+
+  if (success)
+  {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else
+  {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,149 @@
+#define H2D_REPORT_INFO
+#include "hermes2d.h"
+
+// This test assembles a convection-diffusion-reaction operator once from user
+// callbacks and once from the standard forms of WeakForm::add_matrix_form_std(),
+// which are evaluated from reference element integrals on elements with a
+// constant jacobian. The matrices have to agree on a mesh of triangles and
+// parallelograms with hanging nodes, as well as on a mesh of general
+// quadrilaterals, where the standard forms are integrated numerically. The
+// assembling times are reported.
+
+const int INIT_REF_NUM = 4;              // Number of initial uniform mesh refinements.
+const int P_INIT = 3;                    // Polynomial degree of all mesh elements.
+const int NUM_STEPS = 5;                 // Number of timed assemblings.
+const double EPSILON = 0.5;              // Diffusion coefficient.
+const double B1 = 1.0, B2 = -2.0;        // Advection velocity.
+const double SIGMA = 3.0;                // Reaction coefficient.
+
+// Boundary condition types.
+BCType bc_types(int marker)
+{
+  return BC_ESSENTIAL;
+}
+
+// Essential (Dirichlet) boundary condition values.
+scalar essential_bc_values(int ess_bdy_marker, double x, double y)
+{
+  return 0.0;
+}
+
+// The same operator written as user callbacks.
+template<typename Real, typename Scalar>
+Scalar diffusion(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                 Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return EPSILON * int_grad_u_grad_v<Real, Scalar>(n, wt, u, v);
+}
+
+template<typename Real, typename Scalar>
+Scalar advection(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                 Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  Scalar result = 0;
+  for (int i = 0; i < n; i++)
+    result += wt[i] * (B1 * u->dx[i] + B2 * u->dy[i]) * v->val[i];
+  return result;
+}
+
+template<typename Real, typename Scalar>
+Scalar reaction(int n, double *wt, Func<Real> *u_ext[], Func<Real> *u, Func<Real> *v,
+                Geom<Real> *e, ExtData<Scalar> *ext)
+{
+  return SIGMA * int_u_v<Real, Scalar>(n, wt, u, v);
+}
+
+// Assembles NUM_STEPS times and returns the average time.
+static double assemble(WeakForm* wf, Space* space, PatternMatrix* mat)
+{
+  int ndof = get_num_dofs(space);
+  AVector rhs(ndof);
+  DiscreteProblem dp(wf, space);
+  double time = 0.0;
+  for (int step = 0; step < NUM_STEPS; step++)
+  {
+    TimePeriod cpu_time;
+    dp.assemble(NULL, mat, NULL, &rhs);
+    time += cpu_time.tick().last() / NUM_STEPS;
+  }
+  return time;
+}
+
+// Assembles the operator in both ways and compares the matrices. On general
+// quadrilaterals the integrands are rational and the standard forms use one
+// quadrature for all pairs of shape functions, hence the tolerance.
+static bool compare(Mesh* mesh, const char* name, double tol)
+{
+  H1Space space(mesh, bc_types, essential_bc_values, P_INIT);
+  int ndof = get_num_dofs(&space);
+
+  WeakForm wf;
+  wf.add_matrix_form(callback(diffusion), H2D_SYM);
+  wf.add_matrix_form(callback(advection), H2D_UNSYM);
+  wf.add_matrix_form(callback(reaction), H2D_SYM);
+  PatternMatrix mat(ndof);
+  double time = assemble(&wf, &space, &mat);
+
+  WeakForm wf_std;
+  wf_std.add_matrix_form_std(H2D_STD_LAPLACE, EPSILON);
+  wf_std.add_matrix_form_std(H2D_STD_ADVECTION, B1, B2);
+  wf_std.add_matrix_form_std(H2D_STD_MASS, SIGMA);
+  PatternMatrix mat_std(ndof);
+  double time_std = assemble(&wf_std, &space, &mat_std);
+
+  double diff = 0.0, norm = 0.0;
+  if (mat.get_nnz() != mat_std.get_nnz()) return false;
+  for (int i = 0; i < mat.get_nnz(); i++)
+  {
+    diff = std::max(diff, fabs(mat.get_Ax()[i] - mat_std.get_Ax()[i]));
+    norm = std::max(norm, fabs(mat.get_Ax()[i]));
+  }
+  info("%s: ndof = %d, assembling %g s with callbacks, %g s with standard forms, max. difference %g",
+       name, ndof, time, time_std, diff);
+  return diff <= tol * norm;
+}
+
+#define ERROR_SUCCESS                               0
+#define ERROR_FAILURE                               -1
+
+int main(int argc, char* argv[])
+{
+  // Four triangles around the center of a square and a parallelogram on its right.
+  double2 verts[7] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 }, { 0, 0 }, { 3, -0.5 }, { 3, 1.5 } };
+  int4 tris[4] = { { 0, 1, 4, 0 }, { 1, 2, 4, 0 }, { 2, 3, 4, 0 }, { 3, 0, 4, 0 } };
+  int5 quads[1] = { { 1, 5, 6, 2, 0 } };
+  int3 mark[6] = { { 0, 1, 1 }, { 1, 5, 1 }, { 5, 6, 1 }, { 6, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh;
+  mesh.create(7, verts, 4, tris, 1, quads, 6, mark);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh.refine_all_elements();
+  // Hanging nodes on a triangle and on a parallelogram.
+  Element* e;
+  int tri_id = -1, quad_id = -1;
+  for_all_active_elements(e, &mesh)
+  {
+    if (e->is_triangle() && tri_id < 0) tri_id = e->id;
+    if (e->is_quad() && quad_id < 0) quad_id = e->id;
+  }
+  mesh.refine_element(tri_id);
+  mesh.refine_element(quad_id);
+
+  // A general quadrilateral.
+  double2 verts_2[4] = { { -1, -1 }, { 1, -1 }, { 0.6, 1 }, { -1, 0.8 } };
+  int5 quads_2[1] = { { 0, 1, 2, 3, 0 } };
+  int3 mark_2[4] = { { 0, 1, 1 }, { 1, 2, 1 }, { 2, 3, 1 }, { 3, 0, 1 } };
+  Mesh mesh_2;
+  mesh_2.create(4, verts_2, 0, NULL, 1, quads_2, 4, mark_2);
+  for (int i = 0; i < INIT_REF_NUM; i++) mesh_2.refine_all_elements();
+
+  bool success = compare(&mesh, "affine elements", 1e-12);
+  if (!compare(&mesh_2, "general quadrilaterals", 1e-8)) success = false;
+
+  if (success) {
+    printf("Success!\n");
+    return ERROR_SUCCESS;
+  }
+  else {
+    printf("Failure!\n");
+    return ERROR_FAILURE;
+  }
+}
@@ -0,0 +1,70 @@
+#include "hermes2d.h"
+
+// Converts meshes and saved solutions to the binary format, which can be mapped into the
+// memory and loaded without parsing (see Mesh::load_binary(), Solution::load_binary()).
+//
+//   h2dbinary [-r N] input.mesh output.h2db   mesh in the H2D format, optionally refined N times
+//   h2dbinary -s input.h2d[.gz] output.h2db   solution saved by Solution::save()
+//   h2dbinary -m input.h2db output.mesh       binary mesh back to the H2D format
+
+static void usage()
+{
+  printf("Usage: h2dbinary [-r N] input.mesh output.h2db\n"
+         "       h2dbinary -s input.h2d[.gz] output.h2db\n"
+         "       h2dbinary -m input.h2db output.mesh\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  int nref = 0;
+  char mode = 'r';
+
+  int i = 1;
+  for ( ; i < argc && argv[i][0] == '-'; i++)
+  {
+    if (!strcmp(argv[i], "-r") && i+1 < argc)
+      nref = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "-m"))
+      mode = argv[i][1];
+    else
+      usage();
+  }
+  if (argc - i != 2) usage();
+  const char* in = argv[i];
+  const char* out = argv[i+1];
+
+  TimePeriod time;
+  if (mode == 's')
+  {
+    Solution sln;
+    sln.load(in);
+    printf("Loaded solution %s (%d elements) in %g s.\n", in,
+           sln.get_mesh()->get_num_active_elements(), time.tick().last());
+    sln.save_binary(out);
+  }
+  else if (mode == 'm')
+  {
+    Mesh mesh;
+    mesh.load_binary(in);
+    printf("Loaded binary mesh %s (%d elements) in %g s.\n", in,
+           mesh.get_num_active_elements(), time.tick().last());
+    H2DReader writer;
+    writer.save(out, &mesh);
+  }
+  else
+  {
+    Mesh mesh;
+    H2DReader reader;
+    reader.load(in, &mesh);
+    for (int k = 0; k < nref; k++)
+      mesh.refine_all_elements();
+    printf("Loaded and refined mesh %s (%d elements) in %g s.\n", in,
+           mesh.get_num_active_elements(), time.tick().last());
+    mesh.save_binary(out);
+  }
+  printf("Wrote %s in %g s.\n", out, time.tick().last());
+
+  return 0;
+}